@@ -1,6 +1,8 @@
 #ifndef WHODUN_COMPRESS_H
 #define WHODUN_COMPRESS_H 1
 
+#include <map>
+#include <list>
 #include <string>
 #include <vector>
 #include <stdio.h>
@@ -33,8 +35,6 @@ public:
 
 /**Bytes for an annotation entry.*/
 #define BLOCKCOMP_ANNOT_ENTLEN 32
-/**The number of entries to load in memory: less jumping.*/
-#define BLOCKCOMPIN_LASTLINESEEK 1024
 
 /**Block compress output.*/
 class BlockCompOutStream : public OutStream{
@@ -71,6 +71,93 @@ public:
 	CompressionMethod* myComp;
 };
 
+/**Marks that no block is loaded.*/
+#define BLOCKCOMPIN_NO_BLOCK ((uintptr_t)-1)
+
+/**Hold on to recently decompressed blocks (least recently used go first). Can be shared by streams on the same file, from multiple threads.*/
+class BlockCompCache{
+public:
+	/**
+	 * Set up an empty cache.
+	 * @param maxBytes The number of decompressed bytes to hold on to.
+	 */
+	BlockCompCache(uintptr_t maxBytes);
+	/**Clean up.*/
+	~BlockCompCache();
+	/**
+	 * Get a block, if it is held.
+	 * @param blockInd The index of the block.
+	 * @param toFill The place to put the decompressed data.
+	 * @return Whether it was held.
+	 */
+	bool getBlock(uintptr_t blockInd, std::vector<char>* toFill);
+	/**
+	 * Note whether a block is held (does not count as a use).
+	 * @param blockInd The index of the block.
+	 * @return Whether it is held.
+	 */
+	bool hasBlock(uintptr_t blockInd);
+	/**
+	 * Hold on to a block.
+	 * @param blockInd The index of the block.
+	 * @param blockData The decompressed data.
+	 */
+	void addBlock(uintptr_t blockInd, std::vector<char>* blockData);
+	/**The number of decompressed bytes to hold on to.*/
+	uintptr_t maxBytes;
+	/**The number of decompressed bytes held.*/
+	uintptr_t curBytes;
+	/**The number of times a block was asked for and held.*/
+	uintptr_t numHit;
+	/**The number of times a block was asked for and not held.*/
+	uintptr_t numMiss;
+	/**The number of blocks decompressed for the cache (asked for or prefetched).*/
+	uintptr_t numLoad;
+	/**The held blocks, most recently used first.*/
+	std::list< std::pair< uintptr_t,std::vector<char> > > heldBlocks;
+	/**Where each held block is in heldBlocks.*/
+	std::map< uintptr_t, std::list< std::pair< uintptr_t,std::vector<char> > >::iterator > heldLocs;
+	/**Protect the cache.*/
+	void* myMut;
+};
+
+/**The annotations for a block compressed file, held in memory.*/
+class BlockCompAnnotation{
+public:
+	/**Set up an empty annotation set.*/
+	BlockCompAnnotation();
+	/**Clean up.*/
+	~BlockCompAnnotation();
+	/**
+	 * Load the annotations from a file.
+	 * @param annotFN The name of the annotation file.
+	 */
+	void loadAnnotation(const char* annotFN);
+	/**
+	 * Get the block a (pre-compression) address lives in.
+	 * @param toAddr The address of interest.
+	 * @return The index of the block: numBlocks if past the end.
+	 */
+	uintptr_t findBlock(uintptr_t toAddr);
+	/**
+	 * Get the uncompressed size of the file.
+	 * @return The number of bytes in the file.
+	 */
+	uintptr_t getUncompressedSize();
+	/**The number of blocks in the file.*/
+	uintptr_t numBlocks;
+	/**The pre-compressed address of each block.*/
+	std::vector<uintptr_t> preAddrs;
+	/**The post-compressed address of each block.*/
+	std::vector<uintptr_t> postAddrs;
+	/**The pre-compressed length of each block.*/
+	std::vector<uintptr_t> preLens;
+	/**The post-compressed length of each block.*/
+	std::vector<uintptr_t> postLens;
+	/**If every block (but the last) is the same size, that size: zero if not.*/
+	uintptr_t fixedLen;
+};
+
 /**Read a block compressed input stream.*/
 class BlockCompInStream : public InStream{
 public:
@@ -81,8 +168,23 @@ public:
 	 * @param compMeth The compression method to use for the blocks.
 	 */
 	BlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth);
+	/**
+	 * Open up a blcok compressed file.
+	 * @param mainFN The name of the data file.
+	 * @param annotFN The name of the annotation file.
+	 * @param compMeth The compression method to use for the blocks.
+	 * @param useCache The cache of blocks to use (only share between streams on the same file). Null for no cache.
+	 */
+	BlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, BlockCompCache* useCache);
 	/**Clean up and close.*/
 	~BlockCompInStream();
+	/**
+	 * Actually open the file.
+	 * @param mainFN The name of the data file.
+	 * @param annotFN The name of the annotation file.
+	 * @param compMeth The compression method to use for the blocks.
+	 */
+	void openFile(const char* mainFN, const char* annotFN, CompressionMethod* compMeth);
 	int readByte();
 	uintptr_t readBytes(char* toR, uintptr_t numR);
 	/**
@@ -97,22 +199,20 @@ public:
 	uintptr_t getUncompressedSize();
 	/**The number of blocks in the file.*/
 	uintptr_t numBlocks;
-	/**The annotation index at the start of lastLineBuff.*/
-	uintptr_t lastLineBI0;
-	/**The number of blocks accounted for in lastLineBuff.*/
-	uintptr_t numLastLine;
-	/**Temporary storage for a seek.*/
-	char* lastLineBuff;
-	/**The pre-compressed addresses of those block infos.*/
-	uintptr_t* lastLineAddrs;
+	/**The annotations, loaded when opened.*/
+	BlockCompAnnotation blockAnnot;
 	/**The data file.*/
 	FILE* mainF;
-	/**The annotation file. Quads of pre-comp address, post-comp address, pre-comp len, post-comp len.*/
-	FILE* annotF;
 	/**The index in the decompressed data the next read should return.*/
 	uintptr_t nextReadI;
 	/**The compression method this uses.*/
 	CompressionMethod* myComp;
+	/**The index of the next annotation entry a sequential read will use.*/
+	uintptr_t nextBlockI;
+	/**The index of the block currently decompressed, if any.*/
+	uintptr_t loadedBlockI;
+	/**The cache of decompressed blocks, if any.*/
+	BlockCompCache* blockCache;
 };
 
 class MultithreadBlockCompOutStreamUniform;
@@ -171,7 +271,7 @@ public:
 
 class MultithreadBlockCompInStreamUniform;
 
-/**Read a block compressed input stream: does NOT allow random access.*/
+/**Read a block compressed input stream, decompressing multiple blocks at once.*/
 class MultithreadBlockCompInStream : public InStream{
 public:
 	/**
@@ -183,18 +283,65 @@ public:
 	 * @param useThreads The threads to use.
 	 */
 	MultithreadBlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, int numThreads, ThreadPool* useThreads);
+	/**
+	 * Open up a blcok compressed file.
+	 * @param mainFN The name of the data file.
+	 * @param annotFN The name of the annotation file.
+	 * @param compMeth The compression method to use for the blocks.
+	 * @param numThreads The number of threads to spawn.
+	 * @param useThreads The threads to use.
+	 * @param useCache The cache of blocks to use (only share between streams on the same file). Null for no cache (and no prefetch).
+	 */
+	MultithreadBlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, int numThreads, ThreadPool* useThreads, BlockCompCache* useCache);
 	/**Clean up and close.*/
 	~MultithreadBlockCompInStream();
+	/**
+	 * Actually open the file.
+	 * @param mainFN The name of the data file.
+	 * @param annotFN The name of the annotation file.
+	 * @param compMeth The compression method to use for the blocks.
+	 * @param numThreads The number of threads to spawn.
+	 * @param useThreads The threads to use.
+	 */
+	void openFile(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, int numThreads, ThreadPool* useThreads);
 	int readByte();
 	uintptr_t readBytes(char* toR, uintptr_t numR);
+	/**
+	 * Change which byte will be returned next. Also decompresses the next few blocks (see readAhead).
+	 * @param toAddr The (pre-compression) address.
+	 */
+	void seek(uintptr_t toAddr);
+	/**
+	 * Get the uncompressed size of this file.
+	 * @return The number of bytes in the file.
+	 */
+	uintptr_t getUncompressedSize();
+	/**
+	 * Get the block a (pre-compression) address lives in.
+	 * @param toAddr The address of interest.
+	 * @return The index of the block: numBlocks if past the end.
+	 */
+	uintptr_t getBlockIndex(uintptr_t toAddr);
+	/**
+	 * Decompress a collection of blocks at once, and hold them in the cache for later reads.
+	 * @param blockInds The indices of the blocks of interest.
+	 * @param numBlock The number of blocks of interest.
+	 */
+	void prefetchBlocks(const uintptr_t* blockInds, uintptr_t numBlock);
 	/**The number of blocks in the file.*/
 	uintptr_t numBlocks;
+	/**The annotations, loaded when opened.*/
+	BlockCompAnnotation blockAnnot;
 	/**The data file.*/
 	FILE* mainF;
-	/**The annotation file. Quads of pre-comp address, post-comp address, pre-comp len, post-comp len.*/
-	FILE* annotF;
 	/**The number of read blocks.*/
 	uintptr_t numReadBlocks;
+	/**The (post-compression) address the data file is sitting at.*/
+	uintptr_t mainFAt;
+	/**The number of blocks past the target to decompress on a seek.*/
+	uintptr_t readAhead;
+	/**The cache of decompressed blocks, if any.*/
+	BlockCompCache* blockCache;
 	/**The threads to use for compression.*/
 	ThreadPool* compThreads;
 	/**A place to store stuff for each action.*/
@@ -209,6 +356,57 @@ public:
 	std::vector<char> leftoverB;
 };
 
+/**Read a block file whose blocks are stored uncompressed (rawsum: checksummed raw) straight out of a memory map.*/
+class MappedRawBlockInStream : public InStream{
+public:
+	/**
+	 * Map a block file.
+	 * @param mainFN The name of the data file.
+	 * @param annotFN The name of the annotation file.
+	 */
+	MappedRawBlockInStream(const char* mainFN, const char* annotFN);
+	/**Clean up and unmap.*/
+	~MappedRawBlockInStream();
+	int readByte();
+	uintptr_t readBytes(char* toR, uintptr_t numR);
+	/**
+	 * Change which byte will be returned next.
+	 * @param toAddr The (pre-compression) address.
+	 */
+	void seek(uintptr_t toAddr);
+	/**
+	 * Get the uncompressed size of this file.
+	 * @return The number of bytes in the file.
+	 */
+	uintptr_t getUncompressedSize();
+	/**
+	 * Look at a range of the file without copying it (unless it straddles blocks).
+	 * @param fromAddr The (pre-compression) address to start at.
+	 * @param numBytes The number of bytes to look at.
+	 * @return The bytes: good until the next view or the stream is closed.
+	 */
+	const char* getView(uintptr_t fromAddr, uintptr_t numBytes);
+	/**
+	 * Make sure a block's checksum has been verified.
+	 * @param blockI The block to check.
+	 */
+	void checkBlock(uintptr_t blockI);
+	/**The number of blocks in the file.*/
+	uintptr_t numBlocks;
+	/**The annotations, loaded when opened.*/
+	BlockCompAnnotation blockAnnot;
+	/**The mapping of the data file.*/
+	void* fileMap;
+	/**The mapped data.*/
+	const char* mapData;
+	/**Whether each block has been verified.*/
+	std::vector<bool> blockChecked;
+	/**The index in the decompressed data the next read should return.*/
+	uintptr_t nextReadI;
+	/**Storage for views that straddle blocks.*/
+	std::vector<char> stitchBuff;
+};
+
 /**Out to gzip file.*/
 class GZipOutStream : public OutStream{
 public:
@@ -302,7 +500,7 @@ public:
 	CompressionMethod* clone();
 };
 
-/**Compress using gzip.*/
+/**Compress using gzip. Will also read blocks from the tagged methods.*/
 class GZipCompressionMethod : public CompressionMethod{
 public:
 	/**Simple clean.*/
@@ -312,4 +510,51 @@ public:
 	CompressionMethod* clone();
 };
 
+/**The first byte of a fast lz block (zlib data always has 8 in the low nibble of its first byte).*/
+#define BLOCKCOMP_TAG_FASTLZ 0x4C
+/**The first byte of a checksummed raw block.*/
+#define BLOCKCOMP_TAG_RAWSUM 0x43
+/**The number of bits in the fast lz match finder hash.*/
+#define FASTLZ_HASH_BITS 14
+/**The shortest match fast lz will encode.*/
+#define FASTLZ_MIN_MATCH 4
+/**The farthest back fast lz will look for a match.*/
+#define FASTLZ_MAX_OFFSET 0x00FFFF
+
+/**
+ * Decompress a block from any of the gzip/fast lz/checksummed raw methods (figures out which from the first byte).
+ * @param compData The compressed data.
+ * @param theData The place to put the decompressed data.
+ */
+void blockCompDecompressAny(std::vector<char>* compData, std::vector<char>* theData);
+
+/**Compress with a fast lz77 style codec: poor ratio, but cheap to compress and very cheap to decompress. Will also read gzip and checksummed raw blocks.*/
+class FastLZCompressionMethod : public CompressionMethod{
+public:
+	/**Simple clean.*/
+	~FastLZCompressionMethod();
+	void decompressData();
+	void compressData();
+	CompressionMethod* clone();
+	/**The last place each hashed four bytes was seen.*/
+	std::vector<uintptr_t> hashTable;
+};
+
+/**Store the data as is, with a checksum. Will also read gzip and fast lz blocks.*/
+class RawSumCompressionMethod : public CompressionMethod{
+public:
+	/**Simple clean.*/
+	~RawSumCompressionMethod();
+	void decompressData();
+	void compressData();
+	CompressionMethod* clone();
+};
+
+/**
+ * Make a compression method by name.
+ * @param methName The name of the method (gzip, fastlz or rawsum).
+ * @return The method, or null if not known: will need to delete.
+ */
+CompressionMethod* makeNamedCompressionMethod(const char* methName);
+
 #endif
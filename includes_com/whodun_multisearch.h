@@ -0,0 +1,65 @@
+#ifndef WHODUN_MULTISEARCH_H
+#define WHODUN_MULTISEARCH_H 1
+
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**The marker for a missing state in an automaton.*/
+#define AHOCORASICK_NO_STATE 0xFFFFFFFF
+
+/**Search for many strings at once (Aho-Corasick), with a dense transition table.*/
+class AhoCorasickAutomaton{
+public:
+	/**
+	 * Build an automaton for a set of strings.
+	 * @param numPattern The number of strings to look for.
+	 * @param patterns The strings to look for (start and length): empty strings are never found.
+	 */
+	AhoCorasickAutomaton(uintptr_t numPattern, const std::pair<const char*,uintptr_t>* patterns);
+	/**Clean up.*/
+	~AhoCorasickAutomaton();
+	
+	/**
+	 * Move along a character.
+	 * @param curState The current state (zero to start).
+	 * @param nextChar The next character of the text.
+	 * @return The next state.
+	 */
+	inline uint32_t nextState(uint32_t curState, char nextChar){
+		return transitions[curState*numCode + charCodes[0x00FF & nextChar]];
+	}
+	/**
+	 * Get the first state to report matches from.
+	 * @param curState The current state.
+	 * @return The longest suffix of the state (itself included) that ends a string, or AHOCORASICK_NO_STATE.
+	 */
+	inline uint32_t firstOutput(uint32_t curState){
+		return (outStarts[curState] != outStarts[curState+1]) ? curState : dictLinks[curState];
+	}
+	/**
+	 * Get the next state to report matches from.
+	 * @param curOut The current report state.
+	 * @return The next shorter state that ends a string, or AHOCORASICK_NO_STATE.
+	 */
+	inline uint32_t nextOutput(uint32_t curOut){
+		return dictLinks[curOut];
+	}
+	
+	/**The number of character codes (code zero is for characters in none of the strings).*/
+	uintptr_t numCode;
+	/**The code for each character.*/
+	uintptr_t charCodes[256];
+	/**The next state for each state and character code.*/
+	std::vector<uint32_t> transitions;
+	/**The number of characters to get to each state.*/
+	std::vector<uintptr_t> stateDepths;
+	/**The nearest proper suffix of each state that ends a string.*/
+	std::vector<uint32_t> dictLinks;
+	/**Where the strings ending at each state start in outPatterns (and the end of the last).*/
+	std::vector<uintptr_t> outStarts;
+	/**The indices of the strings ending at each state, in increasing order.*/
+	std::vector<uintptr_t> outPatterns;
+};
+
+#endif
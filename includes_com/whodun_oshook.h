@@ -76,6 +76,19 @@ uintptr_t* openDirectory(const char* dirName);
  */
 void closeDirectory(uintptr_t* theDir);
 
+/**
+ * Get the current working directory.
+ * @return The directory: free it when done.
+ */
+char* getWorkingDirectory();
+
+/**
+ * Get whether a path is absolute (does not depend on the working directory).
+ * @param pathName The path.
+ * @return Whether it is absolute.
+ */
+bool pathIsAbsolute(const char* pathName);
+
 /**
  * This will start a thread.
  * @param callFun The thread function.
@@ -168,4 +181,31 @@ void* getDLLLocation(void* fromDLL, const char* locName);
  */
 void unloadDLL(void* toKill);
 
+/**
+ * Map a file into memory for reading.
+ * @param fileName The name of the file.
+ * @return A handle to the mapping, or null if it could not be mapped.
+ */
+void* mapFileForRead(const char* fileName);
+
+/**
+ * Get the mapped contents of a file.
+ * @param fromMap The mapping to get from.
+ * @return The start of the data (null for empty files).
+ */
+const char* getMappedFileData(void* fromMap);
+
+/**
+ * Get the size of a mapped file.
+ * @param fromMap The mapping to get from.
+ * @return The number of bytes in the file.
+ */
+uintptr_t getMappedFileSize(void* fromMap);
+
+/**
+ * Unmap a file.
+ * @param toKill The mapping to drop.
+ */
+void unmapFile(void* toKill);
+
 #endif
@@ -108,6 +108,9 @@ public:
 	void fillBuffer();
 };
 
+/**The number of bytes in each entry of a gail index.*/
+#define GAIL_INDEX_ENTLEN 40
+
 /**Read sequences from a gail file.*/
 class GailAQSequenceReader : public SequenceReader{
 public:
@@ -123,6 +126,12 @@ public:
 	 * @param indFName The name of the index file.
 	 */
 	GailAQSequenceReader(MultithreadBlockCompInStream* toFlit, const char* indFName);
+	/**
+	 * Make a sequence reader: sequences will point into the mapped file.
+	 * @param toFlit The thing to read from.
+	 * @param indFName The name of the index file.
+	 */
+	GailAQSequenceReader(MappedRawBlockInStream* toFlit, const char* indFName);
 	/**Clean up.*/
 	~GailAQSequenceReader();
 	
@@ -147,6 +156,19 @@ public:
 	 * @param toBase The last base index to get.
 	 */
 	void getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase);
+	/**
+	 * Decompress the data for several entry parts at once (only does something for multithreaded readers).
+	 * @param numGet The number of parts to get ready.
+	 * @param entInds The indices of the entries.
+	 * @param fromBases The first base index of each.
+	 * @param toBases The last base index of each.
+	 */
+	void prefetchEntrySubsequences(uintptr_t numGet, const uintptr_t* entInds, const uintptr_t* fromBases, const uintptr_t* toBases);
+	/**
+	 * Seek whichever stream is in use.
+	 * @param toAddr The (pre-compression) address.
+	 */
+	void seekStream(uintptr_t toAddr);
 	
 	/**If a random access was called, use this to reset the stream.*/
 	intptr_t resetInd;
@@ -156,8 +178,10 @@ public:
 	uintptr_t numEntries;
 	/**The actual thing to read.*/
 	BlockCompInStream* theStr;
-	/**Alternative read option, but no seeking.*/
+	/**Alternative read option: decompresses on multiple threads.*/
 	MultithreadBlockCompInStream* theStrMT;
+	/**Alternative read option: views a mapped file.*/
+	MappedRawBlockInStream* theStrMap;
 	/**The index file.*/
 	FILE* indF;
 	/**The allocation for the name.*/
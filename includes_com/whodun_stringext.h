@@ -174,6 +174,22 @@ void nat2le16(uint_least16_t toPrep, char* toBuffer);
  */
 uint_least16_t le2nat16(const char* toDebuffer);
 
+/**
+ * This will pack the low bytes of an integer into memory in big-endian format.
+ * @param toPrep The integer to prepare.
+ * @param toBuffer The memory to put it in.
+ * @param numBytes The number of bytes to write (at most 8).
+ */
+void nat2beN(uint_least64_t toPrep, char* toBuffer, int numBytes);
+
+/**
+ * This will take some bytes of a big-endian memory storage and produce an integer.
+ * @param toDebuffer The memory to read from.
+ * @param numBytes The number of bytes to read (at most 8).
+ * @return The integer.
+ */
+uint_least64_t be2natN(const char* toDebuffer, int numBytes);
+
 /**
  * Get an IEEE single precision floating point number as a 32 bit integer: assumes float is IEEE single.
  * @param toConv The float to convert.
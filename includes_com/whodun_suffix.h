@@ -16,6 +16,17 @@
  */
 void buildSuffixArray(const char* onData, uintptr_t* sortStore);
 
+/**The marker for an empty slot in an induced sort.*/
+#define SUFFIX_INDUCED_EMPTY 0xFFFFFFFF
+
+/**
+ * Builds a suffix array in linear time using induced sorting (SA-IS).
+ * @param numChar The number of characters in onData: less than SUFFIX_INDUCED_EMPTY.
+ * @param onData The characters: the last must be zero, and the only zero.
+ * @param sortStore The sorted order of the suffixes of onData. Must have room for numChar.
+ */
+void buildSuffixArrayInduced(uint32_t numChar, const unsigned char* onData, uint32_t* sortStore);
+
 /**
  * This will search for the first entry in sortStore that has toFind as a prefix.
  * @param toFind The string to search for.
@@ -82,4 +93,15 @@ bool MultiStringSuffixIndexSortOption_compMeth(void* unif, void* itemA, void* it
 /**Function used for sorting.*/
 bool MultiStringSuffixRLPairSortOption_compMeth(void* unif, void* itemA, void* itemB);
 
+/**The part of a packed suffix entry to sort on: fields are big-endian, so bytes compare in order.*/
+class PackedSuffixSortKey{
+public:
+	/**The offset to the first byte of the key.*/
+	uintptr_t keyOffset;
+	/**The number of bytes in the key.*/
+	uintptr_t keyLength;
+};
+/**Function used for sorting packed entries: the uniform is a PackedSuffixSortKey.*/
+bool MultiStringSuffixPackedSortOption_compMeth(void* unif, void* itemA, void* itemB);
+
 #endif
\ No newline at end of file
@@ -1,6 +1,10 @@
 #ifndef PROFINMAN_TASK_H
 #define PROFINMAN_TASK_H 1
 
+#include <map>
+#include <set>
+#include <list>
+#include <string>
 #include <vector>
 #include <fstream>
 #include <utility>
@@ -9,6 +13,15 @@
 
 #include "whodun_args.h"
 
+class InStream;
+class OutStream;
+class ThreadPool;
+class CompressionMethod;
+class BlockCompCache;
+class BlockCompInStream;
+class MappedRawBlockInStream;
+class GailAQSequenceReader;
+
 /**A profinman action.*/
 class ProfinmanAction : public ArgumentParser{
 public:
@@ -39,6 +52,8 @@ public:
 	
 	/**The base name of the dumps.*/
 	char* dumpBaseName;
+	/**The name of the block compression method.*/
+	char* compName;
 	/**The files to block.*/
 	std::vector<const char*> srcFAs;
 };
@@ -69,14 +84,84 @@ public:
 	char* searchName;
 	/**The name of the file to write to.*/
 	char* outputName;
+	/**The folder to put temporary files in.*/
+	char* workFolder;
 	/**The maximum number of bytes of search sequence to load.*/
 	intptr_t maxRam;
 	/**Output results in text.*/
 	bool txtOut;
+	/**The number of threads to use.*/
+	intptr_t numThread;
 	int posteriorCheck();
 	void runThing();
 };
 
+/**The extension of the name table of a reference.*/
+#define PROFINMAN_NAME_TABLE_EXT ".nam"
+
+/**Write the name table of a reference: the names one after the other, then where each starts (and the end of the last), then the size of the reference's index, then the number of names. All numbers eight byte big endian.*/
+class ProfinmanNameTableWriter{
+public:
+	/**
+	 * Start writing a name table.
+	 * @param refName The base name of the reference.
+	 */
+	ProfinmanNameTableWriter(const char* refName);
+	/**Clean up.*/
+	~ProfinmanNameTableWriter();
+	/**
+	 * Add the name of the next sequence.
+	 * @param name The name.
+	 * @param nameLen The length of the name.
+	 */
+	void addName(const char* name, uintptr_t nameLen);
+	/**Write out the end of the table.*/
+	void finish();
+	/**The file being written.*/
+	FILE* tabF;
+	/**Where each name starts.*/
+	std::vector<uintptr_t> nameStarts;
+	/**The number of name bytes written.*/
+	uintptr_t totNameLen;
+};
+
+/**The names of a reference, from its name table.*/
+class ProfinmanNameTable{
+public:
+	/**
+	 * Load a name table (in one read).
+	 * @param refName The base name of the reference.
+	 */
+	ProfinmanNameTable(const char* refName);
+	/**Clean up.*/
+	~ProfinmanNameTable();
+	/**
+	 * Get the number of names.
+	 * @return The number of names.
+	 */
+	uintptr_t getNumEntries();
+	/**
+	 * Get the name of a sequence.
+	 * @param entInd The index of the sequence.
+	 * @param nameLen The place to put the length of the name.
+	 * @return The name.
+	 */
+	const char* getEntryName(uintptr_t entInd, uintptr_t* nameLen);
+	/**The whole table.*/
+	std::vector<char> allData;
+	/**The number of names.*/
+	uintptr_t numEntries;
+	/**The number of name bytes.*/
+	uintptr_t totNameLen;
+};
+
+/**
+ * Figure out whether a reference has a name table that fits it (same index size and total name length).
+ * @param refName The base name of the reference.
+ * @return Whether it does.
+ */
+bool profinmanHaveNameTable(const char* refName);
+
 //************************************************************************
 //MATCH EXAMINATION
 //************************************************************************
@@ -88,12 +173,20 @@ public:
 	ProfinmanGetMatchRegion();
 	/**The base name of the reference.*/
 	char* dumpBaseName;
+	/**The base name of the suffix array searched, if it has deltas.*/
+	char* comboName;
 	/**The name of the search result file.*/
 	char* matchName;
 	/**The number of upstream bases to get.*/
 	intptr_t numPre;
 	/**The number of downstream bases to get.*/
 	intptr_t numPost;
+	/**The number of threads to use.*/
+	intptr_t numThread;
+	/**The number of decompressed reference bytes to cache.*/
+	intptr_t blockCache;
+	/**Report block cache use when done.*/
+	bool verbose;
 	/**The place to write the output.*/
 	char* outputName;
 	int posteriorCheck();
@@ -129,6 +222,8 @@ public:
 	void runThing();
 	/**The base name of the reference.*/
 	char* dumpBaseName;
+	/**The base name of the suffix array searched, if it has deltas.*/
+	char* comboName;
 	/**The name of the search result file.*/
 	char* matchName;
 	/**The place to write the output.*/
@@ -146,6 +241,8 @@ public:
 	void runThing();
 	/**The base name of the reference.*/
 	char* dumpBaseName;
+	/**The base name of the suffix array searched, if it has deltas.*/
+	char* comboName;
 	/**The name of the search result file.*/
 	char* matchName;
 	/**The digest file to compare to.*/
@@ -154,6 +251,39 @@ public:
 	char* outputName;
 	/**The maximum number of bytes to use.*/
 	intptr_t maxRam;
+	/**The number of threads to use.*/
+	intptr_t numThread;
+	/**Write kept matches in input order, rather than by location.*/
+	bool keepOrder;
+};
+
+/**Search, digest filter, sort and name matches in one go.*/
+class ProfinmanPeptideSearch : public ProfinmanAction{
+public:
+	/**Set up an empty action.*/
+	ProfinmanPeptideSearch();
+	int posteriorCheck();
+	void runThing();
+	/**The base name of the reference.*/
+	char* referenceName;
+	/**The base name of the combo file.*/
+	char* comboName;
+	/**The name of the search fasta.*/
+	char* searchName;
+	/**The digest file to compare to.*/
+	char* digestName;
+	/**The folder to work in.*/
+	char* workFolder;
+	/**The place to write the sorted matches.*/
+	char* outputName;
+	/**The place to write the names of the matches.*/
+	char* namesName;
+	/**Load the suffix array into memory.*/
+	bool resident;
+	/**The maximum number of bytes to use for sorting and for matches waiting to be sorted.*/
+	intptr_t maxRam;
+	/**The number of threads to use.*/
+	intptr_t numThread;
 };
 
 //TODO
@@ -181,12 +311,50 @@ public:
 	char* workFolder;
 	/**The file to recover with.*/
 	char* recoverFile;
+	/**Whether to write an lcp side file.*/
+	bool buildLCP;
+	/**The prefix length to build a jump table for: zero for none.*/
+	intptr_t jumpLen;
+	/**Whether to always use the external (prefix doubling) build.*/
+	bool forceExternal;
+	/**The prefix length to split the suffixes into independent buckets by: zero for no buckets.*/
+	intptr_t bucketLen;
+	/**The suffix array to append the result to as a delta, if any.*/
+	char* appendName;
+	/**The name of the compression method to write the suffix array with.*/
+	char* compName;
 	
 	int posteriorCheck();
 	void runThing();
 	
+	/**
+	 * Build the suffix array.
+	 */
+	void buildArray();
+	
+	/**
+	 * Try to build the whole array in memory (by induced sorting).
+	 * @param useThreads The threads to use for reading and writing.
+	 * @return Whether the array was built: false if it would not fit in ram.
+	 */
+	bool buildInMemory(ThreadPool* useThreads);
+	/**
+	 * Build the array by splitting the suffixes into buckets by their leading characters, and sorting each bucket in memory.
+	 * @param handledTasks The tasks that have already been done.
+	 * @param useThreads The threads to sort buckets with.
+	 */
+	void buildBuckets(std::set<std::string>* handledTasks, ThreadPool* useThreads);
+	/**
+	 * Build any requested side files that have not already been made.
+	 * @param handledTasks The tasks that have already been done.
+	 * @param useThreads The threads to use.
+	 */
+	void buildSideFiles(std::set<std::string>* handledTasks, ThreadPool* useThreads);
+	
 	/**The opened recovery file*/
 	std::ofstream* recoverStream = 0;
+	/**The compression method to write the suffix array with.*/
+	CompressionMethod* comboComp = 0;
 };
 
 /**Use to dump a suffix array.*/
@@ -221,6 +389,47 @@ public:
 	char* searchName;
 	/**Output results in text.*/
 	bool txtOut;
+	/**Load the reference and suffix array into memory.*/
+	bool resident;
+	/**Memory map the reference and suffix array.*/
+	bool mapped;
+	/**Sort each batch, and narrow searches with the sequences before them.*/
+	bool batchSearch;
+	/**The maximum number of bytes of sequence to load for a batch.*/
+	intptr_t maxRam;
+	/**The number of decompressed bytes to cache (out of maxRam), or -1 to take a share of maxRam.*/
+	intptr_t blockCache;
+	/**Use the lcp side file.*/
+	bool useLCP;
+	/**Use the jump table side file.*/
+	bool useJump;
+	/**The number of threads to use.*/
+	intptr_t numThread;
+	/**Report block cache use when done.*/
+	bool verbose;
+	int posteriorCheck();
+	void runThing();
+};
+
+/**Answer suffix array searches as they come in.*/
+class ProfinmanServeReference : public ProfinmanAction{
+public:
+	/**Set up an empty action.*/
+	ProfinmanServeReference();
+	/**The base names of the references.*/
+	std::vector<char*> referenceNames;
+	/**The base names of the combo files.*/
+	std::vector<char*> comboNames;
+	/**Output results in text.*/
+	bool txtOut;
+	/**Load the references and suffix arrays into memory.*/
+	bool resident;
+	/**Memory map the references and suffix arrays.*/
+	bool mapped;
+	/**Use the lcp side files.*/
+	bool useLCP;
+	/**Use the jump table side files.*/
+	bool useJump;
 	int posteriorCheck();
 	void runThing();
 };
@@ -240,15 +449,612 @@ public:
 	char* comAName;
 	/**The base name of the second combo.*/
 	char* comBName;
+	/**The base names of any further references (and, after parsing, all of them in order).*/
+	std::vector<char*> refMNames;
+	/**The base names of any further combos (and, after parsing, all of them in order).*/
+	std::vector<char*> comMNames;
 	/**The base name of the output reference.*/
 	char* referenceName;
 	/**The base name of the output combo file.*/
 	char* comboName;
+	/**Whether to write an lcp side file.*/
+	bool buildLCP;
+	/**The prefix length to build a jump table for: zero for none.*/
+	intptr_t jumpLen;
+	/**The maximum number of bytes of sequence to hold in memory.*/
+	intptr_t maxRam;
 	
 	int posteriorCheck();
 	void runThing();
 };
 
+/**Fold the deltas appended to a suffix array into a new reference and suffix array.*/
+class ProfinmanCompactReference : public ProfinmanAction{
+public:
+	/**Set up an empty action.*/
+	ProfinmanCompactReference();
+	/**Clean up.*/
+	~ProfinmanCompactReference();
+	/**The base name of the reference the deltas were appended to.*/
+	char* baseRefName;
+	/**The base name of the combo the deltas were appended to.*/
+	char* baseComName;
+	/**The base name of the output reference.*/
+	char* referenceName;
+	/**The base name of the output combo file.*/
+	char* comboName;
+	/**Whether to write an lcp side file.*/
+	bool buildLCP;
+	/**The prefix length to build a jump table for: zero for none.*/
+	intptr_t jumpLen;
+	/**The maximum number of bytes of sequence to hold in memory.*/
+	intptr_t maxRam;
+	
+	int posteriorCheck();
+	void runThing();
+};
+
+/**Random access to the sequences of a reference.*/
+class ProfinmanReferenceSource{
+public:
+	/**Allow subclasses to deconstruct.*/
+	virtual ~ProfinmanReferenceSource();
+	/**
+	 * Get the number of sequences in the reference.
+	 * @return The number of sequences.
+	 */
+	virtual uintptr_t getNumEntries() = 0;
+	/**
+	 * Get the length of a sequence.
+	 * @param entInd The index of the sequence.
+	 * @return The number of characters in the sequence.
+	 */
+	virtual uintptr_t getEntryLength(uintptr_t entInd) = 0;
+	/**
+	 * Get part of a sequence.
+	 * @param entInd The index of the sequence.
+	 * @param fromBase The first character to get.
+	 * @param toBase The character after the last to get.
+	 * @return The characters: only good until the next call.
+	 */
+	virtual const char* getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase) = 0;
+};
+
+/**Get reference sequences from the block compressed file.*/
+class ProfinmanFileReferenceSource : public ProfinmanReferenceSource{
+public:
+	/**
+	 * Open up a reference.
+	 * @param refName The base name of the reference.
+	 * @param useCache The cache of decompressed blocks to use (only share between sources on the same reference). Null for no cache.
+	 */
+	ProfinmanFileReferenceSource(const char* refName, BlockCompCache* useCache);
+	/**Clean up.*/
+	~ProfinmanFileReferenceSource();
+	uintptr_t getNumEntries();
+	uintptr_t getEntryLength(uintptr_t entInd);
+	const char* getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase);
+	/**The compression method for the reference.*/
+	CompressionMethod* refComp;
+	/**The opened reference.*/
+	BlockCompInStream* refStr;
+	/**The sequence reader.*/
+	GailAQSequenceReader* refRead;
+	/**The number of sequences.*/
+	uintptr_t numEntries;
+};
+
+/**Get reference sequences straight out of a memory mapped (uncompressed) block file.*/
+class ProfinmanMappedReferenceSource : public ProfinmanReferenceSource{
+public:
+	/**
+	 * Map a reference.
+	 * @param refName The base name of the reference.
+	 */
+	ProfinmanMappedReferenceSource(const char* refName);
+	/**Clean up.*/
+	~ProfinmanMappedReferenceSource();
+	uintptr_t getNumEntries();
+	uintptr_t getEntryLength(uintptr_t entInd);
+	const char* getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase);
+	/**The mapped reference.*/
+	MappedRawBlockInStream* refStr;
+	/**The sequence reader.*/
+	GailAQSequenceReader* refRead;
+	/**The number of sequences.*/
+	uintptr_t numEntries;
+};
+
+/**Keep recently used sequences from the block compressed file.*/
+class ProfinmanCachedReferenceSource : public ProfinmanReferenceSource{
+public:
+	/**
+	 * Open up a reference.
+	 * @param refName The base name of the reference.
+	 * @param maxBytes The number of sequence bytes to hold on to (the last sequence asked for is always kept).
+	 */
+	ProfinmanCachedReferenceSource(const char* refName, uintptr_t maxBytes);
+	/**Clean up.*/
+	~ProfinmanCachedReferenceSource();
+	uintptr_t getNumEntries();
+	uintptr_t getEntryLength(uintptr_t entInd);
+	const char* getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase);
+	/**The place the sequences actually come from.*/
+	ProfinmanFileReferenceSource baseSource;
+	/**The number of sequence bytes to hold on to.*/
+	uintptr_t maxBytes;
+	/**The number of sequence bytes held.*/
+	uintptr_t curBytes;
+	/**The held sequences, most recently used first.*/
+	std::list< std::pair<uintptr_t,std::string> > heldSeqs;
+	/**Where each held sequence is in heldSeqs.*/
+	std::map<uintptr_t, std::list< std::pair<uintptr_t,std::string> >::iterator > heldLocs;
+};
+
+/**Load an entire reference into memory.*/
+class ProfinmanResidentReferenceSource : public ProfinmanReferenceSource{
+public:
+	/**
+	 * Load a reference.
+	 * @param refName The base name of the reference.
+	 */
+	ProfinmanResidentReferenceSource(const char* refName);
+	/**
+	 * Load a reference.
+	 * @param refName The base name of the reference.
+	 * @param keepNames Whether to also load the names of the sequences.
+	 */
+	ProfinmanResidentReferenceSource(const char* refName, bool keepNames);
+	/**Clean up.*/
+	~ProfinmanResidentReferenceSource();
+	uintptr_t getNumEntries();
+	uintptr_t getEntryLength(uintptr_t entInd);
+	const char* getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase);
+	/**
+	 * Get the name of a sequence: only if names were loaded.
+	 * @param entInd The index of the sequence.
+	 * @param nameLen The place to put the length of the name.
+	 * @return The name.
+	 */
+	const char* getEntryName(uintptr_t entInd, uintptr_t* nameLen);
+	/**
+	 * Actually load the reference.
+	 * @param refName The base name of the reference.
+	 * @param keepNames Whether to also load the names of the sequences.
+	 */
+	void loadReference(const char* refName, bool keepNames);
+	/**All the sequences, one after the other.*/
+	std::vector<char> allSeqs;
+	/**The start of each sequence in allSeqs (and the end of the last).*/
+	std::vector<uintptr_t> seqStarts;
+	/**All the names, one after the other.*/
+	std::vector<char> allNames;
+	/**The start of each name in allNames (and the end of the last).*/
+	std::vector<uintptr_t> nameStarts;
+};
+
+/**How the entries of a finalized combo file are stored.*/
+class ProfinmanComboLayout{
+public:
+	/**Set up the original layout: two eight byte integers per entry, and no header.*/
+	ProfinmanComboLayout();
+	/**
+	 * Set up the smallest layout that will hold a reference.
+	 * @param numString The number of sequences in the reference.
+	 * @param maxLen The length of the longest sequence.
+	 */
+	ProfinmanComboLayout(uintptr_t numString, uintptr_t maxLen);
+	/**
+	 * Figure out the layout of an existing combo file.
+	 * @param comName The base name of the combo file.
+	 */
+	ProfinmanComboLayout(const char* comName);
+	/**
+	 * Write the header for this layout (if any).
+	 * @param toStr The place to write.
+	 */
+	void writeHeader(OutStream* toStr);
+	/**
+	 * Skip past the header (if any).
+	 * @param fromStr The stream, at its start.
+	 */
+	void skipHeader(InStream* fromStr);
+	/**
+	 * Get the number of entries in a file.
+	 * @param totSize The uncompressed size of the file.
+	 * @return The number of entries.
+	 */
+	uintptr_t getNumEntries(uintptr_t totSize);
+	/**
+	 * Pack an entry.
+	 * @param seqInd The sequence index.
+	 * @param charInd The character index.
+	 * @param toBuff The place to put it: needs entrySize bytes.
+	 */
+	void packEntry(uintptr_t seqInd, uintptr_t charInd, char* toBuff);
+	/**
+	 * Unpack an entry.
+	 * @param fromBuff The packed entry.
+	 * @param seqInd The place to put the sequence index.
+	 * @param charInd The place to put the character index.
+	 */
+	void unpackEntry(const char* fromBuff, uintptr_t* seqInd, uintptr_t* charInd);
+	/**The number of bytes before the first entry.*/
+	uintptr_t headerSize;
+	/**The number of bytes for the sequence index.*/
+	int seqWidth;
+	/**The number of bytes for the character index.*/
+	int charWidth;
+	/**The number of bytes in an entry.*/
+	uintptr_t entrySize;
+};
+
+/**
+ * Get the number of bytes needed to store a value.
+ * @param maxVal The largest value to store.
+ * @return The number of bytes (at least one).
+ */
+int profinmanComboBytesFor(uintptr_t maxVal);
+
+/**Random access to the entries of a combo file.*/
+class ProfinmanComboSource{
+public:
+	/**Allow subclasses to deconstruct.*/
+	virtual ~ProfinmanComboSource();
+	/**
+	 * Get the number of entries in the combo file.
+	 * @return The number of suffixes.
+	 */
+	virtual uintptr_t getNumEntries() = 0;
+	/**
+	 * Get an entry.
+	 * @param entInd The index of the entry.
+	 * @param seqInd The place to put the sequence index.
+	 * @param charInd The place to put the character index.
+	 */
+	virtual void getEntry(uintptr_t entInd, uintptr_t* seqInd, uintptr_t* charInd) = 0;
+};
+
+/**Get combo entries from the block compressed file.*/
+class ProfinmanFileComboSource : public ProfinmanComboSource{
+public:
+	/**
+	 * Open up a combo file.
+	 * @param comName The base name of the combo file.
+	 * @param useCache The cache of decompressed blocks to use (only share between sources on the same combo file). Null for no cache.
+	 */
+	ProfinmanFileComboSource(const char* comName, BlockCompCache* useCache);
+	/**Clean up.*/
+	~ProfinmanFileComboSource();
+	uintptr_t getNumEntries();
+	void getEntry(uintptr_t entInd, uintptr_t* seqInd, uintptr_t* charInd);
+	/**The compression method for the combo.*/
+	CompressionMethod* comComp;
+	/**The opened combo.*/
+	BlockCompInStream* comStr;
+	/**The layout of the combo.*/
+	ProfinmanComboLayout comLayout;
+	/**The number of entries.*/
+	uintptr_t numEntries;
+};
+
+/**Get combo entries straight out of a memory mapped (uncompressed) block file.*/
+class ProfinmanMappedComboSource : public ProfinmanComboSource{
+public:
+	/**
+	 * Map a combo file.
+	 * @param comName The base name of the combo file.
+	 */
+	ProfinmanMappedComboSource(const char* comName);
+	/**Clean up.*/
+	~ProfinmanMappedComboSource();
+	uintptr_t getNumEntries();
+	void getEntry(uintptr_t entInd, uintptr_t* seqInd, uintptr_t* charInd);
+	/**The mapped combo.*/
+	MappedRawBlockInStream* comStr;
+	/**The layout of the combo.*/
+	ProfinmanComboLayout comLayout;
+	/**The number of entries.*/
+	uintptr_t numEntries;
+};
+
+/**Load an entire combo file into memory.*/
+class ProfinmanResidentComboSource : public ProfinmanComboSource{
+public:
+	/**
+	 * Load a combo file.
+	 * @param comName The base name of the combo file.
+	 */
+	ProfinmanResidentComboSource(const char* comName);
+	/**Clean up.*/
+	~ProfinmanResidentComboSource();
+	uintptr_t getNumEntries();
+	void getEntry(uintptr_t entInd, uintptr_t* seqInd, uintptr_t* charInd);
+	/**The decompressed entries.*/
+	std::vector<char> allEnts;
+	/**The layout of the combo.*/
+	ProfinmanComboLayout comLayout;
+	/**The number of entries.*/
+	uintptr_t numEntries;
+};
+
+/**The largest lcp stored in an lcp file: anything longer is clipped.*/
+#define SUFFIX_LCP_MAX 255
+/**The number of lcp entries summarized together.*/
+#define SUFFIX_LCP_BLOCK 256
+
+/**The longest common prefixes of neighboring suffixes in a combo file.*/
+class ProfinmanSuffixLCP{
+public:
+	/**
+	 * Load the lcp file for a combo.
+	 * @param comName The base name of the combo file.
+	 */
+	ProfinmanSuffixLCP(const char* comName);
+	/**Clean up.*/
+	~ProfinmanSuffixLCP();
+	/**
+	 * Get the longest common prefix of two suffixes.
+	 * @param fromEnt The first entry.
+	 * @param toEnt The second entry: must be after the first.
+	 * @return The length of the common prefix: SUFFIX_LCP_MAX means at least that long.
+	 */
+	uintptr_t getRangeLCP(uintptr_t fromEnt, uintptr_t toEnt);
+	/**The lcp of each entry with the one before it.*/
+	std::vector<unsigned char> allLCP;
+	/**The minimum lcp in each block, and then in runs of 2,4,8... blocks.*/
+	std::vector< std::vector<unsigned char> > blockMins;
+};
+
+/**The most prefixes a jump table can have.*/
+#define SUFFIX_JUMP_MAX_CODES 0x04000000
+
+/**The ranges of suffixes starting with each short prefix in a combo file.*/
+class ProfinmanSuffixJumpTable{
+public:
+	/**
+	 * Load the jump table for a combo.
+	 * @param comName The base name of the combo file.
+	 */
+	ProfinmanSuffixJumpTable(const char* comName);
+	/**Clean up.*/
+	~ProfinmanSuffixJumpTable();
+	/**
+	 * Get the range of entries that might start with a sequence.
+	 * @param lookFor The sequence to look for.
+	 * @param lookLen The length of that sequence.
+	 * @param lowEnt The place to put the first entry that might match.
+	 * @param highEnt The place to put the entry after the last that might match.
+	 */
+	void getRange(const char* lookFor, uintptr_t lookLen, uintptr_t* lowEnt, uintptr_t* highEnt);
+	/**The length of the prefixes.*/
+	uintptr_t prefixLen;
+	/**The number of digits per character: one more than the number of characters (zero is end of sequence).*/
+	uintptr_t numDigit;
+	/**The digit for each character (zero if not present).*/
+	uintptr_t charDigits[256];
+	/**The first entry for each prefix (and the number of entries at the end).*/
+	std::vector<uintptr_t> prefixStarts;
+};
+
+/**
+ * Build side files for a combo file.
+ * @param refName The base name of the reference.
+ * @param comName The base name of the combo file.
+ * @param buildLCP Whether to build an lcp file.
+ * @param jumpLen The prefix length to build a jump table for: zero for none.
+ * @param maxRam The number of bytes of reference to hold: the whole reference is loaded only if it fits.
+ * @param numThread The number of threads to use.
+ * @param useThreads The threads to use.
+ */
+void profinmanBuildSuffixSideFiles(const char* refName, const char* comName, bool buildLCP, uintptr_t jumpLen, uintptr_t maxRam, int numThread, ThreadPool* useThreads);
+
+/**Search a suffix array.*/
+class ProfinmanSuffixArraySearcher{
+public:
+	/**
+	 * Set up a search.
+	 * @param useRef The reference to search in.
+	 * @param useCombo The suffix array of that reference.
+	 */
+	ProfinmanSuffixArraySearcher(ProfinmanReferenceSource* useRef, ProfinmanComboSource* useCombo);
+	/**Clean up.*/
+	~ProfinmanSuffixArraySearcher();
+	/**
+	 * Find the range of suffixes that start with a sequence.
+	 * @param lookFor The sequence to look for.
+	 * @param lookLen The length of that sequence.
+	 * @param fromEnt The first entry that might match.
+	 * @param toEnt The entry after the last that might match.
+	 * @param lowEnt The place to put the first matching entry.
+	 * @param highEnt The place to put the entry after the last match.
+	 */
+	void findRange(const char* lookFor, uintptr_t lookLen, uintptr_t fromEnt, uintptr_t toEnt, uintptr_t* lowEnt, uintptr_t* highEnt);
+	/**
+	 * Find the ranges for a batch of sequences: sorts them and uses neighbors to limit the search.
+	 * @param lookFor The sequences to look for.
+	 * @param lowEnts The place to put the first matching entry of each.
+	 * @param highEnts The place to put the entry after the last match of each.
+	 */
+	void findRanges(std::vector< std::pair<const char*,uintptr_t> >* lookFor, std::vector<uintptr_t>* lowEnts, std::vector<uintptr_t>* highEnts);
+	/**
+	 * Search for a batch of sequences and report the matches.
+	 * @param lookFor The sequences to look for.
+	 * @param firstInd The index of the first sequence.
+	 * @param sortFirst Whether to sort the batch and use neighbors to limit the search.
+	 * @param outputTo The place to write the results.
+	 * @param asText Write as text (or binary).
+	 */
+	void searchBatch(std::vector< std::pair<const char*,uintptr_t> >* lookFor, uintptr_t firstInd, bool sortFirst, std::vector<char>* outputTo, bool asText);
+	/**
+	 * Find the ranges for a batch of sequences.
+	 * @param lookFor The sequences to look for.
+	 * @param sortFirst Whether to sort the batch and use neighbors to limit the search.
+	 * @param lowEnts The place to put the first matching entry of each.
+	 * @param highEnts The place to put the entry after the last match of each.
+	 */
+	void findBatchRanges(std::vector< std::pair<const char*,uintptr_t> >* lookFor, bool sortFirst, std::vector<uintptr_t>* lowEnts, std::vector<uintptr_t>* highEnts);
+	/**
+	 * Report the matches in a range.
+	 * @param lookInd The index of the sequence that was looked for.
+	 * @param lookLen The length of that sequence.
+	 * @param lowEnt The first matching entry.
+	 * @param highEnt The entry after the last match.
+	 * @param outputTo The place to write the results.
+	 * @param asText Write as text (or binary).
+	 */
+	void reportRange(uintptr_t lookInd, uintptr_t lookLen, uintptr_t lowEnt, uintptr_t highEnt, std::vector<char>* outputTo, bool asText);
+	/**
+	 * Find the first suffix not less than a sequence.
+	 * @param lookFor The sequence to look for.
+	 * @param lookLen The length of that sequence.
+	 * @param fromEnt The first entry that might match.
+	 * @param toEnt The entry after the last that might match.
+	 * @param orEqual Whether a suffix starting with the sequence counts as less.
+	 * @return The first entry that is not less.
+	 */
+	uintptr_t findBound(const char* lookFor, uintptr_t lookLen, uintptr_t fromEnt, uintptr_t toEnt, bool orEqual);
+	/**
+	 * Compare a suffix against a sequence.
+	 * @param entInd The entry of the suffix to test.
+	 * @param lookFor The sequence to look for.
+	 * @param lookLen The length of that sequence.
+	 * @param startAt The number of characters already known to match.
+	 * @param compRes The place to put the result: negative if the suffix comes first, zero if it starts with the sequence, positive if after.
+	 * @return The number of matching characters.
+	 */
+	uintptr_t compareSuffix(uintptr_t entInd, const char* lookFor, uintptr_t lookLen, uintptr_t startAt, int* compRes);
+	/**The reference.*/
+	ProfinmanReferenceSource* searchRef;
+	/**The suffix array.*/
+	ProfinmanComboSource* searchCombo;
+	/**The lcp information, if any.*/
+	ProfinmanSuffixLCP* searchLCP;
+	/**The jump table, if any.*/
+	ProfinmanSuffixJumpTable* searchJump;
+	/**The number of reference sequences.*/
+	uintptr_t numSeqs;
+	/**The amount to add to reported sequence indices (for deltas appended to another array).*/
+	uintptr_t seqOffset;
+};
+
+/**Everything needed to search a suffix array, possibly from multiple threads.*/
+class ProfinmanSuffixArrayIndex{
+public:
+	/**
+	 * Open up a suffix array.
+	 * @param refName The base name of the reference.
+	 * @param comName The base name of the combo file.
+	 * @param resident Whether to load the reference and combo into memory.
+	 * @param mapped Whether to memory map the reference and combo (if not resident): they must be stored uncompressed.
+	 * @param useLCP Whether to use the lcp side file.
+	 * @param useJump Whether to use the jump table side file.
+	 * @param numThread The number of threads that will search.
+	 * @param cacheBytes The number of decompressed bytes to hold on to when reading the files (split between the reference and the combo, and shared by the threads).
+	 */
+	ProfinmanSuffixArrayIndex(const char* refName, const char* comName, bool resident, bool mapped, bool useLCP, bool useJump, int numThread, uintptr_t cacheBytes);
+	/**Clean up.*/
+	~ProfinmanSuffixArrayIndex();
+	/**The number of suffixes.*/
+	uintptr_t numEntries;
+	/**The searcher for each thread.*/
+	std::vector<ProfinmanSuffixArraySearcher*> threadSearch;
+	/**The opened references (may be fewer than threads if shared).*/
+	std::vector<ProfinmanReferenceSource*> allRefs;
+	/**The opened combos (may be fewer than threads if shared).*/
+	std::vector<ProfinmanComboSource*> allCombos;
+	/**The lcp information, if any.*/
+	ProfinmanSuffixLCP* saLCP;
+	/**The jump table, if any.*/
+	ProfinmanSuffixJumpTable* saJump;
+	/**The cache of decompressed reference blocks, if any.*/
+	BlockCompCache* refCache;
+	/**The cache of decompressed combo blocks, if any.*/
+	BlockCompCache* comCache;
+};
+
+/**
+ * Get the deltas that have been appended to a suffix array (listed in File.gail.sa.delta, relative to its folder).
+ * @param comName The base name of the combo file.
+ * @param refNames The place to put the reference of each delta, in order (usable from the working directory).
+ * @param comNames The place to put the combo file of each delta, in order.
+ */
+void profinmanReadDeltaList(const char* comName, std::vector<std::string>* refNames, std::vector<std::string>* comNames);
+
+/**
+ * Append a delta to a suffix array (if it is not already there).
+ * @param comName The base name of the combo file to append to.
+ * @param refName The reference of the delta.
+ * @param deltaName The combo file of the delta.
+ */
+void profinmanAppendDeltaList(const char* comName, const char* refName, const char* deltaName);
+
+/**The references that suffix array matches point into: the base reference, then the reference of each delta appended to the suffix array (findsa numbers their sequences in that order).*/
+class ProfinmanMatchReference{
+public:
+	/**
+	 * Open up the references.
+	 * @param refName The base name of the reference.
+	 * @param comName The base name of the suffix array the matches came from (for its deltas). Null for just the reference.
+	 * @param numCopy The number of times to open each reference (one for each thread that will read).
+	 * @param cacheBytes The number of decompressed bytes to cache (split between the references, and shared by the copies).
+	 */
+	ProfinmanMatchReference(const char* refName, const char* comName, int numCopy, uintptr_t cacheBytes);
+	/**
+	 * Open up the references once, decompressing with multiple threads.
+	 * @param refName The base name of the reference.
+	 * @param comName The base name of the suffix array the matches came from (for its deltas). Null for just the reference.
+	 * @param numThread The number of threads to decompress with.
+	 * @param useThreads The threads to use.
+	 * @param cacheBytes The number of decompressed bytes to cache (split between the references).
+	 */
+	ProfinmanMatchReference(const char* refName, const char* comName, int numThread, ThreadPool* useThreads, uintptr_t cacheBytes);
+	/**Clean up.*/
+	~ProfinmanMatchReference();
+	/**
+	 * Actually open the references.
+	 * @param refName The base name of the reference.
+	 * @param comName The base name of the suffix array the matches came from. Null for just the reference.
+	 * @param numCopy The number of times to open each reference.
+	 * @param numThread The number of threads to decompress with: zero for single threaded streams.
+	 * @param useThreads The threads to use, if any.
+	 * @param cacheBytes The number of decompressed bytes to cache.
+	 */
+	void openReferences(const char* refName, const char* comName, int numCopy, int numThread, ThreadPool* useThreads, uintptr_t cacheBytes);
+	/**
+	 * Get the total number of sequences.
+	 * @return The number of sequences in all the references.
+	 */
+	uintptr_t getNumEntries();
+	/**
+	 * Figure out which reference a sequence is in.
+	 * @param entInd The index of the sequence, as findsa reports it: must be less than getNumEntries().
+	 * @return The index of the reference (subtract its layerStarts to get the index in that reference).
+	 */
+	uintptr_t findLayer(uintptr_t entInd);
+	/**
+	 * Get a reader.
+	 * @param copyInd The copy to get.
+	 * @param layerInd The reference to get.
+	 * @return The reader.
+	 */
+	GailAQSequenceReader* getReader(uintptr_t copyInd, uintptr_t layerInd);
+	/**The base name of each reference.*/
+	std::vector<std::string> refNames;
+	/**The index of the first sequence of each reference (and the total).*/
+	std::vector<uintptr_t> layerStarts;
+	/**The number of copies of each reference.*/
+	uintptr_t numCopy;
+	/**The compression methods for the streams.*/
+	std::vector<CompressionMethod*> allComps;
+	/**The block caches, one per reference, if any.*/
+	std::vector<BlockCompCache*> allCaches;
+	/**The opened streams.*/
+	std::vector<InStream*> allStrs;
+	/**The readers, by copy and then by reference.*/
+	std::vector<GailAQSequenceReader*> allReads;
+};
+
 //TODO
 
 //************************************************************************
@@ -412,6 +1218,8 @@ public:
 
 /**The size of a search result entry (4 numbers)*/
 #define MATCH_ENTRY_SIZE 32
+/**The most bytes a text search result can take (4 numbers of up to 20 digits, 4 separators and a null).*/
+#define MATCH_TEXT_SIZE 85
 
 /**
  * Output a search result to a file.
@@ -424,9 +1232,26 @@ public:
  */
 void outputSearchResult(uintptr_t lookFor, uintptr_t foundIn, uintptr_t foundAt, uintptr_t foundTo, FILE* outputTo, bool asText);
 
-/**The size of an entry in a working combo file.*/
+/**
+ * Output a search result to memory.
+ * @param lookFor The sequence index that was found.
+ * @param foundIn The reference sequence it was found in.
+ * @param foundAt THe location in the reference it was found at.
+ * @param foundTo The location after the end in the reference.
+ * @param outputTo The place to write to.
+ * @param asText Write as text (or binary).
+ */
+void outputSearchResult(uintptr_t lookFor, uintptr_t foundIn, uintptr_t foundAt, uintptr_t foundTo, std::vector<char>* outputTo, bool asText);
+
+/**The largest size of an entry in a working combo file.*/
 #define COMBO_SORT_ENTRY_SIZE 32
-/**The size of an entry in a finalized combo file.*/
+/**The size of an entry in an unpacked combo file.*/
 #define COMBO_ENTRY_SIZE 16
+/**The size of the header on a packed combo file (the same as an unpacked entry, which it can not be mistaken for).*/
+#define COMBO_HEADER_SIZE 16
+/**The version of packed combo file this writes.*/
+#define COMBO_FORMAT_VERSION 1
+/**The longest prefix to split a bucketed build by.*/
+#define COMBO_BUCKET_MAX_PREFIX 3
 
 #endif
@@ -1,6 +1,7 @@
 #include "whodun_compress.h"
 
 #include <string>
+#include <string.h>
 #include <stdlib.h>
 #include <stdexcept>
 #include <algorithm>
@@ -116,48 +117,158 @@ void BlockCompOutStream::dumpCompData(){
 	myComp->compData.clear();
 }
 
+BlockCompCache::BlockCompCache(uintptr_t maxBytes){
+	this->maxBytes = maxBytes;
+	curBytes = 0;
+	numHit = 0;
+	numMiss = 0;
+	numLoad = 0;
+	myMut = makeMutex();
+}
+
+BlockCompCache::~BlockCompCache(){
+	killMutex(myMut);
+}
+
+bool BlockCompCache::getBlock(uintptr_t blockInd, std::vector<char>* toFill){
+	lockMutex(myMut);
+	std::map< uintptr_t, std::list< std::pair< uintptr_t,std::vector<char> > >::iterator >::iterator heldIt = heldLocs.find(blockInd);
+	if(heldIt == heldLocs.end()){
+		numMiss++;
+		unlockMutex(myMut);
+		return false;
+	}
+	numHit++;
+	heldBlocks.splice(heldBlocks.begin(), heldBlocks, heldIt->second);
+	toFill->clear();
+	toFill->insert(toFill->end(), heldBlocks.front().second.begin(), heldBlocks.front().second.end());
+	unlockMutex(myMut);
+	return true;
+}
+
+bool BlockCompCache::hasBlock(uintptr_t blockInd){
+	lockMutex(myMut);
+	bool isHeld = heldLocs.find(blockInd) != heldLocs.end();
+	unlockMutex(myMut);
+	return isHeld;
+}
+
+void BlockCompCache::addBlock(uintptr_t blockInd, std::vector<char>* blockData){
+	lockMutex(myMut);
+	numLoad++;
+	if(blockData->size() > maxBytes){ unlockMutex(myMut); return; }
+	if(heldLocs.find(blockInd) == heldLocs.end()){
+		heldBlocks.push_front( std::pair< uintptr_t,std::vector<char> >(blockInd, *blockData) );
+		heldLocs[blockInd] = heldBlocks.begin();
+		curBytes += blockData->size();
+		while(curBytes > maxBytes){
+			curBytes -= heldBlocks.back().second.size();
+			heldLocs.erase(heldBlocks.back().first);
+			heldBlocks.pop_back();
+		}
+	}
+	unlockMutex(myMut);
+}
+
+BlockCompAnnotation::BlockCompAnnotation(){
+	numBlocks = 0;
+	fixedLen = 0;
+}
+
+BlockCompAnnotation::~BlockCompAnnotation(){}
+
+void BlockCompAnnotation::loadAnnotation(const char* annotFN){
+	intptr_t annotLen = getFileSize(annotFN);
+	if(annotLen < 0){std::string errMess("Problem examining annotation file "); errMess.append(annotFN); throw std::runtime_error(errMess);}
+	numBlocks = annotLen / BLOCKCOMP_ANNOT_ENTLEN;
+	std::vector<char> annotBuff(numBlocks*BLOCKCOMP_ANNOT_ENTLEN + 1);
+	FILE* annotF = fopen(annotFN, "rb");
+	if(annotF == 0){
+		throw std::runtime_error("Problem opening annotation block file.");
+	}
+	uintptr_t numRead = fread(&(annotBuff[0]), 1, numBlocks*BLOCKCOMP_ANNOT_ENTLEN, annotF);
+	fclose(annotF);
+	if(numRead != numBlocks*BLOCKCOMP_ANNOT_ENTLEN){ throw std::runtime_error("Problem reading annotation file."); }
+	preAddrs.resize(numBlocks);
+	postAddrs.resize(numBlocks);
+	preLens.resize(numBlocks);
+	postLens.resize(numBlocks);
+	for(uintptr_t i = 0; i<numBlocks; i++){
+		char* curEnt = &(annotBuff[i*BLOCKCOMP_ANNOT_ENTLEN]);
+		preAddrs[i] = be2nat64(curEnt);
+		postAddrs[i] = be2nat64(curEnt+8);
+		preLens[i] = be2nat64(curEnt+16);
+		postLens[i] = be2nat64(curEnt+24);
+	}
+	//note if the blocks are all the same size (lookup is a division)
+	fixedLen = numBlocks ? preLens[0] : 0;
+	for(uintptr_t i = 0; fixedLen && (i<numBlocks); i++){
+		if(preAddrs[i] != i*fixedLen){ fixedLen = 0; }
+		else if(((i+1) < numBlocks) && (preLens[i] != fixedLen)){ fixedLen = 0; }
+	}
+}
+
+uintptr_t BlockCompAnnotation::findBlock(uintptr_t toAddr){
+	if(numBlocks == 0){ return 0; }
+	uintptr_t blockI;
+	if(fixedLen){
+		blockI = std::min(toAddr / fixedLen, numBlocks - 1);
+	}
+	else{
+		blockI = std::upper_bound(preAddrs.begin(), preAddrs.end(), toAddr) - preAddrs.begin();
+		if(blockI == 0){ return numBlocks; }
+		blockI--;
+	}
+	if(toAddr >= (preAddrs[blockI] + preLens[blockI])){ return numBlocks; }
+	return blockI;
+}
+
+uintptr_t BlockCompAnnotation::getUncompressedSize(){
+	if(numBlocks == 0){ return 0; }
+	return preAddrs[numBlocks-1] + preLens[numBlocks-1];
+}
+
 BlockCompInStream::BlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth){
+	blockCache = 0;
+	openFile(mainFN, annotFN, compMeth);
+}
+
+BlockCompInStream::BlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, BlockCompCache* useCache){
+	blockCache = useCache;
+	openFile(mainFN, annotFN, compMeth);
+}
+
+void BlockCompInStream::openFile(const char* mainFN, const char* annotFN, CompressionMethod* compMeth){
 	myComp = compMeth;
-	intptr_t numBlocksT = getFileSize(annotFN);
-	if(numBlocksT < 0){std::string errMess("Problem examining annotation file "); errMess.append(annotFN); throw std::runtime_error(errMess);}
-	numBlocks = numBlocksT / BLOCKCOMP_ANNOT_ENTLEN;
-	numLastLine = 0;
-	lastLineBI0 = 0;
+	nextBlockI = 0;
+	loadedBlockI = BLOCKCOMPIN_NO_BLOCK;
+	blockAnnot.loadAnnotation(annotFN);
+	numBlocks = blockAnnot.numBlocks;
 	mainF = fopen(mainFN, "rb");
 	if(mainF == 0){
 		throw std::runtime_error("Problem opening main block file.");
 	}
-	annotF = fopen(annotFN, "rb");
-	if(annotF == 0){
-		fclose(mainF);
-		throw std::runtime_error("Problem opening annotation block file.");
-	}
 	nextReadI = 0;
 	myComp->theData.clear();
 	myComp->compData.clear();
-	lastLineBuff = (char*)malloc(BLOCKCOMP_ANNOT_ENTLEN*BLOCKCOMPIN_LASTLINESEEK);
-	lastLineAddrs = (uintptr_t*)malloc(sizeof(uintptr_t)*BLOCKCOMP_ANNOT_ENTLEN*BLOCKCOMPIN_LASTLINESEEK);
 }
 
 BlockCompInStream::~BlockCompInStream(){
 	fclose(mainF);
-	fclose(annotF);
-	free(lastLineBuff);
-	free(lastLineAddrs);
 }
 
 int BlockCompInStream::readByte(){
 	while(nextReadI >= myComp->theData.size()){
-		char annotBuff[BLOCKCOMP_ANNOT_ENTLEN];
-		if(fread(annotBuff, 1, BLOCKCOMP_ANNOT_ENTLEN, annotF) != BLOCKCOMP_ANNOT_ENTLEN){
-			if(ferror(annotF)){throw std::runtime_error("Problem reading annotations.");}
+		if(nextBlockI >= numBlocks){
 			return -1;
 		}
-		uintptr_t numPost = be2nat64(annotBuff+24);
+		uintptr_t numPost = blockAnnot.postLens[nextBlockI];
+		nextBlockI++;
 		if(numPost){
 			myComp->compData.resize(numPost);
 			if(fread(&(myComp->compData[0]), 1, numPost, mainF) != numPost){throw std::runtime_error("Problem reading data.");}
 			myComp->decompressData();
+			loadedBlockI = nextBlockI - 1;
 			nextReadI = 0;
 		}
 	}
@@ -199,60 +310,41 @@ uintptr_t BlockCompInStream::readBytes(char* toR, uintptr_t numR){
 }
 
 void BlockCompInStream::seek(uintptr_t toAddr){
-	retryWithCachedArena:
-	if(numLastLine){
-		uintptr_t* winBlk = std::upper_bound(lastLineAddrs, lastLineAddrs + numLastLine, toAddr) - 1;
-		intptr_t winBI = winBlk - lastLineAddrs;
-		if(winBI < 0){ goto arenaNotCached; }
-		char* focEnt = lastLineBuff + BLOCKCOMP_ANNOT_ENTLEN*winBI;
-		uintptr_t focLI = be2nat64(focEnt);
-		uintptr_t focHI = focLI + be2nat64(focEnt + 16);
-		if(toAddr >= focHI){ goto arenaNotCached; }
-		uintptr_t blockSAddr = be2nat64(focEnt + 8);
-		uintptr_t blockCLen = be2nat64(focEnt + 24);
-		if(fseekPointer(mainF, blockSAddr, SEEK_SET)){throw std::runtime_error("Problem seeking data file.");}
-		myComp->compData.resize(blockCLen);
-		if(fread(&(myComp->compData[0]), 1, blockCLen, mainF) != blockCLen){throw std::runtime_error("Problem reading data.");}
-		myComp->decompressData();
-		nextReadI = toAddr - focLI;
-		if(fseekPointer(annotF, BLOCKCOMP_ANNOT_ENTLEN*(lastLineBI0 + winBI + 1), SEEK_SET)){throw std::runtime_error("Problem seeking annotation file.");}
+	uintptr_t blockI = blockAnnot.findBlock(toAddr);
+	if(blockI >= numBlocks){
+		//past the end: nothing more to read
+		loadedBlockI = BLOCKCOMPIN_NO_BLOCK;
+		myComp->theData.clear();
+		nextReadI = 0;
+		nextBlockI = numBlocks;
 		return;
 	}
-	arenaNotCached:
-	uintptr_t fromBlock = 0;
-	uintptr_t toBlock = numBlocks;
-	while((toBlock - fromBlock) > BLOCKCOMPIN_LASTLINESEEK){
-		char annotBuff[BLOCKCOMP_ANNOT_ENTLEN];
-		uintptr_t midBlock = (fromBlock + toBlock)/2;
-		if(fseekPointer(annotF, BLOCKCOMP_ANNOT_ENTLEN*midBlock, SEEK_SET)){throw std::runtime_error("Problem seeking annotation file.");}
-		if(fread(annotBuff, 1, BLOCKCOMP_ANNOT_ENTLEN, annotF)!=BLOCKCOMP_ANNOT_ENTLEN){throw std::runtime_error("Problem reading annotation file.");}
-		uintptr_t precomLI = be2nat64(annotBuff);
-		//uintptr_t precomHI = precomLI + be2nat64(annotBuff+16);
-		if(toAddr < precomLI){
-			toBlock = midBlock;
-		}
-		else{
-			fromBlock = midBlock;
+	uintptr_t blockSAddr = blockAnnot.postAddrs[blockI];
+	uintptr_t blockCLen = blockAnnot.postLens[blockI];
+	//get the data: already there, held, or from the file (which leaves the data file at the next block)
+	bool needMainSeek = true;
+	if(blockI != loadedBlockI){
+		loadedBlockI = BLOCKCOMPIN_NO_BLOCK;
+		if(!(blockCache && blockCache->getBlock(blockI, &(myComp->theData)))){
+			if(fseekPointer(mainF, blockSAddr, SEEK_SET)){throw std::runtime_error("Problem seeking data file.");}
+			myComp->compData.resize(blockCLen);
+			if(fread(&(myComp->compData[0]), 1, blockCLen, mainF) != blockCLen){throw std::runtime_error("Problem reading data.");}
+			myComp->decompressData();
+			if(blockCache){ blockCache->addBlock(blockI, &(myComp->theData)); }
+			needMainSeek = false;
 		}
+		loadedBlockI = blockI;
 	}
-	uintptr_t numRBlock = toBlock - fromBlock;
-	numLastLine = numRBlock;
-	lastLineBI0 = fromBlock;
-	if(fseekPointer(annotF, BLOCKCOMP_ANNOT_ENTLEN*fromBlock, SEEK_SET)){throw std::runtime_error("Problem seeking annotation file.");}
-	if(fread(lastLineBuff, 1, numRBlock*BLOCKCOMP_ANNOT_ENTLEN, annotF) != (numRBlock*BLOCKCOMP_ANNOT_ENTLEN)){throw std::runtime_error("Problem reading data.");}
-	for(uintptr_t i = 0; i<numRBlock; i++){
-		lastLineAddrs[i] = be2nat64(lastLineBuff + i*BLOCKCOMP_ANNOT_ENTLEN);
+	else if(nextBlockI == (blockI + 1)){
+		needMainSeek = false;
 	}
-	goto retryWithCachedArena;
+	nextReadI = toAddr - blockAnnot.preAddrs[blockI];
+	if(needMainSeek && fseekPointer(mainF, blockSAddr + blockCLen, SEEK_SET)){throw std::runtime_error("Problem seeking data file.");}
+	nextBlockI = blockI + 1;
 }
 
 uintptr_t BlockCompInStream::getUncompressedSize(){
-	intptr_t retLoc = ftellPointer(annotF);
-	if(fseekPointer(annotF, BLOCKCOMP_ANNOT_ENTLEN * (numBlocks - 1), SEEK_SET)){ throw std::runtime_error("Problem positioning annotation file."); }
-	char tmpBuff[BLOCKCOMP_ANNOT_ENTLEN];
-	if(fread(tmpBuff, 1, BLOCKCOMP_ANNOT_ENTLEN, annotF) != BLOCKCOMP_ANNOT_ENTLEN){ throw std::runtime_error("Problem reading annotation file.");}
-	if(fseekPointer(annotF, retLoc, SEEK_SET)){ throw std::runtime_error("Problem positioning annotation file."); }
-	return be2nat64(tmpBuff) + be2nat64(tmpBuff+16);
+	return blockAnnot.getUncompressedSize();
 }
 
 /**Multithread stuff for block compression.*/
@@ -504,10 +596,16 @@ public:
 	
 	/**The place to copy from: for memcpy jobs.*/
 	const char* copyFrom;
+	
+	/**The index of the block: for prefetch jobs.*/
+	uintptr_t blockInd;
+	/**The place to save the block: for prefetch jobs.*/
+	BlockCompCache* saveTo;
 };
 
 MultithreadBlockCompInStreamUniform::MultithreadBlockCompInStreamUniform(){
 	compMeth = 0;
+	saveTo = 0;
 }
 
 MultithreadBlockCompInStreamUniform::~MultithreadBlockCompInStreamUniform(){
@@ -531,22 +629,35 @@ void multithreadBlockCompInFill(void* myUni){
 	memcpy(rUni->dumpToB, curCpyF + rUni->numDumpA, rUni->numDumpB);
 }
 
+/**Decompress a block and hold on to it.*/
+void multithreadBlockCompInPrefetch(void* myUni){
+	MultithreadBlockCompInStreamUniform* rUni = (MultithreadBlockCompInStreamUniform*)myUni;
+	rUni->compMeth->decompressData();
+	rUni->saveTo->addBlock(rUni->blockInd, &(rUni->compMeth->theData));
+}
+
 MultithreadBlockCompInStream::MultithreadBlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, int numThreads, ThreadPool* useThreads){
+	blockCache = 0;
+	openFile(mainFN, annotFN, compMeth, numThreads, useThreads);
+}
+
+MultithreadBlockCompInStream::MultithreadBlockCompInStream(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, int numThreads, ThreadPool* useThreads, BlockCompCache* useCache){
+	blockCache = useCache;
+	openFile(mainFN, annotFN, compMeth, numThreads, useThreads);
+}
+
+void MultithreadBlockCompInStream::openFile(const char* mainFN, const char* annotFN, CompressionMethod* compMeth, int numThreads, ThreadPool* useThreads){
 	//open up the file proper
-	intptr_t numBlocksT = getFileSize(annotFN);
-	if(numBlocksT < 0){std::string errMess("Problem examining annotation file "); errMess.append(annotFN); throw std::runtime_error(errMess);}
-	numBlocks = numBlocksT / BLOCKCOMP_ANNOT_ENTLEN;
+	blockAnnot.loadAnnotation(annotFN);
+	numBlocks = blockAnnot.numBlocks;
 	mainF = fopen(mainFN, "rb");
 	if(mainF == 0){
 		throw std::runtime_error("Problem opening main block file.");
 	}
-	annotF = fopen(annotFN, "rb");
-	if(annotF == 0){
-		fclose(mainF);
-		throw std::runtime_error("Problem opening annotation block file.");
-	}
 	//set up the initial reads
 	numReadBlocks = 0;
+	mainFAt = 0;
+	readAhead = numThreads ? (numThreads - 1) : 0;
 	compThreads = useThreads;
 	threadUnis.resize(numThreads);
 	for(uintptr_t i = 0; i<threadUnis.size(); i++){
@@ -559,19 +670,18 @@ MultithreadBlockCompInStream::MultithreadBlockCompInStream(const char* mainFN, c
 
 MultithreadBlockCompInStream::~MultithreadBlockCompInStream(){
 	fclose(mainF);
-	fclose(annotF);
 }
 
 int MultithreadBlockCompInStream::readByte(){
 	if(nextLeftover < leftover->size()){
-		int toRet = (*leftover)[nextLeftover];
+		int toRet = 0x00FF & (*leftover)[nextLeftover];
 		nextLeftover++;
 		return toRet;
 	}
 	char rBuff;
 	uintptr_t numRead = readBytes(&rBuff, 1);
 	if(numRead == 1){
-		return rBuff;
+		return 0x00FF & rBuff;
 	}
 	return -1;
 }
@@ -617,17 +727,24 @@ uintptr_t MultithreadBlockCompInStream::readBytes(char* toR, uintptr_t numR){
 		}
 		//if no more blocks, stop
 		if(numReadBlocks == numBlocks){ break; }
-		//load in the annotation for the next block
-		char annotBuff[BLOCKCOMP_ANNOT_ENTLEN];
-		if(fread(annotBuff, 1, BLOCKCOMP_ANNOT_ENTLEN, annotF) != BLOCKCOMP_ANNOT_ENTLEN){
-			throw std::runtime_error("Problem reading annotations.");
-		}
-		uintptr_t numPre = be2nat64(annotBuff+16);
-		uintptr_t numPost = be2nat64(annotBuff+24);
+		//get the annotation for the next block
+		uintptr_t blockI = numReadBlocks;
+		uintptr_t numPre = blockAnnot.preLens[blockI];
+		uintptr_t numPost = blockAnnot.postLens[blockI];
 		numReadBlocks++;
 		if(numPost==0){ continue; }
-		cUni->compMeth->compData.resize(numPost);
-		if(fread(&(cUni->compMeth->compData[0]), 1, numPost, mainF) != numPost){throw std::runtime_error("Problem reading data.");}
+		//already decompressed (prefetch or seek), or need to load
+		bool isHeld = blockCache && blockCache->getBlock(blockI, &(cUni->compMeth->theData));
+		if(isHeld){
+			cUni->copyFrom = &(cUni->compMeth->theData[0]);
+		}
+		else{
+			uintptr_t postAddr = blockAnnot.postAddrs[blockI];
+			if((postAddr != mainFAt) && fseekPointer(mainF, postAddr, SEEK_SET)){throw std::runtime_error("Problem seeking data file.");}
+			cUni->compMeth->compData.resize(numPost);
+			if(fread(&(cUni->compMeth->compData[0]), 1, numPost, mainF) != numPost){throw std::runtime_error("Problem reading data.");}
+			mainFAt = postAddr + numPost;
+		}
 		//figure out how it splits
 		if(numPre > leftR){
 			postlude->resize(numPre - leftR);
@@ -640,7 +757,7 @@ uintptr_t MultithreadBlockCompInStream::readBytes(char* toR, uintptr_t numR){
 			cUni->dumpToB = 0;
 			cUni->numDumpB = 0;
 		}
-		cUni->threadID = compThreads->addTask(multithreadBlockCompInDecompress, cUni);
+		cUni->threadID = compThreads->addTask(isHeld ? multithreadBlockCompInFill : multithreadBlockCompInDecompress, cUni);
 		leftR -= cUni->numDumpA;
 		nextR += cUni->numDumpA;
 		PREPARE_NEXT_JOB
@@ -656,6 +773,175 @@ uintptr_t MultithreadBlockCompInStream::readBytes(char* toR, uintptr_t numR){
 	return (numR - leftR);
 }
 
+void MultithreadBlockCompInStream::seek(uintptr_t toAddr){
+	leftoverA.clear();
+	leftoverB.clear();
+	leftover = &leftoverA;
+	nextLeftover = 0;
+	uintptr_t blockI = getBlockIndex(toAddr);
+	if(blockI >= numBlocks){
+		numReadBlocks = numBlocks;
+		return;
+	}
+	//decompress the target and the next few
+	if(blockCache){
+		std::vector<uintptr_t> winInds;
+		uintptr_t winEnd = std::min(numBlocks, blockI + readAhead + 1);
+		for(uintptr_t i = blockI; i<winEnd; i++){ winInds.push_back(i); }
+		prefetchBlocks(&(winInds[0]), winInds.size());
+	}
+	//get the target (if the cache is too small, need to do it here)
+	if(!(blockCache && blockCache->getBlock(blockI, &leftoverA))){
+		CompressionMethod* useComp = threadUnis[0].compMeth;
+		uintptr_t blockPostAddr = blockAnnot.postAddrs[blockI];
+		uintptr_t numPost = blockAnnot.postLens[blockI];
+		if(fseekPointer(mainF, blockPostAddr, SEEK_SET)){throw std::runtime_error("Problem seeking data file.");}
+		useComp->compData.resize(numPost);
+		if(fread(&(useComp->compData[0]), 1, numPost, mainF) != numPost){throw std::runtime_error("Problem reading data.");}
+		mainFAt = blockPostAddr + numPost;
+		useComp->decompressData();
+		leftoverA.insert(leftoverA.end(), useComp->theData.begin(), useComp->theData.end());
+	}
+	nextLeftover = toAddr - blockAnnot.preAddrs[blockI];
+	numReadBlocks = blockI + 1;
+}
+
+uintptr_t MultithreadBlockCompInStream::getUncompressedSize(){
+	return blockAnnot.getUncompressedSize();
+}
+
+uintptr_t MultithreadBlockCompInStream::getBlockIndex(uintptr_t toAddr){
+	return blockAnnot.findBlock(toAddr);
+}
+
+void MultithreadBlockCompInStream::prefetchBlocks(const uintptr_t* blockInds, uintptr_t numBlock){
+	if(blockCache == 0){ return; }
+	//only do each block once, and read the file in order
+	std::vector<uintptr_t> allInds(blockInds, blockInds + numBlock);
+	std::sort(allInds.begin(), allInds.end());
+	allInds.erase(std::unique(allInds.begin(), allInds.end()), allInds.end());
+	uintptr_t nextOpenI = 0;
+	uintptr_t nextHotI = 0;
+	for(uintptr_t i = 0; i<allInds.size(); i++){
+		uintptr_t blockI = allInds[i];
+		if(blockI >= numBlocks){ break; }
+		if(blockCache->hasBlock(blockI)){ continue; }
+		uintptr_t postAddr = blockAnnot.postAddrs[blockI];
+		uintptr_t numPost = blockAnnot.postLens[blockI];
+		if(numPost==0){ continue; }
+		MultithreadBlockCompInStreamUniform* cUni = &(threadUnis[nextOpenI]);
+		if((postAddr != mainFAt) && fseekPointer(mainF, postAddr, SEEK_SET)){throw std::runtime_error("Problem seeking data file.");}
+		cUni->compMeth->compData.resize(numPost);
+		if(fread(&(cUni->compMeth->compData[0]), 1, numPost, mainF) != numPost){throw std::runtime_error("Problem reading data.");}
+		mainFAt = postAddr + numPost;
+		cUni->blockInd = blockI;
+		cUni->saveTo = blockCache;
+		cUni->threadID = compThreads->addTask(multithreadBlockCompInPrefetch, cUni);
+		PREPARE_NEXT_JOB
+	}
+	while(nextHotI != nextOpenI){
+		compThreads->joinTask(threadUnis[nextHotI].threadID);
+		nextHotI = (nextHotI + 1) % threadUnis.size();
+	}
+}
+
+MappedRawBlockInStream::MappedRawBlockInStream(const char* mainFN, const char* annotFN){
+	blockAnnot.loadAnnotation(annotFN);
+	numBlocks = blockAnnot.numBlocks;
+	nextReadI = 0;
+	fileMap = mapFileForRead(mainFN);
+	if(fileMap == 0){ std::string errMess("Problem mapping file "); errMess.append(mainFN); throw std::runtime_error(errMess); }
+	mapData = getMappedFileData(fileMap);
+	uintptr_t mapSize = getMappedFileSize(fileMap);
+	//only checksummed raw blocks can be mapped
+	blockChecked.resize(numBlocks);
+	for(uintptr_t i = 0; i<numBlocks; i++){
+		uintptr_t blockSAddr = blockAnnot.postAddrs[i];
+		uintptr_t blockCLen = blockAnnot.postLens[i];
+		uintptr_t blockULen = blockAnnot.preLens[i];
+		if((blockSAddr > mapSize) || (blockCLen > (mapSize - blockSAddr))){
+			unmapFile(fileMap);
+			throw std::runtime_error("Block file truncated.");
+		}
+		if(!((blockCLen == (blockULen + 5)) && ((0x00FF & mapData[blockSAddr]) == BLOCKCOMP_TAG_RAWSUM))){
+			unmapFile(fileMap);
+			throw std::runtime_error("Only rawsum block files can be mapped.");
+		}
+		blockChecked[i] = false;
+	}
+}
+
+MappedRawBlockInStream::~MappedRawBlockInStream(){
+	unmapFile(fileMap);
+}
+
+int MappedRawBlockInStream::readByte(){
+	char toRet;
+	if(readBytes(&toRet, 1)){
+		return 0x00FF & toRet;
+	}
+	return -1;
+}
+
+uintptr_t MappedRawBlockInStream::readBytes(char* toR, uintptr_t numR){
+	uintptr_t numGot = 0;
+	while(numGot < numR){
+		uintptr_t blockI = blockAnnot.findBlock(nextReadI);
+		if(blockI >= numBlocks){ break; }
+		checkBlock(blockI);
+		uintptr_t blockOff = nextReadI - blockAnnot.preAddrs[blockI];
+		uintptr_t curCopy = std::min(blockAnnot.preLens[blockI] - blockOff, numR - numGot);
+		memcpy(toR + numGot, mapData + blockAnnot.postAddrs[blockI] + 5 + blockOff, curCopy);
+		numGot += curCopy;
+		nextReadI += curCopy;
+	}
+	return numGot;
+}
+
+void MappedRawBlockInStream::seek(uintptr_t toAddr){
+	nextReadI = toAddr;
+}
+
+uintptr_t MappedRawBlockInStream::getUncompressedSize(){
+	return blockAnnot.getUncompressedSize();
+}
+
+const char* MappedRawBlockInStream::getView(uintptr_t fromAddr, uintptr_t numBytes){
+	uintptr_t totSize = getUncompressedSize();
+	if((fromAddr > totSize) || (numBytes > (totSize - fromAddr))){ throw std::runtime_error("View past the end of the file."); }
+	if(numBytes == 0){ return mapData; }
+	uintptr_t blockI = blockAnnot.findBlock(fromAddr);
+	uintptr_t blockOff = fromAddr - blockAnnot.preAddrs[blockI];
+	checkBlock(blockI);
+	//all in one block: point right at it
+	if(numBytes <= (blockAnnot.preLens[blockI] - blockOff)){
+		return mapData + blockAnnot.postAddrs[blockI] + 5 + blockOff;
+	}
+	//stitch the pieces together (around the checksum headers)
+	uintptr_t blockE = blockAnnot.findBlock(fromAddr + numBytes - 1);
+	stitchBuff.resize(numBytes);
+	uintptr_t numCopy = 0;
+	for(uintptr_t i = blockI; i<=blockE; i++){
+		checkBlock(i);
+		uintptr_t curOff = (i == blockI) ? blockOff : 0;
+		uintptr_t curCopy = std::min(blockAnnot.preLens[i] - curOff, numBytes - numCopy);
+		memcpy(&(stitchBuff[numCopy]), mapData + blockAnnot.postAddrs[i] + 5 + curOff, curCopy);
+		numCopy += curCopy;
+	}
+	return &(stitchBuff[0]);
+}
+
+void MappedRawBlockInStream::checkBlock(uintptr_t blockI){
+	if(blockChecked[blockI]){ return; }
+	const char* blockDat = mapData + blockAnnot.postAddrs[blockI];
+	uintptr_t origLen = blockAnnot.preLens[blockI];
+	uLong wantSum = be2nat32(blockDat + 1);
+	uLong haveSum = crc32(0L, Z_NULL, 0);
+	if(origLen){ haveSum = crc32(haveSum, (const Bytef*)(blockDat + 5), origLen); }
+	if((haveSum & 0x0FFFFFFFFL) != wantSum){ throw std::runtime_error("Checksum mismatch in block data."); }
+	blockChecked[blockI] = true;
+}
+
 GZipOutStream::GZipOutStream(int append, const char* fileName){
 	myName = fileName;
 	if(append){
@@ -870,22 +1156,140 @@ CompressionMethod* RawCompressionMethod::clone(){
 
 GZipCompressionMethod::~GZipCompressionMethod(){}
 
-void GZipCompressionMethod::decompressData(){
-	uintptr_t curBuffLen = theData.capacity();
-	if(compData.size() > curBuffLen){ curBuffLen = compData.size(); }
+/**
+ * Decompress gzip data.
+ * @param compData The compressed data.
+ * @param theData The place to put the decompressed data.
+ */
+void blockCompDecompressGZip(std::vector<char>* compData, std::vector<char>* theData){
+	uintptr_t curBuffLen = theData->capacity();
+	if(compData->size() > curBuffLen){ curBuffLen = compData->size(); }
 	if(1024 > curBuffLen){ curBuffLen = 1024; }
-	theData.resize(curBuffLen);
+	theData->resize(curBuffLen);
 	unsigned long bufEndSStore = curBuffLen;
 	int compRes = 0;
-	while((compRes = uncompress(((unsigned char*)(&(theData[0]))), &bufEndSStore, ((const unsigned char*)(&(compData[0]))), compData.size())) != Z_OK){
+	while((compRes = uncompress(((unsigned char*)(&((*theData)[0]))), &bufEndSStore, ((const unsigned char*)(&((*compData)[0]))), compData->size())) != Z_OK){
 		if((compRes == Z_MEM_ERROR) || (compRes == Z_DATA_ERROR)){
 			throw std::runtime_error("Error decompressing gzip data.");
 		}
+		//deflate tops out near 1032 to 1: more than that is truncated data
+		if(curBuffLen > (1032*compData->size() + 1024)){
+			throw std::runtime_error("Error decompressing gzip data.");
+		}
 		curBuffLen = curBuffLen << 1;
-		theData.resize(curBuffLen);
+		theData->resize(curBuffLen);
 		bufEndSStore = curBuffLen;
 	}
-	theData.resize(bufEndSStore);
+	theData->resize(bufEndSStore);
+}
+
+/**
+ * Decompress fast lz data.
+ * @param compData The compressed data.
+ * @param theData The place to put the decompressed data.
+ */
+void blockCompDecompressFastLZ(std::vector<char>* compData, std::vector<char>* theData){
+	if((compData->size() < 9) || ((0x00FF & (*compData)[0]) != BLOCKCOMP_TAG_FASTLZ)){ throw std::runtime_error("Malformed fast lz data."); }
+	const unsigned char* curIn = (const unsigned char*)&((*compData)[0]) + 9;
+	const unsigned char* endIn = (const unsigned char*)&((*compData)[0]) + compData->size();
+	uintptr_t origLen = be2nat64(&((*compData)[1]));
+	//a byte of fast lz data cannot stand for more than 255 bytes
+	if((origLen / 255) > compData->size()){ throw std::runtime_error("Malformed fast lz data."); }
+	theData->resize(origLen);
+	char* outBase = origLen ? &((*theData)[0]) : 0;
+	uintptr_t outI = 0;
+	#define FASTLZ_READ_EXTLEN(toLen) \
+		if(toLen == 15){\
+			unsigned char curExt;\
+			do{\
+				if(curIn >= endIn){ throw std::runtime_error("Truncated fast lz data."); }\
+				curExt = *curIn;\
+				curIn++;\
+				toLen += curExt;\
+			}while(curExt == 255);\
+		}
+	while(true){
+		if(curIn >= endIn){ throw std::runtime_error("Truncated fast lz data."); }
+		unsigned char curTok = *curIn;
+		curIn++;
+		//literals
+		uintptr_t litLen = curTok >> 4;
+		FASTLZ_READ_EXTLEN(litLen)
+		if((litLen > (uintptr_t)(endIn - curIn)) || (litLen > (origLen - outI))){ throw std::runtime_error("Malformed fast lz data."); }
+		memcpy(outBase + outI, curIn, litLen);
+		curIn += litLen;
+		outI += litLen;
+		if(curIn == endIn){ break; }
+		//match
+		if((endIn - curIn) < 2){ throw std::runtime_error("Truncated fast lz data."); }
+		uintptr_t matchOff = curIn[0] + (((uintptr_t)curIn[1]) << 8);
+		curIn += 2;
+		uintptr_t matchLen = curTok & 0x0F;
+		FASTLZ_READ_EXTLEN(matchLen)
+		matchLen += FASTLZ_MIN_MATCH;
+		if((matchOff == 0) || (matchOff > outI) || (matchLen > (origLen - outI))){ throw std::runtime_error("Malformed fast lz data."); }
+		char* matchTo = outBase + outI;
+		const char* matchFrom = matchTo - matchOff;
+		if(matchOff >= matchLen){
+			memcpy(matchTo, matchFrom, matchLen);
+		}
+		else{
+			for(uintptr_t i = 0; i<matchLen; i++){ matchTo[i] = matchFrom[i]; }
+		}
+		outI += matchLen;
+	}
+	if(outI != origLen){ throw std::runtime_error("Malformed fast lz data."); }
+}
+
+/**
+ * Unpack checksummed raw data.
+ * @param compData The compressed data.
+ * @param theData The place to put the decompressed data.
+ */
+void blockCompDecompressRawSum(std::vector<char>* compData, std::vector<char>* theData){
+	if((compData->size() < 5) || ((0x00FF & (*compData)[0]) != BLOCKCOMP_TAG_RAWSUM)){ throw std::runtime_error("Malformed checksummed data."); }
+	uintptr_t origLen = compData->size() - 5;
+	uLong wantSum = be2nat32(&((*compData)[1]));
+	uLong haveSum = crc32(0L, Z_NULL, 0);
+	if(origLen){ haveSum = crc32(haveSum, (const Bytef*)&((*compData)[5]), origLen); }
+	if((haveSum & 0x0FFFFFFFFL) != wantSum){ throw std::runtime_error("Checksum mismatch in block data."); }
+	theData->clear();
+	theData->insert(theData->end(), compData->begin() + 5, compData->end());
+}
+
+/**
+ * Pack data as checksummed raw.
+ * @param theData The data to pack.
+ * @param compData The place to put the packed data.
+ */
+void blockCompCompressRawSum(std::vector<char>* theData, std::vector<char>* compData){
+	uLong haveSum = crc32(0L, Z_NULL, 0);
+	if(theData->size()){ haveSum = crc32(haveSum, (const Bytef*)&((*theData)[0]), theData->size()); }
+	char headBuff[5];
+	headBuff[0] = BLOCKCOMP_TAG_RAWSUM;
+	nat2be32(haveSum & 0x0FFFFFFFFL, headBuff + 1);
+	compData->clear();
+	compData->reserve(theData->size() + 5);
+	compData->insert(compData->end(), headBuff, headBuff + 5);
+	compData->insert(compData->end(), theData->begin(), theData->end());
+}
+
+void blockCompDecompressAny(std::vector<char>* compData, std::vector<char>* theData){
+	int compTag = compData->size() ? (0x00FF & (*compData)[0]) : 0;
+	switch(compTag){
+		case BLOCKCOMP_TAG_FASTLZ:
+			blockCompDecompressFastLZ(compData, theData);
+			break;
+		case BLOCKCOMP_TAG_RAWSUM:
+			blockCompDecompressRawSum(compData, theData);
+			break;
+		default:
+			blockCompDecompressGZip(compData, theData);
+	}
+}
+
+void GZipCompressionMethod::decompressData(){
+	blockCompDecompressAny(&compData, &theData);
 }
 
 void GZipCompressionMethod::compressData(){
@@ -913,3 +1317,97 @@ CompressionMethod* GZipCompressionMethod::clone(){
 	return toRet;
 }
 
+
+FastLZCompressionMethod::~FastLZCompressionMethod(){}
+
+void FastLZCompressionMethod::decompressData(){
+	blockCompDecompressAny(&compData, &theData);
+}
+
+void FastLZCompressionMethod::compressData(){
+	uintptr_t srcLen = theData.size();
+	const unsigned char* srcD = (const unsigned char*)(srcLen ? &(theData[0]) : 0);
+	compData.clear();
+	compData.reserve(srcLen + (srcLen / 255) + 16);
+	compData.push_back(BLOCKCOMP_TAG_FASTLZ);
+	char lenBuff[8];
+	nat2be64(srcLen, lenBuff);
+	compData.insert(compData.end(), lenBuff, lenBuff + 8);
+	//lengths past 14 spill into extra bytes
+	#define FASTLZ_WRITE_EXTLEN(curLen) \
+		if(curLen >= 15){\
+			uintptr_t leftLen = curLen - 15;\
+			while(leftLen >= 255){ compData.push_back((char)255); leftLen -= 255; }\
+			compData.push_back((char)leftLen);\
+		}
+	#define FASTLZ_LOAD32(fromLoc) (((uint32_t)srcD[fromLoc]) | (((uint32_t)srcD[fromLoc+1])<<8) | (((uint32_t)srcD[fromLoc+2])<<16) | (((uint32_t)srcD[fromLoc+3])<<24))
+	hashTable.clear();
+	hashTable.resize(1 << FASTLZ_HASH_BITS, (uintptr_t)-1);
+	uintptr_t litStart = 0;
+	uintptr_t curI = 0;
+	while((curI + FASTLZ_MIN_MATCH) <= srcLen){
+		uint32_t curSeq = FASTLZ_LOAD32(curI);
+		uint32_t curHash = (uint32_t)(curSeq * 2654435761U) >> (32 - FASTLZ_HASH_BITS);
+		uintptr_t candI = hashTable[curHash];
+		hashTable[curHash] = curI;
+		if((candI == (uintptr_t)-1) || ((curI - candI) > FASTLZ_MAX_OFFSET) || (FASTLZ_LOAD32(candI) != curSeq)){
+			//skip faster through data that is not matching
+			curI += 1 + ((curI - litStart) >> 6);
+			continue;
+		}
+		uintptr_t matchLen = FASTLZ_MIN_MATCH;
+		while(((curI + matchLen) < srcLen) && (srcD[candI + matchLen] == srcD[curI + matchLen])){ matchLen++; }
+		//token, literals, offset, match
+		uintptr_t litLen = curI - litStart;
+		uintptr_t extMatch = matchLen - FASTLZ_MIN_MATCH;
+		compData.push_back((char)((std::min(litLen, (uintptr_t)15) << 4) | std::min(extMatch, (uintptr_t)15)));
+		FASTLZ_WRITE_EXTLEN(litLen)
+		compData.insert(compData.end(), theData.begin() + litStart, theData.begin() + curI);
+		uintptr_t matchOff = curI - candI;
+		compData.push_back((char)(matchOff & 0x00FF));
+		compData.push_back((char)(matchOff >> 8));
+		FASTLZ_WRITE_EXTLEN(extMatch)
+		curI += matchLen;
+		litStart = curI;
+	}
+	//the last bit is all literals
+	uintptr_t litLen = srcLen - litStart;
+	compData.push_back((char)(std::min(litLen, (uintptr_t)15) << 4));
+	FASTLZ_WRITE_EXTLEN(litLen)
+	compData.insert(compData.end(), theData.begin() + litStart, theData.end());
+	//data that does not shrink is better off stored
+	if(compData.size() > (theData.size() + 5)){
+		blockCompCompressRawSum(&theData, &compData);
+	}
+}
+
+CompressionMethod* FastLZCompressionMethod::clone(){
+	FastLZCompressionMethod* toRet = new FastLZCompressionMethod();
+	toRet->theData = theData;
+	toRet->compData = compData;
+	return toRet;
+}
+
+RawSumCompressionMethod::~RawSumCompressionMethod(){}
+
+void RawSumCompressionMethod::decompressData(){
+	blockCompDecompressAny(&compData, &theData);
+}
+
+void RawSumCompressionMethod::compressData(){
+	blockCompCompressRawSum(&theData, &compData);
+}
+
+CompressionMethod* RawSumCompressionMethod::clone(){
+	RawSumCompressionMethod* toRet = new RawSumCompressionMethod();
+	toRet->theData = theData;
+	toRet->compData = compData;
+	return toRet;
+}
+
+CompressionMethod* makeNamedCompressionMethod(const char* methName){
+	if(strcmp(methName, "gzip") == 0){ return new GZipCompressionMethod(); }
+	if(strcmp(methName, "fastlz") == 0){ return new FastLZCompressionMethod(); }
+	if(strcmp(methName, "rawsum") == 0){ return new RawSumCompressionMethod(); }
+	return 0;
+}
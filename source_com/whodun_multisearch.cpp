@@ -0,0 +1,84 @@
+#include "whodun_multisearch.h"
+
+#include <stdexcept>
+
+AhoCorasickAutomaton::AhoCorasickAutomaton(uintptr_t numPattern, const std::pair<const char*,uintptr_t>* patterns){
+	//figure out the alphabet
+		bool charSeen[256];
+		for(int i = 0; i<256; i++){ charSeen[i] = false; }
+		uintptr_t totalLen = 0;
+		for(uintptr_t i = 0; i<numPattern; i++){
+			for(uintptr_t j = 0; j<patterns[i].second; j++){ charSeen[0x00FF & patterns[i].first[j]] = true; }
+			totalLen += patterns[i].second;
+		}
+		if(totalLen >= AHOCORASICK_NO_STATE){ throw std::runtime_error("Too many characters for an automaton."); }
+		numCode = 1;
+		for(int i = 0; i<256; i++){
+			charCodes[i] = 0;
+			if(charSeen[i]){
+				charCodes[i] = numCode;
+				numCode++;
+			}
+		}
+	//build the trie
+		transitions.resize(numCode, AHOCORASICK_NO_STATE);
+		stateDepths.push_back(0);
+		std::vector<uint32_t> patternEnds(numPattern);
+		for(uintptr_t i = 0; i<numPattern; i++){
+			uint32_t curState = 0;
+			for(uintptr_t j = 0; j<patterns[i].second; j++){
+				uint32_t* nextS = &(transitions[curState*numCode + charCodes[0x00FF & patterns[i].first[j]]]);
+				if(*nextS == AHOCORASICK_NO_STATE){
+					*nextS = stateDepths.size();
+					stateDepths.push_back(j+1);
+					transitions.resize(transitions.size() + numCode, AHOCORASICK_NO_STATE);
+				}
+				curState = transitions[curState*numCode + charCodes[0x00FF & patterns[i].first[j]]];
+			}
+			patternEnds[i] = curState;
+		}
+		uintptr_t numState = stateDepths.size();
+	//note what ends where (the root ends nothing)
+		outStarts.resize(numState+1);
+		for(uintptr_t i = 0; i<numPattern; i++){
+			if(patternEnds[i]){ outStarts[patternEnds[i]+1]++; }
+		}
+		for(uintptr_t i = 0; i<numState; i++){ outStarts[i+1] += outStarts[i]; }
+		outPatterns.resize(outStarts[numState]);
+		{
+			std::vector<uintptr_t> fillAt(outStarts.begin(), outStarts.end() - 1);
+			for(uintptr_t i = 0; i<numPattern; i++){
+				if(patternEnds[i]){
+					outPatterns[fillAt[patternEnds[i]]] = i;
+					fillAt[patternEnds[i]]++;
+				}
+			}
+		}
+	//run down the trie breadth first, filling in failures
+		std::vector<uint32_t> failLinks(numState, 0);
+		dictLinks.resize(numState, AHOCORASICK_NO_STATE);
+		std::vector<uint32_t> stateQueue;
+		for(uintptr_t c = 0; c<numCode; c++){
+			uint32_t* nextS = &(transitions[c]);
+			if(*nextS == AHOCORASICK_NO_STATE){ *nextS = 0; }
+			else{ stateQueue.push_back(*nextS); }
+		}
+		for(uintptr_t qi = 0; qi<stateQueue.size(); qi++){
+			uint32_t curState = stateQueue[qi];
+			uint32_t curFail = failLinks[curState];
+			for(uintptr_t c = 0; c<numCode; c++){
+				uint32_t* nextS = &(transitions[curState*numCode + c]);
+				uint32_t failNext = transitions[curFail*numCode + c];
+				if(*nextS == AHOCORASICK_NO_STATE){
+					*nextS = failNext;
+				}
+				else{
+					failLinks[*nextS] = failNext;
+					dictLinks[*nextS] = (outStarts[failNext] != outStarts[failNext+1]) ? failNext : dictLinks[failNext];
+					stateQueue.push_back(*nextS);
+				}
+			}
+		}
+}
+
+AhoCorasickAutomaton::~AhoCorasickAutomaton(){}
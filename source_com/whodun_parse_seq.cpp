@@ -245,11 +245,10 @@ void FastAQSequenceWriter::writeNextEntry(){
 	}
 }
 
-#define GAIL_INDEX_ENTLEN 40
-
 GailAQSequenceReader::GailAQSequenceReader(BlockCompInStream* toFlit, const char* indFName){
 	theStr = toFlit;
 	theStrMT = 0;
+	theStrMap = 0;
 	resetInd = -1;
 	focusInd = 0;
 	intptr_t annotLen = getFileSize(indFName);
@@ -263,6 +262,21 @@ GailAQSequenceReader::GailAQSequenceReader(BlockCompInStream* toFlit, const char
 GailAQSequenceReader::GailAQSequenceReader(MultithreadBlockCompInStream* toFlit, const char* indFName){
 	theStr = 0;
 	theStrMT = toFlit;
+	theStrMap = 0;
+	resetInd = -1;
+	focusInd = 0;
+	intptr_t annotLen = getFileSize(indFName);
+	if(annotLen < 0){throw std::runtime_error("Problem examining index file.");}
+	if(annotLen % GAIL_INDEX_ENTLEN){throw std::runtime_error("Malformed index file.");}
+	numEntries = annotLen / GAIL_INDEX_ENTLEN;
+	indF = fopen(indFName, "rb");
+	if(indF == 0){ throw std::runtime_error("Could not open index file."); }
+}
+
+GailAQSequenceReader::GailAQSequenceReader(MappedRawBlockInStream* toFlit, const char* indFName){
+	theStr = 0;
+	theStrMT = 0;
+	theStrMap = toFlit;
 	resetInd = -1;
 	focusInd = 0;
 	intptr_t annotLen = getFileSize(indFName);
@@ -298,20 +312,28 @@ int GailAQSequenceReader::readNextEntry(){
 	uintptr_t qualLoc = be2nat64(loadBuff+24);
 	uintptr_t haveQual = be2nat64(loadBuff+32);
 	if(wasSeek){
-		theStr->seek(nameLoc);
+		seekStream(nameLoc);
 	}
 	InStream* focStr = theStr;
 		if(!focStr){ focStr = theStrMT; }
+		if(!focStr){ focStr = theStrMap; }
 	nameStore.resize(seqLoc - nameLoc);
 		if(focStr->readBytes(&(nameStore[0]), nameStore.size()) != nameStore.size()){ throw std::runtime_error("Problem reading sequence name."); }
 		lastReadShortNameLen = shortNameLen;
 		if(shortNameLen > nameStore.size()){ throw std::runtime_error("Short name longer than full name."); }
 		lastReadNameLen = nameStore.size();
 		lastReadName = &(nameStore[0]);
-	seqStore.resize(qualLoc - seqLoc);
+	if(theStrMap){
+		lastReadSeqLen = qualLoc - seqLoc;
+		lastReadSeq = theStrMap->getView(seqLoc, lastReadSeqLen);
+		theStrMap->seek(qualLoc);
+	}
+	else{
+		seqStore.resize(qualLoc - seqLoc);
 		if(focStr->readBytes(&(seqStore[0]), seqStore.size()) != seqStore.size()){ throw std::runtime_error("Problem reading sequence."); }
 		lastReadSeqLen = seqStore.size();
 		lastReadSeq = &(seqStore[0]);
+	}
 	lastReadHaveQual = haveQual;
 	if(haveQual){
 		tmpQualS.resize(qualLoc - seqLoc);
@@ -332,7 +354,6 @@ uintptr_t GailAQSequenceReader::getNumEntries(){
 }
 
 uintptr_t GailAQSequenceReader::getEntryLength(uintptr_t entInd){
-	if(!theStr){ throw std::runtime_error("If using a multithreaded gail reader, cannot random access."); }
 	if(entInd >= numEntries){ throw std::runtime_error("Bad entry index."); }
 	resetInd = focusInd;
 	if(fseekPointer(indF, GAIL_INDEX_ENTLEN*entInd, SEEK_SET)){ throw std::runtime_error("Problem seeking index file."); }
@@ -347,7 +368,6 @@ uintptr_t GailAQSequenceReader::getEntryLength(uintptr_t entInd){
 }
 
 void GailAQSequenceReader::getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase){
-	if(!theStr){ throw std::runtime_error("If using a multithreaded gail reader, cannot random access."); }
 	if(entInd >= numEntries){ throw std::runtime_error("Bad entry index."); }
 	resetInd = focusInd;
 	if(fseekPointer(indF, GAIL_INDEX_ENTLEN*entInd, SEEK_SET)){ throw std::runtime_error("Problem seeking index file."); }
@@ -358,27 +378,36 @@ void GailAQSequenceReader::getEntrySubsequence(uintptr_t entInd, uintptr_t fromB
 	uintptr_t seqLoc = be2nat64(loadBuff+16);
 	uintptr_t qualLoc = be2nat64(loadBuff+24);
 	uintptr_t haveQual = be2nat64(loadBuff+32);
+	InStream* focStr = theStr;
+		if(!focStr){ focStr = theStrMT; }
+		if(!focStr){ focStr = theStrMap; }
 	if((toBase < fromBase) || (fromBase > (qualLoc - seqLoc))){ throw std::runtime_error("Invalid sequence range."); }
 	//read the name
-	theStr->seek(nameLoc);
+	seekStream(nameLoc);
 		nameStore.resize(seqLoc - nameLoc);
-		if(theStr->readBytes(&(nameStore[0]), nameStore.size()) != nameStore.size()){ throw std::runtime_error("Problem reading sequence name."); }
+		if(focStr->readBytes(&(nameStore[0]), nameStore.size()) != nameStore.size()){ throw std::runtime_error("Problem reading sequence name."); }
 		lastReadShortNameLen = shortNameLen;
 		if(shortNameLen > nameStore.size()){ throw std::runtime_error("Short name longer than full name."); }
 		lastReadNameLen = nameStore.size();
 		lastReadName = &(nameStore[0]);
 	//sequence
-	theStr->seek(seqLoc + fromBase);
+	if(theStrMap){
+		lastReadSeqLen = toBase - fromBase;
+		lastReadSeq = theStrMap->getView(seqLoc + fromBase, lastReadSeqLen);
+	}
+	else{
+		seekStream(seqLoc + fromBase);
 		seqStore.resize(toBase - fromBase);
-		if(theStr->readBytes(&(seqStore[0]), seqStore.size()) != seqStore.size()){ throw std::runtime_error("Problem reading sequence."); }
+		if(focStr->readBytes(&(seqStore[0]), seqStore.size()) != seqStore.size()){ throw std::runtime_error("Problem reading sequence."); }
 		lastReadSeqLen = seqStore.size();
 		lastReadSeq = &(seqStore[0]);
+	}
 	//quality
 	lastReadHaveQual = haveQual;
 	if(haveQual){
-		theStr->seek(qualLoc + fromBase);
+		seekStream(qualLoc + fromBase);
 			tmpQualS.resize(toBase - fromBase);
-			if(theStr->readBytes((char*)&(tmpQualS[0]), tmpQualS.size()) != tmpQualS.size()){ throw std::runtime_error("Problem reading quality."); }
+			if(focStr->readBytes((char*)&(tmpQualS[0]), tmpQualS.size()) != tmpQualS.size()){ throw std::runtime_error("Problem reading quality."); }
 			qualStore.resize(tmpQualS.size());
 			fastaPhredsToLog10Prob(tmpQualS.size(), &(tmpQualS[0]), &(qualStore[0]));
 			lastReadQual = &(qualStore[0]);
@@ -388,6 +417,47 @@ void GailAQSequenceReader::getEntrySubsequence(uintptr_t entInd, uintptr_t fromB
 	}
 }
 
+void GailAQSequenceReader::prefetchEntrySubsequences(uintptr_t numGet, const uintptr_t* entInds, const uintptr_t* fromBases, const uintptr_t* toBases){
+	if(!theStrMT){ return; }
+	resetInd = focusInd;
+	std::vector<uintptr_t> needBlocks;
+	for(uintptr_t i = 0; i<numGet; i++){
+		if(entInds[i] >= numEntries){ throw std::runtime_error("Bad entry index."); }
+		if(fseekPointer(indF, GAIL_INDEX_ENTLEN*entInds[i], SEEK_SET)){ throw std::runtime_error("Problem seeking index file."); }
+		char loadBuff[GAIL_INDEX_ENTLEN];
+		if(fread(loadBuff, 1, GAIL_INDEX_ENTLEN, indF)!=GAIL_INDEX_ENTLEN){ throw std::runtime_error("Problem reading index file."); }
+		uintptr_t nameLoc = be2nat64(loadBuff);
+		uintptr_t seqLoc = be2nat64(loadBuff+16);
+		uintptr_t qualLoc = be2nat64(loadBuff+24);
+		uintptr_t haveQual = be2nat64(loadBuff+32);
+		//name, sequence and quality ranges
+		uintptr_t rangeLo[3] = {nameLoc, seqLoc + fromBases[i], qualLoc + fromBases[i]};
+		uintptr_t rangeHi[3] = {seqLoc, seqLoc + toBases[i], qualLoc + toBases[i]};
+		int numRange = haveQual ? 3 : 2;
+		for(int j = 0; j<numRange; j++){
+			if(rangeHi[j] <= rangeLo[j]){ continue; }
+			uintptr_t blockLo = theStrMT->getBlockIndex(rangeLo[j]);
+			uintptr_t blockHi = theStrMT->getBlockIndex(rangeHi[j] - 1);
+			for(uintptr_t k = blockLo; (k <= blockHi) && (k < theStrMT->numBlocks); k++){
+				needBlocks.push_back(k);
+			}
+		}
+	}
+	theStrMT->prefetchBlocks(needBlocks.size() ? &(needBlocks[0]) : (uintptr_t*)0, needBlocks.size());
+}
+
+void GailAQSequenceReader::seekStream(uintptr_t toAddr){
+	if(theStr){
+		theStr->seek(toAddr);
+	}
+	else if(theStrMT){
+		theStrMT->seek(toAddr);
+	}
+	else{
+		theStrMap->seek(toAddr);
+	}
+}
+
 GailAQSequenceWriter::GailAQSequenceWriter(int append, BlockCompOutStream* toFlit, const char* indFName){
 	theStr = toFlit;
 	intptr_t annotLen = getFileSize(indFName);
@@ -698,7 +698,7 @@ void outOfMemoryMergesort(InStream* startF, const char* tempFolderName, OutStrea
 			usePool = new ThreadPool(opts->numThread);
 		}
 	//sort in chunks
-		GZipCompressionMethod baseComp;
+		FastLZCompressionMethod baseComp;
 		SortOptions subOpts = *opts;
 			subOpts.usePool = usePool;
 		uintptr_t numOutBase = 0;
@@ -731,7 +731,7 @@ void outOfMemoryMergesort(InStream* startF, const char* tempFolderName, OutStrea
 				//open up the current crop of files
 				uintptr_t cnumTask = 1;
 				uintptr_t cbuffSize = MULTMERGE_BUFF_SIZE;
-				std::vector<GZipCompressionMethod> subComps; subComps.resize(nextI - baseI);
+				std::vector<FastLZCompressionMethod> subComps; subComps.resize(nextI - baseI);
 				std::vector<InStream*> saveFiles;
 				std::vector<MultimergeNode*> allMerge;
 				for(uintptr_t i = baseI; i<nextI; i++){
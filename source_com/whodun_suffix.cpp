@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <iostream>
+#include <vector>
 #include <algorithm>
 
 #include "whodun_stringext.h"
@@ -64,6 +65,153 @@ void buildSuffixArray(const char* onData, uintptr_t* sortStore){
 	free(allSuffs);
 }
 
+//many thanks to Nong, Zhang and Chan, "Two Efficient Algorithms for Linear Time Suffix Array Construction"
+
+/**Get whether a character is an S type.*/
+#define SAIS_TGET(i) ((sTypes[(i)>>3] >> ((i)&7)) & 1)
+/**Set whether a character is an S type.*/
+#define SAIS_TSET(i, b) if(b){ sTypes[(i)>>3] |= (1<<((i)&7)); } else{ sTypes[(i)>>3] &= ~(1<<((i)&7)); }
+/**Get whether a character is the start of an S run.*/
+#define SAIS_ISLMS(i) (((i) > 0) && SAIS_TGET(i) && !SAIS_TGET((i)-1))
+
+/**
+ * Figure out where each character's bucket is.
+ * @param onData The characters.
+ * @param numChar The number of characters.
+ * @param maxChar The largest character value.
+ * @param bucketStore The place to put the bucket locations.
+ * @param atEnd Whether to get the ends (or the starts) of the buckets.
+ */
+template <typename CT>
+void buildSuffixArrayInducedBuckets(const CT* onData, uint32_t numChar, uint32_t maxChar, uint32_t* bucketStore, bool atEnd){
+	for(uint32_t i = 0; i<=maxChar; i++){ bucketStore[i] = 0; }
+	for(uint32_t i = 0; i<numChar; i++){ bucketStore[onData[i]]++; }
+	uint32_t curSum = 0;
+	for(uint32_t i = 0; i<=maxChar; i++){
+		curSum += bucketStore[i];
+		bucketStore[i] = atEnd ? curSum : (curSum - bucketStore[i]);
+	}
+}
+
+/**
+ * Induce the order of L and S suffixes from the placed ones.
+ * @param onData The characters.
+ * @param sTypes The type of each character.
+ * @param numChar The number of characters.
+ * @param maxChar The largest character value.
+ * @param bucketStore Storage for the bucket locations.
+ * @param sortStore The partially sorted suffixes.
+ */
+template <typename CT>
+void buildSuffixArrayInducedSort(const CT* onData, const unsigned char* sTypes, uint32_t numChar, uint32_t maxChar, uint32_t* bucketStore, uint32_t* sortStore){
+	buildSuffixArrayInducedBuckets(onData, numChar, maxChar, bucketStore, false);
+	for(uint32_t i = 0; i<numChar; i++){
+		uint32_t curS = sortStore[i];
+		if((curS == SUFFIX_INDUCED_EMPTY) || (curS == 0)){ continue; }
+		uint32_t j = curS - 1;
+		if(!SAIS_TGET(j)){ sortStore[bucketStore[onData[j]]++] = j; }
+	}
+	buildSuffixArrayInducedBuckets(onData, numChar, maxChar, bucketStore, true);
+	for(uint32_t i = numChar; i>0; i--){
+		uint32_t curS = sortStore[i-1];
+		if((curS == SUFFIX_INDUCED_EMPTY) || (curS == 0)){ continue; }
+		uint32_t j = curS - 1;
+		if(SAIS_TGET(j)){ sortStore[--(bucketStore[onData[j]])] = j; }
+	}
+}
+
+/**
+ * Actually build the suffix array.
+ * @param onData The characters: the last must be zero, and the only zero.
+ * @param sortStore The place to put the suffix array.
+ * @param numChar The number of characters.
+ * @param maxChar The largest character value.
+ */
+template <typename CT>
+void buildSuffixArrayInducedLevel(const CT* onData, uint32_t* sortStore, uint32_t numChar, uint32_t maxChar){
+	if(numChar == 1){
+		sortStore[0] = 0;
+		return;
+	}
+	std::vector<unsigned char> sTypeStore((numChar >> 3) + 1);
+	unsigned char* sTypes = &(sTypeStore[0]);
+	std::vector<uint32_t> bucketStore(((uintptr_t)maxChar) + 1);
+	uint32_t* buckets = &(bucketStore[0]);
+	//classify the characters
+		SAIS_TSET(numChar-1, 1)
+		SAIS_TSET(numChar-2, 0)
+		for(uint32_t i = numChar-2; i>0; i--){
+			uint32_t ci = i-1;
+			bool isS = (onData[ci] < onData[ci+1]) || ((onData[ci] == onData[ci+1]) && SAIS_TGET(ci+1));
+			SAIS_TSET(ci, isS)
+		}
+	//sort the LMS substrings
+		buildSuffixArrayInducedBuckets(onData, numChar, maxChar, buckets, true);
+		for(uint32_t i = 0; i<numChar; i++){ sortStore[i] = SUFFIX_INDUCED_EMPTY; }
+		for(uint32_t i = 1; i<numChar; i++){
+			if(SAIS_ISLMS(i)){ sortStore[--(buckets[onData[i]])] = i; }
+		}
+		buildSuffixArrayInducedSort(onData, sTypes, numChar, maxChar, buckets, sortStore);
+	//pack the sorted LMS substrings to the front
+		uint32_t numLMS = 0;
+		for(uint32_t i = 0; i<numChar; i++){
+			if(SAIS_ISLMS(sortStore[i])){ sortStore[numLMS++] = sortStore[i]; }
+		}
+	//name the LMS substrings
+		for(uint32_t i = numLMS; i<numChar; i++){ sortStore[i] = SUFFIX_INDUCED_EMPTY; }
+		uint32_t numName = 0;
+		uint32_t prevLMS = SUFFIX_INDUCED_EMPTY;
+		for(uint32_t i = 0; i<numLMS; i++){
+			uint32_t curLMS = sortStore[i];
+			bool isDiff = false;
+			for(uint32_t d = 0; d<numChar; d++){
+				if((prevLMS == SUFFIX_INDUCED_EMPTY) || (onData[curLMS+d] != onData[prevLMS+d]) || (SAIS_TGET(curLMS+d) != SAIS_TGET(prevLMS+d))){
+					isDiff = true;
+					break;
+				}
+				else if(d && (SAIS_ISLMS(curLMS+d) || SAIS_ISLMS(prevLMS+d))){
+					break;
+				}
+			}
+			if(isDiff){
+				numName++;
+				prevLMS = curLMS;
+			}
+			sortStore[numLMS + (curLMS >> 1)] = numName - 1;
+		}
+		uint32_t packI = numChar;
+		for(uint32_t i = numChar; i>numLMS; i--){
+			if(sortStore[i-1] != SUFFIX_INDUCED_EMPTY){ sortStore[--packI] = sortStore[i-1]; }
+		}
+	//sort the reduced problem
+		uint32_t* subSort = sortStore;
+		uint32_t* subData = sortStore + numChar - numLMS;
+		if(numName < numLMS){
+			buildSuffixArrayInducedLevel(subData, subSort, numLMS, numName-1);
+		}
+		else{
+			for(uint32_t i = 0; i<numLMS; i++){ subSort[subData[i]] = i; }
+		}
+	//induce the full thing from the sorted LMS suffixes
+		buildSuffixArrayInducedBuckets(onData, numChar, maxChar, buckets, true);
+		uint32_t curLMSI = 0;
+		for(uint32_t i = 1; i<numChar; i++){
+			if(SAIS_ISLMS(i)){ subData[curLMSI++] = i; }
+		}
+		for(uint32_t i = 0; i<numLMS; i++){ subSort[i] = subData[subSort[i]]; }
+		for(uint32_t i = numLMS; i<numChar; i++){ sortStore[i] = SUFFIX_INDUCED_EMPTY; }
+		for(uint32_t i = numLMS; i>0; i--){
+			uint32_t curLMS = sortStore[i-1];
+			sortStore[i-1] = SUFFIX_INDUCED_EMPTY;
+			sortStore[--(buckets[onData[curLMS]])] = curLMS;
+		}
+		buildSuffixArrayInducedSort(onData, sTypes, numChar, maxChar, buckets, sortStore);
+}
+
+void buildSuffixArrayInduced(uint32_t numChar, const unsigned char* onData, uint32_t* sortStore){
+	buildSuffixArrayInducedLevel(onData, sortStore, numChar, 255);
+}
+
 uintptr_t suffixArrayLowerBound(const char* toFind, const char* onData, uintptr_t* sortStore, uintptr_t numInSort){
 	uintptr_t findLen = strlen(toFind);
 	uintptr_t lowInd = 0;
@@ -235,3 +383,7 @@ uintptr_t multiSuffixArrayUpperBound(const char* toFind, int numStrings, const c
 	return lowInd;
 }
 
+bool MultiStringSuffixPackedSortOption_compMeth(void* unif, void* itemA, void* itemB){
+	PackedSuffixSortKey* useKey = (PackedSuffixSortKey*)unif;
+	return memcmp(((char*)itemA) + useKey->keyOffset, ((char*)itemB) + useKey->keyOffset, useKey->keyLength) < 0;
+}
@@ -3,14 +3,17 @@
 
 #include <vector>
 #include <stdio.h>
+#include <errno.h>
 #include <iostream>
 #include <string.h>
 #include <stdlib.h>
 
+#include <fcntl.h>
 #include <dlfcn.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -154,6 +157,42 @@ void unloadDLL(void* toKill){
 	free(toRet);
 }
 
+typedef struct{
+	void* mapData;
+	uintptr_t mapSize;
+} FileMapStruct;
+
+void* mapFileForRead(const char* fileName){
+	int fileD = open(fileName, O_RDONLY);
+	if(fileD < 0){ return 0; }
+	struct stat fileSt;
+	if(fstat(fileD, &fileSt)){ close(fileD); return 0; }
+	void* mapData = 0;
+	if(fileSt.st_size){
+		mapData = mmap(0, fileSt.st_size, PROT_READ, MAP_SHARED, fileD, 0);
+		if(mapData == MAP_FAILED){ close(fileD); return 0; }
+	}
+	close(fileD);
+	FileMapStruct* toRet = (FileMapStruct*)malloc(sizeof(FileMapStruct));
+	toRet->mapData = mapData;
+	toRet->mapSize = fileSt.st_size;
+	return toRet;
+}
+
+const char* getMappedFileData(void* fromMap){
+	return (const char*)(((FileMapStruct*)fromMap)->mapData);
+}
+
+uintptr_t getMappedFileSize(void* fromMap){
+	return ((FileMapStruct*)fromMap)->mapSize;
+}
+
+void unmapFile(void* toKill){
+	FileMapStruct* toRet = (FileMapStruct*)toKill;
+	if(toRet->mapData){ munmap(toRet->mapData, toRet->mapSize); }
+	free(toRet);
+}
+
 bool directoryExists(const char* dirName){
 	struct stat dirFo;
 	if((stat(dirName, &dirFo)==0) && (S_ISDIR(dirFo.st_mode))){
@@ -203,3 +242,18 @@ uintptr_t* openDirectory(const char* dirName){
 void closeDirectory(uintptr_t* theDir){
 	free(theDir);
 }
+
+char* getWorkingDirectory(){
+	uintptr_t buffLen = 256;
+	while(true){
+		char* toRet = (char*)malloc(buffLen);
+		if(getcwd(toRet, buffLen)){ return toRet; }
+		free(toRet);
+		if(errno != ERANGE){ return 0; }
+		buffLen = buffLen << 1;
+	}
+}
+
+bool pathIsAbsolute(const char* pathName){
+	return pathName[0] == '/';
+}
@@ -152,6 +152,50 @@ void unloadDLL(void* toKill){
 	free(toRet);
 }
 
+typedef struct{
+	HANDLE fileH;
+	HANDLE mapH;
+	void* mapData;
+	uintptr_t mapSize;
+} FileMapStruct;
+
+void* mapFileForRead(const char* fileName){
+	HANDLE fileH = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if(fileH == INVALID_HANDLE_VALUE){ return 0; }
+	LARGE_INTEGER fileSize;
+	if(!GetFileSizeEx(fileH, &fileSize)){ CloseHandle(fileH); return 0; }
+	HANDLE mapH = 0;
+	void* mapData = 0;
+	if(fileSize.QuadPart){
+		mapH = CreateFileMapping(fileH, 0, PAGE_READONLY, 0, 0, 0);
+		if(mapH == 0){ CloseHandle(fileH); return 0; }
+		mapData = MapViewOfFile(mapH, FILE_MAP_READ, 0, 0, 0);
+		if(mapData == 0){ CloseHandle(mapH); CloseHandle(fileH); return 0; }
+	}
+	FileMapStruct* toRet = (FileMapStruct*)malloc(sizeof(FileMapStruct));
+	toRet->fileH = fileH;
+	toRet->mapH = mapH;
+	toRet->mapData = mapData;
+	toRet->mapSize = fileSize.QuadPart;
+	return toRet;
+}
+
+const char* getMappedFileData(void* fromMap){
+	return (const char*)(((FileMapStruct*)fromMap)->mapData);
+}
+
+uintptr_t getMappedFileSize(void* fromMap){
+	return ((FileMapStruct*)fromMap)->mapSize;
+}
+
+void unmapFile(void* toKill){
+	FileMapStruct* toRet = (FileMapStruct*)toKill;
+	if(toRet->mapData){ UnmapViewOfFile(toRet->mapData); }
+	if(toRet->mapH){ CloseHandle(toRet->mapH); }
+	CloseHandle(toRet->fileH);
+	free(toRet);
+}
+
 bool directoryExists(const char* dirName){
 	DWORD dwAttrib = GetFileAttributes(dirName);
 	return ((dwAttrib != INVALID_FILE_ATTRIBUTES) && (dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
@@ -198,3 +242,19 @@ uintptr_t* openDirectory(const char* dirName){
 void closeDirectory(uintptr_t* theDir){
 	free(theDir);
 }
+
+char* getWorkingDirectory(){
+	DWORD buffLen = GetCurrentDirectory(0, 0);
+	if(buffLen == 0){ return 0; }
+	char* toRet = (char*)malloc(buffLen);
+	if(GetCurrentDirectory(buffLen, toRet) == 0){
+		free(toRet);
+		return 0;
+	}
+	return toRet;
+}
+
+bool pathIsAbsolute(const char* pathName){
+	if((pathName[0] == '\\') || (pathName[0] == '/')){ return true; }
+	return pathName[0] && (pathName[1] == ':');
+}
@@ -150,6 +150,21 @@ uint_least16_t le2nat16(const char* toDebuffer){
 	return (0x00FF00 & (toDebuffer[1] << 8)) + (0x00FF & toDebuffer[0]);
 }
 
+void nat2beN(uint_least64_t toPrep, char* toBuffer, int numBytes){
+	for(int i = numBytes-1; i>=0; i--){
+		toBuffer[i] = toPrep;
+		toPrep = toPrep >> 8;
+	}
+}
+
+uint_least64_t be2natN(const char* toDebuffer, int numBytes){
+	uint_least64_t toRet = 0;
+	for(int i = 0; i<numBytes; i++){
+		toRet = (toRet << 8) + (0x00FF & toDebuffer[i]);
+	}
+	return toRet;
+}
+
 uint_least32_t sfltbits(float toConv){
 	union {
 		uint32_t saveI;
@@ -2,6 +2,7 @@
 #include <deque>
 #include <fstream>
 #include <string.h>
+#include <stdexcept>
 #include <algorithm>
 
 #include "whodun_args.h"
@@ -40,6 +41,22 @@ void outputSearchResult(uintptr_t lookFor, uintptr_t foundIn, uintptr_t foundAt,
 	}
 }
 
+void outputSearchResult(uintptr_t lookFor, uintptr_t foundIn, uintptr_t foundAt, uintptr_t foundTo, std::vector<char>* outputTo, bool asText){
+	char buffOut[MATCH_TEXT_SIZE];
+	if(asText){
+		int numP = snprintf(buffOut, MATCH_TEXT_SIZE, "%ju\t%ju\t%ju\t%ju\n", (uintmax_t)lookFor, (uintmax_t)foundIn, (uintmax_t)foundAt, (uintmax_t)foundTo);
+		if((numP < 0) || (numP >= MATCH_TEXT_SIZE)){ throw std::runtime_error("Search result too long to format."); }
+		outputTo->insert(outputTo->end(), buffOut, buffOut + numP);
+	}
+	else{
+		nat2be64(lookFor, buffOut);
+		nat2be64(foundIn, buffOut+8);
+		nat2be64(foundAt, buffOut+16);
+		nat2be64(foundTo, buffOut+24);
+		outputTo->insert(outputTo->end(), buffOut, buffOut + MATCH_ENTRY_SIZE);
+	}
+}
+
 //TODO
 //exttest test match region
 //unziptab unpack block comp tsv
@@ -58,9 +75,13 @@ int main(int argc, char** argv){
 		ProfinmanSortSearchResults actm01; allActs["sortfound"] = &actm01;
 		ProfinmanGetMatchName actm02; allActs["nameget"] = &actm02;
 		ProfinmanFilterDigestMatches actm03; allActs["matfildig"] = &actm03;
+		ProfinmanPeptideSearch actm04; allActs["pepsearch"] = &actm04;
 		ProfinmanBuildReference actr00; allActs["safa"] = &actr00;
 		ProfinmanDumpReference actr01; allActs["dbg_dumpsa"] = &actr01;
 		ProfinmanSearchReference actr02; allActs["findsa"] = &actr02;
+		ProfinmanMergeReference actr03; allActs["mergesa"] = &actr03;
+		ProfinmanServeReference actr04; allActs["serve"] = &actr04;
+		ProfinmanCompactReference actr05; allActs["compactsa"] = &actr05;
 		ProfinmanPackTable actd00; allActs["ziptab"] = &actd00;
 		ProfinmanSortTableCells actd01; allActs["sorttab"] = &actd01;
 		ProfinmanSearchSortedTableCells actd02; allActs["findtabs"] = &actd02;
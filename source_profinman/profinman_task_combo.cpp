@@ -2,8 +2,10 @@
 
 #include <iostream>
 #include <string.h>
+#include <stdlib.h>
 #include <stdexcept>
 #include <algorithm>
+#include <functional>
 
 #include "whodun_sort.h"
 #include "whodun_suffix.h"
@@ -60,9 +62,9 @@ void ProfinmanDumpReference::runThing(){
 		std::string cblockFN = cbaseFN + ".blk";
 		GZipCompressionMethod ccompMeth;
 		BlockCompInStream comboB(cbaseFN.c_str(), cblockFN.c_str(), &ccompMeth);
-		uintptr_t comboEnts = comboB.getUncompressedSize();
-		if(comboEnts % COMBO_ENTRY_SIZE){ throw std::runtime_error("Malformed combo file."); }
-		comboEnts = comboEnts / COMBO_ENTRY_SIZE;
+		ProfinmanComboLayout comLayout(comboName);
+		uintptr_t comboEnts = comLayout.getNumEntries(comboB.getUncompressedSize());
+		comLayout.skipHeader(&comboB);
 	//open up the reference, if any
 		GZipCompressionMethod rcompMeth;
 		BlockCompInStream* rblkComp;
@@ -78,9 +80,10 @@ void ProfinmanDumpReference::runThing(){
 		std::vector<char> postSeq;
 		char curEnt[COMBO_ENTRY_SIZE];
 		for(uintptr_t i = 0; i<comboEnts; i++){
-			comboB.readBytes(curEnt, COMBO_ENTRY_SIZE);
-			uintptr_t seqInd = be2nat64(curEnt);
-			uintptr_t charIndS = be2nat64(curEnt+8);
+			if(comboB.readBytes(curEnt, comLayout.entrySize) != comLayout.entrySize){ throw std::runtime_error("Combo file truncated."); }
+			uintptr_t seqInd;
+			uintptr_t charIndS;
+			comLayout.unpackEntry(curEnt, &seqInd, &charIndS);
 			//get the sequence to dump
 			postSeq.clear();
 			if(numPost){
@@ -116,6 +119,15 @@ ProfinmanSearchReference::ProfinmanSearchReference(){
 	searchName = 0;
 	outputName = 0;
 	txtOut = false;
+	resident = false;
+	mapped = false;
+	batchSearch = false;
+	maxRam = 500000000;
+	blockCache = -1;
+	useLCP = false;
+	useJump = false;
+	numThread = 1;
+	verbose = false;
 	mySummary = "  Search for peptides in a suffix array.";
 	myMainDoc = "Usage: profinman findsa [OPTION] [FILE]*\n"
 		"Takes a fasta file and looks for the entries in a reference.\n"
@@ -129,7 +141,7 @@ ProfinmanSearchReference::ProfinmanSearchReference(){
 	ArgumentParserStrMeta comboMeta("Suffix Array File");
 		comboMeta.isFile = true;
 		comboMeta.fileExts.insert(".gail.sa");
-		addStringOption("--sa", &comboName, 0, "    The pre-built suffix array.\n    --sa File.gail.sa\n", &comboMeta);
+		addStringOption("--sa", &comboName, 0, "    The pre-built suffix array.\n    Any deltas appended to it (safa --append) are searched too:\n    their sequences are numbered after the reference's, so pass --sa to nameget, extfin and matfildig as well.\n    --sa File.gail.sa\n", &comboMeta);
 	ArgumentParserStrMeta entsMeta("Search File");
 		entsMeta.isFile = true;
 		entsMeta.fileExts.insert(".fasta");
@@ -146,8 +158,31 @@ ProfinmanSearchReference::ProfinmanSearchReference(){
 		addStringOption("--out", &outputName, 0, "    The place to write the results.\n    --out File.bin\n", &outMeta);
 	ArgumentParserBoolMeta binMeta("Text Output");
 		addBooleanFlag("--text", &txtOut, 1, "    Write out results tsv rather than binary.\n", &binMeta);
+	ArgumentParserBoolMeta resMeta("Load Into Memory");
+		addBooleanFlag("--resident", &resident, 1, "    Load the reference and suffix array into memory before searching.\n", &resMeta);
+	ArgumentParserBoolMeta mapMeta("Memory Map");
+		addBooleanFlag("--map", &mapped, 1, "    Memory map the reference and suffix array instead of reading them.\n    They must be stored uncompressed (zipfa --comp rawsum, safa --comp rawsum).\n", &mapMeta);
+	ArgumentParserBoolMeta batchMeta("Batch Search");
+		addBooleanFlag("--batch", &batchSearch, 1, "    Sort each batch of sequences, and narrow each search with the ones before it.\n", &batchMeta);
+	ArgumentParserIntMeta ramMeta("RAM Usage");
+		addIntegerOption("--ram", &maxRam, 0, "    Specify a target ram usage for batches (and for their buffered results), in bytes.\n    --ram 500000000\n", &ramMeta);
+	ArgumentParserIntMeta cacheMeta("Block Cache");
+		addIntegerOption("--blockcache", &blockCache, 0, "    How many bytes of --ram to spend holding decompressed blocks of the reference and suffix array.\n    Shared by all threads, and not used with --resident or --map.\n    Defaults to 16000000, or a sixteenth of --ram if that is smaller.\n    --blockcache 16000000\n", &cacheMeta);
+	ArgumentParserBoolMeta lcpMeta("Use LCP File");
+		addBooleanFlag("--lcp", &useLCP, 1, "    Use the lcp file built by safa (File.gail.sa.lcp).\n    Deltas without one are searched without it.\n", &lcpMeta);
+	ArgumentParserBoolMeta jumpMeta("Use Jump Table");
+		addBooleanFlag("--jump", &useJump, 1, "    Use the jump table built by safa (File.gail.sa.jump).\n    Deltas without one are searched without it.\n", &jumpMeta);
+	ArgumentParserIntMeta threadMeta("Threads");
+		addIntegerOption("--thread", &numThread, 0, "    How many threads to use.\n    --thread 1\n", &threadMeta);
+	ArgumentParserBoolMeta verbMeta("Verbose");
+		addBooleanFlag("--verbose", &verbose, 1, "    Report how often the block cache was used, and how many blocks were decompressed, to standard error.\n", &verbMeta);
 }
 
+/**The most the block cache takes if not specified.*/
+#define SEARCH_DEFAULT_CACHE 16000000
+/**The block cache takes at most this fraction of the ram if not specified.*/
+#define SEARCH_DEFAULT_CACHE_SHARE 16
+
 int ProfinmanSearchReference::posteriorCheck(){
 	if(!referenceName || (strlen(referenceName)==0)){
 		argumentError = "Need to specify a reference.";
@@ -163,9 +198,135 @@ int ProfinmanSearchReference::posteriorCheck(){
 	if((outputName == 0) || (strlen(outputName)==0)){
 		outputName = 0;
 	}
+	if(maxRam <= 0){
+		argumentError = "Need to use a positive amount of ram.";
+		return 1;
+	}
+	if(resident || mapped){
+		blockCache = 0;
+	}
+	if(blockCache == -1){
+		blockCache = std::min((intptr_t)SEARCH_DEFAULT_CACHE, maxRam / SEARCH_DEFAULT_CACHE_SHARE);
+	}
+	if(blockCache < 0){
+		argumentError = "Block cache cannot be negative.";
+		return 1;
+	}
+	if(blockCache >= maxRam){
+		argumentError = "Block cache must leave some of the ram for batches.";
+		return 1;
+	}
+	if(numThread <= 0){
+		argumentError = "Need at least one thread.";
+		return 1;
+	}
 	return 0;
 }
 
+/**Sort sequence indices by the sequences.*/
+class ProfinmanSuffixArraySearchBatchCompare{
+public:
+	/**The sequences being sorted.*/
+	std::vector< std::pair<const char*,uintptr_t> >* lookFor;
+	bool operator ()(uintptr_t itemA, uintptr_t itemB){
+		return memBlockCompare((*lookFor)[itemA], (*lookFor)[itemB]);
+	}
+};
+
+/**Uniform for searching a piece of a batch.*/
+class ProfinmanSearchReferenceUni{
+public:
+	/**The things to search with: the base array, then any deltas.*/
+	std::vector<ProfinmanSuffixArraySearcher*> useSearch;
+	/**The (distinct) sequences to search for.*/
+	std::vector< std::pair<const char*,uintptr_t> > lookFor;
+	/**Whether to sort the piece first.*/
+	bool sortFirst;
+	/**The first matching entry for each sequence, in each searcher.*/
+	std::vector< std::vector<uintptr_t> > lowEnts;
+	/**The entry after the last match for each sequence, in each searcher.*/
+	std::vector< std::vector<uintptr_t> > highEnts;
+	/**How many matches come before each sequence (and the total).*/
+	std::vector<uintptr_t> hitStarts;
+	/**The first match (counting across all the original sequences) to report.*/
+	uintptr_t fromHit;
+	/**The match after the last to report.*/
+	uintptr_t toHit;
+	/**Where the matches for each original sequence start (and the end of the last).*/
+	std::vector<uintptr_t>* origHitStarts;
+	/**The index of the first sequence in the batch.*/
+	uintptr_t firstInd;
+	/**The distinct sequence each original sequence turned into.*/
+	std::vector<uintptr_t>* origUniq;
+	/**Which piece (and where in it) each distinct sequence was searched in.*/
+	std::vector< std::pair<ProfinmanSearchReferenceUni*,uintptr_t> >* uniqHome;
+	/**Whether to write text.*/
+	bool asText;
+	/**The results.*/
+	std::vector<char> outputTo;
+	/**The ID of this task.*/
+	uintptr_t taskID;
+	/**Save any errors.*/
+	std::string errMess;
+};
+/**Search a piece of a batch.*/
+void profinmanSearchReferenceTask(void* myUni){
+	ProfinmanSearchReferenceUni* myUn = (ProfinmanSearchReferenceUni*)myUni;
+	try{
+		uintptr_t numLayer = myUn->useSearch.size();
+		myUn->lowEnts.resize(numLayer);
+		myUn->highEnts.resize(numLayer);
+		for(uintptr_t l = 0; l<numLayer; l++){
+			myUn->useSearch[l]->findBatchRanges(&(myUn->lookFor), myUn->sortFirst, &(myUn->lowEnts[l]), &(myUn->highEnts[l]));
+		}
+		//count the matches: they are read when reported
+		myUn->hitStarts.clear();
+		uintptr_t totHits = 0;
+		for(uintptr_t i = 0; i<myUn->lookFor.size(); i++){
+			myUn->hitStarts.push_back(totHits);
+			for(uintptr_t l = 0; l<numLayer; l++){ totHits += (myUn->highEnts[l][i] - myUn->lowEnts[l][i]); }
+		}
+		myUn->hitStarts.push_back(totHits);
+	}
+	catch(std::exception& err){
+		myUn->errMess = err.what();
+	}
+}
+/**Report the matches for a range of the original sequences.*/
+void profinmanSearchReferenceReportTask(void* myUni){
+	ProfinmanSearchReferenceUni* myUn = (ProfinmanSearchReferenceUni*)myUni;
+	try{
+		std::vector<uintptr_t>* origHitStarts = myUn->origHitStarts;
+		uintptr_t i = std::upper_bound(origHitStarts->begin(), origHitStarts->end(), myUn->fromHit) - origHitStarts->begin();
+		i--;
+		uintptr_t h = myUn->fromHit;
+		while(h < myUn->toHit){
+			while((*origHitStarts)[i+1] <= h){ i++; }
+			std::pair<ProfinmanSearchReferenceUni*,uintptr_t> curHome = (*(myUn->uniqHome))[(*(myUn->origUniq))[i]];
+			ProfinmanSearchReferenceUni* homeUn = curHome.first;
+			uintptr_t curLen = homeUn->lookFor[curHome.second].second;
+			//the part of this sequence's matches in this piece, read with this thread's searchers
+			uintptr_t fromOff = h - (*origHitStarts)[i];
+			uintptr_t toOff = std::min(myUn->toHit, (*origHitStarts)[i+1]) - (*origHitStarts)[i];
+			uintptr_t layerBase = 0;
+			for(uintptr_t l = 0; l<myUn->useSearch.size(); l++){
+				uintptr_t lowEnt = homeUn->lowEnts[l][curHome.second];
+				uintptr_t layerHits = homeUn->highEnts[l][curHome.second] - lowEnt;
+				uintptr_t useFrom = std::max(fromOff, layerBase);
+				uintptr_t useTo = std::min(toOff, layerBase + layerHits);
+				if(useFrom < useTo){
+					myUn->useSearch[l]->reportRange(myUn->firstInd + i, curLen, lowEnt + (useFrom - layerBase), lowEnt + (useTo - layerBase), &(myUn->outputTo), myUn->asText);
+				}
+				layerBase += layerHits;
+			}
+			h = (*origHitStarts)[i] + toOff;
+		}
+	}
+	catch(std::exception& err){
+		myUn->errMess = err.what();
+	}
+}
+
 void ProfinmanSearchReference::runThing(){
 	//get the output file ready
 	bool killDump = false;
@@ -178,122 +339,1043 @@ void ProfinmanSearchReference::runThing(){
 		dumpTo = fopen(outputName, "wb");
 		if(dumpTo == 0){ throw std::runtime_error("Problem opening output."); }
 	}
-	//open up the reference
-		std::string rbaseFN(referenceName);
-		std::string rblockFN = rbaseFN + ".blk";
-		std::string rfastiFN = rbaseFN + ".fai";
-		GZipCompressionMethod rcompMeth;
-		BlockCompInStream rblkComp(rbaseFN.c_str(), rblockFN.c_str(), &rcompMeth);
-		GailAQSequenceReader gfaIn(&rblkComp, rfastiFN.c_str());
-		uintptr_t numSeqsG = gfaIn.getNumEntries();
-	//open up the combo
-		std::string cbaseFN(comboName);
-		std::string cblockFN = cbaseFN + ".blk";
-		GZipCompressionMethod ccompMeth;
-		BlockCompInStream comboB(cbaseFN.c_str(), cblockFN.c_str(), &ccompMeth);
-		uintptr_t comboEnts = comboB.getUncompressedSize();
-		if(comboEnts % COMBO_ENTRY_SIZE){ throw std::runtime_error("Malformed combo file."); }
-		comboEnts = comboEnts / COMBO_ENTRY_SIZE;
+	//open up the reference and the combo, and any deltas appended to it (splitting the block cache between them)
+		uintptr_t batchRam = maxRam - blockCache;
+		std::vector<ProfinmanSuffixArrayIndex*> allIndex;
+		#define SEARCH_INDEX_CLEANUP for(uintptr_t i = 0; i<allIndex.size(); i++){ delete(allIndex[i]); }
+		try{
+			std::vector<std::string> deltaRefs;
+			std::vector<std::string> deltaComs;
+			profinmanReadDeltaList(comboName, &deltaRefs, &deltaComs);
+			uintptr_t indexCache = blockCache / (deltaRefs.size() + 1);
+			allIndex.push_back(new ProfinmanSuffixArrayIndex(referenceName, comboName, resident, mapped, useLCP, useJump, numThread, indexCache));
+			uintptr_t seqOffset = allIndex[0]->threadSearch[0]->numSeqs;
+			for(uintptr_t i = 0; i<deltaRefs.size(); i++){
+				//deltas built without side files are searched without them
+				bool deltaLCP = useLCP && fileExists((deltaComs[i] + ".lcp.blk").c_str());
+				bool deltaJump = useJump && fileExists((deltaComs[i] + ".jump.blk").c_str());
+				ProfinmanSuffixArrayIndex* curIndex = new ProfinmanSuffixArrayIndex(deltaRefs[i].c_str(), deltaComs[i].c_str(), resident, mapped, deltaLCP, deltaJump, numThread, indexCache);
+				allIndex.push_back(curIndex);
+				for(uintptr_t j = 0; j<curIndex->threadSearch.size(); j++){ curIndex->threadSearch[j]->seqOffset = seqOffset; }
+				seqOffset += curIndex->threadSearch[0]->numSeqs;
+			}
+		}
+		catch(std::exception& err){
+			SEARCH_INDEX_CLEANUP
+			if(killDump){ fclose(dumpTo); }
+			throw;
+		}
 	//open up the input
 		InStream* saveIS = 0;
 		SequenceReader* saveSS = 0;
-		openSequenceFileRead(searchName ? searchName : "-", &saveIS, &saveSS);
+		ThreadPool* useThreads = 0;
 		try{
+			openSequenceFileRead(searchName ? searchName : "-", &saveIS, &saveSS);
 			uintptr_t curLoadI = 0;
-			while(saveSS->readNextEntry()){
-				uintptr_t curLen = saveSS->lastReadSeqLen;
-				const char* curSeq = saveSS->lastReadSeq;
-				//do a lower bound
-					uintptr_t lowRangeS = 0;
-					uintptr_t countL = comboEnts - lowRangeS;
-					while(countL){
-						uintptr_t step = countL / 2;
-						uintptr_t curTestI = lowRangeS + step;
-						//get the entry location
-						char entBuff[COMBO_ENTRY_SIZE];
-						comboB.seek(COMBO_ENTRY_SIZE*curTestI);
-						comboB.readBytes(entBuff, COMBO_ENTRY_SIZE);
-						uintptr_t seqInd = be2nat64(entBuff);
-						uintptr_t charIndS = be2nat64(entBuff+8);
-						uintptr_t charIndE = charIndS + curLen;
-						//do the comparison
-						if(seqInd >= numSeqsG){ throw std::runtime_error("Suffix array file does not match reference."); }
-						bool isLess;
-						uintptr_t curSeqLen = gfaIn.getEntryLength(seqInd);
-						if(charIndS > curSeqLen){ throw std::runtime_error("Suffix array file does not match reference."); }
-						if(charIndE > curSeqLen){
-							gfaIn.getEntrySubsequence(seqInd, charIndS, curSeqLen);
-							isLess = (memcmp(gfaIn.lastReadSeq, curSeq, (curSeqLen - charIndS)) <= 0);
-						}
-						else{
-							gfaIn.getEntrySubsequence(seqInd, charIndS, charIndE);
-							isLess = (memcmp(gfaIn.lastReadSeq, curSeq, curLen) < 0);
+			//identical sequences in a batch are searched once (a single thread still loads batches)
+			if(numThread > 1){ useThreads = new ThreadPool(numThread); }
+			std::vector<ProfinmanSearchReferenceUni> threadUnis;
+			threadUnis.resize(numThread);
+			std::string allLoadedSeq;
+			std::vector<uintptr_t> loadSeqL;
+			std::vector<uintptr_t> origUniq;
+			std::vector<uintptr_t> origHitStarts;
+			std::vector< std::pair<ProfinmanSearchReferenceUni*,uintptr_t> > uniqHome;
+			int moreData = true;
+			while(moreData){
+				moreData = saveSS->readNextEntry();
+				if(moreData){
+					loadSeqL.push_back(saveSS->lastReadSeqLen);
+					allLoadedSeq.insert(allLoadedSeq.end(), saveSS->lastReadSeq, saveSS->lastReadSeq + saveSS->lastReadSeqLen);
+				}
+				if((!moreData && loadSeqL.size()) || (allLoadedSeq.size() > batchRam)){
+					//collapse identical sequences
+						std::vector< std::pair<const char*,uintptr_t> > origSeqs;
+						uintptr_t curOff = 0;
+						for(uintptr_t i = 0; i<loadSeqL.size(); i++){
+							origSeqs.push_back( std::pair<const char*,uintptr_t>(allLoadedSeq.c_str() + curOff, loadSeqL[i]) );
+							curOff += loadSeqL[i];
 						}
-						//update the search bounds
-						if(isLess){
-							lowRangeS = curTestI + 1;
-							countL -= (step + 1);
+						std::vector<uintptr_t> sortOrder;
+						for(uintptr_t i = 0; i<origSeqs.size(); i++){ sortOrder.push_back(i); }
+						ProfinmanSuffixArraySearchBatchCompare sortComp;
+						sortComp.lookFor = &origSeqs;
+						std::sort(sortOrder.begin(), sortOrder.end(), sortComp);
+						std::vector< std::pair<const char*,uintptr_t> > uniqSeqs;
+						origUniq.resize(origSeqs.size());
+						for(uintptr_t i = 0; i<sortOrder.size(); i++){
+							std::pair<const char*,uintptr_t>& curSeq = origSeqs[sortOrder[i]];
+							if(!(uniqSeqs.size() && (uniqSeqs[uniqSeqs.size()-1].second == curSeq.second) && (memcmp(uniqSeqs[uniqSeqs.size()-1].first, curSeq.first, curSeq.second) == 0))){
+								uniqSeqs.push_back(curSeq);
+							}
+							origUniq[sortOrder[i]] = uniqSeqs.size() - 1;
 						}
-						else{
-							countL = step;
+					//split up the distinct sequences
+						uintptr_t numPerT = uniqSeqs.size() / numThread;
+						uintptr_t numExtT = uniqSeqs.size() % numThread;
+						uintptr_t curSeqI = 0;
+						uniqHome.clear();
+						for(intptr_t ti = 0; ti<numThread; ti++){
+							ProfinmanSearchReferenceUni* curUni = &(threadUnis[ti]);
+							curUni->useSearch.clear();
+							for(uintptr_t l = 0; l<allIndex.size(); l++){ curUni->useSearch.push_back(allIndex[l]->threadSearch[ti]); }
+							curUni->sortFirst = batchSearch;
+							curUni->lookFor.clear();
+							uintptr_t numTake = numPerT + (((uintptr_t)ti) < numExtT);
+							for(uintptr_t i = 0; i<numTake; i++){
+								uniqHome.push_back( std::pair<ProfinmanSearchReferenceUni*,uintptr_t>(curUni, curUni->lookFor.size()) );
+								curUni->lookFor.push_back(uniqSeqs[curSeqI]);
+								curSeqI++;
+							}
 						}
-					}
-				//do an upper bound
-					uintptr_t highRangeS = lowRangeS;
-					uintptr_t countH = comboEnts - lowRangeS;
-					while(countH){
-						uintptr_t step = countH / 2;
-						uintptr_t curTestI = highRangeS + step;
-						//get the entry location
-						char entBuff[COMBO_ENTRY_SIZE];
-						comboB.seek(COMBO_ENTRY_SIZE*curTestI);
-						comboB.readBytes(entBuff, COMBO_ENTRY_SIZE);
-						uintptr_t seqInd = be2nat64(entBuff);
-						uintptr_t charIndS = be2nat64(entBuff+8);
-						uintptr_t charIndE = charIndS + curLen;
-						//do the comparison
-						if(seqInd >= numSeqsG){ throw std::runtime_error("Suffix array file does not match reference."); }
-						bool isLessE;
-						uintptr_t curSeqLen = gfaIn.getEntryLength(seqInd);
-						if(charIndS > curSeqLen){ throw std::runtime_error("Suffix array file does not match reference."); }
-						if(charIndE > curSeqLen){
-							gfaIn.getEntrySubsequence(seqInd, charIndS, curSeqLen);
-							isLessE = (memcmp(gfaIn.lastReadSeq, curSeq, (curSeqLen - charIndS)) <= 0);
+					//search
+						if(useThreads){
+							for(intptr_t ti = 0; ti<numThread; ti++){ threadUnis[ti].taskID = useThreads->addTask(profinmanSearchReferenceTask, &(threadUnis[ti])); }
+							for(intptr_t ti = 0; ti<numThread; ti++){ useThreads->joinTask(threadUnis[ti].taskID); }
 						}
 						else{
-							gfaIn.getEntrySubsequence(seqInd, charIndS, charIndE);
-							isLessE = (memcmp(gfaIn.lastReadSeq, curSeq, curLen) <= 0);
+							profinmanSearchReferenceTask(&(threadUnis[0]));
 						}
-						//update the search bounds
-						if(isLessE){
-							highRangeS = curTestI + 1;
-							countH -= (step + 1);
+						for(intptr_t ti = 0; ti<numThread; ti++){
+							if(threadUnis[ti].errMess.size()){ throw std::runtime_error(threadUnis[ti].errMess); }
 						}
-						else{
-							countH = step;
+					//count the matches for every original sequence
+						origHitStarts.resize(loadSeqL.size() + 1);
+						origHitStarts[0] = 0;
+						for(uintptr_t i = 0; i<loadSeqL.size(); i++){
+							std::pair<ProfinmanSearchReferenceUni*,uintptr_t> curHome = uniqHome[origUniq[i]];
+							origHitStarts[i+1] = origHitStarts[i] + (curHome.first->hitStarts[curHome.second+1] - curHome.first->hitStarts[curHome.second]);
 						}
-					}
-				//report everything in between
-					if(highRangeS - lowRangeS){ comboB.seek(COMBO_ENTRY_SIZE*lowRangeS); }
-					for(uintptr_t comboI = lowRangeS; comboI < highRangeS; comboI++){
-						char entBuff[COMBO_ENTRY_SIZE];
-						comboB.readBytes(entBuff, COMBO_ENTRY_SIZE);
-						uintptr_t seqInd = be2nat64(entBuff);
-						uintptr_t charIndS = be2nat64(entBuff+8);
-						outputSearchResult(curLoadI, seqInd, charIndS, charIndS + curLen, dumpTo, txtOut);
-					}
-				curLoadI++;
+					//hand the matches back out in pieces that fit in ram, and report in the original order
+						uintptr_t totHits = origHitStarts[loadSeqL.size()];
+						uintptr_t roundHits = std::max((uintptr_t)1, batchRam / (txtOut ? MATCH_TEXT_SIZE : MATCH_ENTRY_SIZE));
+						uintptr_t curHitI = 0;
+						while(curHitI < totHits){
+							uintptr_t roundEnd = std::min(totHits, curHitI + roundHits);
+							numPerT = (roundEnd - curHitI) / numThread;
+							numExtT = (roundEnd - curHitI) % numThread;
+							for(intptr_t ti = 0; ti<numThread; ti++){
+								ProfinmanSearchReferenceUni* curUni = &(threadUnis[ti]);
+								curUni->fromHit = curHitI;
+								curHitI += numPerT + (((uintptr_t)ti) < numExtT);
+								curUni->toHit = curHitI;
+								curUni->origHitStarts = &origHitStarts;
+								curUni->firstInd = curLoadI;
+								curUni->origUniq = &origUniq;
+								curUni->uniqHome = &uniqHome;
+								curUni->asText = txtOut;
+								curUni->outputTo.clear();
+							}
+							if(useThreads){
+								for(intptr_t ti = 0; ti<numThread; ti++){ threadUnis[ti].taskID = useThreads->addTask(profinmanSearchReferenceReportTask, &(threadUnis[ti])); }
+								for(intptr_t ti = 0; ti<numThread; ti++){ useThreads->joinTask(threadUnis[ti].taskID); }
+							}
+							else{
+								profinmanSearchReferenceReportTask(&(threadUnis[0]));
+							}
+							for(intptr_t ti = 0; ti<numThread; ti++){
+								ProfinmanSearchReferenceUni* curUni = &(threadUnis[ti]);
+								if(curUni->errMess.size()){ throw std::runtime_error(curUni->errMess); }
+								if(curUni->outputTo.size()){ fwrite(&(curUni->outputTo[0]), 1, curUni->outputTo.size(), dumpTo); }
+							}
+						}
+					curLoadI += loadSeqL.size();
+					allLoadedSeq.clear();
+					loadSeqL.clear();
+				}
 			}
 		}
 		catch(std::exception& err){
+			if(useThreads){ delete(useThreads); }
 			if(saveIS){ delete(saveIS); }
 			if(saveSS){ delete(saveSS); }
 			if(killDump){ fclose(dumpTo); }
+			SEARCH_INDEX_CLEANUP
 			throw;
 		}
+		if(useThreads){ delete(useThreads); }
 		if(saveIS){ delete(saveIS); }
 		if(saveSS){ delete(saveSS); }
 		if(killDump){ fclose(dumpTo); }
+		if(verbose){
+			uintptr_t numHit = 0;
+			uintptr_t numMiss = 0;
+			uintptr_t numLoad = 0;
+			for(uintptr_t i = 0; i<allIndex.size(); i++){
+				BlockCompCache* curCaches[] = {allIndex[i]->refCache, allIndex[i]->comCache};
+				for(int j = 0; j<2; j++){
+					if(curCaches[j] == 0){ continue; }
+					numHit += curCaches[j]->numHit;
+					numMiss += curCaches[j]->numMiss;
+					numLoad += curCaches[j]->numLoad;
+				}
+			}
+			std::cerr << "Block cache: " << numHit << " hits, " << numMiss << " misses, " << numLoad << " blocks decompressed." << std::endl;
+		}
+		SEARCH_INDEX_CLEANUP
+		#undef SEARCH_INDEX_CLEANUP
+}
+
+ProfinmanServeReference::ProfinmanServeReference(){
+	txtOut = false;
+	resident = false;
+	mapped = false;
+	useLCP = false;
+	useJump = false;
+	mySummary = "  Answer peptide searches in suffix arrays, one line at a time.";
+	myMainDoc = "Usage: profinman serve [OPTION]\n"
+		"Loads suffix arrays once, then reads peptides (one per line) from standard input.\n"
+		"For each line, and each reference in order, writes the number of matches (8 byte big endian)\n"
+		"followed by that many match records. Output is flushed after every line.\n"
+		"The OPTIONS are:\n";
+	myVersionDoc = "ProFinMan serve 1.0";
+	myCopyrightDoc = "Copyright (C) 2020 UNT HSC Center for Human Identification";
+	ArgumentParserStrVecMeta dumpMeta("Reference Files");
+		dumpMeta.isFile = true;
+		dumpMeta.fileExts.insert(".gail");
+		addStringVectorOption("--ref", &referenceNames, 0, "    A reference file to search through.\n    --ref File.gail\n", &dumpMeta);
+	ArgumentParserStrVecMeta comboMeta("Suffix Array Files");
+		comboMeta.isFile = true;
+		comboMeta.fileExts.insert(".gail.sa");
+		addStringVectorOption("--sa", &comboNames, 0, "    The pre-built suffix array for each reference.\n    --sa File.gail.sa\n", &comboMeta);
+	ArgumentParserBoolMeta binMeta("Text Output");
+		addBooleanFlag("--text", &txtOut, 1, "    Write out results tsv rather than binary: each reference ends with a blank line.\n", &binMeta);
+	ArgumentParserBoolMeta resMeta("Load Into Memory");
+		addBooleanFlag("--resident", &resident, 1, "    Load the references and suffix arrays into memory.\n", &resMeta);
+	ArgumentParserBoolMeta mapMeta("Memory Map");
+		addBooleanFlag("--map", &mapped, 1, "    Memory map the references and suffix arrays instead of reading them.\n    They must be stored uncompressed (zipfa --comp rawsum, safa --comp rawsum).\n", &mapMeta);
+	ArgumentParserBoolMeta lcpMeta("Use LCP File");
+		addBooleanFlag("--lcp", &useLCP, 1, "    Use the lcp files built by safa (File.gail.sa.lcp).\n", &lcpMeta);
+	ArgumentParserBoolMeta jumpMeta("Use Jump Table");
+		addBooleanFlag("--jump", &useJump, 1, "    Use the jump tables built by safa (File.gail.sa.jump).\n", &jumpMeta);
+}
+
+int ProfinmanServeReference::posteriorCheck(){
+	if(referenceNames.size() == 0){
+		argumentError = "Need to specify at least one reference.";
+		return 1;
+	}
+	if(referenceNames.size() != comboNames.size()){
+		argumentError = "Need a suffix array for each reference.";
+		return 1;
+	}
+	return 0;
+}
+
+void ProfinmanServeReference::runThing(){
+	//load everything
+		std::vector<ProfinmanSuffixArrayIndex*> allIndex;
+		try{
+			for(uintptr_t i = 0; i<referenceNames.size(); i++){
+				allIndex.push_back(new ProfinmanSuffixArrayIndex(referenceNames[i], comboNames[i], resident, mapped, useLCP, useJump, 1, 0));
+			}
+		}
+		catch(std::exception& err){
+			for(uintptr_t i = 0; i<allIndex.size(); i++){ delete(allIndex[i]); }
+			throw;
+		}
+	//answer questions
+	try{
+		std::string curLine;
+		std::vector< std::pair<const char*,uintptr_t> > lookFor;
+		std::vector<char> curResult;
+		uintptr_t curLoadI = 0;
+		while(std::getline(std::cin, curLine)){
+			uintptr_t lineLen = curLine.size();
+			while(lineLen && strchr(" \t\r", curLine[lineLen-1])){ lineLen--; }
+			lookFor.clear();
+			if(lineLen){
+				lookFor.push_back( std::pair<const char*,uintptr_t>(curLine.c_str(), lineLen) );
+			}
+			for(uintptr_t i = 0; i<allIndex.size(); i++){
+				curResult.clear();
+				allIndex[i]->threadSearch[0]->searchBatch(&lookFor, curLoadI, false, &curResult, txtOut);
+				if(txtOut){
+					curResult.push_back('\n');
+				}
+				else{
+					char numBuff[8];
+					nat2be64(curResult.size() / MATCH_ENTRY_SIZE, numBuff);
+					fwrite(numBuff, 1, 8, stdout);
+				}
+				if(curResult.size()){ fwrite(&(curResult[0]), 1, curResult.size(), stdout); }
+			}
+			fflush(stdout);
+			curLoadI++;
+		}
+	}
+	catch(std::exception& err){
+		for(uintptr_t i = 0; i<allIndex.size(); i++){ delete(allIndex[i]); }
+		throw;
+	}
+	for(uintptr_t i = 0; i<allIndex.size(); i++){ delete(allIndex[i]); }
+}
+
+ProfinmanSuffixArrayIndex::ProfinmanSuffixArrayIndex(const char* refName, const char* comName, bool resident, bool mapped, bool useLCP, bool useJump, int numThread, uintptr_t cacheBytes){
+	saLCP = 0;
+	saJump = 0;
+	refCache = 0;
+	comCache = 0;
+	#define SUFFIX_INDEX_CLEANUP \
+		for(uintptr_t i = 0; i<threadSearch.size(); i++){ delete(threadSearch[i]); }\
+		for(uintptr_t i = 0; i<allRefs.size(); i++){ delete(allRefs[i]); }\
+		for(uintptr_t i = 0; i<allCombos.size(); i++){ delete(allCombos[i]); }\
+		if(saLCP){ delete(saLCP); }\
+		if(saJump){ delete(saJump); }\
+		if(refCache){ delete(refCache); }\
+		if(comCache){ delete(comCache); }
+	try{
+		//memory can be shared, files can not (but their caches can)
+		int numOpen = resident ? 1 : numThread;
+		if(!resident && !mapped && (cacheBytes / 2)){
+			refCache = new BlockCompCache(cacheBytes / 2);
+			comCache = new BlockCompCache(cacheBytes / 2);
+		}
+		for(int i = 0; i<numOpen; i++){
+			if(resident){
+				allRefs.push_back(new ProfinmanResidentReferenceSource(refName));
+				allCombos.push_back(new ProfinmanResidentComboSource(comName));
+			}
+			else if(mapped){
+				allRefs.push_back(new ProfinmanMappedReferenceSource(refName));
+				allCombos.push_back(new ProfinmanMappedComboSource(comName));
+			}
+			else{
+				allRefs.push_back(new ProfinmanFileReferenceSource(refName, refCache));
+				allCombos.push_back(new ProfinmanFileComboSource(comName, comCache));
+			}
+		}
+		numEntries = allCombos[0]->getNumEntries();
+		if(useLCP){
+			saLCP = new ProfinmanSuffixLCP(comName);
+			if(saLCP->allLCP.size() != numEntries){ throw std::runtime_error("LCP file does not match suffix array."); }
+		}
+		if(useJump){
+			saJump = new ProfinmanSuffixJumpTable(comName);
+			if(saJump->prefixStarts[saJump->prefixStarts.size()-1] != numEntries){ throw std::runtime_error("Jump table does not match suffix array."); }
+		}
+		for(int i = 0; i<numThread; i++){
+			ProfinmanSuffixArraySearcher* curSearch = new ProfinmanSuffixArraySearcher(allRefs[i % numOpen], allCombos[i % numOpen]);
+			curSearch->searchLCP = saLCP;
+			curSearch->searchJump = saJump;
+			threadSearch.push_back(curSearch);
+		}
+	}
+	catch(std::exception& err){
+		SUFFIX_INDEX_CLEANUP
+		throw;
+	}
+}
+
+ProfinmanSuffixArrayIndex::~ProfinmanSuffixArrayIndex(){
+	SUFFIX_INDEX_CLEANUP
+}
+#undef SUFFIX_INDEX_CLEANUP
+
+/**
+ * Split a path into its elements.
+ * @param pathName The path.
+ * @param toFill The place to put the elements: empty elements and "." are skipped, and ".." removes the previous element where it can.
+ */
+void profinmanSplitPath(const std::string& pathName, std::vector<std::string>* toFill){
+	std::string curElem;
+	for(uintptr_t i = 0; i<=pathName.size(); i++){
+		if((i < pathName.size()) && (pathName[i] != '/') && (pathName[i] != pathElementSep[0])){
+			curElem.push_back(pathName[i]);
+			continue;
+		}
+		if((curElem.size() == 0) || (curElem == ".")){}
+		else if((curElem == "..") && toFill->size() && ((*toFill)[toFill->size()-1] != "..")){ toFill->pop_back(); }
+		else{ toFill->push_back(curElem); }
+		curElem.clear();
+	}
+}
+
+/**
+ * Get the absolute path to a file, without going to the file system.
+ * @param pathName The path (relative to the working directory if not absolute).
+ * @param toFill The place to put the elements of the absolute path.
+ */
+void profinmanAbsolutePath(const char* pathName, std::vector<std::string>* toFill){
+	if(!pathIsAbsolute(pathName)){
+		char* workDir = getWorkingDirectory();
+		if(workDir == 0){ throw std::runtime_error("Could not get the working directory."); }
+		std::string workDirS(workDir);
+		free(workDir);
+		profinmanSplitPath(workDirS, toFill);
+	}
+	profinmanSplitPath(pathName, toFill);
+}
+
+/**
+ * Get the directory of a delta list, as a prefix for the relative paths in it.
+ * @param comName The base name of the combo file.
+ * @return The prefix (empty for the working directory).
+ */
+std::string profinmanDeltaListFolder(const char* comName){
+	std::string comNameS(comName);
+	size_t lastSep = comNameS.find_last_of(std::string("/") + pathElementSep);
+	if(lastSep == std::string::npos){ return ""; }
+	return comNameS.substr(0, lastSep+1);
+}
+
+/**
+ * Get the path to a file relative to the directory of a delta list.
+ * @param comName The base name of the combo file.
+ * @param pathName The path to the file (relative to the working directory).
+ * @return The path to use in the delta list (absolute if it is on another drive).
+ */
+std::string profinmanDeltaListPath(const char* comName, const char* pathName){
+	std::vector<std::string> fromElems;
+	profinmanAbsolutePath(comName, &fromElems);
+	fromElems.pop_back();
+	std::vector<std::string> toElems;
+	profinmanAbsolutePath(pathName, &toElems);
+	uintptr_t numCommon = 0;
+	while((numCommon < fromElems.size()) && (numCommon < toElems.size()) && (fromElems[numCommon] == toElems[numCommon])){ numCommon++; }
+	std::string toRet;
+	if((numCommon == 0) && toElems.size() && pathIsAbsolute(toElems[0].c_str())){
+		//on another drive: no way to get there relatively
+		toRet = toElems[0];
+		for(uintptr_t i = 1; i<toElems.size(); i++){
+			toRet.append(pathElementSep);
+			toRet.append(toElems[i]);
+		}
+		return toRet;
+	}
+	for(uintptr_t i = numCommon; i<fromElems.size(); i++){
+		toRet.append("..");
+		toRet.append(pathElementSep);
+	}
+	for(uintptr_t i = numCommon; i<toElems.size(); i++){
+		if(i != numCommon){ toRet.append(pathElementSep); }
+		toRet.append(toElems[i]);
+	}
+	return toRet;
+}
+
+/**
+ * Get whether two paths name the same file (without going to the file system).
+ * @param pathA The first path.
+ * @param pathB The second path.
+ * @return Whether they are the same.
+ */
+bool profinmanSamePath(const char* pathA, const char* pathB){
+	std::vector<std::string> elemsA;
+	profinmanAbsolutePath(pathA, &elemsA);
+	std::vector<std::string> elemsB;
+	profinmanAbsolutePath(pathB, &elemsB);
+	return elemsA == elemsB;
+}
+
+void profinmanReadDeltaList(const char* comName, std::vector<std::string>* refNames, std::vector<std::string>* comNames){
+	std::string deltaFN(comName);
+		deltaFN.append(".delta");
+	if(!fileExists(deltaFN.c_str())){ return; }
+	std::string deltaFold = profinmanDeltaListFolder(comName);
+	std::ifstream deltaF(deltaFN.c_str());
+	std::string curLine;
+	while(std::getline(deltaF, curLine)){
+		if(curLine.size() && (curLine[curLine.size()-1] == '\r')){ curLine.erase(curLine.size()-1); }
+		if(curLine.size() == 0){ continue; }
+		size_t tabLoc = curLine.find('\t');
+		if((tabLoc == std::string::npos) || (tabLoc == 0) || (tabLoc == curLine.size()-1)){ throw std::runtime_error("Malformed delta list."); }
+		//paths in the list are relative to its folder
+		std::string curRef = curLine.substr(0, tabLoc);
+		std::string curCom = curLine.substr(tabLoc+1);
+		refNames->push_back(pathIsAbsolute(curRef.c_str()) ? curRef : (deltaFold + curRef));
+		comNames->push_back(pathIsAbsolute(curCom.c_str()) ? curCom : (deltaFold + curCom));
+	}
+}
+
+void profinmanAppendDeltaList(const char* comName, const char* refName, const char* deltaName){
+	std::vector<std::string> refNames;
+	std::vector<std::string> comNames;
+	profinmanReadDeltaList(comName, &refNames, &comNames);
+	for(uintptr_t i = 0; i<refNames.size(); i++){
+		if(profinmanSamePath(refNames[i].c_str(), refName) && profinmanSamePath(comNames[i].c_str(), deltaName)){ return; }
+	}
+	std::string deltaFN(comName);
+		deltaFN.append(".delta");
+	std::ofstream deltaF(deltaFN.c_str(), std::ofstream::app);
+	deltaF << profinmanDeltaListPath(comName, refName) << "\t" << profinmanDeltaListPath(comName, deltaName) << std::endl;
+	if(!deltaF){ throw std::runtime_error("Problem writing delta list."); }
+}
+
+ProfinmanMatchReference::ProfinmanMatchReference(const char* refName, const char* comName, int numCopy, uintptr_t cacheBytes){
+	openReferences(refName, comName, numCopy, 0, 0, cacheBytes);
+}
+
+ProfinmanMatchReference::ProfinmanMatchReference(const char* refName, const char* comName, int numThread, ThreadPool* useThreads, uintptr_t cacheBytes){
+	openReferences(refName, comName, 1, numThread, useThreads, cacheBytes);
+}
+
+#define MATCH_REFERENCE_CLEANUP \
+	for(uintptr_t i = 0; i<allReads.size(); i++){ delete(allReads[i]); }\
+	for(uintptr_t i = 0; i<allStrs.size(); i++){ delete(allStrs[i]); }\
+	for(uintptr_t i = 0; i<allCaches.size(); i++){ if(allCaches[i]){ delete(allCaches[i]); } }\
+	for(uintptr_t i = 0; i<allComps.size(); i++){ delete(allComps[i]); }
+
+void ProfinmanMatchReference::openReferences(const char* refName, const char* comName, int numCopy, int numThread, ThreadPool* useThreads, uintptr_t cacheBytes){
+	this->numCopy = numCopy;
+	refNames.push_back(refName);
+	if(comName){
+		std::vector<std::string> deltaComs;
+		profinmanReadDeltaList(comName, &refNames, &deltaComs);
+	}
+	uintptr_t numLayer = refNames.size();
+	try{
+		for(uintptr_t l = 0; l<numLayer; l++){
+			allCaches.push_back((cacheBytes / numLayer) ? new BlockCompCache(cacheBytes / numLayer) : (BlockCompCache*)0);
+		}
+		for(int c = 0; c<numCopy; c++){
+			for(uintptr_t l = 0; l<numLayer; l++){
+				std::string baseFN = refNames[l];
+				std::string blockFN = baseFN + ".blk";
+				std::string fastiFN = baseFN + ".fai";
+				CompressionMethod* curComp = new GZipCompressionMethod();
+				allComps.push_back(curComp);
+				if(numThread){
+					MultithreadBlockCompInStream* curStr = new MultithreadBlockCompInStream(baseFN.c_str(), blockFN.c_str(), curComp, numThread, useThreads, allCaches[l]);
+					allStrs.push_back(curStr);
+					curStr->readAhead = 0;
+					allReads.push_back(new GailAQSequenceReader(curStr, fastiFN.c_str()));
+				}
+				else{
+					BlockCompInStream* curStr = new BlockCompInStream(baseFN.c_str(), blockFN.c_str(), curComp, allCaches[l]);
+					allStrs.push_back(curStr);
+					allReads.push_back(new GailAQSequenceReader(curStr, fastiFN.c_str()));
+				}
+			}
+		}
+		uintptr_t totEnts = 0;
+		for(uintptr_t l = 0; l<numLayer; l++){
+			layerStarts.push_back(totEnts);
+			totEnts += allReads[l]->getNumEntries();
+		}
+		layerStarts.push_back(totEnts);
+	}
+	catch(std::exception& err){
+		MATCH_REFERENCE_CLEANUP
+		throw;
+	}
+}
+
+ProfinmanMatchReference::~ProfinmanMatchReference(){
+	MATCH_REFERENCE_CLEANUP
+}
+#undef MATCH_REFERENCE_CLEANUP
+
+uintptr_t ProfinmanMatchReference::getNumEntries(){
+	return layerStarts[layerStarts.size()-1];
+}
+
+uintptr_t ProfinmanMatchReference::findLayer(uintptr_t entInd){
+	return (std::upper_bound(layerStarts.begin(), layerStarts.end(), entInd) - layerStarts.begin()) - 1;
+}
+
+GailAQSequenceReader* ProfinmanMatchReference::getReader(uintptr_t copyInd, uintptr_t layerInd){
+	return allReads[copyInd*refNames.size() + layerInd];
+}
+
+ProfinmanReferenceSource::~ProfinmanReferenceSource(){}
+
+ProfinmanFileReferenceSource::ProfinmanFileReferenceSource(const char* refName, BlockCompCache* useCache){
+	std::string rbaseFN(refName);
+	std::string rblockFN = rbaseFN + ".blk";
+	std::string rfastiFN = rbaseFN + ".fai";
+	refComp = new GZipCompressionMethod();
+	refStr = 0;
+	refRead = 0;
+	try{
+		refStr = new BlockCompInStream(rbaseFN.c_str(), rblockFN.c_str(), refComp, useCache);
+		refRead = new GailAQSequenceReader(refStr, rfastiFN.c_str());
+	}
+	catch(std::exception& err){
+		if(refStr){ delete(refStr); }
+		delete(refComp);
+		throw;
+	}
+	numEntries = refRead->getNumEntries();
+}
+
+ProfinmanFileReferenceSource::~ProfinmanFileReferenceSource(){
+	delete(refRead);
+	delete(refStr);
+	delete(refComp);
+}
+
+uintptr_t ProfinmanFileReferenceSource::getNumEntries(){
+	return numEntries;
+}
+
+uintptr_t ProfinmanFileReferenceSource::getEntryLength(uintptr_t entInd){
+	return refRead->getEntryLength(entInd);
+}
+
+const char* ProfinmanFileReferenceSource::getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase){
+	refRead->getEntrySubsequence(entInd, fromBase, toBase);
+	return refRead->lastReadSeq;
+}
+
+ProfinmanMappedReferenceSource::ProfinmanMappedReferenceSource(const char* refName){
+	std::string rbaseFN(refName);
+	std::string rblockFN = rbaseFN + ".blk";
+	std::string rfastiFN = rbaseFN + ".fai";
+	refStr = new MappedRawBlockInStream(rbaseFN.c_str(), rblockFN.c_str());
+	try{
+		refRead = new GailAQSequenceReader(refStr, rfastiFN.c_str());
+	}
+	catch(std::exception& err){
+		delete(refStr);
+		throw;
+	}
+	numEntries = refRead->getNumEntries();
+}
+
+ProfinmanMappedReferenceSource::~ProfinmanMappedReferenceSource(){
+	delete(refRead);
+	delete(refStr);
+}
+
+uintptr_t ProfinmanMappedReferenceSource::getNumEntries(){
+	return numEntries;
+}
+
+uintptr_t ProfinmanMappedReferenceSource::getEntryLength(uintptr_t entInd){
+	return refRead->getEntryLength(entInd);
+}
+
+const char* ProfinmanMappedReferenceSource::getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase){
+	refRead->getEntrySubsequence(entInd, fromBase, toBase);
+	return refRead->lastReadSeq;
+}
+
+ProfinmanCachedReferenceSource::ProfinmanCachedReferenceSource(const char* refName, uintptr_t maxBytes) : baseSource(refName, 0){
+	this->maxBytes = maxBytes;
+	curBytes = 0;
+}
+
+ProfinmanCachedReferenceSource::~ProfinmanCachedReferenceSource(){}
+
+uintptr_t ProfinmanCachedReferenceSource::getNumEntries(){
+	return baseSource.getNumEntries();
+}
+
+uintptr_t ProfinmanCachedReferenceSource::getEntryLength(uintptr_t entInd){
+	return baseSource.getEntryLength(entInd);
+}
+
+const char* ProfinmanCachedReferenceSource::getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase){
+	//already have it: move it to the front
+	std::map<uintptr_t, std::list< std::pair<uintptr_t,std::string> >::iterator >::iterator heldIt = heldLocs.find(entInd);
+	if(heldIt != heldLocs.end()){
+		heldSeqs.splice(heldSeqs.begin(), heldSeqs, heldIt->second);
+		return heldSeqs.front().second.c_str() + fromBase;
+	}
+	//load the whole thing
+	uintptr_t seqLen = baseSource.getEntryLength(entInd);
+	const char* loadSeq = baseSource.getEntrySubsequence(entInd, 0, seqLen);
+	heldSeqs.push_front( std::pair<uintptr_t,std::string>(entInd, std::string(loadSeq, loadSeq + seqLen)) );
+	heldLocs[entInd] = heldSeqs.begin();
+	curBytes += seqLen;
+	//drop the stale ones
+	while((curBytes > maxBytes) && (heldSeqs.size() > 1)){
+		curBytes -= heldSeqs.back().second.size();
+		heldLocs.erase(heldSeqs.back().first);
+		heldSeqs.pop_back();
+	}
+	return heldSeqs.front().second.c_str() + fromBase;
+}
+
+ProfinmanResidentReferenceSource::ProfinmanResidentReferenceSource(const char* refName){
+	loadReference(refName, false);
+}
+
+ProfinmanResidentReferenceSource::ProfinmanResidentReferenceSource(const char* refName, bool keepNames){
+	loadReference(refName, keepNames);
+}
+
+void ProfinmanResidentReferenceSource::loadReference(const char* refName, bool keepNames){
+	std::string rbaseFN(refName);
+	std::string rblockFN = rbaseFN + ".blk";
+	std::string rfastiFN = rbaseFN + ".fai";
+	GZipCompressionMethod rcompMeth;
+	BlockCompInStream rblkComp(rbaseFN.c_str(), rblockFN.c_str(), &rcompMeth);
+	GailAQSequenceReader gfaIn(&rblkComp, rfastiFN.c_str());
+	seqStarts.push_back(0);
+	nameStarts.push_back(0);
+	while(gfaIn.readNextEntry()){
+		allSeqs.insert(allSeqs.end(), gfaIn.lastReadSeq, gfaIn.lastReadSeq + gfaIn.lastReadSeqLen);
+		seqStarts.push_back(allSeqs.size());
+		if(keepNames){
+			allNames.insert(allNames.end(), gfaIn.lastReadName, gfaIn.lastReadName + gfaIn.lastReadNameLen);
+			nameStarts.push_back(allNames.size());
+		}
+	}
+	//keep the pointers valid even if there is nothing
+	allSeqs.push_back(0);
+	allNames.push_back(0);
+}
+
+ProfinmanResidentReferenceSource::~ProfinmanResidentReferenceSource(){}
+
+uintptr_t ProfinmanResidentReferenceSource::getNumEntries(){
+	return seqStarts.size() - 1;
+}
+
+uintptr_t ProfinmanResidentReferenceSource::getEntryLength(uintptr_t entInd){
+	return seqStarts[entInd+1] - seqStarts[entInd];
+}
+
+const char* ProfinmanResidentReferenceSource::getEntrySubsequence(uintptr_t entInd, uintptr_t fromBase, uintptr_t toBase){
+	return &(allSeqs[seqStarts[entInd] + fromBase]);
+}
+
+const char* ProfinmanResidentReferenceSource::getEntryName(uintptr_t entInd, uintptr_t* nameLen){
+	*nameLen = nameStarts[entInd+1] - nameStarts[entInd];
+	return &(allNames[nameStarts[entInd]]);
+}
+
+int profinmanComboBytesFor(uintptr_t maxVal){
+	int numB = 1;
+	while((numB < 8) && (maxVal >> (8*numB))){ numB++; }
+	return numB;
+}
+
+ProfinmanComboLayout::ProfinmanComboLayout(){
+	headerSize = 0;
+	seqWidth = 8;
+	charWidth = 8;
+	entrySize = COMBO_ENTRY_SIZE;
+}
+
+ProfinmanComboLayout::ProfinmanComboLayout(uintptr_t numString, uintptr_t maxLen){
+	headerSize = COMBO_HEADER_SIZE;
+	seqWidth = profinmanComboBytesFor(numString ? (numString - 1) : 0);
+	charWidth = profinmanComboBytesFor(maxLen);
+	entrySize = seqWidth + charWidth;
+}
+
+ProfinmanComboLayout::ProfinmanComboLayout(const char* comName){
+	std::string cbaseFN(comName);
+	std::string cblockFN = cbaseFN + ".blk";
+	GZipCompressionMethod ccompMeth;
+	BlockCompInStream comboB(cbaseFN.c_str(), cblockFN.c_str(), &ccompMeth);
+	char headBuff[COMBO_HEADER_SIZE];
+	uintptr_t numRead = comboB.readBytes(headBuff, COMBO_HEADER_SIZE);
+	bool isPacked = (numRead == COMBO_HEADER_SIZE);
+	for(uintptr_t i = 0; isPacked && (i<8); i++){ isPacked = ((0x00FF & headBuff[i]) == 0x00FF); }
+	if(!isPacked){
+		headerSize = 0;
+		seqWidth = 8;
+		charWidth = 8;
+		entrySize = COMBO_ENTRY_SIZE;
+		return;
+	}
+	if((0x00FF & headBuff[8]) > COMBO_FORMAT_VERSION){ throw std::runtime_error("Combo file is from a newer version."); }
+	headerSize = COMBO_HEADER_SIZE;
+	seqWidth = headBuff[9];
+	charWidth = headBuff[10];
+	if((seqWidth < 1) || (seqWidth > 8) || (charWidth < 1) || (charWidth > 8)){ throw std::runtime_error("Malformed combo file."); }
+	entrySize = seqWidth + charWidth;
+}
+
+void ProfinmanComboLayout::writeHeader(OutStream* toStr){
+	if(headerSize == 0){ return; }
+	char headBuff[COMBO_HEADER_SIZE];
+	memset(headBuff, 0, COMBO_HEADER_SIZE);
+	memset(headBuff, 0x00FF, 8);
+	headBuff[8] = COMBO_FORMAT_VERSION;
+	headBuff[9] = seqWidth;
+	headBuff[10] = charWidth;
+	toStr->writeBytes(headBuff, COMBO_HEADER_SIZE);
+}
+
+void ProfinmanComboLayout::skipHeader(InStream* fromStr){
+	if(headerSize == 0){ return; }
+	char headBuff[COMBO_HEADER_SIZE];
+	if(fromStr->readBytes(headBuff, headerSize) != headerSize){ throw std::runtime_error("Combo file truncated."); }
+}
+
+uintptr_t ProfinmanComboLayout::getNumEntries(uintptr_t totSize){
+	if((totSize < headerSize) || ((totSize - headerSize) % entrySize)){ throw std::runtime_error("Malformed combo file."); }
+	return (totSize - headerSize) / entrySize;
+}
+
+void ProfinmanComboLayout::packEntry(uintptr_t seqInd, uintptr_t charInd, char* toBuff){
+	nat2beN(seqInd, toBuff, seqWidth);
+	nat2beN(charInd, toBuff + seqWidth, charWidth);
+}
+
+void ProfinmanComboLayout::unpackEntry(const char* fromBuff, uintptr_t* seqInd, uintptr_t* charInd){
+	*seqInd = be2natN(fromBuff, seqWidth);
+	*charInd = be2natN(fromBuff + seqWidth, charWidth);
+}
+
+ProfinmanComboSource::~ProfinmanComboSource(){}
+
+ProfinmanFileComboSource::ProfinmanFileComboSource(const char* comName, BlockCompCache* useCache) : comLayout(comName){
+	std::string cbaseFN(comName);
+	std::string cblockFN = cbaseFN + ".blk";
+	comComp = new GZipCompressionMethod();
+	try{
+		comStr = new BlockCompInStream(cbaseFN.c_str(), cblockFN.c_str(), comComp, useCache);
+	}
+	catch(std::exception& err){
+		delete(comComp);
+		throw;
+	}
+	try{
+		numEntries = comLayout.getNumEntries(comStr->getUncompressedSize());
+	}
+	catch(std::exception& err){
+		delete(comStr);
+		delete(comComp);
+		throw;
+	}
+}
+
+ProfinmanFileComboSource::~ProfinmanFileComboSource(){
+	delete(comStr);
+	delete(comComp);
+}
+
+uintptr_t ProfinmanFileComboSource::getNumEntries(){
+	return numEntries;
+}
+
+void ProfinmanFileComboSource::getEntry(uintptr_t entInd, uintptr_t* seqInd, uintptr_t* charInd){
+	char entBuff[COMBO_ENTRY_SIZE];
+	comStr->seek(comLayout.headerSize + comLayout.entrySize*entInd);
+	comStr->readBytes(entBuff, comLayout.entrySize);
+	comLayout.unpackEntry(entBuff, seqInd, charInd);
+}
+
+ProfinmanMappedComboSource::ProfinmanMappedComboSource(const char* comName) : comLayout(comName){
+	std::string cbaseFN(comName);
+	std::string cblockFN = cbaseFN + ".blk";
+	comStr = new MappedRawBlockInStream(cbaseFN.c_str(), cblockFN.c_str());
+	try{
+		numEntries = comLayout.getNumEntries(comStr->getUncompressedSize());
+	}
+	catch(std::exception& err){
+		delete(comStr);
+		throw;
+	}
+}
+
+ProfinmanMappedComboSource::~ProfinmanMappedComboSource(){
+	delete(comStr);
+}
+
+uintptr_t ProfinmanMappedComboSource::getNumEntries(){
+	return numEntries;
+}
+
+void ProfinmanMappedComboSource::getEntry(uintptr_t entInd, uintptr_t* seqInd, uintptr_t* charInd){
+	comLayout.unpackEntry(comStr->getView(comLayout.headerSize + comLayout.entrySize*entInd, comLayout.entrySize), seqInd, charInd);
+}
+
+ProfinmanResidentComboSource::ProfinmanResidentComboSource(const char* comName) : comLayout(comName){
+	std::string cbaseFN(comName);
+	std::string cblockFN = cbaseFN + ".blk";
+	GZipCompressionMethod ccompMeth;
+	BlockCompInStream comboB(cbaseFN.c_str(), cblockFN.c_str(), &ccompMeth);
+	numEntries = comLayout.getNumEntries(comboB.getUncompressedSize());
+	comLayout.skipHeader(&comboB);
+	uintptr_t totSize = numEntries * comLayout.entrySize;
+	allEnts.resize(totSize + 1);
+	if(comboB.readBytes(&(allEnts[0]), totSize) != totSize){ throw std::runtime_error("Combo file truncated."); }
+}
+
+ProfinmanResidentComboSource::~ProfinmanResidentComboSource(){}
+
+uintptr_t ProfinmanResidentComboSource::getNumEntries(){
+	return numEntries;
+}
+
+void ProfinmanResidentComboSource::getEntry(uintptr_t entInd, uintptr_t* seqInd, uintptr_t* charInd){
+	comLayout.unpackEntry(&(allEnts[comLayout.entrySize*entInd]), seqInd, charInd);
+}
+
+ProfinmanSuffixArraySearcher::ProfinmanSuffixArraySearcher(ProfinmanReferenceSource* useRef, ProfinmanComboSource* useCombo){
+	searchRef = useRef;
+	searchCombo = useCombo;
+	numSeqs = useRef->getNumEntries();
+	searchLCP = 0;
+	searchJump = 0;
+	seqOffset = 0;
+}
+
+ProfinmanSuffixArraySearcher::~ProfinmanSuffixArraySearcher(){}
+
+void ProfinmanSuffixArraySearcher::findRange(const char* lookFor, uintptr_t lookLen, uintptr_t fromEnt, uintptr_t toEnt, uintptr_t* lowEnt, uintptr_t* highEnt){
+	if(searchJump){
+		uintptr_t jumpLow;
+		uintptr_t jumpHigh;
+		searchJump->getRange(lookFor, lookLen, &jumpLow, &jumpHigh);
+		fromEnt = std::max(fromEnt, jumpLow);
+		toEnt = std::min(toEnt, jumpHigh);
+	}
+	uintptr_t lowRangeS = findBound(lookFor, lookLen, fromEnt, toEnt, false);
+	*lowEnt = lowRangeS;
+	*highEnt = findBound(lookFor, lookLen, lowRangeS, toEnt, true);
+}
+
+uintptr_t ProfinmanSuffixArraySearcher::findBound(const char* lookFor, uintptr_t lookLen, uintptr_t fromEnt, uintptr_t toEnt, bool orEqual){
+	//everything before lowI is less, everything at or after highI is not
+	uintptr_t lowI = fromEnt;
+	uintptr_t highI = toEnt;
+	//how much of the sequence the entries at lowI-1 and highI share
+	bool haveLow = false;
+	bool haveHigh = false;
+	uintptr_t lowLCP = 0;
+	uintptr_t highLCP = 0;
+	while(lowI < highI){
+		uintptr_t curTestI = lowI + (highI - lowI)/2;
+		int isLess = -1;
+		uintptr_t curLCP = std::min(lowLCP, highLCP);
+		//see if the lcp information can make the decision without looking
+		if(searchLCP){
+			if(haveLow && (lowLCP >= highLCP) && (lowLCP < SUFFIX_LCP_MAX)){
+				uintptr_t neighLCP = searchLCP->getRangeLCP(lowI-1, curTestI);
+				if(neighLCP > lowLCP){ isLess = 1; curLCP = lowLCP; }
+				else if(neighLCP < lowLCP){ isLess = 0; curLCP = neighLCP; }
+				else{ curLCP = lowLCP; }
+			}
+			else if(haveHigh && (highLCP > lowLCP) && (highLCP < SUFFIX_LCP_MAX)){
+				uintptr_t neighLCP = searchLCP->getRangeLCP(curTestI, highI);
+				if(neighLCP > highLCP){ isLess = 0; curLCP = highLCP; }
+				else if(neighLCP < highLCP){ isLess = 1; curLCP = neighLCP; }
+				else{ curLCP = highLCP; }
+			}
+		}
+		//actually compare, skipping anything known to match
+		if(isLess < 0){
+			int compRes;
+			curLCP = compareSuffix(curTestI, lookFor, lookLen, curLCP, &compRes);
+			isLess = (compRes < 0) || (orEqual && (compRes == 0));
+		}
+		//update the search bounds
+		if(isLess){
+			lowI = curTestI + 1;
+			haveLow = true;
+			lowLCP = curLCP;
+		}
+		else{
+			highI = curTestI;
+			haveHigh = true;
+			highLCP = curLCP;
+		}
+	}
+	return lowI;
+}
+
+/**
+ * Figure out whether one sequence starts with another.
+ * @param prefix The possible prefix.
+ * @param ofSeq The sequence to test.
+ * @return Whether ofSeq starts with prefix.
+ */
+bool profinmanSequenceIsPrefix(const std::pair<const char*,uintptr_t>& prefix, const std::pair<const char*,uintptr_t>& ofSeq){
+	if(prefix.second > ofSeq.second){ return false; }
+	return memcmp(prefix.first, ofSeq.first, prefix.second) == 0;
+}
+
+void ProfinmanSuffixArraySearcher::findRanges(std::vector< std::pair<const char*,uintptr_t> >* lookFor, std::vector<uintptr_t>* lowEnts, std::vector<uintptr_t>* highEnts){
+	uintptr_t numLook = lookFor->size();
+	uintptr_t numEnts = searchCombo->getNumEntries();
+	lowEnts->resize(numLook);
+	highEnts->resize(numLook);
+	//sort the sequences
+		std::vector<uintptr_t> sortOrder;
+		for(uintptr_t i = 0; i<numLook; i++){ sortOrder.push_back(i); }
+		ProfinmanSuffixArraySearchBatchCompare sortComp;
+		sortComp.lookFor = lookFor;
+		std::sort(sortOrder.begin(), sortOrder.end(), sortComp);
+	//run down the sorted sequences
+		//anything that follows a sequence comes at or after its range: anything that starts with it falls inside its range
+		std::vector<uintptr_t> prefixStack;
+		for(uintptr_t i = 0; i<numLook; i++){
+			uintptr_t curI = sortOrder[i];
+			std::pair<const char*,uintptr_t>& curLook = (*lookFor)[curI];
+			uintptr_t fromEnt = 0;
+			uintptr_t toEnt = numEnts;
+			if(i){
+				uintptr_t prevI = sortOrder[i-1];
+				fromEnt = profinmanSequenceIsPrefix((*lookFor)[prevI], curLook) ? (*lowEnts)[prevI] : (*highEnts)[prevI];
+			}
+			while(prefixStack.size() && !profinmanSequenceIsPrefix((*lookFor)[prefixStack[prefixStack.size()-1]], curLook)){
+				prefixStack.pop_back();
+			}
+			if(prefixStack.size()){
+				toEnt = (*highEnts)[prefixStack[prefixStack.size()-1]];
+			}
+			findRange(curLook.first, curLook.second, fromEnt, toEnt, &((*lowEnts)[curI]), &((*highEnts)[curI]));
+			prefixStack.push_back(curI);
+		}
+}
+
+void ProfinmanSuffixArraySearcher::searchBatch(std::vector< std::pair<const char*,uintptr_t> >* lookFor, uintptr_t firstInd, bool sortFirst, std::vector<char>* outputTo, bool asText){
+	std::vector<uintptr_t> lowEnts;
+	std::vector<uintptr_t> highEnts;
+	findBatchRanges(lookFor, sortFirst, &lowEnts, &highEnts);
+	//report in the original order
+	for(uintptr_t i = 0; i<lookFor->size(); i++){
+		reportRange(firstInd + i, (*lookFor)[i].second, lowEnts[i], highEnts[i], outputTo, asText);
+	}
+}
+
+void ProfinmanSuffixArraySearcher::findBatchRanges(std::vector< std::pair<const char*,uintptr_t> >* lookFor, bool sortFirst, std::vector<uintptr_t>* lowEnts, std::vector<uintptr_t>* highEnts){
+	if(sortFirst){
+		findRanges(lookFor, lowEnts, highEnts);
+		return;
+	}
+	uintptr_t numLook = lookFor->size();
+	lowEnts->resize(numLook);
+	highEnts->resize(numLook);
+	uintptr_t numEnts = searchCombo->getNumEntries();
+	for(uintptr_t i = 0; i<numLook; i++){
+		findRange((*lookFor)[i].first, (*lookFor)[i].second, 0, numEnts, &((*lowEnts)[i]), &((*highEnts)[i]));
+	}
+}
+
+void ProfinmanSuffixArraySearcher::reportRange(uintptr_t lookInd, uintptr_t lookLen, uintptr_t lowEnt, uintptr_t highEnt, std::vector<char>* outputTo, bool asText){
+	for(uintptr_t comboI = lowEnt; comboI < highEnt; comboI++){
+		uintptr_t seqInd;
+		uintptr_t charIndS;
+		searchCombo->getEntry(comboI, &seqInd, &charIndS);
+		outputSearchResult(lookInd, seqInd + seqOffset, charIndS, charIndS + lookLen, outputTo, asText);
+	}
+}
+
+uintptr_t ProfinmanSuffixArraySearcher::compareSuffix(uintptr_t entInd, const char* lookFor, uintptr_t lookLen, uintptr_t startAt, int* compRes){
+	//get the entry location
+	uintptr_t seqInd;
+	uintptr_t charIndS;
+	searchCombo->getEntry(entInd, &seqInd, &charIndS);
+	if(seqInd >= numSeqs){ throw std::runtime_error("Suffix array file does not match reference."); }
+	uintptr_t curSeqLen = searchRef->getEntryLength(seqInd);
+	if(charIndS > curSeqLen){ throw std::runtime_error("Suffix array file does not match reference."); }
+	//only get what has not already been matched
+	uintptr_t sufLen = curSeqLen - charIndS;
+	uintptr_t compLen = std::min(sufLen, lookLen);
+	if(startAt >= compLen){
+		*compRes = (sufLen < lookLen) ? -1 : 0;
+		return compLen;
+	}
+	const char* refSeq = searchRef->getEntrySubsequence(seqInd, charIndS + startAt, charIndS + compLen);
+	for(uintptr_t i = startAt; i<compLen; i++){
+		unsigned char refC = refSeq[i - startAt];
+		unsigned char lookC = lookFor[i];
+		if(refC != lookC){
+			*compRes = (refC < lookC) ? -1 : 1;
+			return i;
+		}
+	}
+	*compRes = (sufLen < lookLen) ? -1 : 0;
+	return compLen;
 }
 
 ProfinmanMergeReference::ProfinmanMergeReference(){
@@ -303,11 +1385,14 @@ ProfinmanMergeReference::ProfinmanMergeReference(){
 	comBName = 0;
 	referenceName = 0;
 	comboName = 0;
-	mySummary = "  Merge two suffix arrays (and their gail files).";
-	myMainDoc = "Usage: profinman mrgsa [OPTION]\n"
-		"Merge two suffix arrays.\n"
+	buildLCP = false;
+	jumpLen = 0;
+	maxRam = 500000000;
+	mySummary = "  Merge suffix arrays (and their gail files).";
+	myMainDoc = "Usage: profinman mergesa [OPTION]\n"
+		"Merge two or more suffix arrays.\n"
 		"The OPTIONS are:\n";
-	myVersionDoc = "ProFinMan mrgsa 1.0";
+	myVersionDoc = "ProFinMan mergesa 1.0";
 	myCopyrightDoc = "Copyright (C) 2020 UNT HSC Center for Human Identification";
 	ArgumentParserStrMeta refAMeta("Reference A");
 		refAMeta.isFile = true;
@@ -323,7 +1408,7 @@ ProfinmanMergeReference::ProfinmanMergeReference(){
 		addStringOption("--comA", &comAName, 0, "    The first suffix array.\n    --comA File.gail.sa\n", &comAMeta);
 	ArgumentParserStrMeta comBMeta("Combo B");
 		comBMeta.isFile = true;
-		comBMeta.fileExts.insert(".gail");
+		comBMeta.fileExts.insert(".gail.sa");
 		addStringOption("--comB", &comBName, 0, "    The second suffix array.\n    --comB File.gail.sa\n", &comBMeta);
 	ArgumentParserStrMeta dumpMeta("Reference Out File");
 		dumpMeta.isFile = true;
@@ -335,6 +1420,20 @@ ProfinmanMergeReference::ProfinmanMergeReference(){
 		comboMeta.fileWrite = true;
 		comboMeta.fileExts.insert(".gail.sa");
 		addStringOption("--out", &comboName, 0, "    The place to write the merged suffix array.\n    --ref File.gail.sa\n", &comboMeta);
+	ArgumentParserBoolMeta lcpMeta("Build LCP File");
+		addBooleanFlag("--lcp", &buildLCP, 1, "    Also write an lcp file (File.gail.sa.lcp) to speed up searches.\n", &lcpMeta);
+	ArgumentParserIntMeta jumpMeta("Jump Table Prefix");
+		addIntegerOption("--jump", &jumpLen, 0, "    Also write a jump table (File.gail.sa.jump) for prefixes of this length.\n    --jump 3\n", &jumpMeta);
+	ArgumentParserStrVecMeta refMMeta("More References");
+		refMMeta.isFile = true;
+		refMMeta.fileExts.insert(".gail");
+		addStringVectorOption("--refM", &refMNames, 0, "    Another reference to merge in (after A and B).\n    Can be given multiple times, paired in order with --comM.\n    --refM File.gail\n", &refMMeta);
+	ArgumentParserStrVecMeta comMMeta("More Combos");
+		comMMeta.isFile = true;
+		comMMeta.fileExts.insert(".gail.sa");
+		addStringVectorOption("--comM", &comMNames, 0, "    The suffix array for another reference to merge in.\n    --comM File.gail.sa\n", &comMMeta);
+	ArgumentParserIntMeta ramMeta("RAM Usage");
+		addIntegerOption("--ram", &maxRam, 0, "    How much sequence to hold in memory.\n    Both references are loaded whole if they fit, otherwise recent sequences are kept.\n    --ram 500000000\n", &ramMeta);
 }
 
 ProfinmanMergeReference::~ProfinmanMergeReference(){
@@ -349,154 +1448,480 @@ int ProfinmanMergeReference::posteriorCheck(){
 		argumentError = "Need to specify an output suffix array file.";
 		return 1;
 	}
-	if(!refAName || (strlen(refAName)==0)){
+	//the named pair go first
+	if(refBName && strlen(refBName)){ refMNames.insert(refMNames.begin(), refBName); }
+	if(refAName && strlen(refAName)){ refMNames.insert(refMNames.begin(), refAName); }
+	if(comBName && strlen(comBName)){ comMNames.insert(comMNames.begin(), comBName); }
+	if(comAName && strlen(comAName)){ comMNames.insert(comMNames.begin(), comAName); }
+	if(refMNames.size() < 2){
 		argumentError = "Need to specify references to merge.";
 		return 1;
 	}
-	if(!refBName || (strlen(refBName)==0)){
-		argumentError = "Need to specify references to merge.";
+	if(comMNames.size() != refMNames.size()){
+		argumentError = "Need to specify suffix arrays to merge (one per reference).";
 		return 1;
 	}
-	if(!comAName || (strlen(comAName)==0)){
-		argumentError = "Need to specify suffix arrays to merge.";
+	if(jumpLen < 0){
+		argumentError = "Jump table prefix length must be non-negative.";
 		return 1;
 	}
-	if(!comBName || (strlen(comBName)==0)){
-		argumentError = "Need to specify suffix arrays to merge.";
+	if(maxRam <= 0){
+		argumentError = "Will use at least one byte of ram.";
 		return 1;
 	}
 	return 0;
 }
 
-void ProfinmanMergeReference::runThing(){
-	//open the source references
-		std::string rbaseAFN(refAName);
-		std::string rblockAFN = rbaseAFN + ".blk";
-		std::string rfastiAFN = rbaseAFN + ".fai";
-		GZipCompressionMethod rcompAMeth;
-		BlockCompInStream rblkAComp(rbaseAFN.c_str(), rblockAFN.c_str(), &rcompAMeth);
-		GailAQSequenceReader gfaInA(&rblkAComp, rfastiAFN.c_str());
-		uintptr_t numSeqsAG = gfaInA.getNumEntries();
-		
-		std::string rbaseBFN(refBName);
-		std::string rblockBFN = rbaseBFN + ".blk";
-		std::string rfastiBFN = rbaseBFN + ".fai";
-		GZipCompressionMethod rcompBMeth;
-		BlockCompInStream rblkBComp(rbaseBFN.c_str(), rblockBFN.c_str(), &rcompBMeth);
-		GailAQSequenceReader gfaInB(&rblkBComp, rfastiBFN.c_str());
-		//uintptr_t numSeqsBG = gfaInB.getNumEntries();
-	//open the source combos
-		std::string cbaseAFN(comAName);
-		std::string cblockAFN = cbaseAFN + ".blk";
-		GZipCompressionMethod ccompAMeth;
-		BlockCompInStream comboA(cbaseAFN.c_str(), cblockAFN.c_str(), &ccompAMeth);
-		uintptr_t comboAEnts = comboA.getUncompressedSize();
-		if(comboAEnts % COMBO_ENTRY_SIZE){ throw std::runtime_error("Malformed combo file."); }
-		comboAEnts = comboAEnts / COMBO_ENTRY_SIZE;
-		
-		std::string cbaseBFN(comBName);
-		std::string cblockBFN = cbaseBFN + ".blk";
-		GZipCompressionMethod ccompBMeth;
-		BlockCompInStream comboB(cbaseBFN.c_str(), cblockBFN.c_str(), &ccompBMeth);
-		uintptr_t comboBEnts = comboB.getUncompressedSize();
-		if(comboBEnts % COMBO_ENTRY_SIZE){ throw std::runtime_error("Malformed combo file."); }
-		comboBEnts = comboBEnts / COMBO_ENTRY_SIZE;
-	//open the outputs
-		std::string baseFN(referenceName);
-		std::string blockFN = baseFN + ".blk";
-		std::string fastiFN = baseFN + ".fai";
-		GZipCompressionMethod compFAMeth;
-		BlockCompOutStream blkCompFA(0, 0x010000, baseFN.c_str(), blockFN.c_str(), &compFAMeth);
-		GailAQSequenceWriter gfaOut(0, &blkCompFA, fastiFN.c_str());
-		
-		GZipCompressionMethod comboCompMeth;
-		std::string comFN(comboName);
-		std::string comBlkFN = comFN + ".blk";
-		BlockCompOutStream blkComp(0, 0x000400, comFN.c_str(), comBlkFN.c_str(), &comboCompMeth);
-	//merge the sequences
-		while(gfaInA.readNextEntry()){
-			gfaOut.nextNameLen = gfaInA.lastReadNameLen;
-			gfaOut.nextShortNameLen = gfaInA.lastReadShortNameLen;
-			gfaOut.nextName = gfaInA.lastReadName;
-			gfaOut.nextSeqLen = gfaInA.lastReadSeqLen;
-			gfaOut.nextSeq = gfaInA.lastReadSeq;
-			gfaOut.nextHaveQual = gfaInA.lastReadHaveQual;
-			gfaOut.nextQual = gfaInA.lastReadQual;
-			gfaOut.writeNextEntry();
-		}
-		while(gfaInB.readNextEntry()){
-			gfaOut.nextNameLen = gfaInB.lastReadNameLen;
-			gfaOut.nextShortNameLen = gfaInB.lastReadShortNameLen;
-			gfaOut.nextName = gfaInB.lastReadName;
-			gfaOut.nextSeqLen = gfaInB.lastReadSeqLen;
-			gfaOut.nextSeq = gfaInB.lastReadSeq;
-			gfaOut.nextHaveQual = gfaInB.lastReadHaveQual;
-			gfaOut.nextQual = gfaInB.lastReadQual;
-			gfaOut.writeNextEntry();
-		}
-	//prime the stuff
-		char curEntA[COMBO_ENTRY_SIZE];
-		char curEntB[COMBO_ENTRY_SIZE];
-		uintptr_t numByteA = comboA.readBytes(curEntA, COMBO_ENTRY_SIZE);
-		uintptr_t numByteB = comboB.readBytes(curEntB, COMBO_ENTRY_SIZE);
-	//load and merge the combos
-		uintptr_t lastLoadA = -1;
-		uintptr_t lastLoadB = -1;
-		while(numByteA && numByteB){
-			uintptr_t seqIndA = be2nat64(curEntA);
-			uintptr_t charIndSA = be2nat64(curEntA+8);
-			uintptr_t seqIndB = be2nat64(curEntB);
-			uintptr_t charIndSB = be2nat64(curEntB+8);
-			if(seqIndA != lastLoadA){
-				uintptr_t readTo = gfaInA.getEntryLength(seqIndA);
-				gfaInA.getEntrySubsequence(seqIndA, 0, readTo);
-				lastLoadA = seqIndA;
+/**One of the suffix arrays being merged.*/
+class ProfinmanMergeReferenceInput{
+public:
+	/**
+	 * Open up a suffix array.
+	 * @param comName The combo file.
+	 * @param useSource The sequences of its reference: will be deleted with this.
+	 * @param seqOffset The index of its first sequence in the merged reference.
+	 */
+	ProfinmanMergeReferenceInput(const char* comName, ProfinmanReferenceSource* useSource, uintptr_t seqOffset) : layout(comName){
+		source = useSource;
+		this->seqOffset = seqOffset;
+		haveEnt = false;
+		comboIn = 0;
+		try{
+			std::string cbaseFN(comName);
+			std::string cblockFN = cbaseFN + ".blk";
+			comboIn = new BlockCompInStream(cbaseFN.c_str(), cblockFN.c_str(), &comboComp);
+			layout.getNumEntries(comboIn->getUncompressedSize());
+			layout.skipHeader(comboIn);
+		}
+		catch(std::exception& err){
+			if(comboIn){ delete(comboIn); }
+			delete(source);
+			throw;
+		}
+	}
+	/**Clean up.*/
+	~ProfinmanMergeReferenceInput(){
+		delete(comboIn);
+		delete(source);
+	}
+	/**
+	 * Move to the next suffix.
+	 * @return Whether there was one.
+	 */
+	bool advance(){
+		char curEnt[COMBO_ENTRY_SIZE];
+		uintptr_t numByte = comboIn->readBytes(curEnt, layout.entrySize);
+		haveEnt = numByte != 0;
+		if(!haveEnt){ return false; }
+		if(numByte != layout.entrySize){ throw std::runtime_error("Truncated combo file."); }
+		layout.unpackEntry(curEnt, &seqInd, &charInd);
+		if(seqInd >= source->getNumEntries()){ throw std::runtime_error("Suffix array does not match sequence file."); }
+		uintptr_t seqLen = source->getEntryLength(seqInd);
+		if(charInd > seqLen){ throw std::runtime_error("Suffix array does not match sequence file."); }
+		curSeq = source->getEntrySubsequence(seqInd, charInd, seqLen);
+		curLen = seqLen - charInd;
+		return true;
+	}
+	/**The compression of the combo file.*/
+	GZipCompressionMethod comboComp;
+	/**The combo file.*/
+	BlockCompInStream* comboIn;
+	/**How the combo file is laid out.*/
+	ProfinmanComboLayout layout;
+	/**The sequences.*/
+	ProfinmanReferenceSource* source;
+	/**The index of the first sequence in the merged reference.*/
+	uintptr_t seqOffset;
+	/**Whether there is a current suffix.*/
+	bool haveEnt;
+	/**The sequence of the current suffix.*/
+	uintptr_t seqInd;
+	/**The start of the current suffix.*/
+	uintptr_t charInd;
+	/**The text of the current suffix.*/
+	const char* curSeq;
+	/**The length of the current suffix.*/
+	uintptr_t curLen;
+};
+
+/**Pick the smallest suffix among many suffix arrays (a loser tree).*/
+class ProfinmanMergeReferenceTree{
+public:
+	/**
+	 * Set up a tree.
+	 * @param allIn The inputs: must all be primed.
+	 */
+	ProfinmanMergeReferenceTree(std::vector<ProfinmanMergeReferenceInput*>* allIn){
+		inputs = allIn;
+		numIn = allIn->size();
+		losers.resize(numIn);
+		winner = playGame(1);
+	}
+	/**
+	 * Compare the current suffixes of two inputs: finished inputs come last, ties go to the earlier input.
+	 * @param inA The first input.
+	 * @param inB The second input.
+	 * @return Whether inA comes before inB.
+	 */
+	bool inputBefore(uintptr_t inA, uintptr_t inB){
+		ProfinmanMergeReferenceInput* curA = (*inputs)[inA];
+		ProfinmanMergeReferenceInput* curB = (*inputs)[inB];
+		if(!(curA->haveEnt && curB->haveEnt)){ return curA->haveEnt || (!(curB->haveEnt) && (inA < inB)); }
+		int compV = memcmp(curA->curSeq, curB->curSeq, std::min(curA->curLen, curB->curLen));
+		if(compV){ return compV < 0; }
+		if(curA->curLen != curB->curLen){ return curA->curLen < curB->curLen; }
+		return inA < inB;
+	}
+	/**
+	 * Set up the losers under a node.
+	 * @param nodeI The node: leaves are numIn past their input.
+	 * @return The winner under the node.
+	 */
+	uintptr_t playGame(uintptr_t nodeI){
+		if(nodeI >= numIn){ return nodeI - numIn; }
+		uintptr_t winA = playGame(2*nodeI);
+		uintptr_t winB = playGame(2*nodeI + 1);
+		if(inputBefore(winB, winA)){
+			losers[nodeI] = winA;
+			return winB;
+		}
+		losers[nodeI] = winB;
+		return winA;
+	}
+	/**
+	 * The winner has moved on: replay its path.
+	 */
+	void replay(){
+		uintptr_t curWin = winner;
+		uintptr_t nodeI = (curWin + numIn) / 2;
+		while(nodeI){
+			if(inputBefore(losers[nodeI], curWin)){
+				std::swap(losers[nodeI], curWin);
 			}
-			if(seqIndB != lastLoadB){
-				uintptr_t readTo = gfaInB.getEntryLength(seqIndB);
-				gfaInB.getEntrySubsequence(seqIndB, 0, readTo);
-				lastLoadB = seqIndB;
+			nodeI = nodeI / 2;
+		}
+		winner = curWin;
+	}
+	/**The inputs.*/
+	std::vector<ProfinmanMergeReferenceInput*>* inputs;
+	/**The number of inputs.*/
+	uintptr_t numIn;
+	/**The loser at each internal node.*/
+	std::vector<uintptr_t> losers;
+	/**The input with the smallest suffix.*/
+	uintptr_t winner;
+};
+
+void ProfinmanMergeReference::runThing(){
+	uintptr_t numIn = refMNames.size();
+	//merge the sequences, noting where each reference starts
+		std::vector<uintptr_t> seqOffsets;
+		uintptr_t maxSeqLen = 0;
+		uintptr_t totSeqLen = 0;
+		{
+			std::string baseFN(referenceName);
+			std::string blockFN = baseFN + ".blk";
+			std::string fastiFN = baseFN + ".fai";
+			GZipCompressionMethod compFAMeth;
+			BlockCompOutStream blkCompFA(0, 0x010000, baseFN.c_str(), blockFN.c_str(), &compFAMeth);
+			GailAQSequenceWriter gfaOut(0, &blkCompFA, fastiFN.c_str());
+			ProfinmanNameTableWriter namOut(baseFN.c_str());
+			uintptr_t numSeqs = 0;
+			for(uintptr_t i = 0; i<numIn; i++){
+				seqOffsets.push_back(numSeqs);
+				std::string rbaseFN(refMNames[i]);
+				std::string rblockFN = rbaseFN + ".blk";
+				std::string rfastiFN = rbaseFN + ".fai";
+				GZipCompressionMethod rcompMeth;
+				BlockCompInStream rblkComp(rbaseFN.c_str(), rblockFN.c_str(), &rcompMeth);
+				GailAQSequenceReader gfaIn(&rblkComp, rfastiFN.c_str());
+				while(gfaIn.readNextEntry()){
+					gfaOut.nextNameLen = gfaIn.lastReadNameLen;
+					gfaOut.nextShortNameLen = gfaIn.lastReadShortNameLen;
+					gfaOut.nextName = gfaIn.lastReadName;
+					gfaOut.nextSeqLen = gfaIn.lastReadSeqLen;
+					gfaOut.nextSeq = gfaIn.lastReadSeq;
+					gfaOut.nextHaveQual = gfaIn.lastReadHaveQual;
+					gfaOut.nextQual = gfaIn.lastReadQual;
+					gfaOut.writeNextEntry();
+					namOut.addName(gfaIn.lastReadName, gfaIn.lastReadNameLen);
+					maxSeqLen = std::max(maxSeqLen, gfaIn.lastReadSeqLen);
+					totSeqLen += gfaIn.lastReadSeqLen;
+					numSeqs++;
+				}
 			}
-			if(charIndSA > gfaInA.lastReadSeqLen){ throw std::runtime_error("Suffix array does not match sequence file."); }
-			if(charIndSB > gfaInB.lastReadSeqLen){ throw std::runtime_error("Suffix array does not match sequence file."); }
-			const char* comSeqA = gfaInA.lastReadSeq + charIndSA;
-			const char* comSeqB = gfaInB.lastReadSeq + charIndSB;
-			uintptr_t lenSubA = gfaInA.lastReadSeqLen - charIndSA;
-			uintptr_t lenSubB = gfaInB.lastReadSeqLen - charIndSB;
-			uintptr_t comCompL = std::min(lenSubA, lenSubB);
-			int compV = memcmp(comSeqA, comSeqB, comCompL);
-			compV = compV ? compV : ((lenSubA < lenSubB) ? -1 : (lenSubA > lenSubB ? 1 : 0));
-			if(compV > 0){
-				blkComp.writeBytes(curEntA, COMBO_ENTRY_SIZE);
-				numByteA = comboA.readBytes(curEntA, COMBO_ENTRY_SIZE);
+			seqOffsets.push_back(numSeqs);
+			namOut.finish();
+		}
+	//merge the suffixes
+	{
+		//open the source combos: suffix array order jumps all over the sequences, so avoid going back to the file
+			bool allResident = (totSeqLen + sizeof(uintptr_t)*(seqOffsets[numIn] + numIn)) <= (uintptr_t)maxRam;
+			std::vector<ProfinmanMergeReferenceInput*> allIn;
+			#define MERGE_INPUT_CLEANUP for(uintptr_t i = 0; i<allIn.size(); i++){ delete(allIn[i]); }
+		try{
+			for(uintptr_t i = 0; i<numIn; i++){
+				ProfinmanReferenceSource* curSrc;
+				if(allResident){ curSrc = new ProfinmanResidentReferenceSource(refMNames[i]); }
+				else{ curSrc = new ProfinmanCachedReferenceSource(refMNames[i], std::max((uintptr_t)1, maxRam / numIn)); }
+				allIn.push_back(new ProfinmanMergeReferenceInput(comMNames[i], curSrc, seqOffsets[i]));
+				if(curSrc->getNumEntries() != (seqOffsets[i+1] - seqOffsets[i])){ throw std::runtime_error("Reference changed while merging."); }
 			}
-			else{
-				nat2be64(be2nat64(curEntB+8)+numSeqsAG, curEntB+8);
-				blkComp.writeBytes(curEntB, COMBO_ENTRY_SIZE);
-				numByteB = comboB.readBytes(curEntB, COMBO_ENTRY_SIZE);
+		//open the output
+			GZipCompressionMethod comboCompMeth;
+			std::string comFN(comboName);
+			std::string comBlkFN = comFN + ".blk";
+			BlockCompOutStream blkComp(0, 0x000400, comFN.c_str(), comBlkFN.c_str(), &comboCompMeth);
+			ProfinmanComboLayout layoutO(seqOffsets[numIn], maxSeqLen);
+			layoutO.writeHeader(&blkComp);
+		//run the tournament
+			for(uintptr_t i = 0; i<numIn; i++){ allIn[i]->advance(); }
+			ProfinmanMergeReferenceTree pickTree(&allIn);
+			char curEntO[COMBO_ENTRY_SIZE];
+			while(allIn[pickTree.winner]->haveEnt){
+				ProfinmanMergeReferenceInput* curWin = allIn[pickTree.winner];
+				layoutO.packEntry(curWin->seqInd + curWin->seqOffset, curWin->charInd, curEntO);
+				blkComp.writeBytes(curEntO, layoutO.entrySize);
+				curWin->advance();
+				pickTree.replay();
 			}
 		}
-		while(numByteA){
-			if(numByteA != COMBO_ENTRY_SIZE){
-				throw std::runtime_error("Truncated combo file.");
-			}
-			blkComp.writeBytes(curEntA, COMBO_ENTRY_SIZE);
-			numByteA = comboA.readBytes(curEntA, COMBO_ENTRY_SIZE);
+		catch(std::exception& err){
+			MERGE_INPUT_CLEANUP
+			throw;
 		}
-		while(numByteB){
-			if(numByteB != COMBO_ENTRY_SIZE){
-				throw std::runtime_error("Truncated combo file.");
-			}
-			nat2be64(be2nat64(curEntB+8)+numSeqsAG, curEntB+8);
-			blkComp.writeBytes(curEntB, COMBO_ENTRY_SIZE);
-			numByteB = comboB.readBytes(curEntB, COMBO_ENTRY_SIZE);
+			MERGE_INPUT_CLEANUP
+	}
+	//build the side files
+		if(buildLCP || jumpLen){
+			ThreadPool sideThreads(1);
+			profinmanBuildSuffixSideFiles(referenceName, comboName, buildLCP, jumpLen, maxRam, 1, &sideThreads);
 		}
 }
 
+ProfinmanCompactReference::ProfinmanCompactReference(){
+	baseRefName = 0;
+	baseComName = 0;
+	referenceName = 0;
+	comboName = 0;
+	buildLCP = false;
+	jumpLen = 0;
+	maxRam = 500000000;
+	mySummary = "  Fold the deltas appended to a suffix array into a new one.";
+	myMainDoc = "Usage: profinman compactsa [OPTION]\n"
+		"Merge a suffix array and all the deltas appended to it (safa --append).\n"
+		"The OPTIONS are:\n";
+	myVersionDoc = "ProFinMan compactsa 1.0";
+	myCopyrightDoc = "Copyright (C) 2020 UNT HSC Center for Human Identification";
+	ArgumentParserStrMeta refMeta("Reference File");
+		refMeta.isFile = true;
+		refMeta.fileExts.insert(".gail");
+		addStringOption("--ref", &baseRefName, 0, "    The reference the deltas were appended to.\n    --ref File.gail\n", &refMeta);
+	ArgumentParserStrMeta comMeta("Suffix Array File");
+		comMeta.isFile = true;
+		comMeta.fileExts.insert(".gail.sa");
+		addStringOption("--sa", &baseComName, 0, "    The suffix array the deltas were appended to.\n    --sa File.gail.sa\n", &comMeta);
+	ArgumentParserStrMeta dumpMeta("Reference Out File");
+		dumpMeta.isFile = true;
+		dumpMeta.fileWrite = true;
+		dumpMeta.fileExts.insert(".gail");
+		addStringOption("--outref", &referenceName, 0, "    The place to write the merged reference.\n    --outref File.gail\n", &dumpMeta);
+	ArgumentParserStrMeta comboMeta("Combo Out File");
+		comboMeta.isFile = true;
+		comboMeta.fileWrite = true;
+		comboMeta.fileExts.insert(".gail.sa");
+		addStringOption("--out", &comboName, 0, "    The place to write the merged suffix array.\n    --out File.gail.sa\n", &comboMeta);
+	ArgumentParserBoolMeta lcpMeta("Build LCP File");
+		addBooleanFlag("--lcp", &buildLCP, 1, "    Also write an lcp file (File.gail.sa.lcp) to speed up searches.\n", &lcpMeta);
+	ArgumentParserIntMeta jumpMeta("Jump Table Prefix");
+		addIntegerOption("--jump", &jumpLen, 0, "    Also write a jump table (File.gail.sa.jump) for prefixes of this length.\n    --jump 3\n", &jumpMeta);
+	ArgumentParserIntMeta ramMeta("RAM Usage");
+		addIntegerOption("--ram", &maxRam, 0, "    How much sequence to hold in memory.\n    --ram 500000000\n", &ramMeta);
+}
+
+ProfinmanCompactReference::~ProfinmanCompactReference(){
+}
+
+int ProfinmanCompactReference::posteriorCheck(){
+	if(!baseRefName || (strlen(baseRefName)==0)){
+		argumentError = "Need to specify the reference to compact.";
+		return 1;
+	}
+	if(!baseComName || (strlen(baseComName)==0)){
+		argumentError = "Need to specify the suffix array to compact.";
+		return 1;
+	}
+	if(!referenceName || (strlen(referenceName)==0)){
+		argumentError = "Need to specify an output reference.";
+		return 1;
+	}
+	if(!comboName || (strlen(comboName)==0)){
+		argumentError = "Need to specify an output suffix array file.";
+		return 1;
+	}
+	if((strcmp(baseRefName, referenceName)==0) || (strcmp(baseComName, comboName)==0)){
+		argumentError = "Compaction must write to new files.";
+		return 1;
+	}
+	if(jumpLen < 0){
+		argumentError = "Jump table prefix length must be non-negative.";
+		return 1;
+	}
+	if(maxRam <= 0){
+		argumentError = "Will use at least one byte of ram.";
+		return 1;
+	}
+	return 0;
+}
+
+void ProfinmanCompactReference::runThing(){
+	std::vector<std::string> allRefs;
+	std::vector<std::string> allComs;
+	allRefs.push_back(baseRefName);
+	allComs.push_back(baseComName);
+	profinmanReadDeltaList(baseComName, &allRefs, &allComs);
+	for(uintptr_t i = 1; i<allRefs.size(); i++){
+		if(profinmanSamePath(allRefs[i].c_str(), referenceName) || profinmanSamePath(allComs[i].c_str(), comboName)){ throw std::runtime_error("Compaction must write to new files."); }
+	}
+	//the merge does the real work
+	ProfinmanMergeReference doMerge;
+	for(uintptr_t i = 0; i<allRefs.size(); i++){
+		doMerge.refMNames.push_back(&(allRefs[i][0]));
+		doMerge.comMNames.push_back(&(allComs[i][0]));
+	}
+	doMerge.referenceName = referenceName;
+	doMerge.comboName = comboName;
+	doMerge.buildLCP = buildLCP;
+	doMerge.jumpLen = jumpLen;
+	doMerge.maxRam = maxRam;
+	doMerge.runThing();
+}
+
 
 //*****************************************************************************
 //BUILDING (is a bastard)
 
+/**How the entries of the working files of a build are stored: sequence index, character index, rank and next rank, all big-endian.*/
+class ProfinmanComboSortLayout{
+public:
+	/**
+	 * Set up a layout big enough for a reference.
+	 * @param numString The number of sequences.
+	 * @param maxLen The length of the longest sequence.
+	 * @param totalLen The total number of characters.
+	 */
+	ProfinmanComboSortLayout(uintptr_t numString, uintptr_t maxLen, uintptr_t totalLen);
+	/**
+	 * Pack an entry.
+	 * @param seqInd The sequence index.
+	 * @param charInd The character index.
+	 * @param rank The rank.
+	 * @param comp The next rank.
+	 * @param toBuff The place to put it.
+	 */
+	void packEntry(uintptr_t seqInd, uintptr_t charInd, uintptr_t rank, uintptr_t comp, char* toBuff);
+	/**
+	 * Get the sequence index of an entry.
+	 * @param fromBuff The entry.
+	 * @return The sequence index.
+	 */
+	uintptr_t getSeq(const char* fromBuff);
+	/**
+	 * Get the character index of an entry.
+	 * @param fromBuff The entry.
+	 * @return The character index.
+	 */
+	uintptr_t getChar(const char* fromBuff);
+	/**
+	 * Get the rank of an entry.
+	 * @param fromBuff The entry.
+	 * @return The rank.
+	 */
+	uintptr_t getRank(const char* fromBuff);
+	/**
+	 * Get the next rank of an entry.
+	 * @param fromBuff The entry.
+	 * @return The next rank.
+	 */
+	uintptr_t getComp(const char* fromBuff);
+	/**
+	 * Set the rank of an entry.
+	 * @param rank The rank.
+	 * @param toBuff The entry.
+	 */
+	void setRank(uintptr_t rank, char* toBuff);
+	/**
+	 * Set the next rank of an entry.
+	 * @param comp The next rank.
+	 * @param toBuff The entry.
+	 */
+	void setComp(uintptr_t comp, char* toBuff);
+	/**The number of bytes for the sequence index.*/
+	int seqWidth;
+	/**The number of bytes for the character index.*/
+	int charWidth;
+	/**The number of bytes for the rank and next rank.*/
+	int rankWidth;
+	/**The offset to the rank.*/
+	uintptr_t rankOffset;
+	/**The offset to the next rank.*/
+	uintptr_t compOffset;
+	/**The number of bytes in an entry.*/
+	uintptr_t entrySize;
+	/**The next rank that marks an entry as in its final position.*/
+	uintptr_t finishMark;
+	/**The key for sorting by rank.*/
+	PackedSuffixSortKey rankKey;
+	/**The key for sorting by index.*/
+	PackedSuffixSortKey indexKey;
+};
+
+ProfinmanComboSortLayout::ProfinmanComboSortLayout(uintptr_t numString, uintptr_t maxLen, uintptr_t totalLen){
+	seqWidth = profinmanComboBytesFor(numString ? (numString - 1) : 0);
+	charWidth = profinmanComboBytesFor(maxLen);
+	//ranks start as characters, then become positions: leave room for the finish mark
+	rankWidth = profinmanComboBytesFor(std::max(totalLen, (uintptr_t)256) + 1);
+	rankOffset = seqWidth + charWidth;
+	compOffset = rankOffset + rankWidth;
+	entrySize = compOffset + rankWidth;
+	finishMark = (rankWidth == 8) ? (uintptr_t)-1 : ((((uintptr_t)1) << (8*rankWidth)) - 1);
+	rankKey.keyOffset = rankOffset;
+	rankKey.keyLength = 2*rankWidth;
+	indexKey.keyOffset = 0;
+	indexKey.keyLength = rankOffset;
+}
+
+void ProfinmanComboSortLayout::packEntry(uintptr_t seqInd, uintptr_t charInd, uintptr_t rank, uintptr_t comp, char* toBuff){
+	nat2beN(seqInd, toBuff, seqWidth);
+	nat2beN(charInd, toBuff + seqWidth, charWidth);
+	nat2beN(rank, toBuff + rankOffset, rankWidth);
+	nat2beN(comp, toBuff + compOffset, rankWidth);
+}
+
+uintptr_t ProfinmanComboSortLayout::getSeq(const char* fromBuff){
+	return be2natN(fromBuff, seqWidth);
+}
+
+uintptr_t ProfinmanComboSortLayout::getChar(const char* fromBuff){
+	return be2natN(fromBuff + seqWidth, charWidth);
+}
+
+uintptr_t ProfinmanComboSortLayout::getRank(const char* fromBuff){
+	return be2natN(fromBuff + rankOffset, rankWidth);
+}
+
+uintptr_t ProfinmanComboSortLayout::getComp(const char* fromBuff){
+	return be2natN(fromBuff + compOffset, rankWidth);
+}
+
+void ProfinmanComboSortLayout::setRank(uintptr_t rank, char* toBuff){
+	nat2beN(rank, toBuff + rankOffset, rankWidth);
+}
+
+void ProfinmanComboSortLayout::setComp(uintptr_t comp, char* toBuff){
+	nat2beN(comp, toBuff + compOffset, rankWidth);
+}
+
 /**Thing to pass when sorting.*/
 class ProfinmanBuildReferenceSortUni{
 public:
@@ -529,6 +1954,8 @@ public:
 /**Uniform for the initial make task.*/
 class ProfinmanBuildReferenceInitUni{
 public:
+	/**The layout of the entries.*/
+	ProfinmanComboSortLayout* useLayout;
 	/**Get things to turn into output*/
 	ThreadProdComCollector<ProfinmanBuildReferenceInitTask>* makeCache;
 	/**The place to output.*/
@@ -540,26 +1967,21 @@ public:
 void profinmanBuildReferenceInitMakeTask(void* myUni){
 	std::vector<char> initDump;
 	ProfinmanBuildReferenceInitUni* myUn = (ProfinmanBuildReferenceInitUni*)myUni;
+	ProfinmanComboSortLayout* useLayout = myUn->useLayout;
 	ProfinmanBuildReferenceInitTask* curDo = myUn->makeCache->getThing();
 	while(curDo){
 		std::string* forSeq = &(curDo->forSeq);
-		initDump.clear();
-		char curBuildBuff[COMBO_SORT_ENTRY_SIZE];
-		//make entries for the main
-		nat2be64(curDo->seqInd, curBuildBuff);
-		for(uintptr_t i = 1; i<forSeq->size(); i++){
-			nat2be64(i-1, curBuildBuff+8);
-			nat2be64((*forSeq)[i-1]+1, curBuildBuff+16);
-			nat2be64((*forSeq)[i]+1, curBuildBuff+24);
-			initDump.insert(initDump.end(), curBuildBuff, curBuildBuff + COMBO_SORT_ENTRY_SIZE);
-		}
-		//handle the last one special
-		nat2be64(forSeq->size()-1, curBuildBuff+8);
-		nat2be64((*forSeq)[forSeq->size()-1]+1, curBuildBuff+16);
-		nat2be64(0, curBuildBuff+24);
-		initDump.insert(initDump.end(), curBuildBuff, curBuildBuff + COMBO_SORT_ENTRY_SIZE);
+		uintptr_t seqLen = forSeq->size();
+		initDump.resize(useLayout->entrySize * seqLen);
+		char* curBuildBuff = &(initDump[0]);
+		//make entries for the main (the last one has nothing after)
+		for(uintptr_t i = 0; i<seqLen; i++){
+			uintptr_t nextChar = ((i+1) < seqLen) ? ((0x00FF & (*forSeq)[i+1]) + 1) : 0;
+			useLayout->packEntry(curDo->seqInd, i, (0x00FF & (*forSeq)[i]) + 1, nextChar, curBuildBuff);
+			curBuildBuff += useLayout->entrySize;
+		}
 		//write and return
-		myUn->dumpFile->writeBytes(&(initDump[0]), initDump.size());
+		if(seqLen){ myUn->dumpFile->writeBytes(&(initDump[0]), initDump.size()); }
 		myUn->makeCache->taskCache.dealloc(curDo);
 		//and continue
 		curDo = myUn->makeCache->getThing();
@@ -569,76 +1991,171 @@ void profinmanBuildReferenceInitMakeTask(void* myUni){
 //***************************
 //rerank
 
+/**Flag for an entry that starts a new group (by old rank).*/
+#define COMBO_SORT_FLAG_GROUP 1
+/**Flag for an entry that starts a new subgroup (by old rank and next rank).*/
+#define COMBO_SORT_FLAG_SUBGROUP 2
+/**Marks an unknown position.*/
+#define COMBO_SORT_POS_NONE ((uintptr_t)-1)
+
 /**Uniform for the rerank task.*/
 class ProfinmanBuildReferenceRerankUni{
 public:
-	/**The offsets. For the first pass, holds the high rank on end. For the second pass, holds the mangle ammount.*/
-	uintptr_t useOffset;
+	/**The layout of the entries.*/
+	ProfinmanComboSortLayout* useLayout;
+	/**Whether this is the first rerank (the incoming ranks are characters, not positions).*/
+	bool firstRound;
 	/**The data to edit.*/
 	char* toEdit;
 	/**The number of entries to edit.*/
 	uintptr_t numEdit;
+	/**The group flags for the entries.*/
+	unsigned char* entFlags;
+	/**Whether the last entry ends the chunk (and so cannot be called finished yet).*/
+	bool holdLast;
+	/**The position of the first entry in the sorted stream.*/
+	uintptr_t firstPos;
+	/**The rank of the entry before the first.*/
+	uintptr_t priorRank;
+	/**The next rank of the entry before the first.*/
+	uintptr_t priorComp;
+	/**For the first pass, the start of the last group in this piece. For the second pass, the start of the group the first entry is in.*/
+	uintptr_t groupStart;
+	/**For the first pass, the start of the last subgroup in this piece. For the second pass, the start of the subgroup the first entry is in.*/
+	uintptr_t subStart;
+	/**The number of entries that still need sorting.*/
+	uintptr_t numActive;
+	/**The entries that are in their final position.*/
+	std::vector<char> finished;
 	/**The ID of this task.*/
 	uintptr_t taskID;
 };
-/**First pass rerank.*/
+/**First pass rerank: find the groups.*/
 void profinmanBuildReferenceRerankAlpTask(void* myUni){
 	ProfinmanBuildReferenceRerankUni* myUn = (ProfinmanBuildReferenceRerankUni*)myUni;
-	if(myUn->numEdit == 0){
-		myUn->useOffset = 0;
-		return;
-	}
-	//do the first
+	ProfinmanComboSortLayout* useLayout = myUn->useLayout;
+	myUn->groupStart = COMBO_SORT_POS_NONE;
+	myUn->subStart = COMBO_SORT_POS_NONE;
+	uintptr_t prevRank = myUn->priorRank;
+	uintptr_t prevComp = myUn->priorComp;
 	char* curFocus = myUn->toEdit;
-	uintptr_t prevRank = be2nat64(curFocus + 16);
-	uintptr_t prevComp = be2nat64(curFocus + 24);
-	uintptr_t nextRank = 0;
-	nat2be64(nextRank, curFocus + 16);
-	nat2be64(0, curFocus + 24); //compress better
-	//do the rest
-	uintptr_t numLeft = myUn->numEdit - 1;
-	while(numLeft){
-		numLeft--;
-		curFocus += COMBO_SORT_ENTRY_SIZE;
-		uintptr_t curRank = be2nat64(curFocus + 16);
-		uintptr_t curComp = be2nat64(curFocus + 24);
-		if((curRank != prevRank) || (curComp != prevComp)){
-			nextRank++;
-			prevRank = curRank;
-			prevComp = curComp;
-		}
-		nat2be64(nextRank, curFocus + 16);
-		nat2be64(0, curFocus + 24); //compress better
-	}
-	myUn->useOffset = nextRank;
-}
-/**Second pass rerank.*/
+	for(uintptr_t i = 0; i<myUn->numEdit; i++){
+		uintptr_t curPos = myUn->firstPos + i;
+		uintptr_t curRank = useLayout->getRank(curFocus);
+		uintptr_t curComp = useLayout->getComp(curFocus);
+		bool newGroup = (curPos == 0) || (!(myUn->firstRound) && (curRank != prevRank));
+		bool newSub = newGroup || (curRank != prevRank) || (curComp != prevComp);
+		myUn->entFlags[i] = (newGroup ? COMBO_SORT_FLAG_GROUP : 0) | (newSub ? COMBO_SORT_FLAG_SUBGROUP : 0);
+		if(newGroup){ myUn->groupStart = curPos; }
+		if(newSub){ myUn->subStart = curPos; }
+		prevRank = curRank;
+		prevComp = curComp;
+		curFocus += useLayout->entrySize;
+	}
+}
+/**Second pass rerank: set the new ranks (the position of the start of the subgroup) and note finished entries.*/
 void profinmanBuildReferenceRerankBetTask(void* myUni){
 	ProfinmanBuildReferenceRerankUni* myUn = (ProfinmanBuildReferenceRerankUni*)myUni;
-	if(myUn->numEdit == 0){
-		return;
-	}
+	ProfinmanComboSortLayout* useLayout = myUn->useLayout;
+	myUn->numActive = 0;
+	myUn->finished.clear();
+	uintptr_t groupStart = myUn->groupStart;
+	uintptr_t subStart = myUn->subStart;
 	char* curFocus = myUn->toEdit;
-	uintptr_t myOff = myUn->useOffset;
-	uintptr_t numDo = myUn->numEdit;
-	for(uintptr_t i = 0; i<numDo; i++){
-		nat2be64(myOff + be2nat64(curFocus + 16), curFocus+16);
-		curFocus += COMBO_SORT_ENTRY_SIZE;
+	for(uintptr_t i = 0; i<myUn->numEdit; i++){
+		uintptr_t curPos = myUn->firstPos + i;
+		unsigned char curFlag = myUn->entFlags[i];
+		if(curFlag & COMBO_SORT_FLAG_GROUP){ groupStart = curPos; }
+		if(curFlag & COMBO_SORT_FLAG_SUBGROUP){ subStart = curPos; }
+		uintptr_t curRank = useLayout->getRank(curFocus);
+		uintptr_t curComp = useLayout->getComp(curFocus);
+		uintptr_t newRank = (myUn->firstRound ? 1 : curRank) + (subStart - groupStart);
+		//done if the whole suffix has been looked at, or if alone
+		bool isHeld = myUn->holdLast && ((i+1) == myUn->numEdit);
+		bool isDone = (curComp == 0);
+		if(!isDone && !isHeld && (curFlag & COMBO_SORT_FLAG_SUBGROUP)){
+			isDone = (myUn->entFlags[i+1] & COMBO_SORT_FLAG_SUBGROUP) != 0;
+		}
+		useLayout->setRank(newRank, curFocus);
+		useLayout->setComp(isDone ? useLayout->finishMark : 0, curFocus);
+		if(isHeld){}
+		else if(isDone){ myUn->finished.insert(myUn->finished.end(), curFocus, curFocus + useLayout->entrySize); }
+		else{ myUn->numActive++; }
+		curFocus += useLayout->entrySize;
 	}
 }
 
+/**Read entries from a stream one at a time.*/
+class ProfinmanBuildReferenceEntryReader{
+public:
+	/**
+	 * Set up a reader.
+	 * @param readFrom The stream to read from: null for an empty stream.
+	 * @param entrySize The number of bytes in an entry.
+	 */
+	ProfinmanBuildReferenceEntryReader(InStream* readFrom, uintptr_t entrySize);
+	/**
+	 * Get the next entry.
+	 * @return The next entry, or null if at the end.
+	 */
+	char* peekEntry();
+	/**Move past the current entry.*/
+	void popEntry();
+	/**The stream to read from.*/
+	InStream* baseStr;
+	/**The number of bytes in an entry.*/
+	uintptr_t entSize;
+	/**Storage for loaded entries.*/
+	std::vector<char> entBuff;
+	/**The next entry to report.*/
+	uintptr_t nextEnt;
+	/**The number of loaded entries.*/
+	uintptr_t numEnt;
+};
+
+/**The number of entries to buffer for a reader.*/
+#define COMBO_SORT_READ_BUFFER 0x0800
+
+ProfinmanBuildReferenceEntryReader::ProfinmanBuildReferenceEntryReader(InStream* readFrom, uintptr_t entrySize){
+	baseStr = readFrom;
+	entSize = entrySize;
+	entBuff.resize(COMBO_SORT_READ_BUFFER*entSize);
+	nextEnt = 0;
+	numEnt = 0;
+}
+
+char* ProfinmanBuildReferenceEntryReader::peekEntry(){
+	if(nextEnt < numEnt){ return &(entBuff[entSize*nextEnt]); }
+	if(baseStr == 0){ return 0; }
+	uintptr_t numRead = baseStr->readBytes(&(entBuff[0]), entBuff.size());
+	if(numRead % entSize){ throw std::runtime_error("Truncated file."); }
+	nextEnt = 0;
+	numEnt = numRead / entSize;
+	if(numEnt == 0){
+		baseStr = 0;
+		return 0;
+	}
+	return &(entBuff[0]);
+}
+
+void ProfinmanBuildReferenceEntryReader::popEntry(){
+	nextEnt++;
+}
+
 //***************************
 //next rank
 
 /**A task to get the next rank build.*/
 class ProfinmanBuildReferenceNextRankTask{
 public:
-	/**The bytes to write out.*/
+	/**All the entries for a string, in order.*/
 	std::vector<char> initDump;
 };
 /**Uniform for the initial make task.*/
 class ProfinmanBuildReferenceNextRankUni{
 public:
+	/**The layout of the entries.*/
+	ProfinmanComboSortLayout* useLayout;
 	/**The number of zero next ranks at the end.*/
 	uintptr_t skipLen;
 	/**Get things to turn into output*/
@@ -648,23 +2165,29 @@ public:
 	/**The ID of this task.*/
 	uintptr_t taskID;
 };
-/**Fill in the next ranks.*/
+/**Fill in the next ranks, and pass along the unfinished entries.*/
 void profinmanBuildReferenceNextRankMakeTask(void* myUni){
+	std::vector<char> actDump;
 	ProfinmanBuildReferenceNextRankUni* myUn = (ProfinmanBuildReferenceNextRankUni*)myUni;
+	ProfinmanComboSortLayout* useLayout = myUn->useLayout;
+	uintptr_t entSize = useLayout->entrySize;
 	uintptr_t skipLen = myUn->skipLen;
 	ProfinmanBuildReferenceNextRankTask* curDo = myUn->makeCache->getThing();
 	while(curDo){
-		uintptr_t numEnts = curDo->initDump.size() / COMBO_SORT_ENTRY_SIZE;
-		if(numEnts > skipLen){
-			char* curEnt = &(curDo->initDump[0]);
-			numEnts = numEnts - skipLen;
-			for(uintptr_t i = 0; i<numEnts; i++){
-				nat2be64(be2nat64(curEnt + (COMBO_SORT_ENTRY_SIZE*skipLen) + 16), curEnt + 24);
-				curEnt += COMBO_SORT_ENTRY_SIZE;
+		actDump.clear();
+		uintptr_t numEnts = curDo->initDump.size() / entSize;
+		char* curEnt = &(curDo->initDump[0]);
+		for(uintptr_t i = 0; i<numEnts; i++){
+			if(useLayout->getComp(curEnt) != useLayout->finishMark){
+				if((i + skipLen) < numEnts){
+					useLayout->setComp(useLayout->getRank(curEnt + (entSize*skipLen)), curEnt);
+				}
+				actDump.insert(actDump.end(), curEnt, curEnt + entSize);
 			}
+			curEnt += entSize;
 		}
 		//dump the result
-		myUn->dumpFile->writeBytes(&(curDo->initDump[0]), curDo->initDump.size());
+		if(actDump.size()){ myUn->dumpFile->writeBytes(&(actDump[0]), actDump.size()); }
 		myUn->makeCache->taskCache.dealloc(curDo);
 		//and continue
 		curDo = myUn->makeCache->getThing();
@@ -683,6 +2206,12 @@ ProfinmanBuildReference::ProfinmanBuildReference(){
 	numThread = 1;
 	workFolder = 0;
 	recoverFile = 0;
+	buildLCP = false;
+	jumpLen = 0;
+	forceExternal = false;
+	bucketLen = 0;
+	appendName = 0;
+	compName = (char*)"gzip";
 	mySummary = "  Build a suffix array of protein sequences.";
 	myMainDoc = "Usage: profinman safa [OPTION] [FILE]*\n"
 		"Build a suffix array for a sequence file.\n"
@@ -710,10 +2239,25 @@ ProfinmanBuildReference::ProfinmanBuildReference(){
 		recoMeta.fileWrite = true;
 		recoMeta.fileExts.insert(".rec");
 		addStringOption("--rec", &recoverFile, 0, "    A recovery file: skip previously finished steps.\n    --rec File.rec\n", &recoMeta);
+	ArgumentParserBoolMeta lcpMeta("Build LCP File");
+		addBooleanFlag("--lcp", &buildLCP, 1, "    Also write an lcp file (File.gail.sa.lcp) to speed up searches.\n", &lcpMeta);
+	ArgumentParserIntMeta jumpMeta("Jump Table Prefix");
+		addIntegerOption("--jump", &jumpLen, 0, "    Also write a jump table (File.gail.sa.jump) for prefixes of this length.\n    --jump 3\n", &jumpMeta);
+	ArgumentParserBoolMeta externMeta("Force External Build");
+		addBooleanFlag("--external", &forceExternal, 1, "    Always build on disk, even if the reference would fit in ram.\n", &externMeta);
+	ArgumentParserIntMeta bucketMeta("Bucket Prefix");
+		addIntegerOption("--bucket", &bucketLen, 0, "    Split the suffixes by their first few characters and sort each split in memory.\n    The reference must fit in ram: each thread gets an even share of the rest.\n    --bucket 2\n", &bucketMeta);
+	ArgumentParserStrMeta appendMeta("Append To");
+		appendMeta.isFile = true;
+		appendMeta.fileExts.insert(".gail.sa");
+		addStringOption("--append", &appendName, 0, "    Note the result as a delta of an existing suffix array (findsa will search both).\n    Use compactsa to fold the deltas in later.\n    --append Base.gail.sa\n", &appendMeta);
+	ArgumentParserStrMeta compMeta("Block Compression");
+		addStringOption("--comp", &compName, 0, "    How to compress the suffix array: gzip, fastlz or rawsum (can be memory mapped by findsa --map).\n    --comp gzip\n", &compMeta);
 }
 
 ProfinmanBuildReference::~ProfinmanBuildReference(){
 	if(recoverStream){ delete(recoverStream); }
+	if(comboComp){ delete(comboComp); }
 }
 
 int ProfinmanBuildReference::posteriorCheck(){
@@ -732,6 +2276,19 @@ int ProfinmanBuildReference::posteriorCheck(){
 	if(!recoverFile || (strlen(recoverFile)==0)){
 		recoverFile = 0;
 	}
+	if(!appendName || (strlen(appendName)==0)){
+		appendName = 0;
+	}
+	if(appendName && (strcmp(appendName, comboName)==0)){
+		argumentError = "Can not append a suffix array to itself.";
+		return 1;
+	}
+	CompressionMethod* testComp = makeNamedCompressionMethod(compName);
+	if(testComp == 0){
+		argumentError = "Unknown compression method.";
+		return 1;
+	}
+	delete(testComp);
 	if(maxRam <= 0){
 		argumentError = "Will use at least one byte of ram.";
 		return 1;
@@ -740,6 +2297,14 @@ int ProfinmanBuildReference::posteriorCheck(){
 		argumentError = "Need at least one thread.";
 		return 1;
 	}
+	if(jumpLen < 0){
+		argumentError = "Jump table prefix length must be non-negative.";
+		return 1;
+	}
+	if((bucketLen < 0) || (bucketLen > COMBO_BUCKET_MAX_PREFIX)){
+		argumentError = "Bucket prefix length must be between zero and three.";
+		return 1;
+	}
 	if(maxRam < 8*COMBO_SORT_ENTRY_SIZE){
 		maxRam = 8*COMBO_SORT_ENTRY_SIZE;
 	}
@@ -752,27 +2317,20 @@ int ProfinmanBuildReference::posteriorCheck(){
 #define BLOCK_SIZE_END 0x000400
 
 void ProfinmanBuildReference::runThing(){
+	if(comboComp == 0){ comboComp = makeNamedCompressionMethod(compName); }
+	buildArray();
+	if(appendName){
+		if(!fileExists(appendName)){ throw std::runtime_error("Suffix array to append to does not exist."); }
+		profinmanAppendDeltaList(appendName, referenceName, comboName);
+	}
+}
+
+void ProfinmanBuildReference::buildArray(){
 	//make threads
 		ThreadPool doThreads(numThread);
 		ThreadPool prepThread(numThread);
 		GZipCompressionMethod baseComp;
-	//prepare the sorting methods
-		SortOptions rankSortOpts;
-			rankSortOpts.itemSize = 4*SUFFIX_ARRAY_CANON_SIZE;
-			rankSortOpts.maxLoad = maxRam / 2;
-			rankSortOpts.numThread = numThread;
-			rankSortOpts.compMeth = MultiStringSuffixRankSortOption_compMeth;
-			rankSortOpts.useUni = 0;
-			rankSortOpts.usePool = &doThreads;
-		SortOptions indSortOpts;
-			indSortOpts.itemSize = 4*SUFFIX_ARRAY_CANON_SIZE;
-			indSortOpts.maxLoad = maxRam / 2;
-			indSortOpts.numThread = numThread;
-			indSortOpts.compMeth = MultiStringSuffixIndexSortOption_compMeth;
-			indSortOpts.useUni = 0;
-			indSortOpts.usePool = &doThreads;
-		uintptr_t workRam = maxRam / 2;
-		uintptr_t workEntR = COMBO_SORT_ENTRY_SIZE*std::max((uintptr_t)2, workRam / COMBO_SORT_ENTRY_SIZE);
+		FastLZCompressionMethod scratchComp;
 	//load the recovery file
 		std::set<std::string> handledTasks;
 		if(recoverFile && fileExists(recoverFile)){
@@ -797,6 +2355,10 @@ void ProfinmanBuildReference::runThing(){
 		std::string sortComboChunkBblk = workFPrefix + "scc_b.blk";
 		std::string sortIndex = workFPrefix + "ssi";
 		std::string sortIndexblk = workFPrefix + "ssi.blk";
+		std::string sortFinishA = workFPrefix + "sfi_a";
+		std::string sortFinishB = workFPrefix + "sfi_b";
+		std::string sortFinishAblk = workFPrefix + "sfi_a.blk";
+		std::string sortFinishBblk = workFPrefix + "sfi_b.blk";
 		std::string refFN(referenceName);
 		std::string refBlkFN = refFN + ".blk";
 		std::string refFaiFN = refFN + ".fai";
@@ -804,21 +2366,78 @@ void ProfinmanBuildReference::runThing(){
 		std::string* nxtSCC = &sortComboChunkB;
 		std::string* curSCCB = &sortComboChunkAblk;
 		std::string* nxtSCCB = &sortComboChunkBblk;
+		std::string* curSFI = &sortFinishA;
+		std::string* nxtSFI = &sortFinishB;
+		std::string* curSFIB = &sortFinishAblk;
+		std::string* nxtSFIB = &sortFinishBblk;
 		std::string* tmpSCC;
-		#define SWAP_TARGETS tmpSCC = curSCC; curSCC = nxtSCC; nxtSCC = tmpSCC;    tmpSCC = curSCCB; curSCCB = nxtSCCB; nxtSCCB = tmpSCC;
-	//make and sort the initial thing
+		#define SWAP_TARGETS tmpSCC = curSCC; curSCC = nxtSCC; nxtSCC = tmpSCC;    tmpSCC = curSCCB; curSCCB = nxtSCCB; nxtSCCB = tmpSCC;\
+			tmpSCC = curSFI; curSFI = nxtSFI; nxtSFI = tmpSCC;    tmpSCC = curSFIB; curSFIB = nxtSFIB; nxtSFIB = tmpSCC;
+		std::vector<std::string> finishRuns;
+	//split into buckets, if asked
+	if(bucketLen){
+		if(!(handledTasks.count("dump"))){ buildBuckets(&handledTasks, &doThreads); }
+		buildSideFiles(&handledTasks, &doThreads);
+		return;
+	}
+	//if it fits, just do it in memory
+	if(!forceExternal && !(handledTasks.count("init"))){
+		bool allDone = handledTasks.count("dump");
+		if(!allDone && buildInMemory(&doThreads)){
+			if(recoverStream){ (*recoverStream) << "dump" << std::endl; }
+			allDone = true;
+		}
+		if(allDone){
+			buildSideFiles(&handledTasks, &doThreads);
+			return;
+		}
+	}
+	//need the total number of strings and the maximum string length
 	uintptr_t totNumString = 0;
 	uintptr_t maxStrLen = 0;
+	uintptr_t totStrLen = 0;
 	std::vector<uintptr_t> allStrLens;
+	{
+		GZipCompressionMethod compMeth;
+		BlockCompInStream blkComp(refFN.c_str(), refBlkFN.c_str(), &compMeth);
+		GailAQSequenceReader gfaIn(&blkComp, refFaiFN.c_str());
+		totNumString = gfaIn.getNumEntries();
+		for(uintptr_t i = 0; i<totNumString; i++){
+			uintptr_t curSLen = gfaIn.getEntryLength(i);
+			allStrLens.push_back(curSLen);
+			maxStrLen = std::max(curSLen, maxStrLen);
+			totStrLen += curSLen;
+		}
+	}
+	//prepare the sorting methods (entries are only as wide as they need to be)
+		ProfinmanComboSortLayout sortLayout(totNumString, maxStrLen, totStrLen);
+		uintptr_t entSize = sortLayout.entrySize;
+		SortOptions rankSortOpts;
+			rankSortOpts.itemSize = entSize;
+			rankSortOpts.maxLoad = maxRam / 2;
+			rankSortOpts.numThread = numThread;
+			rankSortOpts.compMeth = MultiStringSuffixPackedSortOption_compMeth;
+			rankSortOpts.useUni = &(sortLayout.rankKey);
+			rankSortOpts.usePool = &doThreads;
+		SortOptions indSortOpts;
+			indSortOpts.itemSize = entSize;
+			indSortOpts.maxLoad = maxRam / 2;
+			indSortOpts.numThread = numThread;
+			indSortOpts.compMeth = MultiStringSuffixPackedSortOption_compMeth;
+			indSortOpts.useUni = &(sortLayout.indexKey);
+			indSortOpts.usePool = &doThreads;
+		uintptr_t workRam = maxRam / 2;
+		uintptr_t workEntR = entSize*std::max((uintptr_t)2, workRam / entSize);
+	//make and sort the initial thing
 	{
 		if(!(handledTasks.count("init"))){
 			{
 				MultithreadBlockCompInStream blkComp(refFN.c_str(), refBlkFN.c_str(), &baseComp, numThread, &doThreads);
 				GailAQSequenceReader gfaIn(&blkComp, refFaiFN.c_str());
-				totNumString = gfaIn.getNumEntries();
+				if(gfaIn.getNumEntries() != totNumString){ throw std::runtime_error("Reference does not match its index."); }
 				//set up the sort (in its own thread)
 					PreSortMultithreadPipe initSPipe(PIPE_BUFFER_SIZE, &doThreads);
-					MultithreadBlockCompOutStream initOut(0, BLOCK_SIZE_INTERNAL, nxtSCC->c_str(), nxtSCCB->c_str(), &baseComp, numThread, &doThreads);
+					MultithreadBlockCompOutStream initOut(0, BLOCK_SIZE_INTERNAL, nxtSCC->c_str(), nxtSCCB->c_str(), &scratchComp, numThread, &doThreads);
 					ProfinmanBuildReferenceSortUni initSortU = {&initSPipe, workFolder, &rankSortOpts, &initOut};
 					void* sortThread = startThread(profinmanBuildReferenceSortTask, &initSortU);
 				//set up the initial producers
@@ -827,6 +2446,7 @@ void ProfinmanBuildReference::runThing(){
 					threadUnis.resize(numThread);
 					for(intptr_t i = 0; i<numThread; i++){
 						ProfinmanBuildReferenceInitUni* curUni = &(threadUnis[i]);
+							curUni->useLayout = &sortLayout;
 							curUni->makeCache = &makeCache;
 							curUni->dumpFile = &initSPipe;
 						curUni->taskID = prepThread.addTask(profinmanBuildReferenceInitMakeTask, &(threadUnis[i]));
@@ -840,8 +2460,6 @@ void ProfinmanBuildReference::runThing(){
 					try{
 						uintptr_t curStrInd = 0;
 						while(gfaIn.readNextEntry()){
-							allStrLens.push_back(gfaIn.lastReadSeqLen);
-							maxStrLen = std::max(maxStrLen, gfaIn.lastReadSeqLen);
 							ProfinmanBuildReferenceInitTask* curTask = makeCache.taskCache.alloc();
 							curTask->seqInd = curStrInd;
 							curTask->forSeq.clear();
@@ -858,103 +2476,125 @@ void ProfinmanBuildReference::runThing(){
 			}
 			if(recoverStream){ (*recoverStream) << "init" << std::endl; }
 		}
-		else{
-			GZipCompressionMethod compMeth;
-			BlockCompInStream blkComp(refFN.c_str(), refBlkFN.c_str(), &compMeth);
-			GailAQSequenceReader gfaIn(&blkComp, refFaiFN.c_str());
-			totNumString = gfaIn.getNumEntries();
-			//need the total number of strings and the maximum string length
-			for(uintptr_t i = 0; i<totNumString; i++){
-				uintptr_t curSLen = gfaIn.getEntryLength(i);
-				allStrLens.push_back(curSLen);
-				maxStrLen = std::max(curSLen, maxStrLen);
-			}
-		}
 	}
 	SWAP_TARGETS
-	//rerank and resort until everything done
+	//rerank and resort until everything done (entries with a unique rank drop out as they are found)
+	bool allFinished = false;
 	for(uintptr_t forLen = 4; forLen < 2*maxStrLen; forLen = forLen << 1){
 		char numBuff[4*sizeof(uintmax_t)+4];
 		sprintf(numBuff, "%ju", forLen);
 		std::string curTaskName = "sa_";
 			curTaskName.append(numBuff);
+		if(handledTasks.count("sa_done") && !(handledTasks.count(curTaskName))){ break; }
+		std::string curRunName = workFPrefix + "sfr_";
+			curRunName.append(numBuff);
+		std::string curRunNameBlk = curRunName + ".blk";
+		finishRuns.push_back(curRunName);
 		//only do if not previously done
 		if(!(handledTasks.count(curTaskName))){
+			uintptr_t numActive = 0;
 			//basic rerank
 			{
 				//prepare the sort
 				PreSortMultithreadPipe sortindPipe(PIPE_BUFFER_SIZE, &doThreads);
-				MultithreadBlockCompOutStream sortindOut(0, BLOCK_SIZE_INTERNAL, sortIndex.c_str(), sortIndexblk.c_str(), &baseComp, numThread, &doThreads);
+				MultithreadBlockCompOutStream sortindOut(0, BLOCK_SIZE_INTERNAL, sortIndex.c_str(), sortIndexblk.c_str(), &scratchComp, numThread, &doThreads);
 				ProfinmanBuildReferenceSortUni initSortU = {&sortindPipe, workFolder, &indSortOpts, &sortindOut};
 				void* sortThread = startThread(profinmanBuildReferenceSortTask, &initSortU);
 				#define COMBO_BUILD_INDSORT_SHUTDOWN \
 					sortindPipe.closeWrite();\
 					joinThread(sortThread);
 				try{
+					MultithreadBlockCompOutStream finishOut(0, BLOCK_SIZE_INTERNAL, curRunName.c_str(), curRunNameBlk.c_str(), &scratchComp, numThread, &doThreads);
 					//rerank things to sort
 					uintptr_t chunkPrevRank = -1;
 					uintptr_t chunkPrevComp = -1;
-					uintptr_t chunkStartOff = 0;
+					uintptr_t chunkGroupStart = COMBO_SORT_POS_NONE;
+					uintptr_t chunkSubStart = COMBO_SORT_POS_NONE;
+					uintptr_t chunkStartPos = 0;
+					//the last entry of a chunk needs the next chunk to tell if it is alone
+					bool haveHeld = false;
+					bool heldSub = false;
+					char heldEnt[COMBO_SORT_ENTRY_SIZE];
+					#define COMBO_BUILD_RERANK_HELD(nextSub) \
+						if(haveHeld){\
+							if(heldSub && (nextSub)){ sortLayout.setComp(sortLayout.finishMark, heldEnt); }\
+							sortindPipe.writeBytes(heldEnt, entSize);\
+							if(sortLayout.getComp(heldEnt) == sortLayout.finishMark){ finishOut.writeBytes(heldEnt, entSize); }\
+							else{ numActive++; }\
+							haveHeld = false;\
+						}
 					std::vector<ProfinmanBuildReferenceRerankUni> saveUnis; saveUnis.resize(numThread);
-					std::vector<uintptr_t> threadStarts; threadStarts.resize(numThread);
 					std::vector<char> curLoad; curLoad.resize(workEntR);
-					MultithreadBlockCompInStream initIn(curSCC->c_str(), curSCCB->c_str(), &baseComp, numThread, &doThreads);
+					std::vector<unsigned char> entFlags; entFlags.resize(workEntR / entSize);
+					MultithreadBlockCompInStream initIn(curSCC->c_str(), curSCCB->c_str(), &scratchComp, numThread, &doThreads);
 					uintptr_t numLoadB = initIn.readBytes(&(curLoad[0]), workEntR);
 					while(numLoadB){
-						if(numLoadB % COMBO_SORT_ENTRY_SIZE){ throw std::runtime_error("Truncated file."); }
-						uintptr_t numLoadE = numLoadB / COMBO_SORT_ENTRY_SIZE;
+						if(numLoadB % entSize){ throw std::runtime_error("Truncated file."); }
+						uintptr_t numLoadE = numLoadB / entSize;
 						//prepare the uniforms
 						intptr_t numPerT = numLoadE / numThread;
 						intptr_t numExtT = numLoadE % numThread;
+						intptr_t lastPiece = numPerT ? (numThread - 1) : (numExtT - 1);
 						uintptr_t curStart = 0;
 						for(intptr_t i = 0; i<numThread; i++){
 							ProfinmanBuildReferenceRerankUni* curUni = &(saveUnis[i]);
-							curUni->toEdit = &(curLoad[curStart]);
+							curUni->useLayout = &sortLayout;
+							curUni->firstRound = (forLen == 4);
+							curUni->toEdit = &(curLoad[entSize*curStart]);
 							curUni->numEdit = numPerT + (i<numExtT);
-							curStart += (COMBO_SORT_ENTRY_SIZE*curUni->numEdit);
-						}
-						//note which pieces involve a break
-						uintptr_t firstRank = be2nat64(saveUnis[0].toEdit + 16);
-						uintptr_t firstComp = be2nat64(saveUnis[0].toEdit + 24);
-						threadStarts[0] = (firstRank != chunkPrevRank) || (firstComp != chunkPrevComp);
-						chunkPrevRank = be2nat64(&(curLoad[numLoadB-16]));
-						chunkPrevComp = be2nat64(&(curLoad[numLoadB-8]));
-						for(intptr_t i = 1; i<numThread; i++){
-							if(saveUnis[i].numEdit == 0){ threadStarts[i] = 0; continue; }
-							ProfinmanBuildReferenceRerankUni* curUni = &(saveUnis[i]);
-							if(curUni->numEdit){
-								uintptr_t priorRank = be2nat64(curUni->toEdit - 16);
-								uintptr_t priorComp = be2nat64(curUni->toEdit - 8);
-								uintptr_t curRank = be2nat64(curUni->toEdit + 16);
-								uintptr_t curComp = be2nat64(curUni->toEdit + 24);
-								threadStarts[i] = ((curRank != priorRank) || (curComp != priorComp));
+							curUni->entFlags = &(entFlags[curStart]);
+							curUni->holdLast = (i == lastPiece);
+							curUni->firstPos = chunkStartPos + curStart;
+							if(i && curUni->numEdit){
+								curUni->priorRank = sortLayout.getRank(curUni->toEdit - entSize);
+								curUni->priorComp = sortLayout.getComp(curUni->toEdit - entSize);
 							}
 							else{
-								threadStarts[i] = 0;
+								curUni->priorRank = chunkPrevRank;
+								curUni->priorComp = chunkPrevComp;
 							}
+							curStart += curUni->numEdit;
 						}
-						//raw-rank in pieces
+						chunkPrevRank = sortLayout.getRank(&(curLoad[numLoadB - entSize]));
+						chunkPrevComp = sortLayout.getComp(&(curLoad[numLoadB - entSize]));
+						//find the groups in pieces
 						for(intptr_t i = 0; i<numThread; i++){
 							ProfinmanBuildReferenceRerankUni* curUni = &(saveUnis[i]);
 							curUni->taskID = prepThread.addTask(profinmanBuildReferenceRerankAlpTask, curUni);
 						}
 						for(intptr_t i = 0; i<numThread; i++){ prepThread.joinTask(saveUnis[i].taskID); }
-						//adjust each piece
-						uintptr_t prevOff = chunkStartOff;
+						//the held entry can now be finished
+						COMBO_BUILD_RERANK_HELD(entFlags[0] & COMBO_SORT_FLAG_SUBGROUP)
+						//pass group starts between pieces
+						for(intptr_t i = 0; i<numThread; i++){
+							ProfinmanBuildReferenceRerankUni* curUni = &(saveUnis[i]);
+							uintptr_t pieceGroup = curUni->groupStart;
+							uintptr_t pieceSub = curUni->subStart;
+							curUni->groupStart = chunkGroupStart;
+							curUni->subStart = chunkSubStart;
+							if(pieceGroup != COMBO_SORT_POS_NONE){ chunkGroupStart = pieceGroup; }
+							if(pieceSub != COMBO_SORT_POS_NONE){ chunkSubStart = pieceSub; }
+						}
+						//set ranks in pieces
 						for(intptr_t i = 0; i<numThread; i++){
-							uintptr_t curOffset = prevOff + threadStarts[i];
-							prevOff = curOffset + saveUnis[i].useOffset;
-							saveUnis[i].useOffset = curOffset;
 							saveUnis[i].taskID = prepThread.addTask(profinmanBuildReferenceRerankBetTask, &(saveUnis[i]));
 						}
 						for(intptr_t i = 0; i<numThread; i++){ prepThread.joinTask(saveUnis[i].taskID); }
 						//write
-						sortindPipe.writeBytes(&(curLoad[0]), numLoadB);
-						//prepare offset rank stuff
-						chunkStartOff = prevOff;
+						memcpy(heldEnt, &(curLoad[numLoadB - entSize]), entSize);
+						heldSub = (entFlags[numLoadE-1] & COMBO_SORT_FLAG_SUBGROUP) != 0;
+						haveHeld = true;
+						sortindPipe.writeBytes(&(curLoad[0]), numLoadB - entSize);
+						for(intptr_t i = 0; i<numThread; i++){
+							ProfinmanBuildReferenceRerankUni* curUni = &(saveUnis[i]);
+							if(curUni->finished.size()){ finishOut.writeBytes(&(curUni->finished[0]), curUni->finished.size()); }
+							numActive += curUni->numActive;
+						}
+						chunkStartPos += numLoadE;
 						//read next
 						numLoadB = initIn.readBytes(&(curLoad[0]), workEntR);
 					}
+					COMBO_BUILD_RERANK_HELD(true)
 				}
 				catch(std::exception& err){
 					COMBO_BUILD_INDSORT_SHUTDOWN
@@ -966,33 +2606,60 @@ void ProfinmanBuildReference::runThing(){
 			{
 				//set up the sort
 					PreSortMultithreadPipe rrankSPipe(PIPE_BUFFER_SIZE, &doThreads);
-					MultithreadBlockCompOutStream rrankOut(0, BLOCK_SIZE_INTERNAL, nxtSCC->c_str(), nxtSCCB->c_str(), &baseComp, numThread, &doThreads);
+					MultithreadBlockCompOutStream rrankOut(0, BLOCK_SIZE_INTERNAL, nxtSCC->c_str(), nxtSCCB->c_str(), &scratchComp, numThread, &doThreads);
 					ProfinmanBuildReferenceSortUni rrankSortU = {&rrankSPipe, workFolder, &rankSortOpts, &rrankOut};
 					void* sortThread = startThread(profinmanBuildReferenceSortTask, &rrankSortU);
 				//set up the rerank threads
-					MultithreadBlockCompInStream initIn(sortIndex.c_str(), sortIndexblk.c_str(), &baseComp, numThread, &doThreads);
+					MultithreadBlockCompInStream initIn(sortIndex.c_str(), sortIndexblk.c_str(), &scratchComp, numThread, &doThreads);
+					MultithreadBlockCompInStream* finishIn = 0;
+					if(forLen > 4){ finishIn = new MultithreadBlockCompInStream(curSFI->c_str(), curSFIB->c_str(), &scratchComp, numThread, &doThreads); }
 					uintptr_t skipLen = forLen >> 1;
 					ThreadProdComCollector<ProfinmanBuildReferenceNextRankTask> makeCache(THREAD_CACHE_EXTRA * numThread);
 					std::vector<ProfinmanBuildReferenceNextRankUni> threadUnis;
 					threadUnis.resize(numThread);
 					for(intptr_t i = 0; i<numThread; i++){
-						threadUnis[i] = {skipLen, &makeCache, &rrankSPipe};
+						threadUnis[i] = {&sortLayout, skipLen, &makeCache, &rrankSPipe};
 						threadUnis[i].taskID = prepThread.addTask(profinmanBuildReferenceNextRankMakeTask, &(threadUnis[i]));
 					}
 					#define COMBO_BUILD_RERANK_SHUTDOWN \
 						makeCache.end();\
 						for(intptr_t i = 0; i<numThread; i++){ prepThread.joinTask(threadUnis[i].taskID); }\
 						rrankSPipe.closeWrite();\
-						joinThread(sortThread);
-				//start reading
+						joinThread(sortThread);\
+						if(finishIn){ delete(finishIn); }
+				//start reading: merge the new entries with the already finished ones
 					try{
+						MultithreadBlockCompOutStream finishOut(0, BLOCK_SIZE_INTERNAL, nxtSFI->c_str(), nxtSFIB->c_str(), &scratchComp, numThread, &doThreads);
+						ProfinmanBuildReferenceEntryReader curRead(&initIn, entSize);
+						ProfinmanBuildReferenceEntryReader finRead(finishIn, entSize);
+						std::vector<char> finDump;
 						for(uintptr_t i = 0; i<totNumString; i++){
 							uintptr_t curStrLen = allStrLens[i];
 							ProfinmanBuildReferenceNextRankTask* curTask = makeCache.taskCache.alloc();
-							curTask->initDump.resize(COMBO_SORT_ENTRY_SIZE*curStrLen);
-							initIn.readBytes(&(curTask->initDump[0]), COMBO_SORT_ENTRY_SIZE*curStrLen);
-							makeCache.addThing(curTask);
+							curTask->initDump.resize(entSize*curStrLen);
+							bool anyActive = false;
+							for(uintptr_t j = 0; j<curStrLen; j++){
+								char* curEnt = curRead.peekEntry();
+								char* finEnt = finRead.peekEntry();
+								bool useCur = curEnt && (!finEnt || MultiStringSuffixPackedSortOption_compMeth(&(sortLayout.indexKey), curEnt, finEnt));
+								char* useEnt = useCur ? curEnt : finEnt;
+								if(!useEnt || (sortLayout.getSeq(useEnt) != i) || (sortLayout.getChar(useEnt) != j)){
+									makeCache.taskCache.dealloc(curTask);
+									throw std::runtime_error("Malformed intermediate file.");
+								}
+								memcpy(&(curTask->initDump[entSize*j]), useEnt, entSize);
+								if(sortLayout.getComp(useEnt) == sortLayout.finishMark){ finDump.insert(finDump.end(), useEnt, useEnt + entSize); }
+								else{ anyActive = true; }
+								if(useCur){ curRead.popEntry(); } else{ finRead.popEntry(); }
+							}
+							if(finDump.size() >= BLOCK_SIZE_INTERNAL){
+								finishOut.writeBytes(&(finDump[0]), finDump.size());
+								finDump.clear();
+							}
+							if(anyActive){ makeCache.addThing(curTask); }
+							else{ makeCache.taskCache.dealloc(curTask); }
 						}
+						if(finDump.size()){ finishOut.writeBytes(&(finDump[0]), finDump.size()); }
 					}
 					catch(std::exception& err){
 						COMBO_BUILD_RERANK_SHUTDOWN
@@ -1001,25 +2668,65 @@ void ProfinmanBuildReference::runThing(){
 					COMBO_BUILD_RERANK_SHUTDOWN
 			}
 			if(recoverStream){ (*recoverStream) << curTaskName << std::endl; }
+			allFinished = (numActive == 0);
+			if(recoverStream && allFinished){ (*recoverStream) << "sa_done" << std::endl; }
 		}
 		SWAP_TARGETS
+		if(allFinished){ break; }
 	}
-	//dump to target
+	//dump to target: merge the finished runs with whatever is left
 	if(!(handledTasks.count("dump"))){
-		MultithreadBlockCompInStream endIn(curSCC->c_str(), curSCCB->c_str(), &baseComp, numThread, &doThreads);
-		GZipCompressionMethod compMeth;
-		std::string comFN(comboName);
-		std::string comBlkFN = comFN + ".blk";
-		MultithreadBlockCompOutStream blkComp(0, BLOCK_SIZE_END, comFN.c_str(), comBlkFN.c_str(), &baseComp, numThread, &doThreads);
-		char curEntBuff[COMBO_SORT_ENTRY_SIZE];
-		uintptr_t numR = endIn.readBytes(curEntBuff, COMBO_SORT_ENTRY_SIZE);
-		while(numR){
-			if(numR != COMBO_SORT_ENTRY_SIZE){ throw std::runtime_error("File truncated."); }
-			blkComp.writeBytes(curEntBuff, 16);
-			numR = endIn.readBytes(curEntBuff, COMBO_SORT_ENTRY_SIZE);
+		std::vector<MultithreadBlockCompInStream*> allIn;
+		std::vector<ProfinmanBuildReferenceEntryReader> allRead;
+		#define COMBO_BUILD_DUMP_CLEANUP \
+			for(uintptr_t i = 0; i<allIn.size(); i++){ delete(allIn[i]); }
+		try{
+			allIn.push_back(new MultithreadBlockCompInStream(curSCC->c_str(), curSCCB->c_str(), &scratchComp, numThread, &doThreads));
+			for(uintptr_t i = 0; i<finishRuns.size(); i++){
+				std::string curRunBlk = finishRuns[i] + ".blk";
+				allIn.push_back(new MultithreadBlockCompInStream(finishRuns[i].c_str(), curRunBlk.c_str(), &scratchComp, numThread, &doThreads));
+			}
+			for(uintptr_t i = 0; i<allIn.size(); i++){ allRead.push_back(ProfinmanBuildReferenceEntryReader(allIn[i], entSize)); }
+			std::string comFN(comboName);
+			std::string comBlkFN = comFN + ".blk";
+			MultithreadBlockCompOutStream blkComp(0, BLOCK_SIZE_END, comFN.c_str(), comBlkFN.c_str(), comboComp, numThread, &doThreads);
+			ProfinmanComboLayout comLayout(totNumString, maxStrLen);
+			comLayout.writeHeader(&blkComp);
+			char curEntBuff[COMBO_ENTRY_SIZE];
+			std::vector<char> dumpBuff;
+			while(true){
+				uintptr_t winInd = allRead.size();
+				uintptr_t winRank = 0;
+				char* winEnt = 0;
+				for(uintptr_t i = 0; i<allRead.size(); i++){
+					char* curEnt = allRead[i].peekEntry();
+					if(!curEnt){ continue; }
+					uintptr_t curRank = sortLayout.getRank(curEnt);
+					if(winEnt && (winRank <= curRank)){ continue; }
+					winInd = i;
+					winRank = curRank;
+					winEnt = curEnt;
+				}
+				if(!winEnt){ break; }
+				comLayout.packEntry(sortLayout.getSeq(winEnt), sortLayout.getChar(winEnt), curEntBuff);
+				dumpBuff.insert(dumpBuff.end(), curEntBuff, curEntBuff + comLayout.entrySize);
+				allRead[winInd].popEntry();
+				if(dumpBuff.size() >= BLOCK_SIZE_INTERNAL){
+					blkComp.writeBytes(&(dumpBuff[0]), dumpBuff.size());
+					dumpBuff.clear();
+				}
+			}
+			if(dumpBuff.size()){ blkComp.writeBytes(&(dumpBuff[0]), dumpBuff.size()); }
+		}
+		catch(std::exception& err){
+			COMBO_BUILD_DUMP_CLEANUP
+			throw;
 		}
+		COMBO_BUILD_DUMP_CLEANUP
 		if(recoverStream){ (*recoverStream) << "dump" << std::endl; }
 	}
+	//build the side files
+	buildSideFiles(&handledTasks, &doThreads);
 	//clean up after yourself
 	if(fileExists(sortComboChunkA.c_str())){ killFile(sortComboChunkA.c_str()); }
 	if(fileExists(sortComboChunkB.c_str())){ killFile(sortComboChunkB.c_str()); }
@@ -1027,7 +2734,821 @@ void ProfinmanBuildReference::runThing(){
 	if(fileExists(sortComboChunkAblk.c_str())){ killFile(sortComboChunkAblk.c_str()); }
 	if(fileExists(sortComboChunkBblk.c_str())){ killFile(sortComboChunkBblk.c_str()); }
 	if(fileExists(sortIndexblk.c_str())){ killFile(sortIndexblk.c_str()); }
+	if(fileExists(sortFinishA.c_str())){ killFile(sortFinishA.c_str()); }
+	if(fileExists(sortFinishB.c_str())){ killFile(sortFinishB.c_str()); }
+	if(fileExists(sortFinishAblk.c_str())){ killFile(sortFinishAblk.c_str()); }
+	if(fileExists(sortFinishBblk.c_str())){ killFile(sortFinishBblk.c_str()); }
+	for(uintptr_t i = 0; i<finishRuns.size(); i++){
+		std::string curRunBlk = finishRuns[i] + ".blk";
+		if(fileExists(finishRuns[i].c_str())){ killFile(finishRuns[i].c_str()); }
+		if(fileExists(curRunBlk.c_str())){ killFile(curRunBlk.c_str()); }
+	}
+}
+
+/**The number of entries to write at a time for an in-memory build.*/
+#define INMEMORY_WRITE_CHUNK 0x010000
+
+/**Sort suffixes of a resident reference by their text: identical suffixes put later sequences first, like the external build.*/
+class ProfinmanBuildReferenceBucketCompare{
+public:
+	/**The reference in question.*/
+	ProfinmanResidentReferenceSource* allRef;
+	/**
+	 * Compare two suffixes.
+	 * @param itemA The first suffix (sequence index and character index).
+	 * @param itemB The second suffix.
+	 * @return Whether itemA comes before itemB.
+	 */
+	bool operator()(const std::pair<uintptr_t,uintptr_t>& itemA, const std::pair<uintptr_t,uintptr_t>& itemB){
+		uintptr_t startA = allRef->seqStarts[itemA.first] + itemA.second;
+		uintptr_t startB = allRef->seqStarts[itemB.first] + itemB.second;
+		uintptr_t lenA = allRef->seqStarts[itemA.first+1] - startA;
+		uintptr_t lenB = allRef->seqStarts[itemB.first+1] - startB;
+		int compV = memcmp(&(allRef->allSeqs[startA]), &(allRef->allSeqs[startB]), std::min(lenA, lenB));
+		if(compV){ return compV < 0; }
+		if(lenA != lenB){ return lenA < lenB; }
+		return itemA.first > itemB.first;
+	}
+};
+
+/**
+ * Get the bucket a suffix goes in.
+ * @param curSeq The suffix.
+ * @param curLen The length of the suffix.
+ * @param prefixLen The number of characters to bucket by.
+ * @param numDigit The number of digits per character (including the end).
+ * @param charDigits The digit for each character.
+ * @return The bucket code.
+ */
+uintptr_t profinmanBuildReferenceBucketCode(const char* curSeq, uintptr_t curLen, uintptr_t prefixLen, uintptr_t numDigit, uintptr_t* charDigits){
+	uintptr_t curCode = 0;
+	for(uintptr_t i = 0; i<prefixLen; i++){
+		curCode = curCode*numDigit + ((i < curLen) ? charDigits[0x00FF & curSeq[i]] : 0);
+	}
+	return curCode;
+}
+
+/**Sort a range of buckets.*/
+class ProfinmanBuildReferenceBucketUni{
+public:
+	/**The reference in question.*/
+	ProfinmanResidentReferenceSource* allRef;
+	/**The number of characters to bucket by.*/
+	uintptr_t prefixLen;
+	/**The number of digits per character (including the end).*/
+	uintptr_t numDigit;
+	/**The digit for each character.*/
+	uintptr_t* charDigits;
+	/**The first bucket to sort.*/
+	uintptr_t lowCode;
+	/**The bucket after the last to sort.*/
+	uintptr_t highCode;
+	/**The number of suffixes expected in the range.*/
+	uintptr_t numExpect;
+	/**The gathered suffixes (sequence index and character index).*/
+	std::vector< std::pair<uintptr_t,uintptr_t> > allSuff;
+	/**The layout to write with.*/
+	ProfinmanComboLayout* useLayout;
+	/**The name of this run in the recovery file.*/
+	std::string taskName;
+	/**The file to write to.*/
+	std::string outName;
+	/**The ID of this task.*/
+	uintptr_t taskID;
+	/**Save any errors.*/
+	std::string errMess;
+};
+/**Sort and write a range of buckets (the suffixes have already been gathered).*/
+void profinmanBuildReferenceBucketTask(void* myUni){
+	ProfinmanBuildReferenceBucketUni* myUn = (ProfinmanBuildReferenceBucketUni*)myUni;
+	try{
+		ProfinmanResidentReferenceSource* allRef = myUn->allRef;
+		std::vector< std::pair<uintptr_t,uintptr_t> >& allSuff = myUn->allSuff;
+		//sort
+			ProfinmanBuildReferenceBucketCompare compMeth;
+			compMeth.allRef = allRef;
+			std::sort(allSuff.begin(), allSuff.end(), compMeth);
+		//and write
+			std::string outBlkName = myUn->outName + ".blk";
+			FastLZCompressionMethod baseComp;
+			BlockCompOutStream blkComp(0, BLOCK_SIZE_INTERNAL, myUn->outName.c_str(), outBlkName.c_str(), &baseComp);
+			std::vector<char> dumpBuff;
+			for(uintptr_t i = 0; i<allSuff.size(); i++){
+				char curEntBuff[COMBO_ENTRY_SIZE];
+				myUn->useLayout->packEntry(allSuff[i].first, allSuff[i].second, curEntBuff);
+				dumpBuff.insert(dumpBuff.end(), curEntBuff, curEntBuff + myUn->useLayout->entrySize);
+				if(dumpBuff.size() >= COMBO_ENTRY_SIZE*INMEMORY_WRITE_CHUNK){
+					blkComp.writeBytes(&(dumpBuff[0]), dumpBuff.size());
+					dumpBuff.clear();
+				}
+			}
+			if(dumpBuff.size()){ blkComp.writeBytes(&(dumpBuff[0]), dumpBuff.size()); }
+	}
+	catch(std::exception& err){
+		myUn->errMess = err.what();
+	}
+	{ std::vector< std::pair<uintptr_t,uintptr_t> > tmpSuff; myUn->allSuff.swap(tmpSuff); }
+}
+
+void ProfinmanBuildReference::buildBuckets(std::set<std::string>* handledTasks, ThreadPool* useThreads){
+	std::string workFPrefix = workFolder;
+		workFPrefix.append(pathElementSep);
+	ProfinmanResidentReferenceSource allRef(referenceName);
+	uintptr_t numSeqs = allRef.getNumEntries();
+	uintptr_t maxLen = 0;
+	for(uintptr_t i = 0; i<numSeqs; i++){ maxLen = std::max(maxLen, allRef.getEntryLength(i)); }
+	ProfinmanComboLayout comLayout(numSeqs, maxLen);
+	//figure out the alphabet
+		uintptr_t charDigits[256];
+		uintptr_t numDigit = 1;
+		{
+			bool charSeen[256];
+			for(int i = 0; i<256; i++){ charSeen[i] = false; }
+			for(uintptr_t i = 0; i<allRef.allSeqs.size()-1; i++){ charSeen[0x00FF & allRef.allSeqs[i]] = true; }
+			for(int i = 0; i<256; i++){
+				charDigits[i] = 0;
+				if(charSeen[i]){
+					charDigits[i] = numDigit;
+					numDigit++;
+				}
+			}
+		}
+		uintptr_t numCode = 1;
+		for(intptr_t i = 0; i<bucketLen; i++){ numCode = numCode * numDigit; }
+	//count the buckets
+		std::vector<uintptr_t> bucketCounts(numCode);
+		for(uintptr_t i = 0; i<numSeqs; i++){
+			uintptr_t seqLen = allRef.getEntryLength(i);
+			const char* curSeq = allRef.getEntrySubsequence(i, 0, seqLen);
+			for(uintptr_t j = 0; j<seqLen; j++){
+				bucketCounts[profinmanBuildReferenceBucketCode(curSeq + j, seqLen - j, bucketLen, numDigit, charDigits)]++;
+			}
+		}
+	//split the ram left after the reference between the threads
+		uintptr_t fixedRam = allRef.allSeqs.size() + sizeof(uintptr_t)*(allRef.seqStarts.size() + 2*numCode);
+		if(fixedRam >= (uintptr_t)maxRam){ throw std::runtime_error("Reference does not fit in ram for a bucketed build."); }
+		uintptr_t maxPerThread = std::max((uintptr_t)1, ((maxRam - fixedRam) / numThread) / sizeof(std::pair<uintptr_t,uintptr_t>));
+	//group neighboring buckets into runs that fit (a lone bucket that does not fit is sorted anyway)
+		std::vector<ProfinmanBuildReferenceBucketUni> allRuns;
+		{
+			ProfinmanBuildReferenceBucketUni curRun;
+			curRun.allRef = &allRef;
+			curRun.prefixLen = bucketLen;
+			curRun.numDigit = numDigit;
+			curRun.charDigits = charDigits;
+			curRun.useLayout = &comLayout;
+			curRun.lowCode = 0;
+			curRun.numExpect = 0;
+			for(uintptr_t i = 0; i<numCode; i++){
+				if(curRun.numExpect && ((curRun.numExpect + bucketCounts[i]) > maxPerThread)){
+					curRun.highCode = i;
+					allRuns.push_back(curRun);
+					curRun.lowCode = i;
+					curRun.numExpect = 0;
+				}
+				curRun.numExpect += bucketCounts[i];
+			}
+			if(curRun.numExpect){
+				curRun.highCode = numCode;
+				allRuns.push_back(curRun);
+			}
+			for(uintptr_t i = 0; i<allRuns.size(); i++){
+				char numBuff[4*sizeof(uintmax_t)+8];
+				sprintf(numBuff, "%ju_%ju", (uintmax_t)(allRuns[i].lowCode), (uintmax_t)(allRuns[i].highCode));
+				allRuns[i].taskName = "bucket_";
+				allRuns[i].taskName.append(numBuff);
+				allRuns[i].outName = workFPrefix + "sbk_";
+				allRuns[i].outName.append(numBuff);
+			}
+		}
+	//sort the runs that have not been done, a wave of threads at a time
+		std::vector<ProfinmanBuildReferenceBucketUni*> waveRuns;
+		std::vector<uintptr_t> codeRun(numCode, (uintptr_t)-1);
+		uintptr_t nextRun = 0;
+		while(nextRun < allRuns.size()){
+			waveRuns.clear();
+			while((nextRun < allRuns.size()) && (waveRuns.size() < (uintptr_t)numThread)){
+				ProfinmanBuildReferenceBucketUni* curRun = &(allRuns[nextRun]);
+				if(!(handledTasks->count(curRun->taskName))){ waveRuns.push_back(curRun); }
+				nextRun++;
+			}
+			if(waveRuns.size() == 0){ continue; }
+			//gather the suffixes for the whole wave in one pass
+			for(uintptr_t i = 0; i<waveRuns.size(); i++){
+				for(uintptr_t j = waveRuns[i]->lowCode; j<waveRuns[i]->highCode; j++){ codeRun[j] = i; }
+				waveRuns[i]->allSuff.reserve(waveRuns[i]->numExpect);
+			}
+			for(uintptr_t i = 0; i<numSeqs; i++){
+				uintptr_t seqLen = allRef.getEntryLength(i);
+				const char* curSeq = allRef.getEntrySubsequence(i, 0, seqLen);
+				for(uintptr_t j = 0; j<seqLen; j++){
+					uintptr_t curRunI = codeRun[profinmanBuildReferenceBucketCode(curSeq + j, seqLen - j, bucketLen, numDigit, charDigits)];
+					if(curRunI < waveRuns.size()){
+						waveRuns[curRunI]->allSuff.push_back( std::pair<uintptr_t,uintptr_t>(i, j) );
+					}
+				}
+			}
+			for(uintptr_t i = 0; i<waveRuns.size(); i++){
+				for(uintptr_t j = waveRuns[i]->lowCode; j<waveRuns[i]->highCode; j++){ codeRun[j] = (uintptr_t)-1; }
+			}
+			for(uintptr_t i = 0; i<waveRuns.size(); i++){ waveRuns[i]->taskID = useThreads->addTask(profinmanBuildReferenceBucketTask, waveRuns[i]); }
+			for(uintptr_t i = 0; i<waveRuns.size(); i++){ useThreads->joinTask(waveRuns[i]->taskID); }
+			for(uintptr_t i = 0; i<waveRuns.size(); i++){
+				ProfinmanBuildReferenceBucketUni* curRun = waveRuns[i];
+				if(curRun->errMess.size()){ throw std::runtime_error(curRun->errMess); }
+				if(recoverStream){ (*recoverStream) << curRun->taskName << std::endl; }
+			}
+		}
+	//stick them together in order
+		{
+			std::string comFN(comboName);
+			std::string comBlkFN = comFN + ".blk";
+			MultithreadBlockCompOutStream blkComp(0, BLOCK_SIZE_END, comFN.c_str(), comBlkFN.c_str(), comboComp, numThread, useThreads);
+			comLayout.writeHeader(&blkComp);
+			std::vector<char> dumpBuff(COMBO_ENTRY_SIZE*INMEMORY_WRITE_CHUNK);
+			for(uintptr_t i = 0; i<allRuns.size(); i++){
+				std::string runBlkName = allRuns[i].outName + ".blk";
+				FastLZCompressionMethod runComp;
+				MultithreadBlockCompInStream runIn(allRuns[i].outName.c_str(), runBlkName.c_str(), &runComp, numThread, useThreads);
+				uintptr_t numCopy = 0;
+				uintptr_t numR = runIn.readBytes(&(dumpBuff[0]), dumpBuff.size());
+				while(numR){
+					blkComp.writeBytes(&(dumpBuff[0]), numR);
+					numCopy += numR;
+					numR = runIn.readBytes(&(dumpBuff[0]), dumpBuff.size());
+				}
+				if(numCopy != (allRuns[i].numExpect * comLayout.entrySize)){ throw std::runtime_error("Bucket file does not match reference."); }
+			}
+		}
+		if(recoverStream){ (*recoverStream) << "dump" << std::endl; }
+	//clean up after yourself
+		for(uintptr_t i = 0; i<allRuns.size(); i++){
+			std::string runBlkName = allRuns[i].outName + ".blk";
+			if(fileExists(allRuns[i].outName.c_str())){ killFile(allRuns[i].outName.c_str()); }
+			if(fileExists(runBlkName.c_str())){ killFile(runBlkName.c_str()); }
+		}
+}
+
+/**The most sequence pairs to remember the common tail of when ordering identical suffixes.*/
+#define INMEMORY_TAIL_CACHE 0x010000
+
+/**Uniform for sorting a piece of the reference in memory.*/
+class ProfinmanBuildReferenceInducedUni{
+public:
+	/**The sequences, squashed down and separated by ones, ending in a zero.*/
+	std::vector<unsigned char> allText;
+	/**Where each sequence starts in the text.*/
+	std::vector<uintptr_t> seqStarts;
+	/**The (global) index of the first sequence in this piece.*/
+	uintptr_t firstSeq;
+	/**The sorted suffixes.*/
+	std::vector<uint32_t> sortStore;
+	/**The ID of this task.*/
+	uintptr_t taskID;
+	/**Save any errors.*/
+	std::string errMess;
+	/**
+	 * Get the sequence a position is in.
+	 * @param textPos The position in the text.
+	 * @return The (local) sequence index.
+	 */
+	uintptr_t findSequence(uintptr_t textPos){
+		return (std::upper_bound(seqStarts.begin(), seqStarts.end(), textPos) - seqStarts.begin()) - 1;
+	}
+	/**
+	 * Get the location of the separator after a sequence.
+	 * @param seqInd The (local) sequence index.
+	 * @return The location of its separator.
+	 */
+	uintptr_t findSeparator(uintptr_t seqInd){
+		return (((seqInd+1) < seqStarts.size()) ? seqStarts[seqInd+1] : (allText.size()-1)) - 1;
+	}
+};
+
+/**Sort a piece of the reference in memory, and put identical suffixes in the same order as the external build (later sequences first).*/
+void profinmanBuildReferenceInducedTask(void* myUni){
+	ProfinmanBuildReferenceInducedUni* myUn = (ProfinmanBuildReferenceInducedUni*)myUni;
+	try{
+		uintptr_t totalLen = myUn->allText.size();
+		uintptr_t numSeq = myUn->seqStarts.size();
+		myUn->sortStore.resize(totalLen);
+		buildSuffixArrayInduced(totalLen, &(myUn->allText[0]), &(myUn->sortStore[0]));
+		//identical suffixes (up to their separators) sit next to each other: they match as far back as their sequences share a tail
+		const unsigned char* allText = &(myUn->allText[0]);
+		uint32_t* sortStore = &(myUn->sortStore[0]);
+		std::map< std::pair<uintptr_t,uintptr_t>, uintptr_t > tailCache;
+		uintptr_t runStart = numSeq + 1;
+		for(uintptr_t k = numSeq + 2; k<=totalLen; k++){
+			bool sameRun = false;
+			if(k < totalLen){
+				uintptr_t posA = sortStore[k-1];
+				uintptr_t posB = sortStore[k];
+				uintptr_t seqA = myUn->findSequence(posA);
+				uintptr_t seqB = myUn->findSequence(posB);
+				uintptr_t sepA = myUn->findSeparator(seqA);
+				uintptr_t sepB = myUn->findSeparator(seqB);
+				if(((sepA - posA) == (sepB - posB)) && (allText[posA] == allText[posB])){
+					std::pair<uintptr_t,uintptr_t> seqPair(std::min(seqA, seqB), std::max(seqA, seqB));
+					std::map< std::pair<uintptr_t,uintptr_t>, uintptr_t >::iterator cacheIt = tailCache.find(seqPair);
+					uintptr_t commonTail;
+					if(cacheIt != tailCache.end()){
+						commonTail = cacheIt->second;
+					}
+					else{
+						uintptr_t maxTail = std::min(sepA - myUn->seqStarts[seqA], sepB - myUn->seqStarts[seqB]);
+						commonTail = 0;
+						while((commonTail < maxTail) && (allText[sepA - commonTail - 1] == allText[sepB - commonTail - 1])){ commonTail++; }
+						if(tailCache.size() >= INMEMORY_TAIL_CACHE){ tailCache.clear(); }
+						tailCache[seqPair] = commonTail;
+					}
+					sameRun = commonTail >= (sepA - posA);
+				}
+			}
+			if(sameRun){ continue; }
+			if((k - runStart) > 1){ std::sort(sortStore + runStart, sortStore + k, std::greater<uint32_t>()); }
+			runStart = k;
+		}
+	}
+	catch(std::exception& err){
+		myUn->errMess = err.what();
+	}
+}
+
+/**The next suffix of a sorted piece of the reference.*/
+class ProfinmanBuildReferenceInducedHead{
+public:
+	/**The piece.*/
+	ProfinmanBuildReferenceInducedUni* fromUni;
+	/**The index of the piece.*/
+	uintptr_t uniInd;
+	/**The next entry in the piece's sorted suffixes.*/
+	uintptr_t nextEnt;
+	/**
+	 * Whether this head's suffix comes before another's: suffixes end at their separators, and identical suffixes put later pieces first.
+	 * @param other The other head.
+	 * @return Whether this goes first.
+	 */
+	bool goesBefore(ProfinmanBuildReferenceInducedHead* other){
+		const unsigned char* curA = &(fromUni->allText[fromUni->sortStore[nextEnt]]);
+		const unsigned char* curB = &(other->fromUni->allText[other->fromUni->sortStore[other->nextEnt]]);
+		while((*curA == *curB) && (*curA != 1)){
+			curA++;
+			curB++;
+		}
+		if(*curA != *curB){ return *curA < *curB; }
+		return uniInd > other->uniInd;
+	}
+	/**
+	 * Whether this head has run out of suffixes.
+	 * @return Whether it is done.
+	 */
+	bool isDone(){
+		return nextEnt >= fromUni->sortStore.size();
+	}
+};
+
+/**Pick the smallest suffix among the sorted pieces (a loser tree).*/
+class ProfinmanBuildReferenceInducedTree{
+public:
+	/**
+	 * Set up a tree.
+	 * @param allHeads The heads of the pieces.
+	 */
+	ProfinmanBuildReferenceInducedTree(std::vector<ProfinmanBuildReferenceInducedHead>* allHeads){
+		heads = allHeads;
+		numIn = allHeads->size();
+		losers.resize(numIn);
+		winner = playGame(1);
+	}
+	/**
+	 * Compare the current suffixes of two heads: finished heads come last.
+	 * @param inA The first head.
+	 * @param inB The second head.
+	 * @return Whether inA comes before inB.
+	 */
+	bool inputBefore(uintptr_t inA, uintptr_t inB){
+		ProfinmanBuildReferenceInducedHead* curA = &((*heads)[inA]);
+		ProfinmanBuildReferenceInducedHead* curB = &((*heads)[inB]);
+		bool doneA = curA->isDone();
+		bool doneB = curB->isDone();
+		if(doneA || doneB){ return !doneA || (doneB && (inA < inB)); }
+		return curA->goesBefore(curB);
+	}
+	/**
+	 * Set up the losers under a node.
+	 * @param nodeI The node: leaves are numIn past their head.
+	 * @return The winner under the node.
+	 */
+	uintptr_t playGame(uintptr_t nodeI){
+		if(nodeI >= numIn){ return nodeI - numIn; }
+		uintptr_t winA = playGame(2*nodeI);
+		uintptr_t winB = playGame(2*nodeI + 1);
+		if(inputBefore(winB, winA)){
+			losers[nodeI] = winA;
+			return winB;
+		}
+		losers[nodeI] = winB;
+		return winA;
+	}
+	/**
+	 * The winner has moved on: replay its path.
+	 */
+	void replay(){
+		uintptr_t curWin = winner;
+		uintptr_t nodeI = (curWin + numIn) / 2;
+		while(nodeI){
+			if(inputBefore(losers[nodeI], curWin)){
+				std::swap(losers[nodeI], curWin);
+			}
+			nodeI = nodeI / 2;
+		}
+		winner = curWin;
+	}
+	/**The heads.*/
+	std::vector<ProfinmanBuildReferenceInducedHead>* heads;
+	/**The number of heads.*/
+	uintptr_t numIn;
+	/**The loser at each internal node.*/
+	std::vector<uintptr_t> losers;
+	/**The current winner.*/
+	uintptr_t winner;
+};
+
+bool ProfinmanBuildReference::buildInMemory(ThreadPool* useThreads){
+	std::string refFN(referenceName);
+	std::string refBlkFN = refFN + ".blk";
+	std::string refFaiFN = refFN + ".fai";
+	//see if it would fit
+	uintptr_t totNumString;
+	uintptr_t totalLen;
+	uintptr_t maxLen = 0;
+	std::vector<uintptr_t> seqLens;
+	{
+		GZipCompressionMethod compMeth;
+		BlockCompInStream blkComp(refFN.c_str(), refBlkFN.c_str(), &compMeth);
+		GailAQSequenceReader gfaIn(&blkComp, refFaiFN.c_str());
+		totNumString = gfaIn.getNumEntries();
+		totalLen = totNumString + 1;
+		for(uintptr_t i = 0; i<totNumString; i++){
+			uintptr_t curLen = gfaIn.getEntryLength(i);
+			maxLen = std::max(maxLen, curLen);
+			totalLen += curLen;
+			if(totalLen >= SUFFIX_INDUCED_EMPTY){ return false; }
+			seqLens.push_back(curLen);
+		}
+	}
+	//text and array, plus the recursion on the reduced problem (at most half as long) with its buckets and types
+	uintptr_t needRam = (5*totalLen) + (totalLen / 8) + (2*totalLen) + (totalLen / 8) + (sizeof(uintptr_t)*totNumString);
+	if(needRam > (uintptr_t)maxRam){ return false; }
+	//split the sequences into a piece per thread
+	uintptr_t numPiece = std::max((uintptr_t)1, std::min((uintptr_t)numThread, totNumString));
+	std::vector<ProfinmanBuildReferenceInducedUni> allPiece(numPiece);
+	{
+		uintptr_t pieceTarget = (totalLen + numPiece - 1) / numPiece;
+		uintptr_t curPiece = 0;
+		uintptr_t curPieceLen = 0;
+		allPiece[0].firstSeq = 0;
+		for(uintptr_t i = 0; i<totNumString; i++){
+			if((curPieceLen >= pieceTarget) && ((curPiece + 1) < numPiece)){
+				curPiece++;
+				curPieceLen = 0;
+				allPiece[curPiece].firstSeq = i;
+			}
+			allPiece[curPiece].seqStarts.push_back(curPieceLen);
+			curPieceLen += seqLens[i] + 1;
+		}
+		numPiece = curPiece + 1;
+		allPiece.resize(numPiece);
+		for(uintptr_t i = 0; i<numPiece; i++){
+			ProfinmanBuildReferenceInducedUni* curUni = &(allPiece[i]);
+			uintptr_t pieceEnd = ((i+1) < numPiece) ? allPiece[i+1].firstSeq : totNumString;
+			uintptr_t pieceLen = 1;
+			for(uintptr_t j = curUni->firstSeq; j<pieceEnd; j++){ pieceLen += seqLens[j] + 1; }
+			curUni->allText.resize(pieceLen);
+		}
+	}
+	//load the sequences, separated by ones and ending in a zero
+	{
+		GZipCompressionMethod compMeth;
+		MultithreadBlockCompInStream blkComp(refFN.c_str(), refBlkFN.c_str(), &compMeth, numThread, useThreads);
+		GailAQSequenceReader gfaIn(&blkComp, refFaiFN.c_str());
+		uintptr_t curStrInd = 0;
+		uintptr_t curPiece = 0;
+		while(gfaIn.readNextEntry()){
+			if((curStrInd >= totNumString) || (gfaIn.lastReadSeqLen != seqLens[curStrInd])){ throw std::runtime_error("Reference does not match its index."); }
+			while(((curPiece + 1) < numPiece) && (allPiece[curPiece+1].firstSeq <= curStrInd)){ curPiece++; }
+			ProfinmanBuildReferenceInducedUni* curUni = &(allPiece[curPiece]);
+			uintptr_t curOff = curUni->seqStarts[curStrInd - curUni->firstSeq];
+			memcpy(&(curUni->allText[curOff]), gfaIn.lastReadSeq, gfaIn.lastReadSeqLen);
+			curUni->allText[curOff + gfaIn.lastReadSeqLen] = 1;
+			curStrInd++;
+		}
+		if(curStrInd != totNumString){ throw std::runtime_error("Reference does not match its index."); }
+	}
+	//squash the characters down (zero and one are taken)
+	{
+		bool charPresent[256];
+		memset(charPresent, 0, 256*sizeof(bool));
+		for(uintptr_t pi = 0; pi<numPiece; pi++){
+			ProfinmanBuildReferenceInducedUni* curUni = &(allPiece[pi]);
+			for(uintptr_t i = 0; i<curUni->seqStarts.size(); i++){
+				uintptr_t curEnd = curUni->findSeparator(i);
+				for(uintptr_t j = curUni->seqStarts[i]; j<curEnd; j++){ charPresent[curUni->allText[j]] = true; }
+			}
+		}
+		unsigned char charMap[256];
+		unsigned curCode = 2;
+		for(int i = 0; i<256; i++){
+			if(!charPresent[i]){ continue; }
+			if(curCode > 255){ return false; }
+			charMap[i] = curCode;
+			curCode++;
+		}
+		for(uintptr_t pi = 0; pi<numPiece; pi++){
+			ProfinmanBuildReferenceInducedUni* curUni = &(allPiece[pi]);
+			for(uintptr_t i = 0; i<curUni->seqStarts.size(); i++){
+				uintptr_t curEnd = curUni->findSeparator(i);
+				for(uintptr_t j = curUni->seqStarts[i]; j<curEnd; j++){ curUni->allText[j] = charMap[curUni->allText[j]]; }
+			}
+			curUni->allText[curUni->allText.size()-1] = 0;
+		}
+	}
+	//sort each piece
+	for(uintptr_t pi = 0; pi<numPiece; pi++){ allPiece[pi].taskID = useThreads->addTask(profinmanBuildReferenceInducedTask, &(allPiece[pi])); }
+	for(uintptr_t pi = 0; pi<numPiece; pi++){ useThreads->joinTask(allPiece[pi].taskID); }
+	for(uintptr_t pi = 0; pi<numPiece; pi++){
+		if(allPiece[pi].errMess.size()){ throw std::runtime_error(allPiece[pi].errMess); }
+	}
+	//merge the pieces and write out: the end and the separators sort first
+	std::string comFN(comboName);
+	std::string comBlkFN = comFN + ".blk";
+	MultithreadBlockCompOutStream blkComp(0, BLOCK_SIZE_END, comFN.c_str(), comBlkFN.c_str(), comboComp, numThread, useThreads);
+	ProfinmanComboLayout comLayout(totNumString, maxLen);
+	comLayout.writeHeader(&blkComp);
+	std::vector<ProfinmanBuildReferenceInducedHead> allHeads(numPiece);
+	for(uintptr_t pi = 0; pi<numPiece; pi++){
+		allHeads[pi].fromUni = &(allPiece[pi]);
+		allHeads[pi].uniInd = pi;
+		allHeads[pi].nextEnt = allPiece[pi].seqStarts.size() + 1;
+	}
+	ProfinmanBuildReferenceInducedTree pickTree(&allHeads);
+	std::vector<char> dumpBuff;
+	while(!(allHeads[pickTree.winner].isDone())){
+		ProfinmanBuildReferenceInducedHead* winHead = &(allHeads[pickTree.winner]);
+		ProfinmanBuildReferenceInducedUni* winUni = winHead->fromUni;
+		uintptr_t curPos = winUni->sortStore[winHead->nextEnt];
+		uintptr_t seqInd = winUni->findSequence(curPos);
+		char curEntBuff[COMBO_ENTRY_SIZE];
+		comLayout.packEntry(winUni->firstSeq + seqInd, curPos - winUni->seqStarts[seqInd], curEntBuff);
+		dumpBuff.insert(dumpBuff.end(), curEntBuff, curEntBuff + comLayout.entrySize);
+		if(dumpBuff.size() >= COMBO_ENTRY_SIZE*INMEMORY_WRITE_CHUNK){
+			blkComp.writeBytes(&(dumpBuff[0]), dumpBuff.size());
+			dumpBuff.clear();
+		}
+		winHead->nextEnt++;
+		pickTree.replay();
+	}
+	if(dumpBuff.size()){ blkComp.writeBytes(&(dumpBuff[0]), dumpBuff.size()); }
+	return true;
+}
+
+void ProfinmanBuildReference::buildSideFiles(std::set<std::string>* handledTasks, ThreadPool* useThreads){
+	bool needLCP = buildLCP && !(handledTasks->count("lcp"));
+	bool needJump = jumpLen && !(handledTasks->count("jump"));
+	if(needLCP || needJump){
+		profinmanBuildSuffixSideFiles(referenceName, comboName, needLCP, needJump ? jumpLen : 0, maxRam, numThread, useThreads);
+		if(recoverStream && needLCP){ (*recoverStream) << "lcp" << std::endl; }
+		if(recoverStream && needJump){ (*recoverStream) << "jump" << std::endl; }
+	}
+}
+
+ProfinmanSuffixLCP::ProfinmanSuffixLCP(const char* comName){
+	//load the lcps
+		std::string lbaseFN(comName);
+			lbaseFN.append(".lcp");
+		std::string lblockFN = lbaseFN + ".blk";
+		GZipCompressionMethod lcompMeth;
+		BlockCompInStream lcpB(lbaseFN.c_str(), lblockFN.c_str(), &lcompMeth);
+		uintptr_t numEnts = lcpB.getUncompressedSize();
+		allLCP.resize(numEnts);
+		if(numEnts && (lcpB.readBytes((char*)&(allLCP[0]), numEnts) != numEnts)){ throw std::runtime_error("LCP file truncated."); }
+	//summarize the blocks
+		uintptr_t numBlock = (numEnts + SUFFIX_LCP_BLOCK - 1) / SUFFIX_LCP_BLOCK;
+		blockMins.resize(1);
+		blockMins[0].resize(numBlock);
+		for(uintptr_t i = 0; i<numBlock; i++){
+			uintptr_t blockE = std::min(numEnts, (i+1)*SUFFIX_LCP_BLOCK);
+			blockMins[0][i] = *std::min_element(allLCP.begin() + i*SUFFIX_LCP_BLOCK, allLCP.begin() + blockE);
+		}
+	//and runs of blocks
+		uintptr_t runLen = 1;
+		while((runLen << 1) <= numBlock){
+			std::vector<unsigned char>* prevMins = &(blockMins[blockMins.size()-1]);
+			std::vector<unsigned char> curMins(numBlock - (runLen << 1) + 1);
+			for(uintptr_t i = 0; i<curMins.size(); i++){
+				curMins[i] = std::min((*prevMins)[i], (*prevMins)[i+runLen]);
+			}
+			blockMins.push_back(curMins);
+			runLen = runLen << 1;
+		}
 }
 
+ProfinmanSuffixLCP::~ProfinmanSuffixLCP(){}
 
+uintptr_t ProfinmanSuffixLCP::getRangeLCP(uintptr_t fromEnt, uintptr_t toEnt){
+	//the lcp is the minimum of the neighbor lcps in (fromEnt,toEnt]
+	uintptr_t firstI = fromEnt + 1;
+	uintptr_t firstB = firstI / SUFFIX_LCP_BLOCK;
+	uintptr_t lastB = toEnt / SUFFIX_LCP_BLOCK;
+	if((lastB - firstB) < 2){
+		return *std::min_element(allLCP.begin() + firstI, allLCP.begin() + toEnt + 1);
+	}
+	//partial blocks on the ends, whole blocks in the middle
+	unsigned char curMin = *std::min_element(allLCP.begin() + firstI, allLCP.begin() + (firstB+1)*SUFFIX_LCP_BLOCK);
+	curMin = std::min(curMin, *std::min_element(allLCP.begin() + lastB*SUFFIX_LCP_BLOCK, allLCP.begin() + toEnt + 1));
+	uintptr_t midS = firstB + 1;
+	uintptr_t midN = lastB - midS;
+	uintptr_t runLev = 0;
+	while((((uintptr_t)2) << runLev) <= midN){ runLev++; }
+	std::vector<unsigned char>* runMins = &(blockMins[runLev]);
+	curMin = std::min(curMin, (*runMins)[midS]);
+	curMin = std::min(curMin, (*runMins)[lastB - (((uintptr_t)1) << runLev)]);
+	return curMin;
+}
+
+ProfinmanSuffixJumpTable::ProfinmanSuffixJumpTable(const char* comName){
+	std::string jbaseFN(comName);
+		jbaseFN.append(".jump");
+	std::string jblockFN = jbaseFN + ".blk";
+	GZipCompressionMethod jcompMeth;
+	BlockCompInStream jumpB(jbaseFN.c_str(), jblockFN.c_str(), &jcompMeth);
+	//get the header
+		char numBuff[8];
+		if(jumpB.readBytes(numBuff, 8) != 8){ throw std::runtime_error("Jump table truncated."); }
+		prefixLen = be2nat64(numBuff);
+		if(jumpB.readBytes(numBuff, 8) != 8){ throw std::runtime_error("Jump table truncated."); }
+		uintptr_t numChar = be2nat64(numBuff);
+		if(numChar > 255){ throw std::runtime_error("Malformed jump table."); }
+		numDigit = numChar + 1;
+		char charBuff[256];
+		if(jumpB.readBytes(charBuff, numChar) != numChar){ throw std::runtime_error("Jump table truncated."); }
+		for(int i = 0; i<256; i++){ charDigits[i] = 0; }
+		for(uintptr_t i = 0; i<numChar; i++){ charDigits[0x00FF & charBuff[i]] = i+1; }
+	//get the starts
+		uintptr_t numCode = 1;
+		for(uintptr_t i = 0; i<prefixLen; i++){
+			numCode = numCode * numDigit;
+			if(numCode > SUFFIX_JUMP_MAX_CODES){ throw std::runtime_error("Malformed jump table."); }
+		}
+		std::vector<char> startBuff(8*(numCode+1));
+		if(jumpB.readBytes(&(startBuff[0]), startBuff.size()) != startBuff.size()){ throw std::runtime_error("Jump table truncated."); }
+		prefixStarts.resize(numCode+1);
+		for(uintptr_t i = 0; i<=numCode; i++){ prefixStarts[i] = be2nat64(&(startBuff[8*i])); }
+}
+
+ProfinmanSuffixJumpTable::~ProfinmanSuffixJumpTable(){}
+
+void ProfinmanSuffixJumpTable::getRange(const char* lookFor, uintptr_t lookLen, uintptr_t* lowEnt, uintptr_t* highEnt){
+	//use as much as can be used (characters not in the reference will be sorted out later)
+	uintptr_t lowCode = 0;
+	uintptr_t codeSpan = 1;
+	uintptr_t numUse = 0;
+	for(uintptr_t i = 0; i<prefixLen; i++){
+		uintptr_t curDig = (i < lookLen) ? charDigits[0x00FF & lookFor[i]] : 0;
+		if(curDig && (numUse == i)){ numUse++; } else{ curDig = 0; }
+		lowCode = lowCode*numDigit + curDig;
+		if(numUse <= i){ codeSpan = codeSpan * numDigit; }
+	}
+	*lowEnt = prefixStarts[lowCode];
+	*highEnt = prefixStarts[lowCode + codeSpan];
+}
 
+void profinmanBuildSuffixSideFiles(const char* refName, const char* comName, bool buildLCP, uintptr_t jumpLen, uintptr_t maxRam, int numThread, ThreadPool* useThreads){
+	std::string cbaseFN(comName);
+	//run down the reference once for its size and alphabet
+		uintptr_t numSeqs;
+		uintptr_t totSeqLen = 0;
+		bool charSeen[256];
+		for(int i = 0; i<256; i++){ charSeen[i] = false; }
+		{
+			std::string rbaseFN(refName);
+			std::string rblockFN = rbaseFN + ".blk";
+			std::string rfastiFN = rbaseFN + ".fai";
+			GZipCompressionMethod rcompMeth;
+			MultithreadBlockCompInStream rblkComp(rbaseFN.c_str(), rblockFN.c_str(), &rcompMeth, numThread, useThreads);
+			GailAQSequenceReader gfaIn(&rblkComp, rfastiFN.c_str());
+			numSeqs = gfaIn.getNumEntries();
+			while(gfaIn.readNextEntry()){
+				totSeqLen += gfaIn.lastReadSeqLen;
+				if(jumpLen){
+					for(uintptr_t i = 0; i<gfaIn.lastReadSeqLen; i++){ charSeen[0x00FF & gfaIn.lastReadSeq[i]] = true; }
+				}
+			}
+		}
+	//figure out the jump table alphabet
+		uintptr_t charDigits[256];
+		std::vector<char> allChars;
+		std::vector<uintptr_t> prefixCounts;
+		uintptr_t numDigit = 1;
+		if(jumpLen){
+			for(int i = 0; i<256; i++){
+				charDigits[i] = 0;
+				if(charSeen[i]){
+					allChars.push_back(i);
+					charDigits[i] = allChars.size();
+				}
+			}
+			numDigit = allChars.size() + 1;
+			uintptr_t numCode = 1;
+			for(uintptr_t i = 0; i<jumpLen; i++){
+				numCode = numCode * numDigit;
+				if(numCode > SUFFIX_JUMP_MAX_CODES){ throw std::runtime_error("Jump table prefix too long for the number of characters in the reference."); }
+			}
+			prefixCounts.resize(numCode);
+		}
+	//only the start of each suffix matters: load the whole reference if it fits, otherwise keep recent sequences
+		uintptr_t numLook = std::max(buildLCP ? (uintptr_t)SUFFIX_LCP_MAX : (uintptr_t)0, jumpLen);
+		uintptr_t needRam = totSeqLen + sizeof(uintptr_t)*(numSeqs + 2) + sizeof(uintptr_t)*prefixCounts.size();
+		ProfinmanReferenceSource* allRef;
+		if(needRam <= maxRam){
+			allRef = new ProfinmanResidentReferenceSource(refName);
+		}
+		else{
+			allRef = new ProfinmanCachedReferenceSource(refName, std::max((uintptr_t)1, maxRam - std::min(maxRam, sizeof(uintptr_t)*prefixCounts.size())));
+		}
+		std::vector<char> prevSeq(numLook + 1);
+	std::string cblockFN = cbaseFN + ".blk";
+	GZipCompressionMethod ccompMeth;
+	GZipCompressionMethod lcompMeth;
+	MultithreadBlockCompOutStream* lcpOut = 0;
+	try{
+	//open the combo
+		MultithreadBlockCompInStream comboIn(cbaseFN.c_str(), cblockFN.c_str(), &ccompMeth, numThread, useThreads);
+		ProfinmanComboLayout comLayout(comName);
+		comLayout.skipHeader(&comboIn);
+	//open the lcp output
+		if(buildLCP){
+			std::string lbaseFN = cbaseFN + ".lcp";
+			std::string lblockFN = lbaseFN + ".blk";
+			lcpOut = new MultithreadBlockCompOutStream(0, BLOCK_SIZE_INTERNAL, lbaseFN.c_str(), lblockFN.c_str(), &lcompMeth, numThread, useThreads);
+		}
+	//run down the suffixes
+		uintptr_t prevLen = 0;
+		uintptr_t numEnts = 0;
+		char curEntBuff[COMBO_ENTRY_SIZE];
+		uintptr_t numR = comboIn.readBytes(curEntBuff, comLayout.entrySize);
+		while(numR){
+			if(numR != comLayout.entrySize){ throw std::runtime_error("File truncated."); }
+			uintptr_t seqInd;
+			uintptr_t charInd;
+			comLayout.unpackEntry(curEntBuff, &seqInd, &charInd);
+			if(seqInd >= numSeqs){ throw std::runtime_error("Suffix array file does not match reference."); }
+			uintptr_t seqLen = allRef->getEntryLength(seqInd);
+			if(charInd > seqLen){ throw std::runtime_error("Suffix array file does not match reference."); }
+			uintptr_t curLen = std::min(seqLen - charInd, numLook);
+			const char* curSeq = allRef->getEntrySubsequence(seqInd, charInd, charInd + curLen);
+			if(lcpOut){
+				uintptr_t maxComp = std::min((uintptr_t)SUFFIX_LCP_MAX, std::min(curLen, prevLen));
+				uintptr_t curLCP = 0;
+				while((curLCP < maxComp) && (curSeq[curLCP] == prevSeq[curLCP])){ curLCP++; }
+				lcpOut->writeByte(curLCP);
+			}
+			if(jumpLen){
+				uintptr_t curCode = 0;
+				for(uintptr_t i = 0; i<jumpLen; i++){
+					curCode = curCode*numDigit + ((i < curLen) ? charDigits[0x00FF & curSeq[i]] : 0);
+				}
+				prefixCounts[curCode]++;
+			}
+			//the source may drop the sequence on the next lookup
+			memcpy(&(prevSeq[0]), curSeq, curLen);
+			prevLen = curLen;
+			numEnts++;
+			numR = comboIn.readBytes(curEntBuff, comLayout.entrySize);
+		}
+		if(lcpOut){ delete(lcpOut); lcpOut = 0; }
+		//write out the jump table
+		if(jumpLen){
+			std::string jbaseFN = cbaseFN + ".jump";
+			std::string jblockFN = jbaseFN + ".blk";
+			GZipCompressionMethod jcompMeth;
+			BlockCompOutStream jumpOut(0, BLOCK_SIZE_INTERNAL, jbaseFN.c_str(), jblockFN.c_str(), &jcompMeth);
+			char numBuff[8];
+			nat2be64(jumpLen, numBuff); jumpOut.writeBytes(numBuff, 8);
+			nat2be64(allChars.size(), numBuff); jumpOut.writeBytes(numBuff, 8);
+			if(allChars.size()){ jumpOut.writeBytes(&(allChars[0]), allChars.size()); }
+			uintptr_t curStart = 0;
+			for(uintptr_t i = 0; i<prefixCounts.size(); i++){
+				nat2be64(curStart, numBuff); jumpOut.writeBytes(numBuff, 8);
+				curStart += prefixCounts[i];
+			}
+			nat2be64(numEnts, numBuff); jumpOut.writeBytes(numBuff, 8);
+		}
+	}
+	catch(std::exception& err){
+		if(lcpOut){ delete(lcpOut); }
+		delete(allRef);
+		throw;
+	}
+	delete(allRef);
+}
@@ -1,13 +1,19 @@
 #include "profinman_task.h"
 
-#include <deque>
+#include <map>
+#include <queue>
 #include <string.h>
 #include <stdexcept>
 #include <algorithm>
 
+#include "whodun_oshelp.h"
+#include "whodun_oshook.h"
+#include "whodun_thread.h"
 #include "whodun_datread.h"
 #include "whodun_compress.h"
 #include "whodun_parse_seq.h"
+#include "whodun_stringext.h"
+#include "whodun_multisearch.h"
 
 ProfinmanBlockSequence::ProfinmanBlockSequence(){
 	dumpBaseName = 0;
@@ -22,6 +28,9 @@ ProfinmanBlockSequence::ProfinmanBlockSequence(){
 		dumpMeta.fileWrite = true;
 		dumpMeta.fileExts.insert(".gail");
 		addStringOption("--dump", &dumpBaseName, 0, "    Specify the main location to write to.\n    --dump File.gail\n", &dumpMeta);
+	compName = (char*)"gzip";
+	ArgumentParserStrMeta compMeta("Block Compression");
+		addStringOption("--comp", &compName, 0, "    How to compress the blocks: gzip, fastlz (faster, larger) or rawsum (no compression, checksummed).\n    Readers figure out which was used.\n    --comp gzip\n", &compMeta);
 }
 
 ProfinmanBlockSequence::~ProfinmanBlockSequence(){}
@@ -43,43 +52,167 @@ int ProfinmanBlockSequence::posteriorCheck(){
 	if(srcFAs.size() == 0){
 		srcFAs.push_back("-");
 	}
+	CompressionMethod* testComp = makeNamedCompressionMethod(compName);
+	if(testComp == 0){
+		argumentError = "Unknown compression method.";
+		return 1;
+	}
+	delete(testComp);
 	return 0;
 }
 
 void ProfinmanBlockSequence::runThing(){
-	//open up the output
-		std::string baseFN(dumpBaseName);
-		std::string blockFN = baseFN + ".blk";
-		std::string fastiFN = baseFN + ".fai";
-		GZipCompressionMethod compMeth;
-		BlockCompOutStream blkComp(0, 0x010000, baseFN.c_str(), blockFN.c_str(), &compMeth);
-		GailAQSequenceWriter gfaOut(0, &blkComp, fastiFN.c_str());
-	//run down the inputs
-	for(uintptr_t i = 0; i<srcFAs.size(); i++){
-		InStream* saveIS = 0;
-		SequenceReader* saveSS = 0;
-		openSequenceFileRead(srcFAs[i], &saveIS, &saveSS);
-		try{
-			while(saveSS->readNextEntry()){
-				gfaOut.nextNameLen = saveSS->lastReadNameLen;
-				gfaOut.nextShortNameLen = saveSS->lastReadShortNameLen;
-				gfaOut.nextName = saveSS->lastReadName;
-				gfaOut.nextSeqLen = saveSS->lastReadSeqLen;
-				gfaOut.nextSeq = saveSS->lastReadSeq;
-				gfaOut.nextHaveQual = saveSS->lastReadHaveQual;
-				gfaOut.nextQual = saveSS->lastReadQual;
-				gfaOut.writeNextEntry();
-				
+	CompressionMethod* compMeth = makeNamedCompressionMethod(compName);
+	try{
+		//open up the output
+			std::string baseFN(dumpBaseName);
+			std::string blockFN = baseFN + ".blk";
+			std::string fastiFN = baseFN + ".fai";
+			BlockCompOutStream blkComp(0, 0x010000, baseFN.c_str(), blockFN.c_str(), compMeth);
+			GailAQSequenceWriter gfaOut(0, &blkComp, fastiFN.c_str());
+			ProfinmanNameTableWriter namOut(baseFN.c_str());
+		//run down the inputs
+		for(uintptr_t i = 0; i<srcFAs.size(); i++){
+			InStream* saveIS = 0;
+			SequenceReader* saveSS = 0;
+			openSequenceFileRead(srcFAs[i], &saveIS, &saveSS);
+			try{
+				while(saveSS->readNextEntry()){
+					gfaOut.nextNameLen = saveSS->lastReadNameLen;
+					gfaOut.nextShortNameLen = saveSS->lastReadShortNameLen;
+					gfaOut.nextName = saveSS->lastReadName;
+					gfaOut.nextSeqLen = saveSS->lastReadSeqLen;
+					gfaOut.nextSeq = saveSS->lastReadSeq;
+					gfaOut.nextHaveQual = saveSS->lastReadHaveQual;
+					gfaOut.nextQual = saveSS->lastReadQual;
+					gfaOut.writeNextEntry();
+					namOut.addName(saveSS->lastReadName, saveSS->lastReadNameLen);
+				}
+				if(saveIS){ delete(saveIS); }
+				if(saveSS){ delete(saveSS); }
+			}
+			catch(std::exception& err){
+				if(saveIS){ delete(saveIS); }
+				if(saveSS){ delete(saveSS); }
+				throw;
 			}
-			if(saveIS){ delete(saveIS); }
-			if(saveSS){ delete(saveSS); }
 		}
-		catch(std::exception& err){
-			if(saveIS){ delete(saveIS); }
-			if(saveSS){ delete(saveSS); }
-			throw;
+		namOut.finish();
+	}
+	catch(std::exception& err){
+		delete(compMeth);
+		throw;
+	}
+	delete(compMeth);
+}
+
+ProfinmanNameTableWriter::ProfinmanNameTableWriter(const char* refName){
+	std::string tabFN(refName);
+		tabFN.append(PROFINMAN_NAME_TABLE_EXT);
+	tabF = fopen(tabFN.c_str(), "wb");
+	if(tabF == 0){ throw std::runtime_error("Could not open name table."); }
+	totNameLen = 0;
+}
+
+ProfinmanNameTableWriter::~ProfinmanNameTableWriter(){
+	if(tabF){ fclose(tabF); }
+}
+
+void ProfinmanNameTableWriter::addName(const char* name, uintptr_t nameLen){
+	nameStarts.push_back(totNameLen);
+	if(nameLen && (fwrite(name, 1, nameLen, tabF) != nameLen)){ throw std::runtime_error("Problem writing name table."); }
+	totNameLen += nameLen;
+}
+
+void ProfinmanNameTableWriter::finish(){
+	nameStarts.push_back(totNameLen);
+	char numBuff[8];
+	for(uintptr_t i = 0; i<nameStarts.size(); i++){
+		nat2be64(nameStarts[i], numBuff);
+		if(fwrite(numBuff, 1, 8, tabF) != 8){ throw std::runtime_error("Problem writing name table."); }
+	}
+	nat2be64(GAIL_INDEX_ENTLEN * (nameStarts.size() - 1), numBuff);
+	if(fwrite(numBuff, 1, 8, tabF) != 8){ throw std::runtime_error("Problem writing name table."); }
+	nat2be64(nameStarts.size() - 1, numBuff);
+	if(fwrite(numBuff, 1, 8, tabF) != 8){ throw std::runtime_error("Problem writing name table."); }
+	int closeRes = fclose(tabF);
+	tabF = 0;
+	if(closeRes){ throw std::runtime_error("Problem writing name table."); }
+}
+
+ProfinmanNameTable::ProfinmanNameTable(const char* refName){
+	std::string tabFN(refName);
+		tabFN.append(PROFINMAN_NAME_TABLE_EXT);
+	intptr_t tabLen = getFileSize(tabFN.c_str());
+	if(tabLen < 24){ throw std::runtime_error("Malformed name table."); }
+	allData.resize(tabLen);
+	FILE* tabF = fopen(tabFN.c_str(), "rb");
+	if(tabF == 0){ throw std::runtime_error("Could not open name table."); }
+	uintptr_t numRead = fread(&(allData[0]), 1, tabLen, tabF);
+	fclose(tabF);
+	if(numRead != (uintptr_t)tabLen){ throw std::runtime_error("Problem reading name table."); }
+	numEntries = be2nat64(&(allData[tabLen - 8]));
+	if((numEntries + 3) > ((uintptr_t)tabLen / 8)){ throw std::runtime_error("Malformed name table."); }
+	totNameLen = tabLen - 8*(numEntries + 3);
+	if(be2nat64(&(allData[tabLen - 24])) != totNameLen){ throw std::runtime_error("Malformed name table."); }
+}
+
+ProfinmanNameTable::~ProfinmanNameTable(){}
+
+uintptr_t ProfinmanNameTable::getNumEntries(){
+	return numEntries;
+}
+
+const char* ProfinmanNameTable::getEntryName(uintptr_t entInd, uintptr_t* nameLen){
+	const char* curStart = &(allData[totNameLen + 8*entInd]);
+	uintptr_t nameFrom = be2nat64(curStart);
+	uintptr_t nameTo = be2nat64(curStart + 8);
+	if((nameFrom > nameTo) || (nameTo > totNameLen)){ throw std::runtime_error("Malformed name table."); }
+	*nameLen = nameTo - nameFrom;
+	return &(allData[nameFrom]);
+}
+
+/**The number of index entries to read at a time when checking a name table.*/
+#define NAME_TABLE_CHECK_ENTS 0x0400
+
+bool profinmanHaveNameTable(const char* refName){
+	std::string tabFN(refName);
+		tabFN.append(PROFINMAN_NAME_TABLE_EXT);
+	std::string fastiFN(refName);
+		fastiFN.append(".fai");
+	if(!fileExists(tabFN.c_str())){ return false; }
+	intptr_t tabLen = getFileSize(tabFN.c_str());
+	intptr_t fastiLen = getFileSize(fastiFN.c_str());
+	if((tabLen < 24) || (fastiLen < 0) || (fastiLen % GAIL_INDEX_ENTLEN)){ return false; }
+	//the end of the table: the total name length, the size of the index, then the number of names
+	char trailBuff[24];
+	FILE* tabF = fopen(tabFN.c_str(), "rb");
+	if(tabF == 0){ return false; }
+	bool readOK = (fseekPointer(tabF, tabLen - 24, SEEK_SET) == 0) && (fread(trailBuff, 1, 24, tabF) == 24);
+	fclose(tabF);
+	if(!readOK){ return false; }
+	uintptr_t totNameLen = be2nat64(trailBuff);
+	uintptr_t numNames = be2nat64(trailBuff + 16);
+	if(be2nat64(trailBuff + 8) != (uintptr_t)fastiLen){ return false; }
+	if(numNames != (uintptr_t)(fastiLen / GAIL_INDEX_ENTLEN)){ return false; }
+	if(totNameLen != (tabLen - 8*(numNames + 3))){ return false; }
+	//the names in the index should be as long
+	FILE* fastiF = fopen(fastiFN.c_str(), "rb");
+	if(fastiF == 0){ return false; }
+	std::vector<char> fastiBuff(GAIL_INDEX_ENTLEN * NAME_TABLE_CHECK_ENTS);
+	uintptr_t fastiNameLen = 0;
+	uintptr_t numLeft = numNames;
+	while(numLeft){
+		uintptr_t numRead = std::min(numLeft, (uintptr_t)NAME_TABLE_CHECK_ENTS);
+		if(fread(&(fastiBuff[0]), GAIL_INDEX_ENTLEN, numRead, fastiF) != numRead){ fclose(fastiF); return false; }
+		for(uintptr_t i = 0; i<numRead; i++){
+			const char* curEnt = &(fastiBuff[GAIL_INDEX_ENTLEN*i]);
+			fastiNameLen += be2nat64(curEnt + 16) - be2nat64(curEnt);
 		}
+		numLeft -= numRead;
 	}
+	fclose(fastiF);
+	return fastiNameLen == totNameLen;
 }
 
 
@@ -155,8 +288,10 @@ ProfinmanSearchSequence::ProfinmanSearchSequence(){
 	dumpBaseName = 0;
 	searchName = 0;
 	outputName = 0;
+	workFolder = 0;
 	maxRam = 500000000;
 	txtOut = false;
+	numThread = 1;
 	mySummary = "  Search for peptides in a sequence file (slow).";
 	myMainDoc = "Usage: profinman findfa [OPTION] [FILE]*\n"
 		"Takes a fasta file and looks for the entries in a reference.\n"
@@ -184,7 +319,12 @@ ProfinmanSearchSequence::ProfinmanSearchSequence(){
 	ArgumentParserBoolMeta binMeta("Text Output");
 		addBooleanFlag("--text", &txtOut, 1, "    Write out results tsv rather than binary.\n", &binMeta);
 	ArgumentParserIntMeta ramMeta("RAM Usage");
-		addIntegerOption("--ram", &maxRam, 0, "    Specify a target ram usage, in bytes.\n    --ram 500000000\n", &ramMeta);
+		addIntegerOption("--ram", &maxRam, 0, "    Specify how many bytes of search sequence to load at once.\n    The search automaton and held results take up to as much again.\n    --ram 500000000\n", &ramMeta);
+	ArgumentParserIntMeta threadMeta("Threads");
+		addIntegerOption("--thread", &numThread, 0, "    How many threads to use.\n    --thread 1\n", &threadMeta);
+	ArgumentParserStrMeta workMeta("Working Folder");
+		workMeta.isFolder = true;
+		addStringOption("--work", &workFolder, 0, "    The folder to put temporary files in, if the search automaton needs splitting.\n    Defaults to the current folder.\n    --work Folder\n", &workMeta);
 }
 
 int ProfinmanSearchSequence::posteriorCheck(){
@@ -198,13 +338,189 @@ int ProfinmanSearchSequence::posteriorCheck(){
 	if((outputName == 0) || (strlen(outputName)==0)){
 		outputName = 0;
 	}
+	if((workFolder == 0) || (strlen(workFolder)==0)){
+		workFolder = 0;
+	}
 	if(maxRam <= 0){
 		argumentError = "Need at least one byte of ram.";
 		return 1;
 	}
+	if(numThread <= 0){
+		argumentError = "Need at least one thread.";
+		return 1;
+	}
 	return 0;
 }
 
+/**The bytes an automaton state takes besides its transitions (depth, links, output start, and scratch while building).*/
+#define SEARCH_AUTOMATON_STATE_COST 28
+/**The bytes an automaton takes for each search sequence.*/
+#define SEARCH_AUTOMATON_PATTERN_COST 16
+/**The number of reference characters to give a thread at a time.*/
+#define SEARCH_SCAN_CHUNK 0x00100000
+/**The fewest bytes of results a thread will hold before writing.*/
+#define SEARCH_RESULT_MIN_BUFFER 0x010000
+
+/**Make threads write their results in the order of their ranges.*/
+class ProfinmanSearchSequenceOrder{
+public:
+	/**
+	 * Set up for a file.
+	 * @param dumpTo The file to write to.
+	 */
+	ProfinmanSearchSequenceOrder(FILE* dumpTo) : turnCond(&turnMut){
+		this->dumpTo = dumpTo;
+		nextWrite = 0;
+	}
+	/**
+	 * Wait until all ranges before this one have been written.
+	 * @param rangeInd The index of the range in its round.
+	 */
+	void waitTurn(uintptr_t rangeInd){
+		turnMut.lock();
+		while(nextWrite != rangeInd){ turnCond.wait(); }
+		turnMut.unlock();
+	}
+	/**Let the next range write.*/
+	void finishTurn(){
+		turnMut.lock();
+		nextWrite++;
+		turnCond.broadcast();
+		turnMut.unlock();
+	}
+	/**The file to write to.*/
+	FILE* dumpTo;
+	/**The range that may write.*/
+	uintptr_t nextWrite;
+	/**Protect the turn.*/
+	OSMutex turnMut;
+	/**Wait for a turn.*/
+	OSCondition turnCond;
+};
+
+/**Uniform for scanning a range of reference sequences.*/
+class ProfinmanSearchSequenceUni{
+public:
+	/**The automaton to search with.*/
+	AhoCorasickAutomaton* findAuto;
+	/**The index (in the loaded sequences) of each sequence in the automaton.*/
+	const uintptr_t* patternInds;
+	/**The reference to read from (one per thread).*/
+	GailAQSequenceReader* gfaIn;
+	/**The first reference sequence to scan.*/
+	uintptr_t fromSeq;
+	/**The reference sequence after the last to scan.*/
+	uintptr_t toSeq;
+	/**The index of the first loaded search sequence.*/
+	uintptr_t firstLoad;
+	/**Whether to write text.*/
+	bool asText;
+	/**Write results straight here, if set (only for a single thread).*/
+	FILE* directTo;
+	/**The results, if not writing straight to a file.*/
+	std::vector<char> outputTo;
+	/**The most bytes of results to hold before waiting to write them.*/
+	uintptr_t maxOutput;
+	/**The index of this range in its round.*/
+	uintptr_t rangeInd;
+	/**The order to write in.*/
+	ProfinmanSearchSequenceOrder* writeOrder;
+	/**The ID of this task.*/
+	uintptr_t taskID;
+	/**Save any errors.*/
+	std::string errMess;
+};
+/**Scan a range of reference sequences.*/
+void profinmanSearchSequenceTask(void* myUni){
+	ProfinmanSearchSequenceUni* myUn = (ProfinmanSearchSequenceUni*)myUni;
+	try{
+		AhoCorasickAutomaton* findAuto = myUn->findAuto;
+		for(uintptr_t gailInd = myUn->fromSeq; gailInd < myUn->toSeq; gailInd++){
+			uintptr_t seqLen = myUn->gfaIn->getEntryLength(gailInd);
+			myUn->gfaIn->getEntrySubsequence(gailInd, 0, seqLen);
+			const char* curSeq = myUn->gfaIn->lastReadSeq;
+			//longer matches ending at a spot come first
+			uint32_t curState = 0;
+			for(uintptr_t si = 0; si<seqLen; si++){
+				curState = findAuto->nextState(curState, curSeq[si]);
+				uint32_t curOut = findAuto->firstOutput(curState);
+				while(curOut != AHOCORASICK_NO_STATE){
+					uintptr_t matLen = findAuto->stateDepths[curOut];
+					for(uintptr_t oi = findAuto->outStarts[curOut]; oi < findAuto->outStarts[curOut+1]; oi++){
+						uintptr_t lookFor = myUn->firstLoad + myUn->patternInds[findAuto->outPatterns[oi]];
+						if(myUn->directTo){
+							outputSearchResult(lookFor, gailInd, (si+1) - matLen, si+1, myUn->directTo, myUn->asText);
+							continue;
+						}
+						outputSearchResult(lookFor, gailInd, (si+1) - matLen, si+1, &(myUn->outputTo), myUn->asText);
+						if(myUn->outputTo.size() >= myUn->maxOutput){
+							//full: wait for the earlier ranges, then write
+							myUn->writeOrder->waitTurn(myUn->rangeInd);
+							fwrite(&(myUn->outputTo[0]), 1, myUn->outputTo.size(), myUn->writeOrder->dumpTo);
+							myUn->outputTo.clear();
+						}
+					}
+					curOut = findAuto->nextOutput(curOut);
+				}
+			}
+		}
+		if(myUn->writeOrder){
+			myUn->writeOrder->waitTurn(myUn->rangeInd);
+			if(myUn->outputTo.size()){ fwrite(&(myUn->outputTo[0]), 1, myUn->outputTo.size(), myUn->writeOrder->dumpTo); }
+			myUn->outputTo.clear();
+		}
+	}
+	catch(std::exception& err){
+		myUn->errMess = err.what();
+		if(myUn->writeOrder){ myUn->writeOrder->waitTurn(myUn->rangeInd); }
+	}
+	if(myUn->writeOrder){ myUn->writeOrder->finishTurn(); }
+}
+
+/**A match read back from the results of one piece of a chunk.*/
+class ProfinmanSearchSequenceMergeEntry{
+public:
+	/**The search sequence.*/
+	uintptr_t lookFor;
+	/**The reference sequence.*/
+	uintptr_t foundIn;
+	/**The start of the match.*/
+	uintptr_t foundAt;
+	/**The end of the match.*/
+	uintptr_t foundTo;
+	/**The piece it came from.*/
+	uintptr_t pieceInd;
+};
+
+/**Put the match a single scan reports first on top of a heap: by reference sequence, then end, then longest, then piece.*/
+class ProfinmanSearchSequenceMergeCompare{
+public:
+	bool operator ()(const ProfinmanSearchSequenceMergeEntry& itemA, const ProfinmanSearchSequenceMergeEntry& itemB){
+		if(itemA.foundIn != itemB.foundIn){ return itemA.foundIn > itemB.foundIn; }
+		if(itemA.foundTo != itemB.foundTo){ return itemA.foundTo > itemB.foundTo; }
+		if(itemA.foundAt != itemB.foundAt){ return itemA.foundAt > itemB.foundAt; }
+		return itemA.pieceInd > itemB.pieceInd;
+	}
+};
+
+/**
+ * Read a match back from a piece.
+ * @param fromF The file to read from.
+ * @param toFill The place to put the match.
+ * @return Whether there was a match.
+ */
+bool profinmanSearchSequenceReadMerge(FILE* fromF, ProfinmanSearchSequenceMergeEntry* toFill){
+	char entryBuff[MATCH_ENTRY_SIZE];
+	uintptr_t numRead = fread(entryBuff, 1, MATCH_ENTRY_SIZE, fromF);
+	if(numRead == 0){ return false; }
+	if(numRead != MATCH_ENTRY_SIZE){ throw std::runtime_error("Problem reading back search results."); }
+	toFill->lookFor = be2nat64(entryBuff);
+	toFill->foundIn = be2nat64(entryBuff+8);
+	toFill->foundAt = be2nat64(entryBuff+16);
+	toFill->foundTo = be2nat64(entryBuff+24);
+	return true;
+}
+
 void ProfinmanSearchSequence::runThing(){
 	//get the output file ready
 	bool killDump = false;
@@ -217,18 +533,51 @@ void ProfinmanSearchSequence::runThing(){
 		dumpTo = fopen(outputName, "wb");
 		if(dumpTo == 0){ throw std::runtime_error("Problem opening output."); }
 	}
-	//open up the input
+	//open up the input, and the reference for each thread
 	InStream* saveIS = 0;
 	SequenceReader* saveSS = 0;
+	ThreadPool* useThreads = 0;
+	std::vector<CompressionMethod*> refComps;
+	std::vector<BlockCompInStream*> refBlks;
+	std::vector<GailAQSequenceReader*> refReads;
+	std::vector<std::string> pieceNames;
+	std::vector<FILE*> pieceFiles;
+	#define SEARCH_SEQUENCE_CLEANUP \
+		for(uintptr_t i = 0; i<pieceFiles.size(); i++){ if(pieceFiles[i]){ fclose(pieceFiles[i]); } }\
+		for(uintptr_t i = 0; i<pieceNames.size(); i++){ if(fileExists(pieceNames[i].c_str())){ killFile(pieceNames[i].c_str()); } }\
+		for(uintptr_t i = 0; i<refReads.size(); i++){ delete(refReads[i]); }\
+		for(uintptr_t i = 0; i<refBlks.size(); i++){ delete(refBlks[i]); }\
+		for(uintptr_t i = 0; i<refComps.size(); i++){ delete(refComps[i]); }\
+		if(useThreads){ delete(useThreads); }\
+		if(saveIS){ delete(saveIS); }\
+		if(saveSS){ delete(saveSS); }\
+		if(killDump){ fclose(dumpTo); }
 	uintptr_t totLoadS = 0;
 	try{
+		std::string baseFN(dumpBaseName);
+		std::string blockFN = baseFN + ".blk";
+		std::string fastiFN = baseFN + ".fai";
+		for(intptr_t ti = 0; ti<numThread; ti++){
+			refComps.push_back(new GZipCompressionMethod());
+			refBlks.push_back(new BlockCompInStream(baseFN.c_str(), blockFN.c_str(), refComps[ti]));
+			refReads.push_back(new GailAQSequenceReader(refBlks[ti], fastiFN.c_str()));
+		}
+		uintptr_t numRefSeq = refReads[0]->getNumEntries();
+		if(numThread > 1){ useThreads = new ThreadPool(numThread); }
+		std::vector<ProfinmanSearchSequenceUni> threadUnis(numThread);
+		//on top of the loaded sequence, half the ram goes to the automaton, half to held results
+		uintptr_t autoRam = std::max((uintptr_t)1, ((uintptr_t)maxRam) / 2);
+		uintptr_t maxOutput = std::max((uintptr_t)SEARCH_RESULT_MIN_BUFFER, (((uintptr_t)maxRam) - autoRam) / numThread);
+		std::string workFPrefix(workFolder ? workFolder : ".");
+			workFPrefix.append(pathElementSep);
 		openSequenceFileRead(searchName ? searchName : "-", &saveIS, &saveSS);
 		std::string allLoadedSeq;
 		std::vector<uintptr_t> loadSeqL;
 		std::vector< std::pair<const char*,uintptr_t> > compLoadSeq; //used for sorting
 		std::map<const char*,uintptr_t> seqLocInd; //go from sequence location to sequence index
-		std::deque< std::pair<uintptr_t,uintptr_t> > liveAction; //Current matches
-		SingleCharMemBlockCompare charComp; //compare single character
+		std::vector< std::pair<uintptr_t,uintptr_t> > allPieces;
+		std::vector<uintptr_t> pieceInds;
+		std::vector<unsigned char> newChars;
 		//read in some amount of sequence
 		int moreData = true;
 		while(moreData){
@@ -238,65 +587,125 @@ void ProfinmanSearchSequence::runThing(){
 				allLoadedSeq.insert(allLoadedSeq.end(), saveSS->lastReadSeq, saveSS->lastReadSeq + saveSS->lastReadSeqLen);
 			}
 			if((!moreData && allLoadedSeq.size()) || (allLoadedSeq.size() > (uintptr_t)maxRam)){
-				//sort the loaded sequences, prepare for main
+				//sort the loaded sequences, so neighbors share prefixes
 				compLoadSeq.clear(); seqLocInd.clear();
 				uintptr_t curOff = 0;
 				for(uintptr_t i = 0; i<loadSeqL.size(); i++){
-					uintptr_t curL = loadSeqL[i];
-					const char* curStr = &(allLoadedSeq[curOff]);
-					compLoadSeq.push_back( std::pair<const char*,uintptr_t>(curStr, curL) );
-					seqLocInd[curStr] = totLoadS + i;
-					curOff+=curL;
+					const char* curStr = allLoadedSeq.c_str() + curOff;
+					compLoadSeq.push_back( std::pair<const char*,uintptr_t>(curStr, loadSeqL[i]) );
+					seqLocInd[curStr] = i;
+					curOff += loadSeqL[i];
 				}
 				std::sort(compLoadSeq.begin(), compLoadSeq.end(), memBlockCompare);
-				//open up the reference and search
-				std::string baseFN(dumpBaseName);
-				std::string blockFN = baseFN + ".blk";
-				std::string fastiFN = baseFN + ".fai";
-				GZipCompressionMethod compMeth;
-				BlockCompInStream blkComp(baseFN.c_str(), blockFN.c_str(), &compMeth);
-				GailAQSequenceReader gfaIn(&blkComp, fastiFN.c_str());
-				uintptr_t gailInd = 0;
-				while(gfaIn.readNextEntry()){
-					for(uintptr_t si = 0; si<gfaIn.lastReadSeqLen; si++){
-						//char curC = gfaIn.lastReadSeq[si];
-						//add things that start here
-							liveAction.push_front( std::pair<uintptr_t,uintptr_t>(0, compLoadSeq.size()) );
-						//try to match stuff already on the docket
-							uintptr_t curHist = liveAction.size();
-							while(curHist){
-								curHist--;
-								std::pair<uintptr_t,uintptr_t> curPosIs = liveAction[curHist];
-								//add matches agains the character
-								charComp.compInd = curHist;
-								std::pair<const char*,uintptr_t> lowLook(gfaIn.lastReadSeq + (si-curHist), curHist+1);
-								std::pair<const char*,uintptr_t> higLook(gfaIn.lastReadSeq + (si-curHist), gfaIn.lastReadSeqLen - (si-curHist));
-								std::vector< std::pair<const char*,uintptr_t> >::iterator matchLow = std::lower_bound(compLoadSeq.begin() + curPosIs.first, compLoadSeq.begin() + curPosIs.second, lowLook, charComp);
-								std::vector< std::pair<const char*,uintptr_t> >::iterator matchHig = std::upper_bound(compLoadSeq.begin() + curPosIs.first, compLoadSeq.begin() + curPosIs.second, higLook, charComp);
-								//remove any matches
-								while((matchLow != matchHig) && (matchLow->second == (curHist+1))){
-									uintptr_t matSInd = seqLocInd[matchLow->first];
-									outputSearchResult(matSInd, gailInd, si-curHist, si+1, dumpTo, txtOut);
-									matchLow++;
-								}
-								//update
-								curPosIs.first = matchLow - compLoadSeq.begin();
-								curPosIs.second = matchHig - compLoadSeq.begin();
-								liveAction[curHist] = curPosIs;
-							}
-						//if the last thing is empty, kill it
-							while(liveAction.size()){
-								std::pair<uintptr_t,uintptr_t> curPosIs = liveAction[liveAction.size()-1];
-								if(curPosIs.first == curPosIs.second){
-									liveAction.pop_back();
-								}
-								else{
-									break;
-								}
+				//split into pieces whose automata fit, counting the trie states and alphabet as they grow
+				allPieces.clear();
+				uintptr_t pieceFrom = 0;
+				while(pieceFrom < compLoadSeq.size()){
+					bool charSeen[256];
+					for(int i = 0; i<256; i++){ charSeen[i] = false; }
+					uintptr_t numCode = 1;
+					uintptr_t numState = 1;
+					uintptr_t pieceTo = pieceFrom;
+					while(pieceTo < compLoadSeq.size()){
+						std::pair<const char*,uintptr_t> curSeq = compLoadSeq[pieceTo];
+						uintptr_t curShare = 0;
+						if(pieceTo > pieceFrom){
+							std::pair<const char*,uintptr_t> prevSeq = compLoadSeq[pieceTo-1];
+							uintptr_t maxShare = std::min(prevSeq.second, curSeq.second);
+							while((curShare < maxShare) && (prevSeq.first[curShare] == curSeq.first[curShare])){ curShare++; }
+						}
+						newChars.clear();
+						for(uintptr_t j = curShare; j<curSeq.second; j++){
+							unsigned char curC = curSeq.first[j];
+							if(!charSeen[curC]){ charSeen[curC] = true; newChars.push_back(curC); }
+						}
+						uintptr_t newCode = numCode + newChars.size();
+						uintptr_t newState = numState + (curSeq.second - curShare);
+						uintptr_t newCost = newState*(4*newCode + SEARCH_AUTOMATON_STATE_COST) + (1 + pieceTo - pieceFrom)*SEARCH_AUTOMATON_PATTERN_COST;
+						if((pieceTo > pieceFrom) && (newCost > autoRam)){ break; }
+						numCode = newCode;
+						numState = newState;
+						pieceTo++;
+					}
+					allPieces.push_back( std::pair<uintptr_t,uintptr_t>(pieceFrom, pieceTo) );
+					pieceFrom = pieceTo;
+				}
+				//search each piece (with more than one, results go to the side and are merged)
+				bool needMerge = allPieces.size() > 1;
+				for(uintptr_t pi = 0; pi<allPieces.size(); pi++){
+					pieceInds.clear();
+					for(uintptr_t i = allPieces[pi].first; i<allPieces[pi].second; i++){ pieceInds.push_back(seqLocInd[compLoadSeq[i].first]); }
+					AhoCorasickAutomaton findAuto(pieceInds.size(), &(compLoadSeq[allPieces[pi].first]));
+					FILE* pieceTo = dumpTo;
+					if(needMerge){
+						char numBuff[4*sizeof(uintmax_t)+4];
+						sprintf(numBuff, "%ju", (uintmax_t)pi);
+						pieceNames.push_back(workFPrefix + "findfa_" + numBuff);
+						pieceFiles.push_back(0);
+						pieceTo = fopen(pieceNames[pi].c_str(), "wb");
+						if(pieceTo == 0){ throw std::runtime_error("Problem opening temporary file."); }
+						pieceFiles[pi] = pieceTo;
+					}
+					//hand out ranges of the reference, and report in order
+					uintptr_t nextSeq = 0;
+					while(nextSeq < numRefSeq){
+						ProfinmanSearchSequenceOrder writeOrder(pieceTo);
+						for(intptr_t ti = 0; ti<numThread; ti++){
+							ProfinmanSearchSequenceUni* curUni = &(threadUnis[ti]);
+							curUni->findAuto = &findAuto;
+							curUni->patternInds = &(pieceInds[0]);
+							curUni->gfaIn = refReads[ti];
+							curUni->firstLoad = totLoadS;
+							curUni->asText = txtOut && !needMerge;
+							curUni->directTo = useThreads ? (FILE*)0 : pieceTo;
+							curUni->outputTo.clear();
+							curUni->maxOutput = maxOutput;
+							curUni->rangeInd = ti;
+							curUni->writeOrder = useThreads ? &writeOrder : (ProfinmanSearchSequenceOrder*)0;
+							curUni->fromSeq = nextSeq;
+							uintptr_t numChar = 0;
+							while((nextSeq < numRefSeq) && (numChar < SEARCH_SCAN_CHUNK)){
+								numChar += refReads[ti]->getEntryLength(nextSeq);
+								nextSeq++;
 							}
+							curUni->toSeq = nextSeq;
+						}
+						if(useThreads){
+							for(intptr_t ti = 0; ti<numThread; ti++){ threadUnis[ti].taskID = useThreads->addTask(profinmanSearchSequenceTask, &(threadUnis[ti])); }
+							for(intptr_t ti = 0; ti<numThread; ti++){ useThreads->joinTask(threadUnis[ti].taskID); }
+						}
+						else{
+							profinmanSearchSequenceTask(&(threadUnis[0]));
+						}
+						for(intptr_t ti = 0; ti<numThread; ti++){
+							ProfinmanSearchSequenceUni* curUni = &(threadUnis[ti]);
+							if(curUni->errMess.size()){ throw std::runtime_error(curUni->errMess); }
+						}
+					}
+				}
+				//merge the pieces back into the order a single scan would give
+				if(needMerge){
+					std::priority_queue<ProfinmanSearchSequenceMergeEntry, std::vector<ProfinmanSearchSequenceMergeEntry>, ProfinmanSearchSequenceMergeCompare> mergeHeap;
+					for(uintptr_t pi = 0; pi<pieceFiles.size(); pi++){
+						fclose(pieceFiles[pi]);
+						pieceFiles[pi] = fopen(pieceNames[pi].c_str(), "rb");
+						if(pieceFiles[pi] == 0){ throw std::runtime_error("Problem opening temporary file."); }
+						ProfinmanSearchSequenceMergeEntry curEnt;
+						curEnt.pieceInd = pi;
+						if(profinmanSearchSequenceReadMerge(pieceFiles[pi], &curEnt)){ mergeHeap.push(curEnt); }
+					}
+					while(mergeHeap.size()){
+						ProfinmanSearchSequenceMergeEntry curEnt = mergeHeap.top();
+						mergeHeap.pop();
+						outputSearchResult(curEnt.lookFor, curEnt.foundIn, curEnt.foundAt, curEnt.foundTo, dumpTo, txtOut);
+						if(profinmanSearchSequenceReadMerge(pieceFiles[curEnt.pieceInd], &curEnt)){ mergeHeap.push(curEnt); }
+					}
+					for(uintptr_t pi = 0; pi<pieceFiles.size(); pi++){
+						fclose(pieceFiles[pi]);
+						killFile(pieceNames[pi].c_str());
 					}
-					liveAction.clear();
-					gailInd++;
+					pieceFiles.clear();
+					pieceNames.clear();
 				}
 				//prepare for the next round
 				totLoadS += loadSeqL.size();
@@ -304,16 +713,10 @@ void ProfinmanSearchSequence::runThing(){
 				loadSeqL.clear();
 			}
 		}
-		if(saveIS){ delete(saveIS); }
-		if(saveSS){ delete(saveSS); }
-		if(killDump){ fclose(dumpTo); }
 	}
 	catch(std::exception& err){
-		if(saveIS){ delete(saveIS); }
-		if(saveSS){ delete(saveSS); }
-		if(killDump){ fclose(dumpTo); }
+		SEARCH_SEQUENCE_CLEANUP
 		throw;
 	}
+	SEARCH_SEQUENCE_CLEANUP
 }
-
-
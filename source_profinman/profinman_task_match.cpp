@@ -1,21 +1,30 @@
 #include "profinman_task.h"
 
+#include <iostream>
 #include <string.h>
 #include <stdexcept>
 
 #include "whodun_sort.h"
 #include "whodun_nmcy.h"
 #include "whodun_parse.h"
+#include "whodun_thread.h"
 #include "whodun_datread.h"
 #include "whodun_compress.h"
 #include "whodun_stringext.h"
 #include "whodun_parse_seq.h"
 
+/**The error for a match past the end of the reference.*/
+#define PROFINMAN_MATCH_INDEX_ERROR "Bad match entry (reference sequence index too big: pass the suffix array with --sa if it has deltas)."
+
 ProfinmanGetMatchRegion::ProfinmanGetMatchRegion(){
 	dumpBaseName = 0;
+	comboName = 0;
 	matchName = 0;
 	numPre = 5;
 	numPost = 5;
+	numThread = 1;
+	blockCache = 32000000;
+	verbose = false;
 	mySummary = "  Get sequence at/near a match.";
 	myMainDoc = "Usage: profinman extfin [OPTION] [FILE]*\n"
 		"Get bases neighboring a match.\n"
@@ -26,6 +35,10 @@ ProfinmanGetMatchRegion::ProfinmanGetMatchRegion(){
 		dumpMeta.isFile = true;
 		dumpMeta.fileExts.insert(".gail");
 		addStringOption("--ref", &dumpBaseName, 0, "    The reference file searched through.\n    --ref File.gail\n", &dumpMeta);
+	ArgumentParserStrMeta comboMeta("Suffix Array File");
+		comboMeta.isFile = true;
+		comboMeta.fileExts.insert(".gail.sa");
+		addStringOption("--sa", &comboName, 0, "    The suffix array that was searched, if it has deltas appended (safa --append).\n    Matches in the deltas are looked up in their own references.\n    --sa File.gail.sa\n", &comboMeta);
 	ArgumentParserStrMeta matchMeta("Match File");
 		matchMeta.isFile = true;
 		matchMeta.fileExts.insert(".bin");
@@ -34,6 +47,12 @@ ProfinmanGetMatchRegion::ProfinmanGetMatchRegion(){
 		addIntegerOption("--pre", &numPre, 0, "    How many bases before the match to get.\n    --pre 5\n", &preMeta);
 	ArgumentParserIntMeta postMeta("Post Bases");
 		addIntegerOption("--post", &numPost, 0, "    How many bases after the match to get.\n    --post 5\n", &postMeta);
+	ArgumentParserIntMeta threadMeta("Threads");
+		addIntegerOption("--thread", &numThread, 0, "    How many threads to use.\n    --thread 1\n", &threadMeta);
+	ArgumentParserIntMeta cacheMeta("Block Cache");
+		addIntegerOption("--blockcache", &blockCache, 0, "    How many bytes of decompressed reference to hold on to.\n    With multiple threads, each batch of matches decompresses into this.\n    --blockcache 32000000\n", &cacheMeta);
+	ArgumentParserBoolMeta verbMeta("Verbose");
+		addBooleanFlag("--verbose", &verbose, 1, "    Report how often the block cache was used, and how many blocks were decompressed, to standard error.\n", &verbMeta);
 	ArgumentParserStrMeta outMeta("Match Region Output File");
 		outMeta.isFile = true;
 		outMeta.fileWrite = true;
@@ -47,6 +66,9 @@ int ProfinmanGetMatchRegion::posteriorCheck(){
 		argumentError = "Need to specify a reference.";
 		return 1;
 	}
+	if((comboName == 0) || (strlen(comboName)==0)){
+		comboName = 0;
+	}
 	if((matchName == 0) || (strlen(matchName)==0)){
 		matchName = 0;
 	}
@@ -61,13 +83,32 @@ int ProfinmanGetMatchRegion::posteriorCheck(){
 		argumentError = "Cannot get negative bases.";
 		return 1;
 	}
+	if(numThread <= 0){
+		argumentError = "Need at least one thread.";
+		return 1;
+	}
+	if(blockCache < 0){
+		argumentError = "Block cache cannot be negative.";
+		return 1;
+	}
 	return 0;
 }
 
+/**The number of matches to get reference data ready for at once.*/
+#define EXTFIN_BATCH_SIZE 0x0100
+
 void ProfinmanGetMatchRegion::runThing(){
 	InStream* saveIS = 0;
 	OutStream* saveOS = 0;
 	SequenceWriter* saveOSS = 0;
+	ThreadPool* useThreads = 0;
+	ProfinmanMatchReference* allRef = 0;
+	#define GET_MATCH_REGION_CLEANUP \
+		if(allRef){ delete(allRef); }\
+		if(useThreads){ delete(useThreads); }\
+		if(saveIS){ delete(saveIS); }\
+		if(saveOS){ delete(saveOS); }\
+		if(saveOS){ delete(saveOSS); }
 	try{
 		//get the output file ready
 			openSequenceFileWrite(outputName ? outputName : "-", &saveOS, &saveOSS);
@@ -78,94 +119,147 @@ void ProfinmanGetMatchRegion::runThing(){
 			else{
 				saveIS = new FileInStream(matchName);
 			}
-		//open up the reference
-			std::string baseFN(dumpBaseName);
-			std::string blockFN = baseFN + ".blk";
-			std::string fastiFN = baseFN + ".fai";
-			GZipCompressionMethod compMeth;
-			BlockCompInStream blkComp(baseFN.c_str(), blockFN.c_str(), &compMeth);
-			GailAQSequenceReader gfaIn(&blkComp, fastiFN.c_str());
-			uintptr_t numEntries = gfaIn.getNumEntries();
+		//open up the reference and any deltas (with multiple threads, decompress everything a batch needs at once)
+			if(numThread > 1){
+				useThreads = new ThreadPool(numThread);
+				allRef = new ProfinmanMatchReference(dumpBaseName, comboName, numThread, useThreads, blockCache);
+			}
+			else{
+				allRef = new ProfinmanMatchReference(dumpBaseName, comboName, 1, blockCache);
+			}
+			uintptr_t numLayer = allRef->refNames.size();
+			uintptr_t numEntries = allRef->getNumEntries();
 		//place to store a name
 			std::string matchEntName;
 			std::string matchEntPreName;
 			std::string matchEntPostName;
 		//start reading matches
 			uintptr_t numEnts = 0;
-			char entryBuff[MATCH_ENTRY_SIZE];
-			uintptr_t numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
-			while(numRead){
-				//parse the match entry
-					if(numRead != MATCH_ENTRY_SIZE){
-						throw std::runtime_error("Incomplete match at end of file.");
-					}
+			std::vector<char> batchEnts(EXTFIN_BATCH_SIZE*MATCH_ENTRY_SIZE);
+			std::vector<uintptr_t> batchL;
+			std::vector<uintptr_t> batchIn;
+			std::vector<uintptr_t> batchAt;
+			std::vector<uintptr_t> batchTo;
+			std::vector<uintptr_t> layerIn;
+			std::vector<uintptr_t> layerAt;
+			std::vector<uintptr_t> layerTo;
+			while(true){
+				uintptr_t numRead = saveIS->readBytes(&(batchEnts[0]), batchEnts.size());
+				if(numRead == 0){ break; }
+				if(numRead % MATCH_ENTRY_SIZE){
+					throw std::runtime_error("Incomplete match at end of file.");
+				}
+				uintptr_t numBatch = numRead / MATCH_ENTRY_SIZE;
+				//parse the match entries
+				batchL.clear();
+				batchIn.clear();
+				batchAt.clear();
+				batchTo.clear();
+				for(uintptr_t i = 0; i<numBatch; i++){
+					char* entryBuff = &(batchEnts[i*MATCH_ENTRY_SIZE]);
 					//uintptr_t lookFor = be2nat64(entryBuff);
 					uintptr_t foundIn = be2nat64(entryBuff+8);
 					uintptr_t foundAt = be2nat64(entryBuff+16);
 					uintptr_t foundTo = be2nat64(entryBuff+24);
-				//idiot checks
+					//idiot checks
 					if(foundTo < foundAt){
 						throw std::runtime_error("Bad match entry (high index below low index).");
 					}
 					if(foundIn >= numEntries){
-						throw std::runtime_error("Bad match entry (reference sequence index too big).");
+						throw std::runtime_error(PROFINMAN_MATCH_INDEX_ERROR);
 					}
-					uintptr_t foundInLen = gfaIn.getEntryLength(foundIn);
+					uintptr_t foundL = allRef->findLayer(foundIn);
+					foundIn -= allRef->layerStarts[foundL];
+					uintptr_t foundInLen = allRef->getReader(0, foundL)->getEntryLength(foundIn);
 					if(foundTo > foundInLen){
 						throw std::runtime_error("Bad match entry (match extends beyond reference sequence).");
 					}
-				//get the sequence
 					uintptr_t postTo = foundTo + numPost;
 						postTo = std::min(postTo, foundInLen);
 					uintptr_t preAt = std::max((intptr_t)0, (intptr_t)foundAt - numPre);
-					gfaIn.getEntrySubsequence(foundIn, preAt, postTo);
-				//make a name
-					char numBuff[4*sizeof(uintmax_t)+4];
-					sprintf(numBuff, "%ju", (uintmax_t)numEnts);
-					matchEntName.clear();
-						matchEntName.append("match_");
-						matchEntName.append(numBuff);
-					matchEntPreName.clear();
-						matchEntPreName.append(matchEntName);
-						matchEntPreName.append("_pre");
-					matchEntPostName.clear();
-						matchEntPostName.append(matchEntName);
-						matchEntPostName.append("_post");
-				//output pre, match and post
-					saveOSS->nextNameLen = matchEntPreName.size();
-						saveOSS->nextShortNameLen = matchEntPreName.size();
-						saveOSS->nextName = &(matchEntPreName[0]);
-						saveOSS->nextSeqLen = foundAt - preAt;
-						saveOSS->nextSeq = gfaIn.lastReadSeq;
-						saveOSS->nextHaveQual = 0;
-						saveOSS->writeNextEntry();
-					saveOSS->nextNameLen = matchEntName.size();
-						saveOSS->nextShortNameLen = matchEntName.size();
-						saveOSS->nextName = &(matchEntName[0]);
-						saveOSS->nextSeqLen = foundTo - foundAt;
-						saveOSS->nextSeq = gfaIn.lastReadSeq + (foundAt - preAt);
-						saveOSS->nextHaveQual = 0;
-						saveOSS->writeNextEntry();
-					saveOSS->nextNameLen = matchEntPostName.size();
-						saveOSS->nextShortNameLen = matchEntPostName.size();
-						saveOSS->nextName = &(matchEntPostName[0]);
-						saveOSS->nextSeqLen = postTo - foundTo;
-						saveOSS->nextSeq = gfaIn.lastReadSeq + (foundTo - preAt);
-						saveOSS->nextHaveQual = 0;
-						saveOSS->writeNextEntry();
-				numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
-				numEnts++;
+					batchL.push_back(foundL);
+					batchIn.push_back(foundIn);
+					batchAt.push_back(preAt);
+					batchTo.push_back(postTo);
+				}
+				for(uintptr_t l = 0; l<numLayer; l++){
+					layerIn.clear();
+					layerAt.clear();
+					layerTo.clear();
+					for(uintptr_t i = 0; i<numBatch; i++){
+						if(batchL[i] != l){ continue; }
+						layerIn.push_back(batchIn[i]);
+						layerAt.push_back(batchAt[i]);
+						layerTo.push_back(batchTo[i]);
+					}
+					if(layerIn.size()){ allRef->getReader(0, l)->prefetchEntrySubsequences(layerIn.size(), &(layerIn[0]), &(layerAt[0]), &(layerTo[0])); }
+				}
+				for(uintptr_t i = 0; i<numBatch; i++){
+					char* entryBuff = &(batchEnts[i*MATCH_ENTRY_SIZE]);
+					uintptr_t foundAt = be2nat64(entryBuff+16);
+					uintptr_t foundTo = be2nat64(entryBuff+24);
+					uintptr_t preAt = batchAt[i];
+					uintptr_t postTo = batchTo[i];
+					//get the sequence
+						GailAQSequenceReader* gfaIn = allRef->getReader(0, batchL[i]);
+						gfaIn->getEntrySubsequence(batchIn[i], preAt, postTo);
+					//make a name
+						char numBuff[4*sizeof(uintmax_t)+4];
+						sprintf(numBuff, "%ju", (uintmax_t)numEnts);
+						matchEntName.clear();
+							matchEntName.append("match_");
+							matchEntName.append(numBuff);
+						matchEntPreName.clear();
+							matchEntPreName.append(matchEntName);
+							matchEntPreName.append("_pre");
+						matchEntPostName.clear();
+							matchEntPostName.append(matchEntName);
+							matchEntPostName.append("_post");
+					//output pre, match and post
+						saveOSS->nextNameLen = matchEntPreName.size();
+							saveOSS->nextShortNameLen = matchEntPreName.size();
+							saveOSS->nextName = &(matchEntPreName[0]);
+							saveOSS->nextSeqLen = foundAt - preAt;
+							saveOSS->nextSeq = gfaIn->lastReadSeq;
+							saveOSS->nextHaveQual = 0;
+							saveOSS->writeNextEntry();
+						saveOSS->nextNameLen = matchEntName.size();
+							saveOSS->nextShortNameLen = matchEntName.size();
+							saveOSS->nextName = &(matchEntName[0]);
+							saveOSS->nextSeqLen = foundTo - foundAt;
+							saveOSS->nextSeq = gfaIn->lastReadSeq + (foundAt - preAt);
+							saveOSS->nextHaveQual = 0;
+							saveOSS->writeNextEntry();
+						saveOSS->nextNameLen = matchEntPostName.size();
+							saveOSS->nextShortNameLen = matchEntPostName.size();
+							saveOSS->nextName = &(matchEntPostName[0]);
+							saveOSS->nextSeqLen = postTo - foundTo;
+							saveOSS->nextSeq = gfaIn->lastReadSeq + (foundTo - preAt);
+							saveOSS->nextHaveQual = 0;
+							saveOSS->writeNextEntry();
+					numEnts++;
+				}
+			}
+		//report the cache
+			if(verbose){
+				uintptr_t numHit = 0;
+				uintptr_t numMiss = 0;
+				uintptr_t numLoad = 0;
+				for(uintptr_t l = 0; l<numLayer; l++){
+					BlockCompCache* curCache = allRef->allCaches[l];
+					if(curCache == 0){ continue; }
+					numHit += curCache->numHit;
+					numMiss += curCache->numMiss;
+					numLoad += curCache->numLoad;
+				}
+				std::cerr << "Block cache: " << numHit << " hits, " << numMiss << " misses, " << numLoad << " blocks decompressed." << std::endl;
 			}
 	}
 	catch(std::exception& err){
-		if(saveIS){ delete(saveIS); }
-		if(saveOS){ delete(saveOS); }
-		if(saveOS){ delete(saveOSS); }
+		GET_MATCH_REGION_CLEANUP
 		throw;
 	}
-	if(saveIS){ delete(saveIS); }
-	if(saveOS){ delete(saveOS); }
-	if(saveOS){ delete(saveOSS); }
+	GET_MATCH_REGION_CLEANUP
 }
 
 /**Compare search results.*/
@@ -277,6 +371,7 @@ void ProfinmanSortSearchResults::runThing(){
 
 ProfinmanGetMatchName::ProfinmanGetMatchName(){
 	dumpBaseName = 0;
+	comboName = 0;
 	matchName = 0;
 	outputName = 0;
 	maxRam = 500000000;
@@ -290,6 +385,10 @@ ProfinmanGetMatchName::ProfinmanGetMatchName(){
 		dumpMeta.isFile = true;
 		dumpMeta.fileExts.insert(".gail");
 		addStringOption("--ref", &dumpBaseName, 0, "    The reference file searched through.\n    --ref File.gail\n", &dumpMeta);
+	ArgumentParserStrMeta comboMeta("Suffix Array File");
+		comboMeta.isFile = true;
+		comboMeta.fileExts.insert(".gail.sa");
+		addStringOption("--sa", &comboName, 0, "    The suffix array that was searched, if it has deltas appended (safa --append).\n    Matches in the deltas are looked up in their own references.\n    --sa File.gail.sa\n", &comboMeta);
 	ArgumentParserStrMeta matchMeta("Match File");
 		matchMeta.isFile = true;
 		addStringOption("--match", &matchName, 0, "    The binary list of match information.\n    --match File.bmatch\n", &matchMeta);
@@ -304,6 +403,9 @@ int ProfinmanGetMatchName::posteriorCheck(){
 		argumentError = "Need to specify a reference.";
 		return 1;
 	}
+	if((comboName == 0) || (strlen(comboName)==0)){
+		comboName = 0;
+	}
 	if((matchName == 0) || (strlen(matchName)==0)){
 		matchName = 0;
 	}
@@ -339,62 +441,99 @@ void ProfinmanGetMatchName::runThing(){
 			else{
 				saveOS = new FileOutStream(0, outputName);
 			}
-		//open up the reference
-			std::string baseFN(dumpBaseName);
-			std::string blockFN = baseFN + ".blk";
-			std::string fastiFN = baseFN + ".fai";
-			GZipCompressionMethod compMeth;
-			BlockCompInStream blkComp(baseFN.c_str(), blockFN.c_str(), &compMeth);
-			GailAQSequenceReader gfaIn(&blkComp, fastiFN.c_str());
-			uintptr_t numEntries = gfaIn.getNumEntries();
-		//place to store stuff
-			std::vector<char> preloadEnts;
-			std::map<uintptr_t, std::pair<uintptr_t,uintptr_t> > entWindices;
-			std::string saveFounds;
-		//start reading matches
-			char entryBuff[MATCH_ENTRY_SIZE];
-			uintptr_t numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
-			while(numRead || preloadEnts.size()){
-				//add the entry to the entities
-				if(numRead){
+		//open up the reference (and any deltas)
+			ProfinmanMatchReference allRef(dumpBaseName, comboName, 1, 0);
+			uintptr_t numLayer = allRef.refNames.size();
+			uintptr_t numEntries = allRef.getNumEntries();
+		//use the name tables if there are some
+		bool haveTabs = true;
+		for(uintptr_t l = 0; l<numLayer; l++){ haveTabs = haveTabs && profinmanHaveNameTable(allRef.refNames[l].c_str()); }
+		if(haveTabs){
+			std::vector<ProfinmanNameTable*> nameTabs;
+			try{
+				for(uintptr_t l = 0; l<numLayer; l++){
+					nameTabs.push_back(new ProfinmanNameTable(allRef.refNames[l].c_str()));
+					if(nameTabs[l]->getNumEntries() != (allRef.layerStarts[l+1] - allRef.layerStarts[l])){
+						throw std::runtime_error("Name table does not match reference.");
+					}
+				}
+				char entryBuff[MATCH_ENTRY_SIZE];
+				uintptr_t numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
+				while(numRead){
 					if(numRead != MATCH_ENTRY_SIZE){
 						throw std::runtime_error("Incomplete match at end of file.");
 					}
-					preloadEnts.insert(preloadEnts.end(), entryBuff, entryBuff + numRead);
-				}
-				//if enough entries (or nothing left), handle
-				if((numRead == 0) || (preloadEnts.size() > (uintptr_t)maxRam)){
-					for(uintptr_t i = 0; i<preloadEnts.size(); i+=MATCH_ENTRY_SIZE){
-						char* curEnt = &(preloadEnts[i]);
-						//uintptr_t lookFor = be2nat64(entryBuff);
-						uintptr_t foundIn = be2nat64(curEnt+8);
-						//uintptr_t foundAt = be2nat64(curEnt+16);
-						//uintptr_t foundTo = be2nat64(curEnt+24);
-						//idiot check
-							if(foundIn >= numEntries){
-								throw std::runtime_error("Bad match entry (reference sequence index too big).");
-							}
-						//find if not in cache
-							if(entWindices.find(foundIn) == entWindices.end()){
-								uintptr_t foundInLen = std::min((uintptr_t)1, gfaIn.getEntryLength(foundIn));
-								gfaIn.getEntrySubsequence(foundIn, 0, foundInLen);
-								entWindices[foundIn] = std::pair<uintptr_t,uintptr_t>(saveFounds.size(), gfaIn.lastReadNameLen);
-								saveFounds.insert(saveFounds.end(), gfaIn.lastReadName, gfaIn.lastReadName + gfaIn.lastReadNameLen);
-							}
-						//get from cache
-							std::pair<uintptr_t,uintptr_t> windex = entWindices[foundIn];
-							saveOS->writeBytes(&(saveFounds[windex.first]), windex.second);
-							saveOS->writeByte('\n');
+					uintptr_t foundIn = be2nat64(entryBuff+8);
+					if(foundIn >= numEntries){
+						throw std::runtime_error(PROFINMAN_MATCH_INDEX_ERROR);
 					}
-					preloadEnts.clear();
-					entWindices.clear();
-					saveFounds.clear();
-				}
-				//load next
-				if(numRead){
+					uintptr_t foundL = allRef.findLayer(foundIn);
+					uintptr_t nameLen;
+					const char* curName = nameTabs[foundL]->getEntryName(foundIn - allRef.layerStarts[foundL], &nameLen);
+					saveOS->writeBytes(curName, nameLen);
+					saveOS->writeByte('\n');
 					numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
 				}
 			}
+			catch(std::exception& err){
+				for(uintptr_t l = 0; l<nameTabs.size(); l++){ delete(nameTabs[l]); }
+				throw;
+			}
+			for(uintptr_t l = 0; l<nameTabs.size(); l++){ delete(nameTabs[l]); }
+		}
+		else{
+			//place to store stuff
+				std::vector<char> preloadEnts;
+				std::map<uintptr_t, std::pair<uintptr_t,uintptr_t> > entWindices;
+				std::string saveFounds;
+			//start reading matches
+				char entryBuff[MATCH_ENTRY_SIZE];
+				uintptr_t numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
+				while(numRead || preloadEnts.size()){
+					//add the entry to the entities
+					if(numRead){
+						if(numRead != MATCH_ENTRY_SIZE){
+							throw std::runtime_error("Incomplete match at end of file.");
+						}
+						preloadEnts.insert(preloadEnts.end(), entryBuff, entryBuff + numRead);
+					}
+					//if enough entries (or nothing left), handle
+					if((numRead == 0) || (preloadEnts.size() > (uintptr_t)maxRam)){
+						for(uintptr_t i = 0; i<preloadEnts.size(); i+=MATCH_ENTRY_SIZE){
+							char* curEnt = &(preloadEnts[i]);
+							//uintptr_t lookFor = be2nat64(entryBuff);
+							uintptr_t foundIn = be2nat64(curEnt+8);
+							//uintptr_t foundAt = be2nat64(curEnt+16);
+							//uintptr_t foundTo = be2nat64(curEnt+24);
+							//idiot check
+								if(foundIn >= numEntries){
+									throw std::runtime_error(PROFINMAN_MATCH_INDEX_ERROR);
+								}
+							//find if not in cache
+								if(entWindices.find(foundIn) == entWindices.end()){
+									uintptr_t foundL = allRef.findLayer(foundIn);
+									uintptr_t foundLI = foundIn - allRef.layerStarts[foundL];
+									GailAQSequenceReader* gfaIn = allRef.getReader(0, foundL);
+									uintptr_t foundInLen = std::min((uintptr_t)1, gfaIn->getEntryLength(foundLI));
+									gfaIn->getEntrySubsequence(foundLI, 0, foundInLen);
+									entWindices[foundIn] = std::pair<uintptr_t,uintptr_t>(saveFounds.size(), gfaIn->lastReadNameLen);
+									saveFounds.insert(saveFounds.end(), gfaIn->lastReadName, gfaIn->lastReadName + gfaIn->lastReadNameLen);
+								}
+							//get from cache
+								std::pair<uintptr_t,uintptr_t> windex = entWindices[foundIn];
+								saveOS->writeBytes(&(saveFounds[windex.first]), windex.second);
+								saveOS->writeByte('\n');
+						}
+						preloadEnts.clear();
+						entWindices.clear();
+						saveFounds.clear();
+					}
+					//load next
+					if(numRead){
+						numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
+					}
+				}
+		}
 	}
 	catch(std::exception& err){
 		if(saveIS){ delete(saveIS); }
@@ -587,93 +726,6 @@ class CuttingRules{
 public:
 	/**The rules in question.*/
 	std::vector<CuttingRule*> theRules;
-	/**
-	 * Start a search for matching rules.
-	 * @param addLive The place to add live indices to.
-	 */
-	void startMatchSearch(std::vector<int>* addLive){
-		addLive->clear();
-		for(unsigned i = 0; i < theRules.size(); i++){
-			addLive->push_back(i);
-		}
-	}
-#define SCAN_CODE(lenVar, seqVar, needAGet, forRevIndGet) \
-		int splen = strlen(toTest);\
-		std::vector<int> nextLive;\
-		for(unsigned i = 0; i<toCull->size(); i++){\
-			int ci = (*toCull)[i];\
-			CuttingRule* curRule = (theRules[ci]);\
-			int testLen = curRule->lenVar;\
-			char** testVals = curRule->seqVar;\
-			bool needAll = needAGet;\
-			if(splen < testLen){\
-				continue;\
-			}\
-			if(needAll && (splen > testLen)){\
-				continue;\
-			}\
-			bool foundIt = true;\
-			for(int j = 0; j<testLen; j++){\
-				char* valChars = testVals[j];\
-				int curChar = toTest[forRevIndGet];\
-				if(strchr(valChars, curChar) == 0){\
-					foundIt = false;\
-					break;\
-				}\
-			}\
-			if(foundIt){\
-				nextLive.push_back(ci);\
-			}\
-		}\
-		toCull->clear();\
-		toCull->insert(toCull->begin(), nextLive.begin(), nextLive.end());
-	/**
-	 * This will see if the prefix matches the prefix of the starting cut.
-	 * @param toCull The live rules to work with.
-	 * @param toTest The stuff before the match.
-	 */
-	void checkStartCutPrefix(std::vector<int>* toCull, const char* toTest){
-		SCAN_CODE(startPreLen,startPreRev,curRule->startPreAll,splen-(j+1))
-	}
-	/**
-	 * This will see if the suffix matches the suffix of the starting cut.
-	 * @param toCull The live rules to work with.
-	 * @param toTest The match.
-	 */
-	void checkStartCutSuffix(std::vector<int>* toCull, const char* toTest){
-		SCAN_CODE(startPostLen,startPost,false,j)
-	}
-	/**
-	 * This will see if the prefix matches the prefix of the ending cut.
-	 * @param toCull The live rules to work with.
-	 * @param toTest The match.
-	 */
-	void checkEndCutPrefix(std::vector<int>* toCull, const char* toTest){
-		SCAN_CODE(endPreLen,endPreRev,false,splen-(j+1))
-	}
-	/**
-	 * This will see if the suffix matches the suffix of the ending cut.
-	 * @param toCull The live rules to work with.
-	 * @param toTest The stuff after the match.
-	 */
-	void checkEndCutSuffix(std::vector<int>* toCull, const char* toTest){
-		SCAN_CODE(endPostLen,endPost,curRule->endPostAll,j)
-	}
-	/**
-	 * This will find all cuts the given match satisfies.
-	 * @param preMatch The stuff before the match.
-	 * @param match The match.
-	 * @param postMatch The stuff after the match.
-	 * @param toFill The place to put the indices of the matching rules.
-	 */
-	void getMatchingCuts(const char* preMatch, const char* match, const char* postMatch, std::vector<int>* toFill){
-		toFill->clear();
-		startMatchSearch(toFill);
-		checkStartCutPrefix(toFill, preMatch);
-		checkStartCutSuffix(toFill, match);
-		checkEndCutPrefix(toFill, match);
-		checkEndCutSuffix(toFill, postMatch);
-	}
 	/**
 	 * Loads cutting rules from a file.
 	 * @param toParse The file to parse. Closed on return.
@@ -698,6 +750,112 @@ public:
 				theRules.push_back(curRule);
 			}
 		}
+		compileRules();
+	}
+	/**The number of 64 bit words in a set of rules.*/
+	uintptr_t numWord;
+	/**The length of the longest rule in each part (start prefix, start suffix, end prefix, end suffix).*/
+	uintptr_t partMaxLen[4];
+	/**For each part, position and character, which rules accept that character there: indexed by ((position*256 + character)*numWord + word).*/
+	std::vector<uint64_t> partTables[4];
+	/**For each part and available length (capped at the longest plus one), which rules accept that length.*/
+	std::vector<uint64_t> partLenMasks[4];
+	/**Build the lookup tables for the rules.*/
+	void compileRules(){
+		numWord = (theRules.size() + 63) / 64;
+		for(int p = 0; p<4; p++){
+			partMaxLen[p] = 0;
+			for(uintptr_t r = 0; r<theRules.size(); r++){
+				CuttingRule* curRule = theRules[r];
+				int testLen = (p == 0) ? curRule->startPreLen : ((p == 1) ? curRule->startPostLen : ((p == 2) ? curRule->endPreLen : curRule->endPostLen));
+				partMaxLen[p] = std::max(partMaxLen[p], (uintptr_t)testLen);
+			}
+			partTables[p].clear();
+			partTables[p].resize(partMaxLen[p]*256*numWord);
+			partLenMasks[p].clear();
+			partLenMasks[p].resize((partMaxLen[p]+2)*numWord);
+			for(uintptr_t r = 0; r<theRules.size(); r++){
+				CuttingRule* curRule = theRules[r];
+				uintptr_t testLen = (p == 0) ? curRule->startPreLen : ((p == 1) ? curRule->startPostLen : ((p == 2) ? curRule->endPreLen : curRule->endPostLen));
+				char** testVals = (p == 0) ? curRule->startPreRev : ((p == 1) ? curRule->startPost : ((p == 2) ? curRule->endPreRev : curRule->endPost));
+				bool needAll = (p == 0) ? curRule->startPreAll : ((p == 3) ? curRule->endPostAll : false);
+				uint64_t ruleBit = ((uint64_t)1) << (r % 64);
+				uintptr_t ruleWord = r / 64;
+				//positions past the end of the rule take anything
+				for(uintptr_t j = 0; j<partMaxLen[p]; j++){
+					uint64_t* posTab = &(partTables[p][j*256*numWord]);
+					if(j >= testLen){
+						for(int c = 0; c<256; c++){ posTab[c*numWord + ruleWord] |= ruleBit; }
+						continue;
+					}
+					//the terminating null always counts as found
+					posTab[ruleWord] |= ruleBit;
+					for(const char* curV = testVals[j]; *curV; curV++){
+						posTab[(0x00FF & *curV)*numWord + ruleWord] |= ruleBit;
+					}
+				}
+				for(uintptr_t l = 0; l<=(partMaxLen[p]+1); l++){
+					if((l >= testLen) && !(needAll && (l != testLen))){
+						partLenMasks[p][l*numWord + ruleWord] |= ruleBit;
+					}
+				}
+			}
+		}
+	}
+	/**
+	 * Remove the rules that fail on one part.
+	 * @param partI The part to test.
+	 * @param fromChar The first character to test.
+	 * @param charStep The direction to walk in.
+	 * @param availLen The number of characters available.
+	 * @param liveMask The rules still live.
+	 * @return Whether any rules are still live.
+	 */
+	bool cullPart(int partI, const char* fromChar, intptr_t charStep, uintptr_t availLen, uint64_t* liveMask){
+		uintptr_t maxLen = partMaxLen[partI];
+		const uint64_t* lenMask = &(partLenMasks[partI][std::min(availLen, maxLen+1)*numWord]);
+		uint64_t anyLive = 0;
+		for(uintptr_t w = 0; w<numWord; w++){
+			liveMask[w] &= lenMask[w];
+			anyLive |= liveMask[w];
+		}
+		uintptr_t numTest = std::min(availLen, maxLen);
+		const uint64_t* posTab = partTables[partI].size() ? &(partTables[partI][0]) : 0;
+		for(uintptr_t j = 0; anyLive && (j<numTest); j++){
+			const uint64_t* charMask = posTab + (0x00FF & *fromChar)*numWord;
+			anyLive = 0;
+			for(uintptr_t w = 0; w<numWord; w++){
+				liveMask[w] &= charMask[w];
+				anyLive |= liveMask[w];
+			}
+			posTab += 256*numWord;
+			fromChar += charStep;
+		}
+		return anyLive != 0;
+	}
+	/**
+	 * See whether any rule accepts a match, reading straight from the sequence.
+	 * @param curSeq The sequence the match is in.
+	 * @param seqLen The length of that sequence.
+	 * @param foundAt The start of the match.
+	 * @param foundTo The end of the match.
+	 * @param numPre The amount of sequence before the match to consider.
+	 * @param numPost The amount of sequence after the match to consider.
+	 * @param liveStore Storage for the live rules.
+	 * @return Whether any rule matches.
+	 */
+	bool anyMatchingCut(const char* curSeq, uintptr_t seqLen, uintptr_t foundAt, uintptr_t foundTo, uintptr_t numPre, uintptr_t numPost, std::vector<uint64_t>* liveStore){
+		if(numWord == 0){ return false; }
+		liveStore->resize(numWord);
+		uint64_t* liveMask = &((*liveStore)[0]);
+		for(uintptr_t w = 0; w<numWord; w++){ liveMask[w] = ~(uint64_t)0; }
+		uintptr_t preLen = std::min(numPre, foundAt);
+		uintptr_t postLen = std::min(numPost, seqLen - foundTo);
+		uintptr_t midLen = foundTo - foundAt;
+		if(!cullPart(0, curSeq + foundAt - 1, -1, preLen, liveMask)){ return false; }
+		if(!cullPart(1, curSeq + foundAt, 1, midLen, liveMask)){ return false; }
+		if(!cullPart(2, curSeq + foundTo - 1, -1, midLen, liveMask)){ return false; }
+		return cullPart(3, curSeq + foundTo, 1, postLen, liveMask);
 	}
 	/**Kill the memory.*/
 	~CuttingRules(){
@@ -707,12 +865,31 @@ public:
 	}
 };
 
+/**
+ * Note how far outside a match a digest looks.
+ * @param digestRule The digest.
+ * @param numPre The place to put the longest prefix.
+ * @param numPost The place to put the longest suffix.
+ */
+void profinmanDigestReach(CuttingRules* digestRule, uintptr_t* numPre, uintptr_t* numPost){
+	*numPre = 0;
+	*numPost = 0;
+	for(uintptr_t i = 0; i<digestRule->theRules.size(); i++){
+		CuttingRule* curRule = digestRule->theRules[i];
+		*numPre = std::max(*numPre, (uintptr_t)(curRule->startPreLen));
+		*numPost = std::max(*numPost, (uintptr_t)(curRule->endPostLen));
+	}
+}
+
 ProfinmanFilterDigestMatches::ProfinmanFilterDigestMatches(){
 	dumpBaseName = 0;
+	comboName = 0;
 	matchName = 0;
 	outputName = 0;
 	digestName = 0;
 	maxRam = 500000000;
+	numThread = 1;
+	keepOrder = false;
 	mySummary = "  Filter matches consistent with a digest.";
 	myMainDoc = "Usage: profinman matfildig [OPTION] [FILE]*\n"
 		"Filter matches consistent with a digest.\n"
@@ -723,6 +900,10 @@ ProfinmanFilterDigestMatches::ProfinmanFilterDigestMatches(){
 		dumpMeta.isFile = true;
 		dumpMeta.fileExts.insert(".gail");
 		addStringOption("--ref", &dumpBaseName, 0, "    The reference file searched through.\n    --ref File.gail\n", &dumpMeta);
+	ArgumentParserStrMeta comboMeta("Suffix Array File");
+		comboMeta.isFile = true;
+		comboMeta.fileExts.insert(".gail.sa");
+		addStringOption("--sa", &comboName, 0, "    The suffix array that was searched, if it has deltas appended (safa --append).\n    Matches in the deltas are looked up in their own references.\n    --sa File.gail.sa\n", &comboMeta);
 	ArgumentParserStrMeta matchMeta("Match File");
 		matchMeta.isFile = true;
 		addStringOption("--match", &matchName, 0, "    The binary list of match information.\n    --match File.bmatch\n", &matchMeta);
@@ -736,6 +917,10 @@ ProfinmanFilterDigestMatches::ProfinmanFilterDigestMatches(){
 		addStringOption("--dig", &digestName, 0, "    The digest specification file.\n    --dig File.dig\n", &digMeta);
 	ArgumentParserIntMeta ramMeta("RAM Usage");
 		addIntegerOption("--ram", &maxRam, 0, "    How much ram to use.\n    --ram 500000000\n", &ramMeta);
+	ArgumentParserIntMeta threadMeta("Threads");
+		addIntegerOption("--thread", &numThread, 0, "    How many threads to use.\n    --thread 1\n", &threadMeta);
+	ArgumentParserBoolMeta orderMeta("Keep Input Order");
+		addBooleanFlag("--inorder", &keepOrder, 1, "    Write the kept matches in the order they came in, rather than by location.\n", &orderMeta);
 }
 
 int ProfinmanFilterDigestMatches::posteriorCheck(){
@@ -747,6 +932,9 @@ int ProfinmanFilterDigestMatches::posteriorCheck(){
 		argumentError = "Need to specify a digest to filter on.";
 		return 1;
 	}
+	if((comboName == 0) || (strlen(comboName)==0)){
+		comboName = 0;
+	}
 	if((matchName == 0) || (strlen(matchName)==0)){
 		matchName = 0;
 	}
@@ -757,6 +945,10 @@ int ProfinmanFilterDigestMatches::posteriorCheck(){
 		argumentError = "Will use at least one byte of ram.";
 		return 1;
 	}
+	if(numThread <= 0){
+		argumentError = "Need at least one thread.";
+		return 1;
+	}
 	if(maxRam < 4*MATCH_ENTRY_SIZE){
 		maxRam = 4*MATCH_ENTRY_SIZE;
 	}
@@ -764,6 +956,81 @@ int ProfinmanFilterDigestMatches::posteriorCheck(){
 	return 0;
 }
 
+/**The extra bytes on a sorted match to remember where it came from.*/
+#define FILTER_ORDER_SIZE 8
+
+/**Uniform for filtering a piece of a sorted chunk.*/
+class ProfinmanFilterDigestUni{
+public:
+	/**The digest.*/
+	CuttingRules* digestRule;
+	/**The references to use (and which copy).*/
+	ProfinmanMatchReference* useRef;
+	/**The copy of the references to use.*/
+	uintptr_t useCopy;
+	/**The number of sequences in the references.*/
+	uintptr_t numEntries;
+	/**The longest prefix of the digest.*/
+	uintptr_t numPre;
+	/**The longest suffix of the digest.*/
+	uintptr_t numPost;
+	/**The sorted matches.*/
+	char* sortEnts;
+	/**The size of each sorted match.*/
+	uintptr_t itemSize;
+	/**The first match to test.*/
+	uintptr_t fromI;
+	/**The match after the last to test.*/
+	uintptr_t toI;
+	/**The place to note whether each match is kept.*/
+	char* keepFlags;
+	/**The ID of this task.*/
+	uintptr_t taskID;
+	/**Save any errors.*/
+	std::string errMess;
+};
+
+/**Filter a piece of a sorted chunk.*/
+void profinmanFilterDigestTask(void* myUni){
+	ProfinmanFilterDigestUni* myUn = (ProfinmanFilterDigestUni*)myUni;
+	try{
+		GailAQSequenceReader* gfaIn = 0;
+		std::vector<uint64_t> liveStore;
+		uintptr_t foundInLen = 0;
+		uintptr_t lastLoad = -1;
+		for(uintptr_t i = myUn->fromI; i<myUn->toI; i++){
+			char* curEnt = myUn->sortEnts + i*myUn->itemSize;
+			uintptr_t foundIn = be2nat64(curEnt+8);
+			uintptr_t foundAt = be2nat64(curEnt+16);
+			uintptr_t foundTo = be2nat64(curEnt+24);
+			//idiot checks
+				if(foundTo < foundAt){
+					throw std::runtime_error("Bad match entry (high index below low index).");
+				}
+				if(foundIn >= myUn->numEntries){
+					throw std::runtime_error(PROFINMAN_MATCH_INDEX_ERROR);
+				}
+				if(lastLoad != foundIn){
+					//load if not already in
+					lastLoad = foundIn;
+					uintptr_t foundL = myUn->useRef->findLayer(foundIn);
+					uintptr_t foundLI = foundIn - myUn->useRef->layerStarts[foundL];
+					gfaIn = myUn->useRef->getReader(myUn->useCopy, foundL);
+					foundInLen = gfaIn->getEntryLength(foundLI);
+					gfaIn->getEntrySubsequence(foundLI, 0, foundInLen);
+				}
+				if(foundTo > foundInLen){
+					throw std::runtime_error("Bad match entry (match extends beyond reference sequence).");
+				}
+			//see if it matches
+				myUn->keepFlags[i] = myUn->digestRule->anyMatchingCut(gfaIn->lastReadSeq, foundInLen, foundAt, foundTo, myUn->numPre, myUn->numPost, &liveStore);
+		}
+	}
+	catch(std::exception& err){
+		myUn->errMess = err.what();
+	}
+}
+
 void ProfinmanFilterDigestMatches::runThing(){
 	//load in the digest
 		std::ifstream ruleStr(digestName);
@@ -773,36 +1040,35 @@ void ProfinmanFilterDigestMatches::runThing(){
 		CuttingRules digestRule(&ruleStr, &(std::cerr));
 		ruleStr.close();
 	//note the longest prefix and suffix
-		uintptr_t numPre = 0;
-		uintptr_t numPost = 0;
-		for(uintptr_t i = 0; i<digestRule.theRules.size(); i++){
-			CuttingRule* curRule = digestRule.theRules[i];
-			numPre = std::max(numPre, (uintptr_t)(curRule->startPreLen));
-			numPost = std::max(numPost, (uintptr_t)(curRule->endPostLen));
-		}
+		uintptr_t numPre;
+		uintptr_t numPost;
+		profinmanDigestReach(&digestRule, &numPre, &numPost);
 	//start matching
 	InStream* saveIS = 0;
 	OutStream* saveOS = 0;
+	ThreadPool* useThreads = 0;
+	ProfinmanMatchReference* allRef = 0;
+	#define FILTER_DIGEST_CLEANUP \
+		if(allRef){ delete(allRef); }\
+		if(useThreads){ delete(useThreads); }\
+		if(saveIS){ delete(saveIS); }\
+		if(saveOS){ delete(saveOS); }
 	try{
 		//open up the output
 			saveOS = outputName ? (OutStream*)(new FileOutStream(0, outputName)) : (OutStream*)(new ConsoleOutStream());
 		//open up the input
 			saveIS = matchName ? (InStream*)(new FileInStream(matchName)) : (InStream*)(new ConsoleInStream());
-		//open up the reference
-			std::string baseFN(dumpBaseName);
-			std::string blockFN = baseFN + ".blk";
-			std::string fastiFN = baseFN + ".fai";
-			GZipCompressionMethod compMeth;
-			BlockCompInStream blkComp(baseFN.c_str(), blockFN.c_str(), &compMeth);
-			GailAQSequenceReader gfaIn(&blkComp, fastiFN.c_str());
-			uintptr_t numEntries = gfaIn.getNumEntries();
-		//start reading matches
+		//open up the reference (and any deltas), once per thread
+			allRef = new ProfinmanMatchReference(dumpBaseName, comboName, numThread, 0);
+			uintptr_t numEntries = allRef->getNumEntries();
+			if(numThread > 1){ useThreads = new ThreadPool(numThread); }
+		//start reading matches (remembering where they came from, if needed)
+			uintptr_t itemSize = MATCH_ENTRY_SIZE + (keepOrder ? FILTER_ORDER_SIZE : 0);
 			std::vector<char> preloadEnts;
-			std::string preStore;
-			std::string midStore;
-			std::string postStore;
-			std::vector<int> goodMatch;
-			char entryBuff[MATCH_ENTRY_SIZE];
+			std::vector<char> keepFlags;
+			std::vector<uintptr_t> keptAt;
+			std::vector<ProfinmanFilterDigestUni> threadUnis(numThread);
+			char entryBuff[MATCH_ENTRY_SIZE + FILTER_ORDER_SIZE];
 			uintptr_t numRead = saveIS->readBytes(entryBuff, MATCH_ENTRY_SIZE);
 			while(numRead || preloadEnts.size()){
 				//add the entry to the entities
@@ -810,59 +1076,69 @@ void ProfinmanFilterDigestMatches::runThing(){
 					if(numRead != MATCH_ENTRY_SIZE){
 						throw std::runtime_error("Incomplete match at end of file.");
 					}
-					preloadEnts.insert(preloadEnts.end(), entryBuff, entryBuff + numRead);
+					if(keepOrder){ nat2be64(preloadEnts.size() / itemSize, entryBuff + MATCH_ENTRY_SIZE); }
+					preloadEnts.insert(preloadEnts.end(), entryBuff, entryBuff + itemSize);
 				}
 				//if enough entries (or nothing left), handle
 				if((numRead == 0) || (preloadEnts.size() > (uintptr_t)maxRam)){
-					//sort them by foundIn, foundAt and foundTo
+					uintptr_t numItems = preloadEnts.size() / itemSize;
+					//sort them by foundIn, foundAt and foundTo (one thread keeps ties in input order)
 						SortOptions useOpts;
 							useOpts.compMeth = compareBinarySearchLocationData;
-							useOpts.itemSize = MATCH_ENTRY_SIZE;
+							useOpts.itemSize = itemSize;
 							useOpts.maxLoad = maxRam;
 							useOpts.numThread = 1;
 							useOpts.useUni = 0;
-						inMemoryMergesort(preloadEnts.size() / MATCH_ENTRY_SIZE, &(preloadEnts[0]), &useOpts);
-					//run down
-					uintptr_t foundInLen = 0;
-					uintptr_t lastLoad = -1;
-					for(uintptr_t i = 0; i<preloadEnts.size(); i+=MATCH_ENTRY_SIZE){
-						char* curEnt = &(preloadEnts[i]);
-						//uintptr_t lookFor = be2nat64(entryBuff);
-						uintptr_t foundIn = be2nat64(curEnt+8);
-						uintptr_t foundAt = be2nat64(curEnt+16);
-						uintptr_t foundTo = be2nat64(curEnt+24);
-						//idiot checks
-							if(foundTo < foundAt){
-								throw std::runtime_error("Bad match entry (high index below low index).");
-							}
-							if(foundIn >= numEntries){
-								throw std::runtime_error("Bad match entry (reference sequence index too big).");
-							}
-							if(lastLoad != foundIn){
-								//load if not already in
-								lastLoad = foundIn;
-								foundInLen = gfaIn.getEntryLength(foundIn);
-								gfaIn.getEntrySubsequence(foundIn, 0, foundInLen);
+							useOpts.usePool = 0;
+						inMemoryMergesort(numItems, &(preloadEnts[0]), &useOpts);
+					//split by reference sequence
+						keepFlags.resize(numItems);
+						uintptr_t curFrom = 0;
+						for(intptr_t ti = 0; ti<numThread; ti++){
+							ProfinmanFilterDigestUni* curUni = &(threadUnis[ti]);
+							uintptr_t curTo = ((ti+1) == numThread) ? numItems : std::max(curFrom, (numItems * (ti+1)) / numThread);
+							while((curTo > 0) && (curTo < numItems) && (be2nat64(&(preloadEnts[curTo*itemSize + 8])) == be2nat64(&(preloadEnts[(curTo-1)*itemSize + 8])))){ curTo++; }
+							curUni->digestRule = &digestRule;
+							curUni->useRef = allRef;
+							curUni->useCopy = ti;
+							curUni->numEntries = numEntries;
+							curUni->numPre = numPre;
+							curUni->numPost = numPost;
+							curUni->sortEnts = &(preloadEnts[0]);
+							curUni->itemSize = itemSize;
+							curUni->fromI = curFrom;
+							curUni->toI = curTo;
+							curUni->keepFlags = &(keepFlags[0]);
+							curUni->errMess.clear();
+							curFrom = curTo;
+						}
+					//filter
+						if(useThreads){
+							for(intptr_t ti = 0; ti<numThread; ti++){ threadUnis[ti].taskID = useThreads->addTask(profinmanFilterDigestTask, &(threadUnis[ti])); }
+							for(intptr_t ti = 0; ti<numThread; ti++){ useThreads->joinTask(threadUnis[ti].taskID); }
+						}
+						else{
+							profinmanFilterDigestTask(&(threadUnis[0]));
+						}
+						for(intptr_t ti = 0; ti<numThread; ti++){
+							if(threadUnis[ti].errMess.size()){ throw std::runtime_error(threadUnis[ti].errMess); }
+						}
+					//and output
+						if(keepOrder){
+							keptAt.clear();
+							keptAt.resize(numItems, (uintptr_t)-1);
+							for(uintptr_t i = 0; i<numItems; i++){
+								if(keepFlags[i]){ keptAt[be2nat64(&(preloadEnts[i*itemSize + MATCH_ENTRY_SIZE]))] = i; }
 							}
-							if(foundTo > foundInLen){
-								throw std::runtime_error("Bad match entry (match extends beyond reference sequence).");
+							for(uintptr_t i = 0; i<numItems; i++){
+								if(keptAt[i] != (uintptr_t)-1){ saveOS->writeBytes(&(preloadEnts[keptAt[i]*itemSize]), MATCH_ENTRY_SIZE); }
 							}
-						//get the sequence
-							preStore.clear(); midStore.clear(); postStore.clear();
-							uintptr_t postTo = foundTo + numPost;
-								postTo = std::min(postTo, foundInLen);
-							uintptr_t preAt = std::max((intptr_t)0, (intptr_t)foundAt - (intptr_t)numPre);
-							const char* curSeq = gfaIn.lastReadSeq;
-							preStore.insert(preStore.end(), curSeq + preAt, curSeq + foundAt);
-							midStore.insert(midStore.end(), curSeq + foundAt, curSeq + foundTo);
-							postStore.insert(postStore.end(), curSeq + foundTo, curSeq + postTo);
-						//see if it matches
-							goodMatch.clear();
-							digestRule.getMatchingCuts(preStore.c_str(), midStore.c_str(), postStore.c_str(), &goodMatch);
-							if(goodMatch.size()){
-								saveOS->writeBytes(curEnt, MATCH_ENTRY_SIZE);
+						}
+						else{
+							for(uintptr_t i = 0; i<numItems; i++){
+								if(keepFlags[i]){ saveOS->writeBytes(&(preloadEnts[i*itemSize]), MATCH_ENTRY_SIZE); }
 							}
-					}
+						}
 					preloadEnts.clear();
 				}
 				//load next
@@ -872,11 +1148,437 @@ void ProfinmanFilterDigestMatches::runThing(){
 			}
 	}
 	catch(std::exception& err){
-		if(saveIS){ delete(saveIS); }
-		if(saveOS){ delete(saveOS); }
+		FILTER_DIGEST_CLEANUP
 		throw;
 	}
-	if(saveIS){ delete(saveIS); }
-	if(saveOS){ delete(saveOS); }
+	FILTER_DIGEST_CLEANUP
+}
+
+/**The number of bytes of query sequence to search together.*/
+#define PEPSEARCH_BATCH_SIZE 0x00010000
+/**The number of batches to allow in flight per thread.*/
+#define PEPSEARCH_QUEUE_EXTRA 4
+/**The number of bytes to buffer on the way to the sort.*/
+#define PEPSEARCH_PIPE_SIZE 0x00100000
+
+ProfinmanPeptideSearch::ProfinmanPeptideSearch(){
+	referenceName = 0;
+	comboName = 0;
+	searchName = 0;
+	digestName = 0;
+	workFolder = 0;
+	outputName = 0;
+	namesName = 0;
+	resident = false;
+	maxRam = 500000000;
+	numThread = 1;
+	mySummary = "  Search, digest filter, sort and name peptide matches.";
+	myMainDoc = "Usage: profinman pepsearch [OPTION] [FILE]*\n"
+		"Does findsa, matfildig, sortfound and nameget in one go.\n"
+		"The reference is loaded once and shared by every stage.\n"
+		"The OPTIONS are:\n";
+	myVersionDoc = "ProFinMan pepsearch 1.0";
+	myCopyrightDoc = "Copyright (C) 2020 UNT HSC Center for Human Identification";
+	ArgumentParserStrMeta dumpMeta("Reference File");
+		dumpMeta.isFile = true;
+		dumpMeta.fileExts.insert(".gail");
+		addStringOption("--ref", &referenceName, 0, "    The reference file to search through.\n    --ref File.gail\n", &dumpMeta);
+	ArgumentParserStrMeta comboMeta("Suffix Array File");
+		comboMeta.isFile = true;
+		comboMeta.fileExts.insert(".gail.sa");
+		addStringOption("--sa", &comboName, 0, "    The pre-built suffix array.\n    --sa File.gail.sa\n", &comboMeta);
+	ArgumentParserStrMeta entsMeta("Search File");
+		entsMeta.isFile = true;
+		entsMeta.fileExts.insert(".fasta");
+		entsMeta.fileExts.insert(".fa");
+		entsMeta.fileExts.insert(".fasta.gzip");
+		entsMeta.fileExts.insert(".fa.gzip");
+		entsMeta.fileExts.insert(".fasta.gz");
+		entsMeta.fileExts.insert(".fa.gz");
+		addStringOption("--search", &searchName, 0, "    The file containing sequences to find.\n    --search File.fa\n", &entsMeta);
+	ArgumentParserStrMeta digMeta("Digest Specification");
+		digMeta.isFile = true;
+		addStringOption("--dig", &digestName, 0, "    The digest specification file.\n    --dig File.dig\n", &digMeta);
+	ArgumentParserStrMeta workMeta("Working Folder");
+		addStringOption("--work", &workFolder, 0, "    The folder to put temporary files in.\n    --work Folder\n", &workMeta);
+	ArgumentParserStrMeta outMeta("Search Result File");
+		outMeta.isFile = true;
+		outMeta.fileWrite = true;
+		outMeta.fileExts.insert(".bin");
+		addStringOption("--out", &outputName, 0, "    The place to write the sorted matches.\n    --out File.bin\n", &outMeta);
+	ArgumentParserStrMeta nameMeta("Name Output File");
+		nameMeta.isFile = true;
+		nameMeta.fileWrite = true;
+		addStringOption("--names", &namesName, 0, "    The place to write the names of the matches.\n    --names File.tsv\n", &nameMeta);
+	ArgumentParserBoolMeta resMeta("Load Into Memory");
+		addBooleanFlag("--resident", &resident, 1, "    Load the suffix array into memory before searching.\n", &resMeta);
+	ArgumentParserIntMeta ramMeta("RAM Usage");
+		addIntegerOption("--ram", &maxRam, 0, "    How much ram to use: half for sorting, half for matches on their way to the sort.\n    The reference (and the suffix array, with --resident) is loaded whole on top of this.\n    --ram 500000000\n", &ramMeta);
+	ArgumentParserIntMeta threadMeta("Threads");
+		addIntegerOption("--thread", &numThread, 0, "    How many threads to use.\n    --thread 1\n", &threadMeta);
 }
 
+int ProfinmanPeptideSearch::posteriorCheck(){
+	if((referenceName == 0) || (strlen(referenceName)==0)){
+		argumentError = "Need to specify a reference.";
+		return 1;
+	}
+	if((comboName == 0) || (strlen(comboName)==0)){
+		argumentError = "Need to specify a suffix array.";
+		return 1;
+	}
+	if((digestName == 0) || (strlen(digestName)==0)){
+		argumentError = "Need to specify a digest to filter on.";
+		return 1;
+	}
+	if((workFolder == 0) || (strlen(workFolder)==0)){
+		argumentError = "Need to specify a working folder.";
+		return 1;
+	}
+	if((outputName == 0) || (strlen(outputName)==0) || (strcmp(outputName,"-")==0)){
+		argumentError = "Need to specify a file for the sorted matches.";
+		return 1;
+	}
+	if((searchName == 0) || (strlen(searchName)==0)){
+		searchName = 0;
+	}
+	if((namesName == 0) || (strlen(namesName)==0)){
+		namesName = 0;
+	}
+	if(maxRam <= 0){
+		argumentError = "Will use at least one byte of ram.";
+		return 1;
+	}
+	if(numThread <= 0){
+		argumentError = "Need at least one thread.";
+		return 1;
+	}
+	if(maxRam < 8*MATCH_ENTRY_SIZE){
+		maxRam = 8*MATCH_ENTRY_SIZE;
+	}
+	maxRam = MATCH_ENTRY_SIZE * (maxRam / MATCH_ENTRY_SIZE);
+	return 0;
+}
+
+/**A batch of sequences (or a piece of its matches) on its way through the stages.*/
+class ProfinmanPeptideSearchBatch{
+public:
+	/**The index of the first sequence.*/
+	uintptr_t firstInd;
+	/**The sequences, one after the other.*/
+	std::string allSeq;
+	/**The length of each sequence.*/
+	std::vector<uintptr_t> seqLens;
+	/**The matches found for the batch.*/
+	std::vector<char> foundEnts;
+};
+
+/**Uniform for the search and filter stages.*/
+class ProfinmanPeptideSearchUni{
+public:
+	/**The thing to search with.*/
+	ProfinmanSuffixArraySearcher* useSearch;
+	/**The shared reference.*/
+	ProfinmanResidentReferenceSource* useRef;
+	/**The digest to filter with.*/
+	CuttingRules* digestRule;
+	/**The longest prefix of the digest.*/
+	uintptr_t numPre;
+	/**The longest suffix of the digest.*/
+	uintptr_t numPost;
+	/**The most bytes of matches to send on at once.*/
+	uintptr_t maxFound;
+	/**The batches waiting to be searched.*/
+	ThreadProdComCollector<ProfinmanPeptideSearchBatch>* searchQueue;
+	/**The batches waiting to be filtered.*/
+	ThreadProdComCollector<ProfinmanPeptideSearchBatch>* filterQueue;
+	/**The place to send filtered matches to be sorted.*/
+	PreSortMultithreadPipe* sortPipe;
+	/**The ID of this task.*/
+	uintptr_t taskID;
+	/**Save any errors.*/
+	std::string errMess;
+};
+
+/**Search batches of sequences.*/
+void profinmanPeptideSearchTask(void* myUni){
+	ProfinmanPeptideSearchUni* myUn = (ProfinmanPeptideSearchUni*)myUni;
+	std::vector< std::pair<const char*,uintptr_t> > lookFor;
+	std::vector<uintptr_t> lowEnts;
+	std::vector<uintptr_t> highEnts;
+	ProfinmanPeptideSearchBatch* curDo = myUn->searchQueue->getThing();
+	while(curDo){
+		//after an error, just keep things moving
+		if(myUn->errMess.size()){
+			myUn->searchQueue->taskCache.dealloc(curDo);
+			curDo = myUn->searchQueue->getThing();
+			continue;
+		}
+		try{
+			lookFor.clear();
+			uintptr_t curOff = 0;
+			for(uintptr_t i = 0; i<curDo->seqLens.size(); i++){
+				lookFor.push_back( std::pair<const char*,uintptr_t>(curDo->allSeq.c_str() + curOff, curDo->seqLens[i]) );
+				curOff += curDo->seqLens[i];
+			}
+			myUn->useSearch->findBatchRanges(&lookFor, true, &lowEnts, &highEnts);
+			//send the matches on in pieces that fit
+			ProfinmanPeptideSearchBatch* curPiece = 0;
+			try{
+				for(uintptr_t i = 0; i<lookFor.size(); i++){
+					uintptr_t curEnt = lowEnts[i];
+					while(curEnt < highEnts[i]){
+						if(curPiece == 0){
+							curPiece = myUn->searchQueue->taskCache.alloc();
+							curPiece->foundEnts.clear();
+						}
+						uintptr_t numTake = std::min(highEnts[i] - curEnt, std::max((uintptr_t)1, (myUn->maxFound - curPiece->foundEnts.size()) / MATCH_ENTRY_SIZE));
+						myUn->useSearch->reportRange(curDo->firstInd + i, lookFor[i].second, curEnt, curEnt + numTake, &(curPiece->foundEnts), false);
+						curEnt += numTake;
+						if(curPiece->foundEnts.size() >= myUn->maxFound){
+							myUn->filterQueue->addThing(curPiece);
+							curPiece = 0;
+						}
+					}
+				}
+				if(curPiece){ myUn->filterQueue->addThing(curPiece); }
+			}
+			catch(std::exception& err){
+				if(curPiece){ myUn->searchQueue->taskCache.dealloc(curPiece); }
+				throw;
+			}
+		}
+		catch(std::exception& err){
+			myUn->errMess = err.what();
+		}
+		myUn->searchQueue->taskCache.dealloc(curDo);
+		curDo = myUn->searchQueue->getThing();
+	}
+}
+
+/**Filter the matches of searched batches.*/
+void profinmanPeptideFilterTask(void* myUni){
+	ProfinmanPeptideSearchUni* myUn = (ProfinmanPeptideSearchUni*)myUni;
+	ProfinmanResidentReferenceSource* useRef = myUn->useRef;
+	uintptr_t numEntries = useRef->getNumEntries();
+	std::vector<uint64_t> liveStore;
+	std::vector<char> keepEnts;
+	ProfinmanPeptideSearchBatch* curDo = myUn->filterQueue->getThing();
+	while(curDo){
+		if(myUn->errMess.size() == 0){
+			try{
+				keepEnts.clear();
+				for(uintptr_t i = 0; i<curDo->foundEnts.size(); i+=MATCH_ENTRY_SIZE){
+					char* curEnt = &(curDo->foundEnts[i]);
+					uintptr_t foundIn = be2nat64(curEnt+8);
+					uintptr_t foundAt = be2nat64(curEnt+16);
+					uintptr_t foundTo = be2nat64(curEnt+24);
+					if(foundIn >= numEntries){
+						throw std::runtime_error("Bad match entry (reference sequence index too big).");
+					}
+					uintptr_t foundInLen = useRef->getEntryLength(foundIn);
+					if((foundTo < foundAt) || (foundTo > foundInLen)){
+						throw std::runtime_error("Bad match entry (match extends beyond reference sequence).");
+					}
+					const char* curSeq = useRef->getEntrySubsequence(foundIn, 0, foundInLen);
+					if(myUn->digestRule->anyMatchingCut(curSeq, foundInLen, foundAt, foundTo, myUn->numPre, myUn->numPost, &liveStore)){
+						keepEnts.insert(keepEnts.end(), curEnt, curEnt + MATCH_ENTRY_SIZE);
+					}
+				}
+				if(keepEnts.size()){ myUn->sortPipe->writeBytes(&(keepEnts[0]), keepEnts.size()); }
+			}
+			catch(std::exception& err){
+				myUn->errMess = err.what();
+			}
+		}
+		myUn->searchQueue->taskCache.dealloc(curDo);
+		curDo = myUn->filterQueue->getThing();
+	}
+}
+
+/**Uniform for the sort stage.*/
+class ProfinmanPeptideSortUni{
+public:
+	/**The place to input.*/
+	InStream* inpFile;
+	/**The folder to put temporaries in.*/
+	const char* tempFold;
+	/**Options for sorting.*/
+	SortOptions* sortOpts;
+	/**The place to write.*/
+	OutStream* outFile;
+	/**Save any errors.*/
+	std::string errMess;
+};
+
+/**Sort the filtered matches.*/
+void profinmanPeptideSortTask(void* myUni){
+	ProfinmanPeptideSortUni* myUn = (ProfinmanPeptideSortUni*)myUni;
+	try{
+		outOfMemoryMergesort(myUn->inpFile, myUn->tempFold, myUn->outFile, myUn->sortOpts);
+	}
+	catch(std::exception& err){
+		myUn->errMess = err.what();
+		//drain the rest so the writers do not hang
+		char drainBuff[MATCH_ENTRY_SIZE];
+		while(myUn->inpFile->readBytes(drainBuff, MATCH_ENTRY_SIZE)){}
+	}
+}
+
+void ProfinmanPeptideSearch::runThing(){
+	//the deltas would need their own reference
+		std::vector<std::string> deltaRefs;
+		std::vector<std::string> deltaComs;
+		profinmanReadDeltaList(comboName, &deltaRefs, &deltaComs);
+		if(deltaRefs.size()){
+			throw std::runtime_error("Suffix array has appended deltas: run compactsa first.");
+		}
+	//load in the digest
+		std::ifstream ruleStr(digestName);
+		if(!ruleStr){
+			throw std::runtime_error("Could not open digest file.");
+		}
+		CuttingRules digestRule(&ruleStr, &(std::cerr));
+		ruleStr.close();
+		uintptr_t numPre;
+		uintptr_t numPost;
+		profinmanDigestReach(&digestRule, &numPre, &numPost);
+	//load the reference once, for everything
+		ProfinmanResidentReferenceSource useRef(referenceName, true);
+		uintptr_t numEntries = useRef.getNumEntries();
+	//open up the suffix array
+		std::vector<ProfinmanComboSource*> allCombos;
+		std::vector<ProfinmanSuffixArraySearcher*> allSearch;
+		InStream* saveIS = 0;
+		SequenceReader* saveSS = 0;
+		OutStream* sortOut = 0;
+		InStream* sortIn = 0;
+		OutStream* nameOut = 0;
+		#define PEPSEARCH_CLEANUP \
+			for(uintptr_t i = 0; i<allSearch.size(); i++){ delete(allSearch[i]); }\
+			for(uintptr_t i = 0; i<allCombos.size(); i++){ delete(allCombos[i]); }\
+			if(saveIS){ delete(saveIS); }\
+			if(saveSS){ delete(saveSS); }\
+			if(sortOut){ delete(sortOut); }\
+			if(sortIn){ delete(sortIn); }\
+			if(nameOut){ delete(nameOut); }
+	try{
+		intptr_t numOpen = resident ? 1 : numThread;
+		for(intptr_t i = 0; i<numOpen; i++){
+			if(resident){
+				allCombos.push_back(new ProfinmanResidentComboSource(comboName));
+			}
+			else{
+				allCombos.push_back(new ProfinmanFileComboSource(comboName, 0));
+			}
+		}
+		for(intptr_t i = 0; i<numThread; i++){
+			allSearch.push_back(new ProfinmanSuffixArraySearcher(&useRef, allCombos[i % numOpen]));
+		}
+		//open up the input and the sorted output
+			openSequenceFileRead(searchName ? searchName : "-", &saveIS, &saveSS);
+			sortOut = new FileOutStream(0, outputName);
+		//start the sort
+			SortOptions useOpts;
+				useOpts.compMeth = compareBinarySearchData;
+				useOpts.itemSize = MATCH_ENTRY_SIZE;
+				useOpts.maxLoad = MATCH_ENTRY_SIZE * ((maxRam / 2) / MATCH_ENTRY_SIZE);
+				useOpts.numThread = numThread;
+				useOpts.useUni = 0;
+				useOpts.usePool = 0;
+			PreSortMultithreadPipe sortPipe(PEPSEARCH_PIPE_SIZE);
+			ProfinmanPeptideSortUni sortUni;
+				sortUni.inpFile = &sortPipe;
+				sortUni.tempFold = workFolder;
+				sortUni.sortOpts = &useOpts;
+				sortUni.outFile = sortOut;
+			void* sortThread = startThread(profinmanPeptideSortTask, &sortUni);
+		//start the searchers and filterers
+			ThreadPool useThreads(2*numThread);
+			ThreadProdComCollector<ProfinmanPeptideSearchBatch> searchQueue(PEPSEARCH_QUEUE_EXTRA * numThread);
+			ThreadProdComCollector<ProfinmanPeptideSearchBatch> filterQueue(PEPSEARCH_QUEUE_EXTRA * numThread);
+			std::vector<ProfinmanPeptideSearchUni> searchUnis(numThread);
+			std::vector<ProfinmanPeptideSearchUni> filterUnis(numThread);
+			//the other half of the ram goes to pieces of matches: queued, being filtered, or being filled
+			uintptr_t numPieces = 2*(PEPSEARCH_QUEUE_EXTRA + 1)*numThread;
+			uintptr_t maxFound = std::max((uintptr_t)1, (maxRam - useOpts.maxLoad) / (numPieces * MATCH_ENTRY_SIZE)) * MATCH_ENTRY_SIZE;
+			for(intptr_t i = 0; i<numThread; i++){
+				ProfinmanPeptideSearchUni* curUni = &(searchUnis[i]);
+				curUni->useSearch = allSearch[i];
+				curUni->useRef = &useRef;
+				curUni->digestRule = &digestRule;
+				curUni->numPre = numPre;
+				curUni->numPost = numPost;
+				curUni->maxFound = maxFound;
+				curUni->searchQueue = &searchQueue;
+				curUni->filterQueue = &filterQueue;
+				curUni->sortPipe = &sortPipe;
+				filterUnis[i] = *curUni;
+				curUni->taskID = useThreads.addTask(profinmanPeptideSearchTask, curUni);
+				filterUnis[i].taskID = useThreads.addTask(profinmanPeptideFilterTask, &(filterUnis[i]));
+			}
+		//feed in the sequences
+			#define PEPSEARCH_SHUTDOWN \
+				searchQueue.end();\
+				for(intptr_t i = 0; i<numThread; i++){ useThreads.joinTask(searchUnis[i].taskID); }\
+				filterQueue.end();\
+				for(intptr_t i = 0; i<numThread; i++){ useThreads.joinTask(filterUnis[i].taskID); }\
+				sortPipe.closeWrite();\
+				joinThread(sortThread);
+			try{
+				uintptr_t curLoadI = 0;
+				ProfinmanPeptideSearchBatch* curBatch = 0;
+				while(saveSS->readNextEntry()){
+					if(curBatch == 0){
+						curBatch = searchQueue.taskCache.alloc();
+						curBatch->firstInd = curLoadI;
+						curBatch->allSeq.clear();
+						curBatch->seqLens.clear();
+					}
+					curBatch->allSeq.insert(curBatch->allSeq.end(), saveSS->lastReadSeq, saveSS->lastReadSeq + saveSS->lastReadSeqLen);
+					curBatch->seqLens.push_back(saveSS->lastReadSeqLen);
+					curLoadI++;
+					if(curBatch->allSeq.size() >= PEPSEARCH_BATCH_SIZE){
+						searchQueue.addThing(curBatch);
+						curBatch = 0;
+					}
+				}
+				if(curBatch){ searchQueue.addThing(curBatch); }
+			}
+			catch(std::exception& err){
+				PEPSEARCH_SHUTDOWN
+				throw;
+			}
+			PEPSEARCH_SHUTDOWN
+			for(intptr_t i = 0; i<numThread; i++){
+				if(searchUnis[i].errMess.size()){ throw std::runtime_error(searchUnis[i].errMess); }
+				if(filterUnis[i].errMess.size()){ throw std::runtime_error(filterUnis[i].errMess); }
+			}
+			if(sortUni.errMess.size()){ throw std::runtime_error(sortUni.errMess); }
+			delete(sortOut); sortOut = 0;
+		//name the sorted matches
+			sortIn = new FileInStream(outputName);
+			nameOut = namesName ? (OutStream*)(new FileOutStream(0, namesName)) : (OutStream*)(new ConsoleOutStream());
+			char entryBuff[MATCH_ENTRY_SIZE];
+			uintptr_t numRead = sortIn->readBytes(entryBuff, MATCH_ENTRY_SIZE);
+			while(numRead){
+				if(numRead != MATCH_ENTRY_SIZE){
+					throw std::runtime_error("Incomplete match at end of file.");
+				}
+				uintptr_t foundIn = be2nat64(entryBuff+8);
+				if(foundIn >= numEntries){
+					throw std::runtime_error("Bad match entry (reference sequence index too big).");
+				}
+				uintptr_t nameLen;
+				const char* curName = useRef.getEntryName(foundIn, &nameLen);
+				nameOut->writeBytes(curName, nameLen);
+				nameOut->writeByte('\n');
+				numRead = sortIn->readBytes(entryBuff, MATCH_ENTRY_SIZE);
+			}
+	}
+	catch(std::exception& err){
+		PEPSEARCH_CLEANUP
+		throw;
+	}
+	PEPSEARCH_CLEANUP
+}